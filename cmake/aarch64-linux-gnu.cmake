@@ -0,0 +1,21 @@
+# Cross build for Linux aarch64. The tests run under qemu-user through ctest :
+#   cmake -S . -B build-arm64 -DBUILD_EXAMPLES=ON -DCMAKE_TOOLCHAIN_FILE=cmake/aarch64-linux-gnu.cmake
+#   cmake --build build-arm64 && ctest --test-dir build-arm64/example
+set(CMAKE_SYSTEM_NAME Linux)
+set(CMAKE_SYSTEM_PROCESSOR aarch64)
+
+set(JOMOCK_AARCH64_PREFIX aarch64-linux-gnu CACHE STRING "Prefix of the aarch64 cross tools")
+set(JOMOCK_AARCH64_SYSROOT /usr/${JOMOCK_AARCH64_PREFIX} CACHE PATH "Sysroot of the aarch64 target")
+
+set(CMAKE_C_COMPILER ${JOMOCK_AARCH64_PREFIX}-gcc)
+set(CMAKE_CXX_COMPILER ${JOMOCK_AARCH64_PREFIX}-g++)
+set(CMAKE_FIND_ROOT_PATH ${JOMOCK_AARCH64_SYSROOT})
+set(CMAKE_FIND_ROOT_PATH_MODE_PROGRAM NEVER)
+set(CMAKE_FIND_ROOT_PATH_MODE_LIBRARY ONLY)
+set(CMAKE_FIND_ROOT_PATH_MODE_INCLUDE ONLY)
+set(CMAKE_FIND_ROOT_PATH_MODE_PACKAGE ONLY)
+
+find_program(JOMOCK_QEMU_AARCH64 qemu-aarch64)
+if(JOMOCK_QEMU_AARCH64)
+    set(CMAKE_CROSSCOMPILING_EMULATOR ${JOMOCK_QEMU_AARCH64} -L ${JOMOCK_AARCH64_SYSROOT})
+endif()
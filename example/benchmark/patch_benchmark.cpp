@@ -0,0 +1,153 @@
+#include <gtest/gtest.h>
+#include <gmock/gmock.h>
+
+#include "../../jomock/jomock.h"
+
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+using namespace ::std;
+
+// Install/restore cost per mock, one protection flip per graft versus one batched transaction,
+// and for a libc function, a text graft versus a swap of its GOT entries. Then the cost of changing
+// the behavior of an installed mock : restore and a new mock, versus retarget().
+
+const int kMocks = 128;
+
+template < int N >
+int target(int x)
+{
+    return x + N;
+}
+
+template < int N >
+struct Installer {
+    static void install() {
+        Installer<N - 1>::install();
+        ::jomock::MockerCreator::getJoMock<::jomock::TypeForUniqMocker<N>>(target<N>, "target");
+    }
+};
+
+template < >
+struct Installer<0> {
+    static void install() {}
+};
+
+struct Result {
+    double installNs;
+    double restoreNs;
+};
+
+static Result run(bool batched, int rounds)
+{
+    typedef chrono::steady_clock Clock;
+    Clock::duration install = Clock::duration::zero();
+    Clock::duration restore = Clock::duration::zero();
+    for (int round = 0; round < rounds; ++round) {
+        Clock::time_point start = Clock::now();
+        if (batched) {
+            ::jomock::JoMockPatchTransaction transaction;
+            Installer<kMocks>::install();
+        }
+        else {
+            Installer<kMocks>::install();
+        }
+        Clock::time_point installed = Clock::now();
+        CLEAR_JOMOCK();
+        Clock::time_point restored = Clock::now();
+        install += installed - start;
+        restore += restored - installed;
+    }
+    const double mocks = static_cast<double>(rounds) * kMocks;
+    Result result = {
+        chrono::duration<double, nano>(install).count() / mocks,
+        chrono::duration<double, nano>(restore).count() / mocks
+    };
+    return result;
+}
+
+static Result runLibrary(bool import, int rounds)
+{
+    typedef chrono::steady_clock Clock;
+    Clock::duration install = Clock::duration::zero();
+    Clock::duration restore = Clock::duration::zero();
+    for (int round = 0; round < rounds; ++round) {
+        Clock::time_point start = Clock::now();
+#ifdef JOMOCK_IMPORT_SUPPORT
+        if (import) {
+            JOMOCK_IMPORT(atoi);
+        }
+        else
+#endif
+        {
+            JOMOCK(atoi);
+        }
+        Clock::time_point installed = Clock::now();
+        CLEAR_JOMOCK();
+        Clock::time_point restored = Clock::now();
+        install += installed - start;
+        restore += restored - installed;
+    }
+    Result result = {
+        chrono::duration<double, nano>(install).count() / rounds,
+        chrono::duration<double, nano>(restore).count() / rounds
+    };
+    return result;
+}
+
+// ns per change of behavior, including one call through the mock.
+static double reconfigure(int mode, int rounds)
+{
+    using namespace ::testing;
+    auto mocker = &JOMOCK(target<1>);
+    auto one = mocker->target([](int) { return 1; });
+    auto two = mocker->target([](int) { return 2; });
+    int sum = 0;
+    chrono::steady_clock::time_point start = chrono::steady_clock::now();
+    for (int i = 0; i < rounds; ++i) {
+        if (mode == 0) {
+            CLEAR_JOMOCK();
+            EXPECT_CALL(JOMOCK(target<1>), JOMOCK_FUNC(_))
+                .WillRepeatedly(Return(i));
+        }
+        else if (mode == 1) {
+            mocker->retarget(i % 2 == 0 ? one : two);
+        }
+        else {
+            mocker->retarget([i](int) { return i; });
+        }
+        sum += target<1>(i);
+    }
+    const double elapsed = chrono::duration<double, nano>(chrono::steady_clock::now() - start).count();
+    CLEAR_JOMOCK();
+    if (sum == 42) printf(" "); // keep the loop observable
+    return elapsed / rounds;
+}
+
+int main(int argc, char* argv[])
+{
+    const int rounds = argc > 1 ? atoi(argv[1]) : 200;
+    run(true, 1); // warm up gmock and the page tables
+
+    Result single = run(false, rounds);
+    Result batched = run(true, rounds);
+    printf("mocks per round : %d, rounds : %d\n", kMocks, rounds);
+    printf("%-12s %16s %16s\n", "mode", "install ns/mock", "restore ns/mock");
+    printf("%-12s %16.1f %16.1f\n", "per-graft", single.installNs, single.restoreNs);
+    printf("%-12s %16.1f %16.1f\n", "batched", batched.installNs, batched.restoreNs);
+
+    runLibrary(false, 1);
+    Result text = runLibrary(false, rounds * 10);
+    printf("%-12s %16.1f %16.1f\n", "atoi text", text.installNs, text.restoreNs);
+#ifdef JOMOCK_IMPORT_SUPPORT
+    runLibrary(true, 1);
+    Result import = runLibrary(true, rounds * 10);
+    printf("%-12s %16.1f %16.1f\n", "atoi GOT", import.installNs, import.restoreNs);
+#endif
+
+    printf("%-24s %16s\n", "reconfigure", "ns/change");
+    printf("%-24s %16.1f\n", "restore + JOMOCK", reconfigure(0, rounds * 10));
+    printf("%-24s %16.1f\n", "retarget prepared", reconfigure(1, rounds * 1000));
+    printf("%-24s %16.1f\n", "retarget lambda", reconfigure(2, rounds * 100));
+    return 0;
+}
@@ -0,0 +1,107 @@
+#include <gtest/gtest.h>
+#include <gmock/gmock.h>
+
+#include "../../jomock/jomock.h"
+
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <new>
+using namespace ::std;
+
+// Fixture setup/teardown cost : mocks created and restored per round, with the heap allocations they make.
+
+const int kMocks = 128;
+
+static size_t allocations = 0;
+
+void* operator new(size_t size)
+{
+    ++allocations;
+    void* const memory = malloc(size == 0 ? 1 : size);
+    if (memory == nullptr) throw bad_alloc();
+    return memory;
+}
+
+void operator delete(void* memory) noexcept
+{
+    free(memory);
+}
+
+void operator delete(void* memory, size_t) noexcept
+{
+    free(memory);
+}
+
+template < int N >
+int target(int x)
+{
+    return x * N;
+}
+
+template < int N >
+struct Installer {
+    static void install() {
+        Installer<N - 1>::install();
+        ::jomock::MockerCreator::getJoMock<::jomock::TypeForUniqMocker<N>>(target<N>, "target");
+        ::jomock::MockerCreator::getJoMock<::jomock::TypeForUniqMocker<N + kMocks>>(target<N>, "target"); // same mock
+    }
+};
+
+template < >
+struct Installer<0> {
+    static void install() {}
+};
+
+struct Result {
+    double setupNs;
+    double teardownNs;
+    double setupAllocations;
+    double teardownAllocations;
+};
+
+static Result run(int rounds)
+{
+    typedef chrono::steady_clock Clock;
+    Clock::duration setup = Clock::duration::zero();
+    Clock::duration teardown = Clock::duration::zero();
+    size_t setupAllocations = 0;
+    size_t teardownAllocations = 0;
+    for (int round = 0; round < rounds; ++round) {
+        const size_t before = allocations;
+        Clock::time_point start = Clock::now();
+        {
+            ::jomock::JoMockPatchTransaction transaction;
+            Installer<kMocks>::install();
+        }
+        Clock::time_point installed = Clock::now();
+        const size_t middle = allocations;
+        CLEAR_JOMOCK();
+        Clock::time_point restored = Clock::now();
+        setupAllocations += middle - before;
+        teardownAllocations += allocations - middle;
+        setup += installed - start;
+        teardown += restored - installed;
+    }
+    const double mocks = static_cast<double>(rounds) * kMocks;
+    Result result = {
+        chrono::duration<double, nano>(setup).count() / mocks,
+        chrono::duration<double, nano>(teardown).count() / mocks,
+        setupAllocations / mocks,
+        teardownAllocations / mocks
+    };
+    return result;
+}
+
+int main(int argc, char* argv[])
+{
+    const int rounds = argc > 1 ? atoi(argv[1]) : 200;
+    run(1); // warm up the registry, the veneers and the page tables
+
+    Result result = run(rounds);
+    printf("mocks per round : %d (looked up twice), rounds : %d\n", kMocks, rounds);
+    printf("%-10s %12s %14s\n", "phase", "ns/mock", "allocs/mock");
+    printf("%-10s %12.1f %14.3f\n", "setup", result.setupNs, result.setupAllocations);
+    printf("%-10s %12.1f %14.3f\n", "teardown", result.teardownNs, result.teardownAllocations);
+    return 0;
+}
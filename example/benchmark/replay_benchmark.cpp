@@ -0,0 +1,82 @@
+#include <gtest/gtest.h>
+#include <gmock/gmock.h>
+
+#include "../../jomock/jomock.h"
+#include "../../jomock/jomock_replay.h"
+
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <string>
+#include <vector>
+using namespace ::std;
+using namespace ::testing;
+
+// ns per call of a mocked function : gmock Return versus recording and replaying the calls of 'keys' argument values.
+
+uint64_t checksum(const string& text, int seed)
+{
+    uint64_t sum = static_cast<uint64_t>(seed);
+    for (int round = 0; round < 64; ++round) {
+        for (char c : text) {
+            sum = (sum ^ static_cast<unsigned char>(c)) * 0x100000001B3ull;
+        }
+    }
+    return sum;
+}
+
+static double measure(const vector<string>& texts, long calls)
+{
+    chrono::steady_clock::time_point start = chrono::steady_clock::now();
+    uint64_t sum = 0;
+    for (long i = 0; i < calls; ++i) {
+        sum += checksum(texts[i % texts.size()], static_cast<int>(i % 7));
+    }
+    const double elapsed = chrono::duration<double, nano>(chrono::steady_clock::now() - start).count();
+    if (sum == 42) printf(" "); // keep the loop observable
+    return elapsed / calls;
+}
+
+int main(int argc, char* argv[])
+{
+    const long calls = argc > 1 ? atol(argv[1]) : 200000;
+    const size_t keys = argc > 2 ? strtoul(argv[2], nullptr, 10) : 1000;
+    const string path = "replay_benchmark.rec";
+    vector<string> texts;
+    for (size_t i = 0; i < keys; ++i) {
+        texts.push_back("payload #" + to_string(i) + string(48, 'x'));
+    }
+    const long recorded = static_cast<long>(keys * 7); // every (text, seed) pair once.
+
+    printf("keys : %zu, calls : %ld\n", keys * 7, calls);
+    printf("%-24s %10s\n", "mode", "ns/call");
+    printf("%-24s %10.2f\n", "original", measure(texts, calls));
+
+    EXPECT_CALL(JOMOCK(checksum), JOMOCK_FUNC(_, _))
+        .WillRepeatedly(Return(3));
+    printf("%-24s %10.2f\n", "JOMOCK Return", measure(texts, calls));
+    CLEAR_JOMOCK();
+
+    remove(path.c_str());
+    {
+        ::jomock::JoMockRecording recording(path);
+        auto mocker = &JOMOCK(checksum);
+        EXPECT_CALL(*mocker, JOMOCK_FUNC(_, _))
+            .WillRepeatedly(JOMOCK_RECORD(mocker, recording));
+        printf("%-24s %10.2f\n", "JOMOCK_RECORD", measure(texts, recorded));
+        CLEAR_JOMOCK();
+    }
+
+    ::jomock::JoMockRecording recording(path);
+    chrono::steady_clock::time_point start = chrono::steady_clock::now();
+    ::jomock::JoMockRecording reopened(path);
+    const double open = chrono::duration<double, micro>(chrono::steady_clock::now() - start).count();
+    auto mocker = &JOMOCK(checksum);
+    EXPECT_CALL(*mocker, JOMOCK_FUNC(_, _))
+        .WillRepeatedly(JOMOCK_REPLAY(mocker, recording));
+    printf("%-24s %10.2f\n", "JOMOCK_REPLAY", measure(texts, calls));
+    CLEAR_JOMOCK();
+    printf("open with %zu records : %.1f us\n", reopened.size(), open);
+    remove(path.c_str());
+    return 0;
+}
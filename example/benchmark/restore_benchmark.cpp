@@ -0,0 +1,112 @@
+#include <gtest/gtest.h>
+#include <gmock/gmock.h>
+
+#include "../../jomock/jomock.h"
+
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <vector>
+using namespace ::std;
+
+// CLEAR_JOMOCK() cost with many mocks spread over many text pages : byte-level restore,
+// page snapshot restore, and page snapshot restore with verification.
+
+const int kMocks = 1000;
+
+#if defined(__GNUC__)
+#define TARGET_ALIGNMENT __attribute__((aligned(512), noinline))
+#else
+#define TARGET_ALIGNMENT
+#endif
+
+template < int N >
+TARGET_ALIGNMENT int target(int x)
+{
+    return x * N + 1;
+}
+
+// Installs target<Begin> .. target<Begin + Count - 1>, halving the range to stay within the template depth.
+template < int Begin, int Count >
+struct Installer {
+    static void install() {
+        Installer<Begin, Count / 2>::install();
+        Installer<Begin + Count / 2, Count - Count / 2>::install();
+    }
+
+    static void collect(vector<size_t>& addresses) {
+        Installer<Begin, Count / 2>::collect(addresses);
+        Installer<Begin + Count / 2, Count - Count / 2>::collect(addresses);
+    }
+};
+
+template < int Begin >
+struct Installer<Begin, 1> {
+    static void install() {
+        ::jomock::MockerCreator::getJoMock<::jomock::TypeForUniqMocker<Begin>>(target<Begin>, "target");
+    }
+
+    static void collect(vector<size_t>& addresses) {
+        addresses.push_back(reinterpret_cast<size_t>(&target<Begin>));
+    }
+};
+
+struct Result {
+    double installNs;
+    double restoreNs;
+};
+
+static Result run(int rounds)
+{
+    typedef chrono::steady_clock Clock;
+    Clock::duration install = Clock::duration::zero();
+    Clock::duration restore = Clock::duration::zero();
+    for (int round = 0; round < rounds; ++round) {
+        Clock::time_point start = Clock::now();
+        {
+            ::jomock::JoMockPatchTransaction transaction;
+            Installer<0, kMocks>::install();
+        }
+        Clock::time_point installed = Clock::now();
+        CLEAR_JOMOCK();
+        Clock::time_point restored = Clock::now();
+        install += installed - start;
+        restore += restored - installed;
+    }
+    const double mocks = static_cast<double>(rounds) * kMocks;
+    Result result = {
+        chrono::duration<double, nano>(install).count() / mocks,
+        chrono::duration<double, nano>(restore).count() / mocks
+    };
+    return result;
+}
+
+static void report(const char* mode, bool snapshots, bool verification, int rounds)
+{
+    ::jomock::MockerCreator::setPageSnapshots(snapshots);
+    ::jomock::MockerCreator::setRestoreVerification(verification);
+    run(1); // warm up the registry, the snapshots and the page tables
+    Result result = run(rounds);
+    printf("%-22s %12.1f %12.1f\n", mode, result.installNs, result.restoreNs);
+}
+
+int main(int argc, char* argv[])
+{
+    const int rounds = argc > 1 ? atoi(argv[1]) : 50;
+    const size_t pageSize = ::jomock::JoMockPage::pageSize();
+    vector<size_t> pages;
+    Installer<0, kMocks>::collect(pages);
+    for (size_t& address : pages) {
+        address /= pageSize;
+    }
+    sort(pages.begin(), pages.end());
+    pages.erase(unique(pages.begin(), pages.end()), pages.end());
+
+    printf("mocks : %d over %zu pages, rounds : %d\n", kMocks, pages.size(), rounds);
+    printf("%-22s %12s %12s\n", "restore", "install ns", "restore ns");
+    report("byte-level", false, false, rounds);
+    report("page snapshot", true, false, rounds);
+    report("page snapshot+verify", true, true, rounds);
+    return 0;
+}
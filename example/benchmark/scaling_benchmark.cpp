@@ -0,0 +1,73 @@
+#include <gtest/gtest.h>
+#include <gmock/gmock.h>
+
+#include "../../jomock/jomock.h"
+
+#include <atomic>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <thread>
+#include <vector>
+using namespace ::std;
+using namespace ::testing;
+
+// calls/sec of a mocked function hammered by 1 to 32 threads : gmock expectations versus JOMOCK_FAST.
+
+int target(int x)
+{
+    return x + 1;
+}
+
+static double measure(int threads, long calls)
+{
+    atomic<int> ready(0);
+    atomic<bool> go(false);
+    atomic<long> sum(0);
+    vector<thread> workers;
+    for (int t = 0; t < threads; ++t) {
+        workers.emplace_back([&]() {
+            ++ready;
+            while (!go.load()) {
+                this_thread::yield();
+            }
+            long local = 0;
+            for (long i = 0; i < calls; ++i) {
+                local += target(static_cast<int>(i));
+            }
+            sum += local;
+        });
+    }
+    while (ready.load() != threads) {
+        this_thread::yield();
+    }
+    chrono::steady_clock::time_point start = chrono::steady_clock::now();
+    go = true;
+    for (thread& worker : workers) {
+        worker.join();
+    }
+    const double elapsed = chrono::duration<double>(chrono::steady_clock::now() - start).count();
+    if (sum == 42) printf(" "); // keep the loop observable
+    return threads * calls / elapsed;
+}
+
+int main(int argc, char* argv[])
+{
+    const long calls = argc > 1 ? atol(argv[1]) : 200000;
+    const long gmockCalls = calls / 50;
+
+    printf("cores : %u, calls per thread : %ld (gmock %ld)\n", thread::hardware_concurrency(), calls, gmockCalls);
+    printf("%8s %16s %16s %16s\n", "threads", "gmock calls/s", "fast calls/s", "fast per thread");
+    for (int threads = 1; threads <= 32; threads *= 2) {
+        EXPECT_CALL(JOMOCK(target), JOMOCK_FUNC(_))
+            .WillRepeatedly(Return(3));
+        const double gmock = measure(threads, gmockCalls);
+        CLEAR_JOMOCK();
+
+        JOMOCK_FAST(target).willRepeatedly(3).times(threads * calls);
+        const double fast = measure(threads, calls);
+        CLEAR_JOMOCK();
+        printf("%8d %16.0f %16.0f %16.0f\n", threads, gmock, fast, fast / threads);
+    }
+    return 0;
+}
@@ -0,0 +1,112 @@
+#include <gtest/gtest.h>
+#include <gmock/gmock.h>
+
+#include "../../jomock/jomock.h"
+
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <vector>
+using namespace ::std;
+using namespace ::testing;
+
+// ns per call of a mocked function: gmock expectation path versus JOMOCK_STUB, a retargeted JOMOCK entered
+// through its thunk or the template entry point, and the calls a JOMOCK_INSTANCE mock passes through for the
+// objects it was not given.
+
+int target(int x)
+{
+    return x + 1;
+}
+
+static int replacement(int x)
+{
+    return x + 2;
+}
+
+class Widget {
+public:
+    int value(int x)
+    {
+        return x + 1;
+    }
+};
+
+static double measureObjects(vector<Widget>& objects, long calls)
+{
+    chrono::steady_clock::time_point start = chrono::steady_clock::now();
+    int sum = 0;
+    for (long i = 0; i < calls; ++i) {
+        sum += objects[static_cast<size_t>(i) % objects.size()].value(static_cast<int>(i));
+    }
+    const double elapsed = chrono::duration<double, nano>(chrono::steady_clock::now() - start).count();
+    if (sum == 42) printf(" ");
+    return elapsed / calls;
+}
+
+static double measure(long calls)
+{
+    chrono::steady_clock::time_point start = chrono::steady_clock::now();
+    int sum = 0;
+    for (long i = 0; i < calls; ++i) {
+        sum += target(static_cast<int>(i));
+    }
+    const double elapsed = chrono::duration<double, nano>(chrono::steady_clock::now() - start).count();
+    if (sum == 42) printf(" "); // keep the loop observable
+    return elapsed / calls;
+}
+
+int main(int argc, char* argv[])
+{
+    const long calls = argc > 1 ? atol(argv[1]) : 10000000;
+    const long gmockCalls = calls / 50;
+
+    printf("%-24s %10s\n", "mode", "ns/call");
+    printf("%-24s %10.2f\n", "original", measure(calls));
+
+    EXPECT_CALL(JOMOCK(target), JOMOCK_FUNC(_))
+        .WillRepeatedly(Return(3));
+    printf("%-24s %10.2f\n", "JOMOCK (gmock)", measure(gmockCalls));
+    CLEAR_JOMOCK();
+
+    JOMOCK_STUB(target, [](int x) { return x + 2; });
+    printf("%-24s %10.2f\n", "JOMOCK_STUB lambda", measure(calls));
+    CLEAR_JOMOCK();
+
+    (JOMOCK(target)).retarget([](int x) { return x + 2; });
+    printf("%-24s %10.2f\n", "JOMOCK retarget", measure(calls));
+    CLEAR_JOMOCK();
+
+    ::jomock::MockerCreator::setThunks(false);
+    (JOMOCK(target)).retarget([](int x) { return x + 2; });
+    printf("%-24s %10.2f\n", "JOMOCK retarget no thunk", measure(calls));
+    CLEAR_JOMOCK();
+    ::jomock::MockerCreator::setThunks(true);
+
+    JOMOCK_STUB(target, replacement);
+    printf("%-24s %10.2f\n", "JOMOCK_STUB function", measure(calls));
+    CLEAR_JOMOCK();
+
+    auto stub = &JOMOCK_STUB(target, [](int x) { return x + 2; });
+    stub->countCalls();
+    printf("%-24s %10.2f\n", "JOMOCK_STUB counted", measure(calls));
+    CLEAR_JOMOCK();
+
+    JOMOCK_TRACE("stub_benchmark_trace"); // keeps the last calls of the ring
+    JOMOCK_STUB(target, [](int x) { return x + 2; });
+    printf("%-24s %10.2f\n", "JOMOCK_STUB traced", measure(calls));
+    CLEAR_JOMOCK();
+    JOMOCK_TRACE(nullptr);
+    remove("stub_benchmark_trace.json");
+    remove("stub_benchmark_trace.bin");
+
+    vector<Widget> objects(4096);
+    printf("%-24s %10.2f\n", "member original", measureObjects(objects, calls));
+    for (size_t i = 0; i < objects.size(); i += 2) {
+        JOMOCK_INSTANCE(&objects[i], &Widget::value);
+    }
+    vector<Widget> others(4096);
+    printf("%-24s %10.2f\n", "JOMOCK_INSTANCE others", measureObjects(others, calls));
+    CLEAR_JOMOCK();
+    return 0;
+}
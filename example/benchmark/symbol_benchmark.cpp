@@ -0,0 +1,51 @@
+#include <gtest/gtest.h>
+#include <gmock/gmock.h>
+
+#include "../../jomock/jomock.h"
+
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+using namespace ::std;
+
+// JoMockSymbolIndex lookup cost : the first lookup maps and sorts the modules' symbol tables,
+// later ones are binary searches.
+
+static int hiddenTarget(int x)
+{
+    return x + 1;
+}
+
+namespace {
+    int anonymousTarget(int x)
+    {
+        return x + 2;
+    }
+}
+
+typedef chrono::steady_clock Clock;
+
+static double lookup(const char* name, int rounds)
+{
+    Clock::time_point start = Clock::now();
+    for (int round = 0; round < rounds; ++round) {
+        if (::jomock::JoMockSymbolIndex::find(name) == nullptr) {
+            fprintf(stderr, "%s not found\n", name);
+            exit(1);
+        }
+    }
+    return chrono::duration<double, nano>(Clock::now() - start).count() / rounds;
+}
+
+int main(int argc, char* argv[])
+{
+    const int rounds = argc > 1 ? atoi(argv[1]) : 10000;
+    printf("hiddenTarget(1) = %d, anonymousTarget(1) = %d\n", hiddenTarget(1), anonymousTarget(1));
+    printf("%-34s %14s\n", "lookup", "ns");
+    printf("%-34s %14.1f\n", "first (mangled, builds the index)", lookup("_ZL12hiddenTargeti", 1));
+    printf("%-34s %14.1f\n", "first demangled (demangles)", lookup("hiddenTarget", 1));
+    printf("%-34s %14.1f\n", "mangled", lookup("_ZL12hiddenTargeti", rounds));
+    printf("%-34s %14.1f\n", "demangled", lookup("hiddenTarget", rounds));
+    printf("%-34s %14.1f\n", "demangled with parameters", lookup("(anonymous namespace)::anonymousTarget(int)", rounds));
+    return 0;
+}
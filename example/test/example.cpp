@@ -1,9 +1,21 @@
 #include <gtest/gtest.h>
 #include <gmock/gmock.h>
 
+#include <gtest/gtest-spi.h>
+
 #include "../../jomock/jomock.h"
+#include "../../jomock/jomock_replay.h"
+#include "../../jomock/jomock_clock.h"
+#include "../../jomock/jomock_memfs.h"
+#include "../../jomock/jomock_memoize.h"
 
 #include <iostream>
+#include <fstream>
+#include <sstream>
+#include <thread>
+#include <condition_variable>
+#include <mutex>
+#include <set>
 using namespace ::std;
 using namespace ::testing;
 using testing::InitGoogleTest;
@@ -180,13 +192,1645 @@ TEST_F(JoMock, LogacyLibraryTest)
 
 }
 
+TEST_F(JoMock, MockSharedByCallSites)
+{
+    auto first = &JOMOCK(funcInt);
+    auto second = &JOMOCK(funcInt);
+    EXPECT_EQ(first, second);
+    EXPECT_STREQ(first->functionName, "funcInt");
+    EXPECT_CALL(*second, JOMOCK_FUNC(_))
+        .WillRepeatedly(Return(5));
+    EXPECT_EQ(funcInt(1), 5);
+    CLEAR_JOMOCK();
+
+    ::jomock::JoMockBase<string()>* previous = nullptr;
+    for (int i = 0; i < 3; ++i) {
+        auto mocker = &JOMOCK(func);
+        EXPECT_CALL(*mocker, JOMOCK_FUNC())
+            .WillOnce(Return("loop"));
+        EXPECT_EQ(func(), "loop");
+        if (previous != nullptr) {
+            EXPECT_EQ(mocker, previous); // the call site's storage is reused
+        }
+        previous = mocker;
+        CLEAR_JOMOCK();
+        EXPECT_EQ(func(), "no mock");
+    }
+}
+
+TEST_F(JoMock, ThreadLocalDispatch)
+{
+    JOMOCK_THREAD_LOCAL_DISPATCH(true);
+
+    EXPECT_CALL(JOMOCK(funcInt), JOMOCK_FUNC(_))
+        .WillRepeatedly(Return(7));
+    EXPECT_EQ(funcInt(1), 7);
+
+    string otherFunc;
+    int otherFuncInt = 0;
+    thread other([&otherFunc, &otherFuncInt]() {
+        EXPECT_CALL(JOMOCK(func), JOMOCK_FUNC())
+            .Times(Exactly(1))
+            .WillOnce(Return("thread mock"));
+        otherFunc = func();
+        otherFuncInt = funcInt(1);
+        CLEAR_JOMOCK();
+    });
+    other.join();
+
+    EXPECT_EQ(otherFunc, "thread mock");
+    EXPECT_EQ(otherFuncInt, 100); // falls through to the original
+    EXPECT_EQ(func(), "no mock");
+    EXPECT_EQ(funcInt(1), 7);
+
+    CLEAR_JOMOCK();
+    EXPECT_EQ(funcInt(1), 100);
+    JOMOCK_THREAD_LOCAL_DISPATCH(false);
+}
+
+TEST_F(JoMock, ThreadLocalDispatchMemberFunction)
+{
+    JOMOCK_THREAD_LOCAL_DISPATCH(true);
+
+    ClassTest classTest;
+    EXPECT_CALL(JOMOCK(&ClassTest::nonStaticFunc), JOMOCK_FUNC(&classTest, _))
+        .Times(Exactly(1))
+        .WillOnce(Return(4));
+    EXPECT_EQ(classTest.nonStaticFunc(0), 4);
+
+    int other = 0;
+    thread([&classTest, &other]() { other = classTest.nonStaticFunc(0); }).join();
+    EXPECT_EQ(other, 2);
+
+    CLEAR_JOMOCK();
+    JOMOCK_THREAD_LOCAL_DISPATCH(false);
+}
+
+TEST_F(JoMock, CallOriginalFunction)
+{
+    auto mocker = &JOMOCK(func);
+    EXPECT_CALL(*mocker, JOMOCK_FUNC())
+        .Times(Exactly(2))
+        .WillOnce(Return("mocked func"))
+        .WillOnce(JOMOCK_CALL_ORIGINAL(mocker));
+
+    EXPECT_EQ(func(), "mocked func");
+    EXPECT_EQ(func(), "no mock");
+    EXPECT_EQ(mocker->callOriginal(), "no mock");
+}
+
+TEST_F(JoMock, CallOriginalMemberFunction)
+{
+    ClassTest classTest;
+    auto mocker = &JOMOCK(&ClassTest::nonStaticFunc);
+    EXPECT_CALL(*mocker, JOMOCK_FUNC(&classTest, _))
+        .Times(Exactly(1))
+        .WillOnce(JOMOCK_CALL_ORIGINAL(mocker));
+
+    EXPECT_EQ(classTest.nonStaticFunc(0), 2);
+    EXPECT_EQ(mocker->callOriginal(&classTest, 0), 2);
+}
+
+TEST_F(JoMock, MockSelectedInstances)
+{
+    ClassTest selected;
+    ClassTest other;
+    EXPECT_CALL(JOMOCK_INSTANCE(&selected, &ClassTest::nonStaticFunc), JOMOCK_FUNC(_, _))
+        .Times(Exactly(1))
+        .WillOnce(Return(4));
+    EXPECT_EQ(other.nonStaticFunc(0), 2); // not selected, no expectation consumed
+    EXPECT_EQ(selected.nonStaticFunc(0), 4);
+    CLEAR_JOMOCK();
+
+    vector<ClassTest> objects(1000);
+    for (size_t i = 0; i < objects.size(); i += 2) {
+        JOMOCK_INSTANCE(&objects[i], &ClassTest::nonStaticFunc);
+    }
+    EXPECT_CALL(JOMOCK(&ClassTest::nonStaticFunc), JOMOCK_FUNC(_, _))
+        .Times(Exactly(500))
+        .WillRepeatedly(Return(7));
+    int sum = 0;
+    for (ClassTest& object : objects) {
+        sum += object.nonStaticFunc(0);
+    }
+    EXPECT_EQ(sum, 500 * 7 + 500 * 2);
+    CLEAR_JOMOCK();
+    EXPECT_EQ(selected.nonStaticFunc(0), 2);
+}
+
+#ifdef JOMOCK_VTABLE_SUPPORT
+class Shape {
+public:
+    virtual ~Shape() {}
+    virtual int area() const
+    {
+        return 1;
+    }
+    virtual int scale(int factor)
+    {
+        return factor;
+    }
+};
+
+class Square : public Shape {
+public:
+    int area() const override
+    {
+        return 4;
+    }
+};
+
+class Named {
+public:
+    virtual ~Named() {}
+    virtual string name() const
+    {
+        return "named";
+    }
+};
+
+class Tile : public Square, public Named {
+public:
+    string name() const override
+    {
+        return "tile";
+    }
+};
+
+// Calls through a pointer the compiler cannot see the target of, it devirtualizes the others even at -O0.
+template < typename T >
+static T* opaque(T* object)
+{
+    T* volatile value = object;
+    return value;
+}
+
+TEST_F(JoMock, VirtualFunctionOfOneObject)
+{
+    Square mocked;
+    Square other;
+    Shape& shape = *opaque<Shape>(&mocked);
+    Shape& otherShape = *opaque<Shape>(&other);
+    void* const vptr = *reinterpret_cast<void**>(&mocked);
+
+    auto mocker = &JOMOCK_VIRTUAL(&mocked, &Shape::area);
+    EXPECT_CALL(*mocker, JOMOCK_FUNC(&mocked))
+        .Times(Exactly(2))
+        .WillOnce(Return(9))
+        .WillOnce(JOMOCK_CALL_ORIGINAL(mocker));
+    EXPECT_CALL(JOMOCK_VIRTUAL(&mocked, &Shape::scale), JOMOCK_FUNC(_, _))
+        .WillRepeatedly(Return(0));
+    EXPECT_EQ(shape.area(), 9);
+    EXPECT_EQ(shape.area(), 4);
+    EXPECT_EQ(shape.scale(3), 0);
+    EXPECT_EQ(otherShape.area(), 4);
+    EXPECT_EQ(otherShape.scale(3), 3);
+    EXPECT_NE(dynamic_cast<Square*>(&shape), nullptr); // the copy keeps the type information
+
+    CLEAR_JOMOCK();
+    EXPECT_EQ(*reinterpret_cast<void**>(&mocked), vptr);
+    EXPECT_EQ(shape.area(), 4);
+}
+
+TEST_F(JoMock, VirtualFunctionOfSecondaryBase)
+{
+    Tile tile;
+    Named& named = *opaque<Named>(&tile);
+    Shape& shape = *opaque<Shape>(&tile);
+    EXPECT_CALL(JOMOCK_VIRTUAL(&tile, &Named::name), JOMOCK_FUNC(_))
+        .WillOnce(Return("mocked"));
+    EXPECT_EQ(named.name(), "mocked");
+    EXPECT_EQ(shape.area(), 4);
+    CLEAR_JOMOCK();
+    EXPECT_EQ(named.name(), "tile");
+}
+
+TEST_F(JoMock, VirtualFunctionOfObjectDestroyedWhileAttached)
+{
+    alignas(Square) unsigned char storage[sizeof(Square)];
+    Square* first = new (storage) Square;
+    EXPECT_CALL(JOMOCK_VIRTUAL(first, &Shape::area), JOMOCK_FUNC(_))
+        .WillRepeatedly(Return(9));
+    EXPECT_EQ(opaque<Shape>(first)->area(), 9);
+    first->~Square();
+
+    Square* second = new (storage) Square; // the stale copy of 'first' is dropped
+    Shape& shape = *opaque<Shape>(second);
+    void* const vptr = *reinterpret_cast<void**>(second);
+    EXPECT_EQ(shape.area(), 4);
+    EXPECT_CALL(JOMOCK_VIRTUAL(second, &Shape::scale), JOMOCK_FUNC(_, _))
+        .WillRepeatedly(Return(0));
+    EXPECT_EQ(shape.scale(3), 0);
+    EXPECT_EQ(shape.area(), 4);
+    {
+        ::jomock::JoMockDetach detach(second);
+    }
+    EXPECT_EQ(*reinterpret_cast<void**>(second), vptr);
+    EXPECT_EQ(shape.scale(3), 3);
+
+    Square* third = new Square;
+    EXPECT_CALL(JOMOCK_VIRTUAL(third, &Shape::area), JOMOCK_FUNC(_))
+        .WillRepeatedly(Return(7));
+    EXPECT_EQ(opaque<Shape>(third)->area(), 7);
+    JOMOCK_DETACH(third);
+    EXPECT_EQ(opaque<Shape>(third)->area(), 4);
+    delete third;
+    second->~Square();
+}
+#endif
+
+TEST_F(JoMock, CallOriginalLegacyLibrary)
+{
+    auto mocker = &JOMOCK(atoi);
+    EXPECT_CALL(*mocker, JOMOCK_FUNC(_))
+        .Times(Exactly(2))
+        .WillOnce(Return(1))
+        .WillOnce(JOMOCK_CALL_ORIGINAL(mocker));
+
+    EXPECT_EQ(atoi("TEN"), 1);
+    EXPECT_EQ(atoi("10"), 10);
+}
+
+#if defined(ARM64_SUPPORT) || defined(__x86_64__) || defined(_M_X64)
+TEST_F(JoMock, FarGraftUsesVeneer)
+{
+    auto mocker = &JOMOCK(atoi);
+    EXPECT_CALL(*mocker, JOMOCK_FUNC(_))
+        .WillRepeatedly(Return(1));
+#ifdef ARM64_SUPPORT
+    EXPECT_EQ(mocker->binaryBackup.size(), 4u);
+    EXPECT_EQ(*reinterpret_cast<const uint32_t*>(&atoi) & 0xFC000000u, 0x14000000u); // b
+#else
+    EXPECT_EQ(mocker->binaryBackup.size(), 5u);
+    EXPECT_EQ(*reinterpret_cast<const unsigned char*>(&atoi), 0xE9);
+#endif
+    EXPECT_EQ(atoi("TEN"), 1);
+    const size_t veneers = ::jomock::JoMockVeneerPool::size();
+
+    CLEAR_JOMOCK();
+    EXPECT_EQ(atoi("10"), 10);
+
+    EXPECT_CALL(JOMOCK(atoi), JOMOCK_FUNC(_))
+        .WillRepeatedly(Return(2));
+    EXPECT_EQ(atoi("TEN"), 2);
+    EXPECT_EQ(::jomock::JoMockVeneerPool::size(), veneers); // retargeted, nothing allocated
+}
+#endif
+
+static int digestCalls = 0;
+
+static uint64_t expensiveDigest(const string& text, int rounds)
+{
+    ++digestCalls;
+    uint64_t digest = static_cast<uint64_t>(rounds);
+    for (int i = 0; i < rounds; ++i) {
+        for (char c : text) {
+            digest = digest * 131 + static_cast<unsigned char>(c);
+        }
+    }
+    return digest;
+}
+
+TEST_F(JoMock, RecordAndReplay)
+{
+    const string path = TempDir() + "jomock_record_and_replay.rec";
+    remove(path.c_str());
+    const uint64_t abc = expensiveDigest("abc", 3);
+    const uint64_t xyz = expensiveDigest("xyz", 2);
+    {
+        ::jomock::JoMockRecording recording(path);
+        auto mocker = &JOMOCK(expensiveDigest);
+        EXPECT_CALL(*mocker, JOMOCK_FUNC(_, _))
+            .WillRepeatedly(JOMOCK_RECORD(mocker, recording));
+        EXPECT_EQ(expensiveDigest("abc", 3), abc);
+        EXPECT_EQ(expensiveDigest("xyz", 2), xyz);
+        EXPECT_EQ(recording.size(), 2u);
+        CLEAR_JOMOCK();
+    }
+
+    digestCalls = 0;
+    ::jomock::JoMockRecording recording(path);
+    EXPECT_EQ(recording.size(), 2u);
+    auto mocker = &JOMOCK(expensiveDigest);
+    EXPECT_CALL(*mocker, JOMOCK_FUNC(_, _))
+        .WillRepeatedly(JOMOCK_REPLAY(mocker, recording));
+    EXPECT_EQ(expensiveDigest("xyz", 2), xyz);
+    EXPECT_EQ(expensiveDigest("abc", 3), abc);
+    EXPECT_EQ(digestCalls, 0);
+    EXPECT_NONFATAL_FAILURE(expensiveDigest("abc", 4), "no call of expensiveDigest");
+    EXPECT_EQ(digestCalls, 1); // passed through
+    CLEAR_JOMOCK();
+    remove(path.c_str());
+}
+
+static int stepForward(int* position)
+{
+    return *position += 10;
+}
+
+static int sumOf(const int* values, size_t count)
+{
+    int sum = 0;
+    for (size_t i = 0; i < count; ++i) sum += values[i];
+    return sum;
+}
+
+static void greet(char* out, size_t size)
+{
+    snprintf(out, size, "hello");
+}
+
+TEST_F(JoMock, ReplayBuffers)
+{
+    const string path = TempDir() + "jomock_replay_buffers.rec";
+    remove(path.c_str());
+    ::jomock::JoMockRecording recording(path);
+    auto stepper = &JOMOCK(stepForward);
+    EXPECT_CALL(*stepper, JOMOCK_FUNC(_))
+        .WillOnce(JOMOCK_RECORD(stepper, recording, ::jomock::JoMockPointee<0>()))
+        .WillOnce(JOMOCK_REPLAY(stepper, recording, ::jomock::JoMockPointee<0>()));
+    auto summer = &JOMOCK(sumOf);
+    EXPECT_CALL(*summer, JOMOCK_FUNC(_, _))
+        .WillRepeatedly(JOMOCK_RECORD(summer, recording, ::jomock::JoMockArray<0, 1>()));
+    auto greeter = &JOMOCK(greet);
+    EXPECT_CALL(*greeter, JOMOCK_FUNC(_, _))
+        .WillOnce(JOMOCK_RECORD(greeter, recording, ::jomock::JoMockArray<0, 1>()))
+        .WillOnce(JOMOCK_REPLAY(greeter, recording, ::jomock::JoMockArray<0, 1>()));
+
+    int position = 1;
+    EXPECT_EQ(stepForward(&position), 11);
+    position = 1;
+    EXPECT_EQ(stepForward(&position), 11); // replayed, the key is taken before the call
+    EXPECT_EQ(position, 11); // and the output is written back
+
+    const int first[] = { 1, 2 };
+    const int second[] = { 1, 5 };
+    EXPECT_EQ(sumOf(first, 2), 3);
+    EXPECT_EQ(sumOf(second, 2), 6);
+    EXPECT_CALL(*summer, JOMOCK_FUNC(_, _))
+        .WillRepeatedly(JOMOCK_REPLAY(summer, recording, ::jomock::JoMockArray<0, 1>()));
+    EXPECT_EQ(sumOf(second, 2), 6); // the elements are in the key, not the first one only
+    EXPECT_EQ(sumOf(first, 2), 3);
+
+    char text[8] = {};
+    greet(text, sizeof(text));
+    char replayed[8] = {};
+    greet(replayed, sizeof(replayed));
+    EXPECT_STREQ(replayed, "hello");
+    CLEAR_JOMOCK();
+    remove(path.c_str());
+}
+
+TEST_F(JoMock, ReplayedViewsOutliveGrowth)
+{
+    const string path = TempDir() + "jomock_replay_growth.rec";
+    remove(path.c_str());
+    ::jomock::JoMockRecording recording(path);
+    const uint64_t first = ::jomock::JoMockRecording::key("label", 0);
+    recording.append(first, [](::jomock::JoMockBufferSink& sink) {
+        ::jomock::JoMockSerializer<const char*>::write(sink, "first label");
+    });
+    ::jomock::JoMockSource source;
+    ASSERT_TRUE(recording.next(first, source));
+    const char* const view = ::jomock::JoMockSerializer<const char*>::read(source);
+    const string padding(1000, 'x');
+    for (int i = 1; i <= 64; ++i) { // remaps the file several times
+        recording.append(::jomock::JoMockRecording::key("label", i), [&padding](::jomock::JoMockBufferSink& sink) {
+            ::jomock::JoMockSerializer<string>::write(sink, padding);
+        });
+    }
+    EXPECT_STREQ(view, "first label");
+    remove(path.c_str());
+}
+
+struct Reading {
+    int sensor;
+    string unit;
+    double value;
+};
+
+static Reading readSensor(int sensor)
+{
+    Reading reading = { sensor, "celsius", 20.5 + sensor };
+    return reading;
+}
+
+namespace jomock {
+    template <>
+    struct JoMockSerializer<Reading> {
+        template < typename Sink >
+        static void write(Sink& sink, const Reading& reading) {
+            JoMockSerializer<int>::write(sink, reading.sensor);
+            JoMockSerializer<string>::write(sink, reading.unit);
+            JoMockSerializer<double>::write(sink, reading.value);
+        }
+
+        static Reading read(JoMockSource& source) {
+            Reading reading;
+            reading.sensor = JoMockSerializer<int>::read(source);
+            reading.unit = JoMockSerializer<string>::read(source);
+            reading.value = JoMockSerializer<double>::read(source);
+            return reading;
+        }
+    };
+}
+
+TEST_F(JoMock, ReplayCustomSerializer)
+{
+    const string path = TempDir() + "jomock_replay_custom.rec";
+    remove(path.c_str());
+    ::jomock::JoMockRecording recording(path);
+    auto mocker = &JOMOCK(readSensor);
+    EXPECT_CALL(*mocker, JOMOCK_FUNC(_))
+        .WillOnce(JOMOCK_RECORD(mocker, recording))
+        .WillOnce(Return(Reading{ 0, "none", 0 }))
+        .WillOnce(JOMOCK_REPLAY(mocker, recording));
+    EXPECT_EQ(readSensor(7).value, 27.5);
+    EXPECT_EQ(readSensor(7).unit, "none");
+    const Reading replayed = readSensor(7);
+    EXPECT_EQ(replayed.sensor, 7);
+    EXPECT_EQ(replayed.unit, "celsius");
+    EXPECT_EQ(replayed.value, 27.5);
+    CLEAR_JOMOCK();
+    remove(path.c_str());
+}
+
+static int derivations = 0;
+
+static string deriveKey(const string& secret, int rounds)
+{
+    ++derivations;
+    string key = secret;
+    for (int i = 0; i < rounds; ++i) {
+        for (char& c : key) c = static_cast<char>(c * 31 + i);
+    }
+    return key;
+}
+
+TEST_F(JoMock, MemoizeExpensiveFunction)
+{
+    derivations = 0;
+    const string expected = deriveKey("secret", 1000);
+    auto& memo = JOMOCK_MEMOIZE(deriveKey);
+    EXPECT_EQ(deriveKey("secret", 1000), expected);
+    EXPECT_EQ(deriveKey("secret", 1000), expected);
+    EXPECT_EQ(derivations, 2);
+    EXPECT_EQ(memo.hitCount(), 1u);
+    EXPECT_EQ(memo.missCount(), 1u);
+
+    memo.limit(2);
+    deriveKey("other", 10);
+    deriveKey("third", 10); // evicts "secret"
+    EXPECT_EQ(memo.size(), 2u);
+    EXPECT_EQ(memo.evictionCount(), 1u);
+    EXPECT_EQ(deriveKey("secret", 1000), expected);
+    EXPECT_EQ(derivations, 5);
+
+    const size_t bytes = memo.byteCount();
+    memo.limit(0, bytes - 1); // one entry less
+    EXPECT_EQ(memo.size(), 1u);
+}
+
+TEST_F(JoMock, MemoizePersistsAcrossRuns)
+{
+    remove("jomock_memo.cache");
+    derivations = 0;
+    JOMOCK_MEMOIZE(deriveKey).persist("jomock_memo.cache");
+    const string first = deriveKey("secret", 100);
+    EXPECT_EQ(derivations, 1);
+
+    CLEAR_JOMOCK(); // as if the test binary ran again
+    auto& memo = JOMOCK_MEMOIZE(deriveKey).persist("jomock_memo.cache");
+    EXPECT_EQ(deriveKey("secret", 100), first);
+    EXPECT_EQ(derivations, 1); // read from the file
+    EXPECT_EQ(memo.hitCount(), 1u);
+    CLEAR_JOMOCK();
+    remove("jomock_memo.cache");
+}
+
+#ifdef NON_WIN32_SUPPORT
+// Sleeps 1, 2, 4... seconds before each attempt.
+static int retryWithBackoff(int attempts)
+{
+    int tries = 0;
+    for (chrono::seconds delay(1); tries < attempts; delay *= 2) {
+        this_thread::sleep_for(delay);
+        ++tries;
+    }
+    return tries;
+}
+
+TEST_F(JoMock, VirtualTimeBackoff)
+{
+    const int64_t realStart = ::jomock::JoMockClock::realNanoseconds(CLOCK_MONOTONIC);
+    auto& clock = JOMOCK_VIRTUAL_TIME();
+    const chrono::steady_clock::time_point start = chrono::steady_clock::now();
+#ifdef JOMOCK_IMPORT_SUPPORT
+    const time_t startTime = time(nullptr);
+#endif
+    EXPECT_EQ(retryWithBackoff(5), 5);
+    EXPECT_EQ(chrono::duration_cast<chrono::seconds>(chrono::steady_clock::now() - start).count(), 31);
+    usleep(500000);
+    sleep(1);
+    clock.advance(chrono::seconds(10));
+    EXPECT_EQ(clock.elapsed(), chrono::milliseconds(42500));
+    EXPECT_EQ(chrono::duration_cast<chrono::milliseconds>(chrono::steady_clock::now() - start).count(), 42500);
+#ifdef JOMOCK_IMPORT_SUPPORT
+    EXPECT_GE(time(nullptr) - startTime, 42);
+#endif
+    EXPECT_LT(::jomock::JoMockClock::realNanoseconds(CLOCK_MONOTONIC) - realStart, 1000000000);
+
+    CLEAR_JOMOCK();
+    EXPECT_LT(chrono::steady_clock::now() - start, chrono::seconds(1)); // real time again
+}
+
+TEST_F(JoMock, VirtualTimeTimedWait)
+{
+    auto& clock = JOMOCK_VIRTUAL_TIME();
+    mutex guard;
+    condition_variable condition;
+    bool ready = false;
+    clock.setAutoAdvance(true); // nobody will notify
+    {
+        unique_lock<mutex> lock(guard);
+        EXPECT_FALSE(condition.wait_for(lock, chrono::seconds(30), [&ready]() { return ready; }));
+    }
+    EXPECT_EQ(clock.elapsed(), chrono::seconds(30));
+
+    clock.setAutoAdvance(false);
+    bool notified = false;
+    thread waiter([&]() {
+        unique_lock<mutex> lock(guard);
+        notified = condition.wait_for(lock, chrono::seconds(60), [&ready]() { return ready; });
+    });
+    while (clock.waiters() == 0) this_thread::yield();
+    {
+        lock_guard<mutex> lock(guard);
+        ready = true;
+    }
+    condition.notify_all();
+    waiter.join();
+    EXPECT_TRUE(notified);
+    EXPECT_EQ(clock.elapsed(), chrono::seconds(30));
+
+    ready = false;
+    thread sleeper([&]() {
+        unique_lock<mutex> lock(guard);
+        notified = condition.wait_for(lock, chrono::seconds(5), [&ready]() { return ready; });
+    });
+    while (clock.waiters() == 0) this_thread::yield();
+    clock.advance(chrono::seconds(5));
+    sleeper.join();
+    EXPECT_FALSE(notified);
+    EXPECT_EQ(clock.elapsed(), chrono::seconds(35));
+}
+
+TEST_F(JoMock, VirtualTimeWaitOutlastsRealWork)
+{
+    auto& clock = JOMOCK_VIRTUAL_TIME();
+    mutex guard;
+    condition_variable condition;
+    bool ready = false;
+    thread worker([&]() {
+        while (clock.waiters() == 0) this_thread::yield();
+        const int64_t end = ::jomock::JoMockClock::realNanoseconds(CLOCK_MONOTONIC) + 5000000;
+        while (::jomock::JoMockClock::realNanoseconds(CLOCK_MONOTONIC) < end) {} // real work, longer than a wait slice
+        lock_guard<mutex> lock(guard);
+        ready = true;
+        condition.notify_all();
+    });
+    bool notified;
+    {
+        unique_lock<mutex> lock(guard);
+        notified = condition.wait_for(lock, chrono::seconds(30), [&ready]() { return ready; });
+    }
+    worker.join();
+    EXPECT_TRUE(notified);
+    EXPECT_EQ(clock.elapsed(), chrono::seconds(0));
+}
+
+TEST_F(JoMock, MemoryFileSystem)
+{
+    auto& fs = JOMOCK_MEMORY_FS("/tmp/jomock_memfs");
+    const char* const path = "/tmp/jomock_memfs/data/../log.bin";
+    const int file = open(path, O_RDWR | O_CREAT | O_TRUNC, 0600);
+    ASSERT_GE(file, 0);
+    const string text = "memory speed";
+    EXPECT_EQ(write(file, text.data(), text.size()), static_cast<ssize_t>(text.size()));
+    EXPECT_EQ(pwrite(file, "!", 1, 3 * 4096), 1); // leaves a hole of zeros
+    EXPECT_EQ(lseek(file, 7, SEEK_SET), 7);
+    char buffer[16] = {};
+    EXPECT_EQ(read(file, buffer, 5), 5);
+    EXPECT_STREQ(buffer, "speed");
+    EXPECT_EQ(pread(file, buffer, 2, 4095), 2);
+    EXPECT_EQ(buffer[0], '\0');
+    struct stat status;
+    EXPECT_EQ(fstat(file, &status), 0);
+    EXPECT_EQ(status.st_size, 3 * 4096 + 1);
+    EXPECT_EQ(status.st_blocks, 2 * 8); // the pages of the hole are not allocated
+
+    char* const mapped = static_cast<char*>(mmap(nullptr, 4096, PROT_READ | PROT_WRITE, MAP_SHARED, file, 0));
+    ASSERT_NE(mapped, MAP_FAILED);
+    EXPECT_EQ(string(mapped, text.size()), text);
+    mapped[0] = 'M';
+    EXPECT_EQ(munmap(mapped, 4096), 0);
+    EXPECT_EQ(fs.contents("/tmp/jomock_memfs/log.bin").substr(0, text.size()), "Memory speed");
+    EXPECT_EQ(close(file), 0);
+    EXPECT_EQ(close(file), -1);
+    EXPECT_EQ(errno, EBADF);
+
+    EXPECT_NE(access("/tmp/jomock_memfs/log.bin", F_OK), 0); // nothing on the disk
+    EXPECT_EQ(open("/tmp/jomock_memfs/missing", O_RDONLY), -1);
+    EXPECT_EQ(errno, ENOENT);
+    EXPECT_EQ(open("/tmp/jomock_memfs/missing", O_RDONLY | O_CREAT | O_DIRECTORY, 0700), -1);
+    EXPECT_FALSE(fs.exists("/tmp/jomock_memfs/missing"));
+    EXPECT_EQ(unlink("/tmp/jomock_memfs/log.bin"), 0);
+    EXPECT_FALSE(fs.exists("/tmp/jomock_memfs/log.bin"));
+    const int outside = open("/proc/self/stat", O_RDONLY); // not mounted
+    EXPECT_GT(read(outside, buffer, sizeof(buffer)), 0);
+    EXPECT_EQ(close(outside), 0);
+}
+
+TEST_F(JoMock, MemoryFileSystemGrowsUnderASharedMapping)
+{
+    JOMOCK_MEMORY_FS("/tmp/jomock_memfs");
+    const int file = open("/tmp/jomock_memfs/sparse.bin", O_RDWR | O_CREAT | O_TRUNC, 0600);
+    ASSERT_GE(file, 0);
+    EXPECT_EQ(write(file, "head", 4), 4);
+    char* const mapped = static_cast<char*>(mmap(nullptr, 4096, PROT_READ | PROT_WRITE, MAP_SHARED, file, 0));
+    ASSERT_NE(mapped, MAP_FAILED);
+    // The page tables of the file outgrow the mmap threshold of malloc : growing one frees the last by munmap().
+    for (off_t offset = off_t(1) << 28; offset <= off_t(1) << 31; offset <<= 1) {
+        EXPECT_EQ(pwrite(file, "!", 1, offset), 1);
+    }
+    mapped[0] = 'H';
+    EXPECT_EQ(munmap(mapped, 4096), 0);
+    char buffer[4] = {};
+    EXPECT_EQ(pread(file, buffer, 4, 0), 4);
+    EXPECT_EQ(string(buffer, 4), "Head");
+    EXPECT_EQ(close(file), 0);
+    EXPECT_EQ(unlink("/tmp/jomock_memfs/sparse.bin"), 0);
+}
+
+TEST_F(JoMock, MemoryFileSystemFaults)
+{
+    auto& clock = JOMOCK_VIRTUAL_TIME();
+    auto& fs = JOMOCK_MEMORY_FS("/tmp/jomock_memfs");
+    fs.fail("/tmp/jomock_memfs/flaky", ::jomock::JoMockMemoryFs::Read, EIO, 1);
+    fs.delay("/tmp/jomock_memfs", ::jomock::JoMockMemoryFs::Write, chrono::seconds(2));
+    const int file = open("/tmp/jomock_memfs/flaky", O_RDWR | O_CREAT, 0600);
+    ASSERT_GE(file, 0);
+    const string page(4096, 'x');
+    EXPECT_EQ(write(file, page.data(), page.size()), 4096);
+    EXPECT_EQ(clock.elapsed(), chrono::seconds(2));
+    char buffer[4];
+    EXPECT_EQ(pread(file, buffer, sizeof(buffer), 0), -1);
+    EXPECT_EQ(errno, EIO);
+    EXPECT_EQ(pread(file, buffer, sizeof(buffer), 0), 4); // failed once only
+    const size_t pages = fs.allocatedPages();
+
+    CLEAR_JOMOCK(); // closes 'file', the next install starts empty and reuses the pages
+    EXPECT_EQ(fcntl(file, F_GETFD), -1);
+    EXPECT_EQ(errno, EBADF);
+    auto& next = JOMOCK_MEMORY_FS("/tmp/jomock_memfs");
+    EXPECT_FALSE(next.exists("/tmp/jomock_memfs/flaky"));
+    const int other = open("/tmp/jomock_memfs/other", O_WRONLY | O_CREAT, 0600);
+    EXPECT_EQ(write(other, page.data(), page.size()), 4096);
+    EXPECT_EQ(close(other), 0);
+    EXPECT_EQ(next.allocatedPages(), pages);
+}
+#endif
+
+#ifdef JOMOCK_IMPORT_SUPPORT
+TEST_F(JoMock, ImportedFunction)
+{
+    const unsigned char* const text = reinterpret_cast<const unsigned char*>(dlsym(RTLD_DEFAULT, "atoi"));
+    const unsigned char entry = *text;
+
+    auto mocker = &JOMOCK_IMPORT(atoi);
+    EXPECT_CALL(*mocker, JOMOCK_FUNC(_))
+        .Times(Exactly(2))
+        .WillOnce(Return(1))
+        .WillOnce(JOMOCK_CALL_ORIGINAL(mocker));
+    EXPECT_EQ(atoi("TEN"), 1);
+    EXPECT_EQ(atoi("10"), 10);
+    EXPECT_EQ(*text, entry); // the library's text is not patched
+
+    CLEAR_JOMOCK();
+    EXPECT_EQ(atoi("10"), 10);
+
+    auto again = &JOMOCK_IMPORT_FROM("", atoi); // the program's own imports only
+    EXPECT_CALL(*again, JOMOCK_FUNC(_))
+        .WillOnce(Return(2));
+    EXPECT_EQ(atoi("10"), 2);
+    CLEAR_JOMOCK();
+    EXPECT_EQ(atoi("10"), 10);
+}
+#endif
+
+#ifdef JOMOCK_SYMBOL_SUPPORT
+__attribute__((always_inline)) inline int inlinedTwice(int x)
+{
+    return x * 2;
+}
+
+int callInlinedTwice(int x)
+{
+    return inlinedTwice(x);
+}
+
+TEST_F(JoMock, ReportInlinedCalls)
+{
+    testing::internal::CaptureStderr();
+    EXPECT_CALL(JOMOCK(inlinedTwice), JOMOCK_FUNC(_))
+        .Times(Exactly(1))
+        .WillOnce(Return(-1));
+    const string report = testing::internal::GetCapturedStderr();
+    EXPECT_NE(report.find("inlinedTwice(int) is inlined into callInlinedTwice(int)"), string::npos) << report;
+    EXPECT_EQ(callInlinedTwice(2), 4); // the inlined copy is not mocked
+    int (*volatile outOfLine)(int) = &inlinedTwice;
+    EXPECT_EQ(outOfLine(2), -1);
+}
+
+int callHiddenAdd(int a, int b);
+string callHiddenName(int id);
+int callCounterNext(int step);
+
+TEST_F(JoMock, SymbolByName)
+{
+    EXPECT_CALL(JOMOCK_SYMBOL<int(int, int)>("hiddenAdd"), JOMOCK_FUNC(_, _))
+        .WillOnce(Return(-1));
+    EXPECT_CALL(JOMOCK_SYMBOL<string(int)>("(anonymous namespace)::hiddenName(int)"), JOMOCK_FUNC(_))
+        .WillOnce(Return("mock"));
+    EXPECT_EQ(callHiddenAdd(1, 2), -1);
+    EXPECT_EQ(callHiddenName(1), "mock");
+    CLEAR_JOMOCK();
+    EXPECT_EQ(callHiddenAdd(1, 2), 3);
+    EXPECT_EQ(callHiddenName(1), "name1");
+
+    auto mocker = &JOMOCK_SYMBOL<int(int, int)>("_ZL9hiddenAddii"); // mangled
+    EXPECT_CALL(*mocker, JOMOCK_FUNC(_, _))
+        .WillOnce(JOMOCK_CALL_ORIGINAL(mocker));
+    EXPECT_EQ(callHiddenAdd(2, 2), 4);
+    CLEAR_JOMOCK();
+}
+
+TEST_F(JoMock, SymbolMemberFunction)
+{
+    struct Counter; // only names the class in the signature
+    EXPECT_CALL(JOMOCK_SYMBOL<int(Counter::*)(int) const>("symbol::Counter::next"), JOMOCK_FUNC(_, _))
+        .WillOnce(Return(0));
+    EXPECT_EQ(callCounterNext(1), 0);
+    CLEAR_JOMOCK();
+    EXPECT_EQ(callCounterNext(1), 11);
+    EXPECT_EQ(::jomock::JoMockSymbolIndex::find("no_such_function"), nullptr);
+}
+
+namespace books {
+class Ledger {
+public:
+    Ledger() : total(10) {}
+    int balance() const;
+    bool deposit(int amount);
+    void reset();
+    const char* owner() const;
+    double rate(int days) const;
+    string describe() const;
+    static Ledger* open(int id);
+
+private:
+    int total;
+};
+
+int Ledger::balance() const
+{
+    return total;
+}
+
+bool Ledger::deposit(int amount)
+{
+    total += amount;
+    return true;
+}
+
+void Ledger::reset()
+{
+    total = 0;
+}
+
+const char* Ledger::owner() const
+{
+    return "owner";
+}
+
+double Ledger::rate(int days) const
+{
+    return days * 0.5;
+}
+
+string Ledger::describe() const
+{
+    return "ledger " + to_string(total);
+}
+
+Ledger* Ledger::open(int)
+{
+    static Ledger ledger;
+    return &ledger;
+}
+}
+
+TEST_F(JoMock, MockWholeClass)
+{
+    books::Ledger ledger;
+    auto mocker = &JOMOCK_CLASS(books::Ledger);
+    EXPECT_EQ(ledger.describe(), "ledger 10"); // the default runs the original code
+    EXPECT_EQ(ledger.balance(), 10);
+    mocker->setDefault(::jomock::JoMockClass::kReturnDefault);
+    EXPECT_EQ(mocker->size(), 7u);
+    const vector<string> names = mocker->names();
+    EXPECT_NE(find(names.begin(), names.end(), "books::Ledger::deposit(int)"), names.end());
+    EXPECT_EQ(ledger.balance(), 0);
+    EXPECT_FALSE(ledger.deposit(5));
+    ledger.reset();
+    EXPECT_EQ(ledger.owner(), nullptr);
+    EXPECT_EQ(ledger.rate(4), 0.0);
+    EXPECT_EQ(books::Ledger::open(1), nullptr);
+
+    EXPECT_CALL(JOMOCK(&books::Ledger::describe), JOMOCK_FUNC(&ledger))
+        .WillOnce(Return("mock")); // the handle takes the method over
+    auto deposit = &JOMOCK(&books::Ledger::deposit);
+    EXPECT_CALL(*deposit, JOMOCK_FUNC(&ledger, 5))
+        .WillOnce(JOMOCK_CALL_ORIGINAL(deposit));
+    EXPECT_EQ(ledger.describe(), "mock");
+    EXPECT_TRUE(ledger.deposit(5));
+    EXPECT_EQ(ledger.balance(), 0);
+
+    mocker->setDefault(::jomock::JoMockClass::kCallOriginal);
+    EXPECT_EQ(ledger.balance(), 15);
+    EXPECT_EQ(ledger.rate(4), 2.0);
+    mocker->setDefault(::jomock::JoMockClass::kReturnDefault);
+    EXPECT_EQ(ledger.balance(), 0);
+    CLEAR_JOMOCK();
+    EXPECT_EQ(ledger.balance(), 15);
+    EXPECT_EQ(ledger.describe(), "ledger 15");
+    EXPECT_TRUE(ledger.deposit(1));
+    EXPECT_EQ(string(ledger.owner()), "owner");
+}
+#endif
+
+static string stubbedFunc()
+{
+    return "stub";
+}
+
+TEST_F(JoMock, StubFunction)
+{
+    auto stub = &JOMOCK_STUB(funcInt, [](int x) { return x * 2; });
+    stub->countCalls();
+    EXPECT_EQ(funcInt(3), 6);
+    EXPECT_EQ(funcInt(4), 8);
+    EXPECT_EQ(stub->calls(), 2u);
+    EXPECT_EQ(stub->callOriginal(3), 100);
+
+    JOMOCK_STUB(func, stubbedFunc);
+    EXPECT_EQ(func(), "stub");
+
+    JOMOCK_STUB(funcInt, [](int) { return -1; }); // replaces the previous stub
+    EXPECT_EQ(funcInt(3), -1);
+
+    CLEAR_JOMOCK();
+    EXPECT_EQ(funcInt(3), 100);
+    EXPECT_EQ(func(), "no mock");
+}
+
+TEST_F(JoMock, StubMemberFunction)
+{
+    ClassTest classTest;
+    const int offset = 10;
+    JOMOCK_STUB(&ClassTest::nonStaticFunc, [offset, &classTest](ClassTest* self, int i) {
+        return self == &classTest ? i + offset : 0;
+    });
+    EXPECT_EQ(classTest.nonStaticFunc(1), 11);
+
+    CLEAR_JOMOCK();
+    EXPECT_EQ(classTest.nonStaticFunc(1), 2);
+}
+
+TEST_F(JoMock, FastExpectations)
+{
+    JOMOCK_FAST(funcInt).willOnce(1).willOnce(2).willRepeatedly(7).times(4);
+    EXPECT_EQ(funcInt(0), 1);
+    EXPECT_EQ(funcInt(0), 2);
+    EXPECT_EQ(funcInt(0), 7);
+    EXPECT_EQ(funcInt(0), 7);
+    EXPECT_EQ(JOMOCK_FAST(funcInt).calls(), 4u);
+
+    JOMOCK_FAST(func).willRepeatedly("fast").times(2);
+    EXPECT_EQ(func(), "fast");
+    EXPECT_NONFATAL_FAILURE(CLEAR_JOMOCK(), "func was called 1 times, expected 2");
+    EXPECT_EQ(func(), "no mock");
+}
+
+TEST_F(JoMock, FastExpectationsFromThreads)
+{
+    const int threads = 8, calls = 5000;
+    JOMOCK_FAST(funcInt).willOnce(-1).willRepeatedly(1).times(threads * calls);
+    std::atomic<int> sum(0);
+    vector<thread> workers;
+    for (int t = 0; t < threads; ++t) {
+        workers.emplace_back([&sum]() {
+            int local = 0;
+            for (int i = 0; i < calls; ++i) {
+                local += funcInt(i);
+            }
+            sum += local;
+        });
+    }
+    for (thread& worker : workers) {
+        worker.join();
+    }
+    EXPECT_EQ(sum.load(), threads * calls - 2); // one -1, the rest 1
+    EXPECT_EQ(JOMOCK_FAST(funcInt).calls(), static_cast<size_t>(threads * calls));
+}
+
+static int counterValue = 0;
+
+int& counter()
+{
+    return counterValue;
+}
+
+unique_ptr<int> makeInt(int value)
+{
+    return unique_ptr<int>(new int(value));
+}
+
+TEST_F(JoMock, ReferenceAndMoveOnlyReturns)
+{
+    int other = 5;
+    EXPECT_CALL(JOMOCK(counter), JOMOCK_FUNC())
+        .WillOnce(ReturnRef(other));
+    EXPECT_EQ(&counter(), &other);
+    EXPECT_CALL(JOMOCK(makeInt), JOMOCK_FUNC(_))
+        .WillOnce(Return(ByMove(unique_ptr<int>(new int(9)))));
+    EXPECT_EQ(*makeInt(1), 9);
+}
+
+TEST_F(JoMock, RetargetInstalledMock)
+{
+    auto mocker = &JOMOCK(funcInt);
+    EXPECT_CALL(*mocker, JOMOCK_FUNC(_))
+        .WillRepeatedly(Return(5));
+    EXPECT_EQ(funcInt(2), 5);
+    char entry[16];
+    memcpy(entry, reinterpret_cast<const void*>(&funcInt), sizeof(entry));
+
+    auto triple = [](int x) { return x * 3; };
+    mocker->retarget(triple);
+    EXPECT_EQ(funcInt(2), 6);
+    EXPECT_EQ(mocker->target(triple), mocker->target(triple)); // stored once
+    auto negate = mocker->target([](int x) { return -x; });
+    mocker->retarget(negate);
+    EXPECT_EQ(funcInt(2), -2);
+    mocker->disable();
+    EXPECT_EQ(funcInt(2), 100);
+    mocker->enable();
+    EXPECT_EQ(funcInt(2), -2);
+    mocker->retarget(nullptr); // back to the expectations
+    EXPECT_EQ(funcInt(2), 5);
+    EXPECT_EQ(memcmp(entry, reinterpret_cast<const void*>(&funcInt), sizeof(entry)), 0); // text untouched
+}
+
+TEST_F(JoMock, RetargetWhileCalling)
+{
+    auto mocker = &JOMOCK(funcInt);
+    auto one = mocker->target([](int) { return 1; });
+    auto two = mocker->target([](int) { return 2; });
+    mocker->retarget(one);
+    std::atomic<bool> stop(false);
+    std::atomic<int> unexpected(0), started(0);
+    vector<thread> workers;
+    for (int t = 0; t < 4; ++t) {
+        workers.emplace_back([&stop, &unexpected, &started]() {
+            ++started;
+            while (!stop.load()) {
+                const int value = funcInt(0);
+                if (value != 1 && value != 2 && value != 100) ++unexpected;
+            }
+        });
+    }
+    while (started.load() != 4) {
+        this_thread::yield();
+    }
+    for (int i = 0; i < 20000; ++i) {
+        mocker->retarget(i % 2 == 0 ? two : one);
+        if (i % 1000 == 0) mocker->disable();
+        if (i % 1000 == 500) mocker->enable();
+    }
+    stop = true;
+    for (thread& worker : workers) {
+        worker.join();
+    }
+    EXPECT_EQ(unexpected.load(), 0);
+}
+
+// May throw : the compiler keeps the unwind tables of its callers.
+static int lookupValue(int key)
+{
+    if (key < 0) throw invalid_argument("key");
+    return key * 2;
+}
+
+TEST_F(JoMock, InjectIntoRealFunction)
+{
+    ::jomock::JoMockRandom::seed(7);
+    auto& injected = JOMOCK_INJECT(funcInt);
+    EXPECT_EQ(funcInt(1), 100); // the real function
+    injected.fail(0.25, -1, EIO);
+    int failures = 0;
+    for (int i = 0; i < 4000; ++i) {
+        errno = 0;
+        if (funcInt(i) == -1) {
+            ++failures;
+            EXPECT_EQ(errno, EIO);
+        }
+    }
+    EXPECT_EQ(injected.failures(), static_cast<size_t>(failures));
+    EXPECT_NEAR(failures, 1000, 150);
+
+    auto& throwing = JOMOCK_INJECT(lookupValue);
+    throwing.raise(1.0, runtime_error("unavailable"));
+    EXPECT_THROW(lookupValue(1), runtime_error);
+    EXPECT_EQ(throwing.exceptions(), 1u);
+    throwing.clear();
+    EXPECT_EQ(lookupValue(1), 2);
+
+    injected.clear().latency(::jomock::JoMockLatency::fixed(chrono::milliseconds(2)));
+    const chrono::steady_clock::time_point start = chrono::steady_clock::now();
+    EXPECT_EQ(funcInt(1), 100);
+    EXPECT_GE(chrono::steady_clock::now() - start, chrono::milliseconds(2));
+}
+
+TEST_F(JoMock, InjectLatencyDistributions)
+{
+    typedef ::jomock::JoMockLatency Latency;
+    const Latency uniform = Latency::uniform(chrono::microseconds(100), chrono::microseconds(300));
+    const Latency lognormal = Latency::lognormal(chrono::milliseconds(1), 0.5, chrono::milliseconds(20));
+    vector<chrono::nanoseconds> samples;
+    for (int i = 0; i < 1001; ++i) {
+        const chrono::nanoseconds value = uniform.sample();
+        EXPECT_TRUE(value >= chrono::microseconds(100) && value < chrono::microseconds(300));
+        samples.push_back(lognormal.sample());
+    }
+    nth_element(samples.begin(), samples.begin() + 500, samples.end());
+    EXPECT_GT(samples[500], chrono::microseconds(900));
+    EXPECT_LT(samples[500], chrono::microseconds(1100));
+    const chrono::nanoseconds longest = *max_element(samples.begin(), samples.end());
+    EXPECT_GT(longest, chrono::milliseconds(2)); // the tail
+    EXPECT_LE(longest, chrono::milliseconds(20));
+}
+
+TEST_F(JoMock, TraceMockActions)
+{
+    JOMOCK_TRACE("jomock_trace");
+    auto mocker = &JOMOCK(funcInt);
+    EXPECT_CALL(*mocker, JOMOCK_FUNC(_))
+        .WillRepeatedly(Return(5));
+    EXPECT_EQ(funcInt(1), 5);
+    thread other([]() { EXPECT_EQ(funcInt(2), 5); });
+    other.join();
+    JOMOCK_STUB(&ClassTest::staticFunc, []() { return 7; });
+    EXPECT_EQ(ClassTest::staticFunc(), 7);
+    CLEAR_JOMOCK(); // dumps
+    EXPECT_EQ(funcInt(3), 100); // not mocked, not traced
+    JOMOCK_TRACE(nullptr);
+
+    ifstream json("jomock_trace.json");
+    string line;
+    set<string> threads;
+    int mocks = 0, stubs = 0;
+    while (getline(json, line)) {
+        if (line.find("\"name\":\"funcInt\"") != string::npos) ++mocks;
+        if (line.find("\"name\":\"&ClassTest::staticFunc\"") != string::npos) ++stubs;
+        const size_t tid = line.find("\"tid\":");
+        if (tid != string::npos) threads.insert(line.substr(tid, line.find(',', tid) - tid));
+    }
+    EXPECT_EQ(mocks, 2);
+    EXPECT_EQ(stubs, 1);
+    EXPECT_EQ(threads.size(), 2u);
+    json.clear();
+    json.seekg(0);
+    const string text((istreambuf_iterator<char>(json)), istreambuf_iterator<char>());
+    EXPECT_EQ(text.front(), '[');
+    EXPECT_EQ(text.substr(text.size() - 4), "}\n]\n") << text; // closed, no trailing comma
+
+    ifstream binary("jomock_trace.bin", ios::binary);
+    char magic[8];
+    uint32_t names = 0;
+    binary.read(magic, sizeof(magic));
+    binary.read(reinterpret_cast<char*>(&names), sizeof(names));
+    EXPECT_EQ(string(magic, sizeof(magic)), "JMTRACE1");
+    EXPECT_EQ(names, 2u);
+    for (uint32_t i = 0; i < names; ++i) {
+        uint32_t length = 0;
+        binary.read(reinterpret_cast<char*>(&length), sizeof(length));
+        binary.ignore(length);
+    }
+    double perMicrosecond = 0;
+    uint32_t records = 0;
+    binary.read(reinterpret_cast<char*>(&perMicrosecond), sizeof(perMicrosecond));
+    binary.read(reinterpret_cast<char*>(&records), sizeof(records));
+    EXPECT_GT(perMicrosecond, 0);
+    EXPECT_EQ(records, 3u);
+    json.close();
+    binary.close();
+    remove("jomock_trace.json");
+    remove("jomock_trace.bin");
+}
+
+#ifdef JOMOCK_THUNK_SUPPORT
+// GDB's JIT interface, defined by the program as a JIT would.
+extern "C" {
+    __attribute__((noinline)) void __jit_debug_register_code()
+    {
+        __asm__ __volatile__("");
+    }
+
+    ::jomock::JoMockJitDescriptor __jit_debug_descriptor = { 1, 0, nullptr, nullptr };
+}
+
+static long mixArguments(int, double, const char*, long, float, short, unsigned)
+{
+    return 0;
+}
+
+static bool registeredThunk(const string& symbol)
+{
+    for (const ::jomock::JoMockJitEntry* entry = __jit_debug_descriptor.first; entry != nullptr; entry = entry->next) {
+        const string file(entry->symbolFile, entry->symbolFileSize);
+        if (file.compare(0, 4, "\177ELF") == 0 && file.find(symbol) != string::npos) return true;
+    }
+    return false;
+}
+
+TEST_F(JoMock, ThunkPrependsTheMock)
+{
+    auto mocker = &JOMOCK(mixArguments);
+    const void* const thunk = ::jomock::JoMockThunk::find(mocker);
+    ASSERT_NE(thunk, nullptr);
+    mocker->retarget([](int a, double b, const char* c, long d, float e, short f, unsigned g) {
+        return static_cast<long>(a + b + strlen(c) + d + e + f + g);
+    });
+    EXPECT_EQ(mixArguments(1, 2.5, "four", 8, 16.5f, 32, 64), 128);
+    EXPECT_NE(::jomock::JoMockThunk::find(&JOMOCK(&ClassTest::nonStaticFunc)), nullptr);
+    EXPECT_EQ(::jomock::JoMockThunk::find(&JOMOCK(ClassTest::parameterFunc)), nullptr); // string by value
+
+    EXPECT_TRUE(registeredThunk("jomock:mixArguments"));
+
+    JOMOCK_PERF_MAP(true);
+    const string path = "/tmp/perf-" + to_string(getpid()) + ".map";
+    ifstream map(path);
+    string line;
+    bool listed = false;
+    while (getline(map, line)) {
+        if (line.find(" jomock:mixArguments") != string::npos && stoull(line, nullptr, 16) == reinterpret_cast<uintptr_t>(thunk)) listed = true;
+    }
+    EXPECT_TRUE(listed);
+    JOMOCK_PERF_MAP(false);
+    map.close();
+    remove(path.c_str());
+}
+
+TEST_F(JoMock, ThunkIsReleasedWithItsMock)
+{
+    const void* const mocker = &JOMOCK(mixArguments);
+    const void* const thunk = ::jomock::JoMockThunk::find(mocker);
+    ASSERT_NE(thunk, nullptr);
+    EXPECT_TRUE(registeredThunk("jomock:mixArguments"));
+    CLEAR_JOMOCK();
+    EXPECT_EQ(::jomock::JoMockThunk::find(mocker), nullptr);
+    EXPECT_FALSE(registeredThunk("jomock:mixArguments"));
+    EXPECT_EQ(mixArguments(1, 2.5, "four", 8, 16.5f, 32, 64), 0);
+
+    // The next thunk reuses the code.
+    JOMOCK(mixArguments).retarget([](int, double, const char*, long, float, short, unsigned) { return 7L; });
+    EXPECT_EQ(::jomock::JoMockThunk::find(&JOMOCK(mixArguments)), thunk);
+    EXPECT_EQ(mixArguments(1, 2.5, "four", 8, 16.5f, 32, 64), 7);
+}
+#endif
+
+TEST_F(JoMock, RelocatorX86)
+{
+    // cmp byte [rip + 0xe3341], 0; je +0x17; xor eax, eax; syscall; cmp rax, -4096
+    const unsigned char code[] = { 0x80, 0x3d, 0x41, 0x33, 0x0e, 0x00, 0x00, 0x74, 0x17, 0x31, 0xc0,
+        0x0f, 0x05, 0x48, 0x3d, 0x00, 0xf0, 0xff, 0xff, 0x77, 0x5b, 0xc3, 0x90, 0x90, 0x90, 0x90, 0x90, 0x90, 0x90 };
+    const uint64_t from = 0x10000, to = 0x20000;
+    unsigned char out[128];
+    size_t covered = 0;
+    const size_t size = ::jomock::JoMockRelocator::relocateX86(code, from, 14, covered, to, reinterpret_cast<char*>(out), true);
+
+    ASSERT_EQ(size, 47u);
+    EXPECT_EQ(covered, 19u);
+    int32_t displacement = 0;
+    memcpy(&displacement, out + 2, 4);
+    EXPECT_EQ(to + 7 + displacement, from + 7 + 0xe3341); // same absolute operand
+    EXPECT_EQ(out[7], 0x75); // jne over the absolute jump
+    EXPECT_EQ(out[8], 14);
+    uint64_t target = 0;
+    memcpy(&target, out + 15, 8);
+    EXPECT_EQ(target, from + 9 + 0x17);
+    memcpy(&target, out + 39, 8);
+    EXPECT_EQ(target, from + covered); // back to the rest of the function
+}
+
+TEST_F(JoMock, RelocatorArm64)
+{
+    const uint32_t code[] = {
+        0xA9BF7BFD, // stp x29, x30, [sp, #-16]!
+        0xB0000000, // adrp x0, #0x1000
+        0x54000800, // b.eq #0x100
+        0x94000010, // bl #0x40
+    };
+    const uint32_t expected[] = {
+        0xA9BF7BFD,
+        0x58000040, 0x14000003, 0x00401000, 0,
+        0x540000A1, 0x58000050, 0xD61F0200, 0x00400108, 0,
+        0x58000070, 0xD63F0200, 0x14000003, 0x0040004C, 0,
+        0x58000050, 0xD61F0200, 0x00400010, 0,
+    };
+    uint32_t out[64];
+    size_t covered = 0;
+    const size_t size = ::jomock::JoMockRelocator::relocateArm64(code, 0x400000, 16, covered, out);
+
+    ASSERT_EQ(size, sizeof(expected));
+    EXPECT_EQ(covered, 16u);
+    EXPECT_TRUE(equal(expected, expected + sizeof(expected) / 4, out));
+}
+
+TEST_F(JoMock, JumpEncodingArm64)
+{
+    typedef ::jomock::JoMockPatch Patch;
+    char* const from = reinterpret_cast<char*>(0x10000000);
+    uint32_t words[4] = {};
+    char* const code = reinterpret_cast<char*>(words);
+
+    EXPECT_EQ(Patch::encodeBranchArm64(from, from + 0x40, code), 4u);
+    EXPECT_EQ(words[0], 0x14000010u); // b #0x40
+    EXPECT_EQ(Patch::encodeBranchArm64(from, from - 8, code), 4u);
+    EXPECT_EQ(words[0], 0x17FFFFFEu); // b #-8
+    EXPECT_EQ(Patch::encodeBranchArm64(from, from + 0x07FFFFFC, code), 4u);
+    EXPECT_EQ(words[0], 0x15FFFFFFu);
+    EXPECT_EQ(Patch::encodeBranchArm64(from, from - 0x08000000, code), 4u);
+    EXPECT_EQ(words[0], 0x16000000u);
+
+    EXPECT_EQ(Patch::encodeBranchArm64(from, from + 0x08000000, code), 0u); // out of range
+    EXPECT_EQ(Patch::encodeBranchArm64(from, from - 0x08000004, code), 0u);
+    EXPECT_EQ(Patch::encodeBranchArm64(from, from + 2, code), 0u); // misaligned
+
+    const uint64_t target = 0x0000123456789ABCull;
+    EXPECT_EQ(Patch::encodeAbsoluteJumpArm64(reinterpret_cast<void*>(target), code), 16u);
+    EXPECT_EQ(words[0], 0x58000050u); // ldr x16, #8
+    EXPECT_EQ(words[1], 0xD61F0200u); // br x16
+    uint64_t literal;
+    memcpy(&literal, code + 8, sizeof(literal));
+    EXPECT_EQ(literal, target);
+}
+
+#if !defined(ARM64_SUPPORT)
+TEST_F(JoMock, InstructionDecoder)
+{
+    struct Sample { const char* bytes; size_t length; size_t displacement; size_t relative; };
+    const Sample samples[] = {
+        { "\x55", 1, 0, 0 },                                     // push rbp
+        { "\x48\x89\xe5", 3, 0, 0 },                            // mov rbp, rsp
+        { "\xf3\x0f\x1e\xfa", 4, 0, 0 },                        // endbr64
+        { "\x80\x3d\x41\x33\x0e\x00\x00", 7, 2, 0 },            // cmp byte [rip + x], 0
+        { "\x64\x48\x8b\x04\x25\x28\x00\x00\x00", 9, 0, 0 },    // mov rax, fs:0x28
+        { "\x48\xb8\x01\x02\x03\x04\x05\x06\x07\x08", 10, 0, 0 }, // movabs rax, imm64
+        { "\xe8\x60\xb7\x00\x00", 5, 0, 1 },                    // call rel32
+        { "\x74\x17", 2, 0, 1 },                                 // je rel8
+        { "\x0f\x87\x38\x01\x00\x00", 6, 0, 2 },                // ja rel32
+        { "\x62\xa1\xfd\x00\xef\xc0", 6, 0, 0 },                // vpxorq xmm16, xmm16, xmm16
+        { "\xc5\xf8\x77", 3, 0, 0 },                             // vzeroupper
+        { "\x66\x0f\x1f\x44\x00\x00", 6, 0, 0 },                // nop word [rax + rax]
+    };
+    for (const Sample& sample : samples) {
+        const ::jomock::JoMockInstruction instruction =
+            ::jomock::JoMockDecoder::decode(reinterpret_cast<const unsigned char*>(sample.bytes), true);
+        EXPECT_EQ(instruction.length, sample.length);
+        EXPECT_EQ(instruction.displacementOffset, sample.displacement);
+        EXPECT_EQ(instruction.relativeOffset, sample.relative);
+    }
+}
+#endif
+
+#ifdef __linux__
+static string pageProtection(const void* address)
+{
+    ifstream maps("/proc/self/maps");
+    string line;
+    const size_t target = reinterpret_cast<size_t>(address);
+    while (getline(maps, line)) {
+        size_t begin = 0, end = 0;
+        char dash = 0;
+        string perms;
+        istringstream fields(line);
+        fields >> hex >> begin >> dash >> end >> perms;
+        if (begin <= target && target < end) {
+            return perms.substr(0, 3);
+        }
+    }
+    return "";
+}
+
+TEST_F(JoMock, TransactionBatchesGrafts)
+{
+    {
+        ::jomock::JoMockPatchTransaction transaction;
+        EXPECT_CALL(JOMOCK(func), JOMOCK_FUNC())
+            .Times(Exactly(1))
+            .WillOnce(Return("batched mock"));
+        EXPECT_CALL(JOMOCK(funcInt), JOMOCK_FUNC(_))
+            .Times(Exactly(1))
+            .WillOnce(Return(7));
+        EXPECT_EQ(transaction.size(), 2u);
+        EXPECT_EQ(func(), "no mock"); // not applied before commit
+        EXPECT_TRUE(transaction.commit());
+    }
+    EXPECT_EQ(func(), "batched mock");
+    EXPECT_EQ(funcInt(1), 7);
+    EXPECT_EQ(pageProtection(reinterpret_cast<void*>(&func)), "r-x");
+
+    CLEAR_JOMOCK();
+    EXPECT_EQ(func(), "no mock");
+    EXPECT_EQ(pageProtection(reinterpret_cast<void*>(&func)), "r-x");
+}
+
+TEST_F(JoMock, TransactionCoversPageSpanningPatch)
+{
+    const size_t pageSize = ::jomock::JoMockPage::pageSize();
+    char* pages = static_cast<char*>(mmap(nullptr, pageSize * 2, PROT_READ | PROT_EXEC,
+        MAP_PRIVATE | MAP_ANONYMOUS, -1, 0));
+    ASSERT_NE(pages, MAP_FAILED);
+
+    const char code[14] = { 1, 2, 3, 4, 5, 6, 7, 8, 9, 10, 11, 12, 13, 14 };
+    char* const target = pages + pageSize - 6;
+    {
+        ::jomock::JoMockPatchTransaction transaction;
+        transaction.write(target, code, sizeof(code));
+    }
+    EXPECT_TRUE(equal(code, code + sizeof(code), target));
+    EXPECT_EQ(pageProtection(pages), "r-x");
+    EXPECT_EQ(pageProtection(pages + pageSize), "r-x");
+
+    munmap(pages, pageSize * 2);
+}
+
+TEST_F(JoMock, TransactionRestoresEachPageProtection)
+{
+    const size_t pageSize = ::jomock::JoMockPage::pageSize();
+    char* pages = static_cast<char*>(mmap(nullptr, pageSize * 2, PROT_READ | PROT_WRITE | PROT_EXEC,
+        MAP_PRIVATE | MAP_ANONYMOUS, -1, 0));
+    ASSERT_NE(pages, MAP_FAILED);
+    ASSERT_EQ(mprotect(pages + pageSize, pageSize, PROT_READ), 0);
+
+    const char code[8] = { 1, 2, 3, 4, 5, 6, 7, 8 };
+    {
+        ::jomock::JoMockPatchTransaction transaction;
+        transaction.write(pages, code, sizeof(code)); // a JIT page
+        transaction.write(pages + pageSize, code, sizeof(code)); // data, next to it
+    }
+    EXPECT_TRUE(equal(code, code + sizeof(code), pages + pageSize));
+    EXPECT_EQ(pageProtection(pages), "rwx");
+    EXPECT_EQ(pageProtection(pages + pageSize), "r--");
+    pages[16] = 1; // still writable
+
+    munmap(pages, pageSize * 2);
+}
+
+static int snapshotTarget(int x)
+{
+    int sum = 0;
+    for (int i = 0; i < x; ++i) {
+        sum += i * x;
+    }
+    return sum;
+}
+
+// Changes a byte of the mocked body, which never runs while the mock is installed.
+static void scribble(char value)
+{
+    ::jomock::JoMockPatchTransaction transaction;
+    transaction.write(reinterpret_cast<char*>(&snapshotTarget) + 12, &value, 1);
+}
+
+TEST_F(JoMock, RestoreCopiesSnapshotPage)
+{
+    char* const body = reinterpret_cast<char*>(&snapshotTarget) + 12;
+    const char original = *body;
+
+    EXPECT_CALL(JOMOCK(snapshotTarget), JOMOCK_FUNC(_))
+        .WillRepeatedly(Return(-1));
+    EXPECT_EQ(snapshotTarget(3), -1);
+    scribble(static_cast<char>(original ^ 0x5A));
+
+    CLEAR_JOMOCK();
+    EXPECT_EQ(*body, original); // the whole page came back
+    EXPECT_EQ(snapshotTarget(3), 9);
+    EXPECT_EQ(pageProtection(body), "r-x");
+}
+
+TEST_F(JoMock, RestoreVerificationKeepsForeignChange)
+{
+    char* const body = reinterpret_cast<char*>(&snapshotTarget) + 12;
+    const char original = *body;
+    const size_t conflicts = ::jomock::JoMockSnapshot::conflicts();
+    JOMOCK_VERIFY_RESTORE(true);
+
+    EXPECT_CALL(JOMOCK(snapshotTarget), JOMOCK_FUNC(_))
+        .WillRepeatedly(Return(-1));
+    EXPECT_EQ(snapshotTarget(3), -1);
+    scribble(static_cast<char>(original ^ 0x5A));
+
+    CLEAR_JOMOCK();
+    EXPECT_EQ(::jomock::JoMockSnapshot::conflicts(), conflicts + 1);
+    EXPECT_EQ(*body, static_cast<char>(original ^ 0x5A)); // reported, not overwritten
+    scribble(original);
+    EXPECT_EQ(snapshotTarget(3), 9); // the entry was restored anyway
+
+    EXPECT_CALL(JOMOCK(snapshotTarget), JOMOCK_FUNC(_))
+        .WillRepeatedly(Return(-1));
+    EXPECT_EQ(snapshotTarget(3), -1);
+    CLEAR_JOMOCK();
+    EXPECT_EQ(::jomock::JoMockSnapshot::conflicts(), conflicts + 1); // clean page
+    EXPECT_EQ(snapshotTarget(3), 9);
+    JOMOCK_VERIFY_RESTORE(false);
+}
+
+#ifdef __x86_64__
+typedef int (*RawFunction)(int);
+
+static RawFunction rawFunction(const unsigned char* code, size_t size, size_t offset = 0)
+{
+    char* const page = static_cast<char*>(mmap(nullptr, ::jomock::JoMockPage::pageSize(), PROT_READ | PROT_WRITE | PROT_EXEC,
+        MAP_PRIVATE | MAP_ANONYMOUS, -1, 0));
+    memcpy(page + offset, code, size);
+    mprotect(page, ::jomock::JoMockPage::pageSize(), PROT_READ | PROT_EXEC);
+    return reinterpret_cast<RawFunction>(page + offset);
+}
+
+TEST_F(JoMock, PatchTrapsBranchIntoEntry)
+{
+    // xor eax,eax; loop: add eax,2; dec edi; jnz loop; ret -- the loop starts inside the 5 byte jump.
+    const unsigned char code[] = { 0x31, 0xC0, 0x83, 0xC0, 0x02, 0xFF, 0xCF, 0x75, 0xF9, 0xC3 };
+    RawFunction loop = rawFunction(code, sizeof(code));
+    EXPECT_EQ(::jomock::JoMockPatchCheck::inspect(reinterpret_cast<void*>(loop), 5), ::jomock::JoMockPatchCheck::kBranchInside);
+
+    auto mocker = &JOMOCK(loop);
+    EXPECT_CALL(*mocker, JOMOCK_FUNC(_))
+        .Times(Exactly(2))
+        .WillOnce(Return(-1))
+        .WillOnce(JOMOCK_CALL_ORIGINAL(mocker));
+    EXPECT_EQ(reinterpret_cast<unsigned char*>(loop)[0], 0xCC);
+    EXPECT_EQ(loop(3), -1);
+    EXPECT_EQ(loop(3), 6);
+
+    CLEAR_JOMOCK();
+    EXPECT_TRUE(equal(code, code + sizeof(code), reinterpret_cast<unsigned char*>(loop)));
+    EXPECT_EQ(loop(3), 6);
+    munmap(reinterpret_cast<void*>(loop), ::jomock::JoMockPage::pageSize());
+}
+
+TEST_F(JoMock, PatchTrapsShortFunction)
+{
+    // xor eax,eax; ret -- followed by mov eax,1; ret, which the jump would overwrite.
+    const unsigned char code[] = { 0x31, 0xC0, 0xC3, 0xB8, 0x01, 0x00, 0x00, 0x00, 0xC3 };
+    RawFunction shortFunction = rawFunction(code, sizeof(code));
+    RawFunction next = reinterpret_cast<RawFunction>(reinterpret_cast<char*>(shortFunction) + 3);
+    EXPECT_EQ(::jomock::JoMockPatchCheck::inspect(reinterpret_cast<void*>(shortFunction), 5), ::jomock::JoMockPatchCheck::kTooShort);
+
+    EXPECT_CALL(JOMOCK(shortFunction), JOMOCK_FUNC(_))
+        .Times(Exactly(1))
+        .WillOnce(Return(-1));
+    EXPECT_EQ(shortFunction(0), -1);
+    EXPECT_EQ(next(0), 1);
+
+    CLEAR_JOMOCK();
+    EXPECT_EQ(shortFunction(0), 0);
+    munmap(reinterpret_cast<void*>(shortFunction), ::jomock::JoMockPage::pageSize());
+}
+
+static volatile sig_atomic_t otherTraps = 0;
+
+static void countOtherTrap(int)
+{
+    otherTraps = otherTraps + 1; // installed by main(), before jomock chains to it
+}
+
+TEST_F(JoMock, PatchTrapChainsOtherTraps)
+{
+    const unsigned char code[] = { 0x31, 0xC0, 0xC3, 0xB8, 0x01, 0x00, 0x00, 0x00, 0xC3 };
+    RawFunction shortFunction = rawFunction(code, sizeof(code));
+    EXPECT_CALL(JOMOCK(shortFunction), JOMOCK_FUNC(_))
+        .Times(Exactly(1))
+        .WillOnce(Return(-1));
+    EXPECT_EQ(shortFunction(0), -1); // through the trap
+    const int before = otherTraps;
+    raise(SIGTRAP);
+    EXPECT_EQ(otherTraps, before + 1);
+
+    CLEAR_JOMOCK();
+    munmap(reinterpret_cast<void*>(shortFunction), ::jomock::JoMockPage::pageSize());
+}
+
+TEST_F(JoMock, PatchPolicyFail)
+{
+    const unsigned char code[] = { 0x31, 0xC0, 0xC3, 0xB8, 0x01, 0x00, 0x00, 0x00, 0xC3 };
+    RawFunction shortFunction = rawFunction(code, sizeof(code));
+    EXPECT_DEATH({
+        JOMOCK_PATCH_POLICY(::jomock::JoMockPatchCheck::kFail);
+        EXPECT_CALL(JOMOCK(shortFunction), JOMOCK_FUNC(_)).WillRepeatedly(Return(-1));
+    }, "cannot patch");
+    munmap(reinterpret_cast<void*>(shortFunction), ::jomock::JoMockPage::pageSize());
+}
+
+static int livePatchReplacement(int)
+{
+    return -1;
+}
+
+// Grafts and restores 'function' in a loop while threads call it, and returns the calls that saw neither
+// the original nor the replacement.
+static int patchUnderLoad(RawFunction function, int iterations)
+{
+    std::atomic<bool> done(false);
+    std::atomic<int> wrong(0);
+    std::vector<std::thread> callers;
+    for (int t = 0; t < 3; ++t) {
+        callers.emplace_back([&]() {
+            RawFunction volatile call = function;
+            for (int i = 0; !done.load(); ++i) {
+                const int got = call(i);
+                if (got != i + 1 && got != -1) ++wrong;
+            }
+        });
+    }
+    for (int i = 0; i < iterations; ++i) {
+        ::jomock::JoMockBackup backup;
+        ::jomock::JoMockPatch::graftFunction(function, &livePatchReplacement, backup);
+        std::this_thread::yield();
+        ::jomock::JoMockPatch::_restore(function, backup);
+        std::this_thread::yield();
+    }
+    done = true;
+    for (std::thread& caller : callers) {
+        caller.join();
+    }
+    return wrong.load();
+}
+
+TEST_F(JoMock, LivePatchUnderLoad)
+{
+    // lea eax,[rdi+1] with a 32 bit displacement; ret -- nothing starts inside the jump.
+    const unsigned char code[] = { 0x8D, 0x87, 0x01, 0x00, 0x00, 0x00, 0xC3 };
+    RawFunction aligned = rawFunction(code, sizeof(code)); // the jump is one 8 byte store
+    RawFunction straddling = rawFunction(code, sizeof(code), 6); // the jump crosses a word, written behind a trap
+    EXPECT_EQ(patchUnderLoad(aligned, 100), 0);
+    EXPECT_EQ(patchUnderLoad(straddling, 100), 0);
+    EXPECT_EQ(straddling(1), 2);
+    EXPECT_TRUE(equal(code, code + sizeof(code), reinterpret_cast<unsigned char*>(straddling)));
+    munmap(reinterpret_cast<void*>(aligned), ::jomock::JoMockPage::pageSize());
+    munmap(reinterpret_cast<char*>(straddling) - 6, ::jomock::JoMockPage::pageSize());
+}
+
+TEST_F(JoMock, LivePatchQuiesced)
+{
+    // mov eax,edi; add eax,1; ret -- a caller may stand on the add, inside the jump.
+    const unsigned char code[] = { 0x89, 0xF8, 0x83, 0xC0, 0x01, 0xC3 };
+    RawFunction function = rawFunction(code, sizeof(code), 6);
+    JOMOCK_QUIESCE_THREADS(true);
+    EXPECT_EQ(patchUnderLoad(function, 100), 0);
+    JOMOCK_QUIESCE_THREADS(false);
+    EXPECT_EQ(function(1), 2);
+    munmap(reinterpret_cast<char*>(function) - 6, ::jomock::JoMockPage::pageSize());
+}
+#endif
+#endif
+
 int main(int argc, char* argv[])
 {
     std::cout << ">>>>>>>>>>>>>>>>>>>>>>>>>>>>>>>>>>" << endl;
 
+#if defined(__linux__) && defined(__x86_64__)
+    struct sigaction trap;
+    memset(&trap, 0, sizeof(trap));
+    trap.sa_handler = &countOtherTrap;
+    sigaction(SIGTRAP, &trap, nullptr);
+#endif
     testing::InitGoogleTest(&argc, argv);
-    RUN_ALL_TESTS();
+    int result = RUN_ALL_TESTS();
     std::cout << "<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<" << endl;
 
-    return 0;
+    return result;
 }
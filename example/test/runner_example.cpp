@@ -0,0 +1,52 @@
+#include <gtest/gtest.h>
+#include <gmock/gmock.h>
+
+#include "../../jomock/jomock_runner.h"
+
+#include <iostream>
+using namespace ::std;
+using namespace ::testing;
+
+// No CLEAR_JOMOCK() here : each test runs in its own child process and its patches go away with it.
+
+int answer()
+{
+    return 42;
+}
+
+TEST(RunnerExample, LeavesMockBehind)
+{
+    EXPECT_CALL(JOMOCK(answer), JOMOCK_FUNC())
+        .WillRepeatedly(Return(0));
+    EXPECT_EQ(answer(), 0);
+}
+
+TEST(RunnerExample, SeesOriginalCode)
+{
+    EXPECT_EQ(answer(), 42);
+}
+
+TEST(RunnerExample, LeavesAnotherMockBehind)
+{
+    EXPECT_CALL(JOMOCK(answer), JOMOCK_FUNC())
+        .Times(Exactly(1))
+        .WillOnce(Return(1));
+    EXPECT_EQ(answer(), 1);
+}
+
+TEST(RunnerExample, FilterMatching)
+{
+    typedef ::jomock::JoMockRunner Runner;
+    EXPECT_TRUE(Runner::matchesFilter("Suite.Test", "*"));
+    EXPECT_TRUE(Runner::matchesFilter("Suite.Test", ""));
+    EXPECT_TRUE(Runner::matchesFilter("Suite.Test", "Other.*:Suite.T?st"));
+    EXPECT_FALSE(Runner::matchesFilter("Suite.Test", "Other.*"));
+    EXPECT_FALSE(Runner::matchesFilter("Suite.Test", "*-Suite.*"));
+    EXPECT_TRUE(Runner::matchesFilter("Suite.Test", "-Other.*"));
+}
+
+int main(int argc, char* argv[])
+{
+    testing::InitGoogleTest(&argc, argv);
+    return JOMOCK_RUN_ALL_TESTS(argc, argv);
+}
@@ -0,0 +1,82 @@
+#include <gtest/gtest.h>
+#include <gmock/gmock.h>
+
+#include "../../jomock/jomock.h"
+
+#include <atomic>
+#include <chrono>
+#include <cstdio>
+#include <thread>
+#include <vector>
+using namespace ::std;
+using namespace ::testing;
+
+// Runs independent mocked cases on every core of one process. With thread-local dispatch each
+// worker thread sees only the mocks it created, so the cases can not leak into each other.
+
+int readSensor(int channel)
+{
+    return channel;
+}
+
+const int kCases = 64;
+const int kIterations = 200;
+
+static int runCase(int seed)
+{
+    EXPECT_CALL(JOMOCK(readSensor), JOMOCK_FUNC(_))
+        .WillRepeatedly(Return(seed));
+
+    int mismatches = 0;
+    unsigned long checksum = 0;
+    for (int i = 0; i < kIterations; ++i) {
+        if (readSensor(i) != seed) {
+            ++mismatches;
+        }
+        for (int j = 0; j < 20000; ++j) {
+            checksum = checksum * 31 + j;
+        }
+    }
+    CLEAR_JOMOCK();
+    return checksum == 0 ? mismatches + 1 : mismatches;
+}
+
+static double runSharded(unsigned threads, atomic<int>& mismatches)
+{
+    atomic<int> next(0);
+    chrono::steady_clock::time_point start = chrono::steady_clock::now();
+    vector<thread> workers;
+    for (unsigned t = 0; t < threads; ++t) {
+        workers.push_back(thread([&next, &mismatches]() {
+            for (int seed = next++; seed < kCases; seed = next++) {
+                mismatches += runCase(seed);
+            }
+        }));
+    }
+    for (thread& worker : workers) {
+        worker.join();
+    }
+    return chrono::duration<double, milli>(chrono::steady_clock::now() - start).count();
+}
+
+TEST(ShardedExample, RunsCasesOnAllCores)
+{
+    JOMOCK_THREAD_LOCAL_DISPATCH(true);
+
+    const unsigned cores = thread::hardware_concurrency() == 0 ? 1 : thread::hardware_concurrency();
+    atomic<int> mismatches(0);
+    const double serial = runSharded(1, mismatches);
+    const double sharded = runSharded(cores, mismatches);
+    printf("%d cases, serial %.1f ms, %u threads %.1f ms, speedup %.2fx\n",
+        kCases, serial, cores, sharded, serial / sharded);
+
+    EXPECT_EQ(mismatches, 0);
+    EXPECT_EQ(readSensor(3), 3);
+    JOMOCK_THREAD_LOCAL_DISPATCH(false);
+}
+
+int main(int argc, char* argv[])
+{
+    testing::InitGoogleTest(&argc, argv);
+    return RUN_ALL_TESTS();
+}
@@ -0,0 +1,42 @@
+#include <string>
+
+// Functions JOMOCK() cannot name from example.cpp : JOMOCK_SYMBOL finds them by name.
+
+static int hiddenAdd(int a, int b)
+{
+    return a + b;
+}
+
+namespace {
+    std::string hiddenName(int id)
+    {
+        return "name" + std::to_string(id);
+    }
+}
+
+namespace symbol {
+    class Counter {
+    public:
+        int next(int step) const
+        {
+            return base + step;
+        }
+        int base = 10;
+    };
+}
+
+int callHiddenAdd(int a, int b)
+{
+    return hiddenAdd(a, b);
+}
+
+std::string callHiddenName(int id)
+{
+    return hiddenName(id);
+}
+
+int callCounterNext(int step)
+{
+    symbol::Counter counter;
+    return counter.next(step);
+}
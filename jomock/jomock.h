@@ -9,8 +9,33 @@
 #pragma once
 
 #include <unordered_map>
+#include <map>
+#include <string>
+#include <type_traits>
 #include <vector>
 #include <functional>
+#include <algorithm>
+#include <mutex>
+#include <cstdint>
+#include <cstdlib>
+#include <cstring>
+#include <cstdio>
+#include <memory>
+#include <atomic>
+#include <new>
+#include <utility>
+#include <chrono>
+#include <thread>
+#include <cmath>
+#include <cerrno>
+#include <limits>
+#include <typeinfo>
+
+#if defined(_MSC_VER)
+#include <intrin.h>
+#elif defined(__x86_64__) || defined(__i386__)
+#include <x86intrin.h>
+#endif
 
 #ifndef NON_WIN32_SUPPORT
 #include <Windows.h>
@@ -21,17 +46,63 @@
 #include <unistd.h>
 #include <sys/mman.h>
 #include <memory>
+#ifdef __linux__
+#include <link.h>
+#include <dlfcn.h>
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <cxxabi.h>
+#include <signal.h>
+#include <ucontext.h>
+#include <sched.h>
+#include <sys/syscall.h>
+#include <elf.h>
+#define JOMOCK_IMPORT_SUPPORT
+#define JOMOCK_SYMBOL_SUPPORT
+#define JOMOCK_TRAP_SUPPORT
+#define JOMOCK_QUIESCE_SUPPORT
+#define JOMOCK_VTABLE_SUPPORT
+#if defined(__x86_64__) || defined(__aarch64__)
+#define JOMOCK_THUNK_SUPPORT
+#endif
+#endif
 #endif
 
 
 using namespace std;
 
-#define JOMOCK(function) *::jomock::MockerCreator::getJoMock<::jomock::TypeForUniqMocker<__COUNTER__>>(function, #function)
+// Mock entry points are reached by a jump from the mocked function's entry. A caller that sees the body of a
+// static function may call it with the stack 8-byte aligned only, so x86 entry points realign it for gmock.
+#if (defined(__GNUC__) || defined(__clang__)) && (defined(__x86_64__) || defined(__i386__))
+#define JOMOCK_ENTRY __attribute__((force_align_arg_pointer))
+#else
+#define JOMOCK_ENTRY
+#endif
+
+#define JOMOCK(function) ::jomock::JoMockReference(::jomock::MockerCreator::getJoMock<::jomock::TypeForUniqMocker<__COUNTER__>>(function, #function))
 #define JOMOCK_POLY(mocker, className, functionPoint, functionName, ret, args) ret(className::*functionPoint)args = &className::functionName;\
                                             auto mocker = &JOMOCK(functionPoint);
 #define JOMOCK_POLY_S(mocker, functionPoint, functionName, ret, args) ret(*functionPoint)args = &functionName;\
                                             auto mocker = &JOMOCK(functionPoint);
 #define CLEAR_JOMOCK ::jomock::MockerCreator::restoreAll
+#define JOMOCK_THREAD_LOCAL_DISPATCH ::jomock::MockerCreator::setThreadLocalDispatch
+#define JOMOCK_VERIFY_RESTORE ::jomock::MockerCreator::setRestoreVerification
+#define JOMOCK_PATCH_POLICY ::jomock::MockerCreator::setPatchPolicy
+#define JOMOCK_REPORT_INLINING ::jomock::MockerCreator::setInliningReport
+#define JOMOCK_QUIESCE_THREADS ::jomock::MockerCreator::setQuiescence
+#define JOMOCK_TRACE ::jomock::MockerCreator::setTrace
+#define JOMOCK_PERF_MAP ::jomock::MockerCreator::setPerfMap
+#define JOMOCK_CALL_ORIGINAL(mocker) (mocker)->originalAction()
+#define JOMOCK_FAST(function) (JOMOCK(function)).fast()
+#define JOMOCK_INJECT(function) (JOMOCK(function)).inject()
+#define JOMOCK_VIRTUAL(object, function) ::jomock::JoMockReference(::jomock::MockerCreator::getJoMockVirtual<::jomock::TypeForUniqMocker<__COUNTER__>>(object, function, #function))
+#define JOMOCK_DETACH(object) ::jomock::JoMockShadow::detach(object, sizeof(*(object)))
+#define JOMOCK_INSTANCE(object, function) ::jomock::JoMockReference(::jomock::MockerCreator::getJoMockInstance<::jomock::TypeForUniqMocker<__COUNTER__>>(object, function, #function))
+#define JOMOCK_IMPORT(function) ::jomock::JoMockReference(::jomock::MockerCreator::getJoMockImport<::jomock::TypeForUniqMocker<__COUNTER__>>(function, #function, nullptr))
+#define JOMOCK_SYMBOL ::jomock::JoMockSymbolSite<__COUNTER__>::get
+#define JOMOCK_CLASS(className) ::jomock::JoMockReference(::jomock::MockerCreator::getJoMockClass<className>(#className))
+#define JOMOCK_IMPORT_FROM(module, function) ::jomock::JoMockReference(::jomock::MockerCreator::getJoMockImport<::jomock::TypeForUniqMocker<__COUNTER__>>(function, #function, module))
+#define JOMOCK_STUB(function, ...) ::jomock::JoMockReference(::jomock::MockerCreator::getJoMockStub<::jomock::TypeForUniqMocker<__COUNTER__>>(function, __VA_ARGS__, #function))
 #define JOMOCK_FUNC stubFunc
 #define JOMOCK_FUNC_1(function) stubFunc(function, ::testing::_)
 #define JOMOCK_FUNC_2(function) stubFunc(function, ::testing::_, ::testing::_)
@@ -66,9 +137,33 @@ namespace jomock {
     template < typename T >
     struct JoMock : public JoMockBase<T> { };
 
+    template < typename T >
+    struct JoMockMethod { };
+
+    template < typename T >
+    struct JoMockVirtual { };
+
     template < typename T >
     struct MockerEntryPoint { };
 
+    template < typename T >
+    struct JoMockImport { };
+
+    template < typename T >
+    struct JoMockFast { };
+
+    template < typename T >
+    struct JoMockInject { };
+
+    template < typename T >
+    struct JoMockTarget { };
+
+    // The mock a macro gives, as a reference : a bare '*' would be an unused value in a statement.
+    template < typename T >
+    T& JoMockReference(T* const mock) {
+        return *mock;
+    }
+
     template < typename T >
     struct SingletonBase {
         static T& getInstance() {
@@ -77,333 +172,5507 @@ namespace jomock {
         }
     };
 
-    struct JoMockPatch {
-        template < typename F1, typename F2 >
-        static void graftFunction(F1 address, F2 destination, std::vector<char>& binary_backup) {
-            void* function = reinterpret_cast<void*>((std::size_t&)address);
-            if (!unprotectMemoryForOnePage(function)) {
-                std::abort();
-            }
-            else {
-                setJump(function, reinterpret_cast<void*>((std::size_t&)destination), binary_backup);
+    struct JoMockPage {
+        static std::size_t pageSize() {
+            static std::size_t pageSize = 0;
+            if (pageSize == 0)
+            {
+#ifndef NON_WIN32_SUPPORT
+                SYSTEM_INFO info;
+                ::GetSystemInfo(&info);
+                pageSize = info.dwPageSize;
+#else
+                pageSize = getpagesize();
+#endif
             }
-        }
-
-        template < typename F >
-        static void _restore(F address, const std::vector<char>& binary_backup) {
-            revertJump(reinterpret_cast<void*>((std::size_t&)address), binary_backup);
+            return pageSize;
         }
 
         static std::size_t alignAddress(const std::size_t address, const std::size_t page_size) {
             return address & (~(page_size - 1));
         }
 
-        static void backupBinary(const char* const function, std::vector<char>& binary_backup, const std::size_t size) {
-            binary_backup = std::vector<char>(function, function + size);
-        }
-
-        static bool isDistanceOverflow(const std::size_t distance) {
-            if(distance > INT32_MAX) return true;
-            if(distance < ((long long)INT32_MIN)) return true;
-            return false;
-        }
-
-        static std::size_t calculateDistance(const void* const address, const void* const destination) {
-        	#ifndef ARM64_SUPPORT
-            std::size_t distance = reinterpret_cast<std::size_t>(destination)
-                - reinterpret_cast<std::size_t>(address) - 5; // For jmp instruction;
-            return distance;
-            #else
-            std::size_t distance = reinterpret_cast<std::size_t>(destination)- reinterpret_cast<std::size_t>(address);
-            return ((distance>>2) & 0x03FFFFFF);
-            #endif
-
-        }
-
-        static void patchFunctionShortDistance(char* const function, const std::size_t distance) {
-            const char* const distance_bytes = reinterpret_cast<const char*>(&distance);
-            function[0] = (char)0xE9; // jmp
-            std::copy(distance_bytes, distance_bytes + 4, function + 1);
-        }
-
-        static void patchFunctionLongAddress(char* const function, const void* const destination) {
-            const char* const distance_bytes = reinterpret_cast<const char*>(&destination);
-            function[0] = 0x68; // push
-            std::copy(distance_bytes, distance_bytes + 4, function + 1);
-            function[5] = (char)0xC7;
-            function[6] = (char)0x44;
-            function[7] = (char)0x24;
-            function[8] = (char)0x04;
-            std::copy(distance_bytes + 4, distance_bytes + 8, function + 9);
-            function[13] = (char)0xC3; // ret
-        }
-		#ifdef ARM64_SUPPORT
-        // Function to flush the instruction cache
-        static void flushInstructionCache(void* start, void* end) {
-            __builtin___clear_cache(start, end);
-        }
-        static std::size_t calculateDistanceArm64(const void* const address, const void* const destination) {
-            std::size_t distance = reinterpret_cast<std::size_t>(destination)
-                - reinterpret_cast<std::size_t>(address);
-            return ((distance>>2) & 0x03FFFFFF);
-        }
-        static void patchFunctionArm64(uint * function, const std::size_t distance) {
-            const uint32_t kBInstruction = 0x14000000;
-            uint32_t instruction =  kBInstruction | distance;
-            function[0] = instruction;
-            flushInstructionCache((void*)function, (void*)(function + sizeof(uint32_t)));
+        // Makes [page, page + length) writable. 'oldProtect' receives what restoreProtection() needs : on POSIX
+        // the protection of 'page' in the last loadProtections(), the range is one protection.
+        static bool unprotect(void* const page, const std::size_t length, unsigned long& oldProtect) {
+#ifndef NON_WIN32_SUPPORT
+            DWORD protect;
+            if (!VirtualProtect(page, length, PAGE_EXECUTE_READWRITE, &protect)) return false;
+            oldProtect = protect;
+            return true;
+#else
+            const int protect = protection(reinterpret_cast<std::size_t>(page));
+            oldProtect = static_cast<unsigned long>(protect < 0 ? PROT_READ | PROT_EXEC : protect);
+            return mprotect(page, length, PROT_READ | PROT_WRITE | PROT_EXEC) == 0;
+#endif
         }
-        #endif
 
-        static void setJump(void* const address, const void* const destination, std::vector<char>& binary_backup) {
-            char* const function = reinterpret_cast<char*>(address);
-            #ifdef ARM64_SUPPORT
-            std::size_t distance = calculateDistanceArm64(address, destination);
-            backupBinary(function, binary_backup, 4); // 4 bytes : 1 instruction 3 data
-            patchFunctionArm64((uint*)address, distance);
-            #else
-            std::size_t distance = calculateDistance(address, destination);
-            if (isDistanceOverflow(distance)) {
-                backupBinary(function, binary_backup, 14); // long jmp.
-                patchFunctionLongAddress(function, destination);
+#ifdef NON_WIN32_SUPPORT
+        // Reads the protection of every mapping from /proc/self/maps, with raw system calls as the file functions
+        // may be mocked. Once per transaction, under its lock.
+        static void loadProtections() {
+            std::vector<Range>& ranges = protections();
+            ranges.clear();
+            const long file = syscall(SYS_openat, AT_FDCWD, "/proc/self/maps", O_RDONLY | O_CLOEXEC);
+            if (file < 0) return;
+            static thread_local std::string text;
+            text.clear();
+            char chunk[4096];
+            long read = 0;
+            while ((read = syscall(SYS_read, file, chunk, sizeof(chunk))) > 0) {
+                text.append(chunk, static_cast<std::size_t>(read));
             }
-            else {
-                backupBinary(function, binary_backup, 5); // short jmp.
-                patchFunctionShortDistance(function, distance);
+            syscall(SYS_close, file);
+            // "begin-end rwxp ..." per line, in address order.
+            for (const char* line = text.c_str(); *line != '\0';) {
+                char* end = nullptr;
+                Range range;
+                range.begin = static_cast<std::size_t>(std::strtoull(line, &end, 16));
+                range.end = static_cast<std::size_t>(std::strtoull(end + 1, &end, 16));
+                range.protect = (end[1] == 'r' ? PROT_READ : 0) | (end[2] == 'w' ? PROT_WRITE : 0) | (end[3] == 'x' ? PROT_EXEC : 0);
+                ranges.push_back(range);
+                const char* const next = std::strchr(end, '\n');
+                if (next == nullptr) break;
+                line = next + 1;
             }
-            #endif
         }
 
-        static void revertJump(void* address, const std::vector<char>& binary_backup) {
-            std::copy(binary_backup.begin(), binary_backup.end(), reinterpret_cast<char*>(address));
+        // Protection of 'page' in the last loadProtections(), -1 when it was not mapped.
+        static int protection(const std::size_t page) {
+            const std::vector<Range>& ranges = protections();
+            auto found = std::upper_bound(ranges.begin(), ranges.end(), page,
+                [](const std::size_t value, const Range& range) { return value < range.end; });
+            return found != ranges.end() && found->begin <= page ? found->protect : -1;
         }
+#endif
 
-        static int unprotectMemory(const void* const address, const size_t length) {
-            void* const page = reinterpret_cast<void*>(alignAddress(reinterpret_cast<std::size_t>(address), length));
+        static bool restoreProtection(void* const page, const std::size_t length, const unsigned long oldProtect) {
 #ifndef NON_WIN32_SUPPORT
-            DWORD oldProtect;
-            return VirtualProtect(page, length, PAGE_EXECUTE_READWRITE, &oldProtect);
+            DWORD protect;
+            return VirtualProtect(page, length, static_cast<DWORD>(oldProtect), &protect) != 0;
 #else
-            int ret = mprotect(page, length, PROT_READ | PROT_WRITE | PROT_EXEC);
-            if (ret != 0) return 0;
-            else return 1;
+            return mprotect(page, length, static_cast<int>(oldProtect)) == 0;
 #endif
         }
 
-        static int unprotectMemoryForOnePage(void* const address) {
-            static std::size_t pageSize = 0;
-            if (pageSize == 0)
-            {
+#ifdef NON_WIN32_SUPPORT
+    private:
+        struct Range {
+            std::size_t begin;
+            std::size_t end;
+            int protect;
+        };
+
+        static std::vector<Range>& protections() {
+            static std::vector<Range> value;
+            return value;
+        }
+
+    public:
+#endif
+        static void flushInstructionCache(void* const start, const std::size_t length) {
 #ifndef NON_WIN32_SUPPORT
-                SYSTEM_INFO info;
-                ::GetSystemInfo(&info);
-                pageSize = info.dwPageSize;
+            ::FlushInstructionCache(::GetCurrentProcess(), start, length);
+#elif defined(ARM64_SUPPORT)
+            __builtin___clear_cache(reinterpret_cast<char*>(start), reinterpret_cast<char*>(start) + length);
 #else
-                pageSize = getpagesize();
+            (void)start; (void)length; // x86 keeps the instruction cache coherent with stores.
 #endif
-            }
-            return unprotectMemory(address, pageSize);
         }
     };
 
-    template < typename I, typename R, typename ... P >
-    struct MockerEntryPoint<I(R(P ...))> {
-        typedef I IntegrateType(R(P ...));
-        friend struct JoMock<IntegrateType>;
-        static R EntryPoint(P... p) {
-            return SingletonBase<JoMock<IntegrateType>*>::getInstance()->stubFunc(p ...);
-        }
+    struct JoMockPatchWrite {
+        char* address;
+        std::size_t size;
+        char code[16];
     };
 
-    template < typename I, typename C, typename R, typename ... P >
-    struct MockerEntryPoint<I(R(C::*)(P ...) const)> {
-        typedef I IntegrateType(R(C::*)(const void*, P ...) const);
-        friend struct JoMock<IntegrateType>; \
-            R EntryPoint(P... p) {
-            return SingletonBase<JoMock<IntegrateType>*>::getInstance()->stubFunc(this, p ...);
+#ifdef JOMOCK_TRAP_SUPPORT
+    // Trapping instruction (int3, or brk on ARM64) at a function entry, and the SIGTRAP handler behind it.
+    // A trap added with a destination stands for an entry that cannot take a jump : the trapped thread goes
+    // to the mock. A trap in a write slot marks a code write in progress (see JoMockLiveWrite) : the trapped
+    // thread waits for the write, then runs the new code. Other traps go to the previous handler.
+    struct JoMockTrap {
+        static const std::size_t kCapacity = 256;
+        static const std::size_t kWrites = 64;
+
+        static std::size_t encode(char* const code) {
+#ifdef ARM64_SUPPORT
+            const std::uint32_t instruction = 0xD4200000; // brk #0
+            std::memcpy(code, &instruction, sizeof(instruction));
+            return 4;
+#else
+            code[0] = static_cast<char>(0xCC); // int3
+            return 1;
+#endif
         }
-    };
 
-    template < typename I, typename C, typename R, typename ... P >
-    struct MockerEntryPoint<I(R(C::*)(P ...))> {
-        typedef I IntegrateType(R(C::*)(const void*, P ...));
-        friend struct JoMock<IntegrateType>; \
-            R EntryPoint(P... p) {
-            return SingletonBase<JoMock<IntegrateType>*>::getInstance()->stubFunc(this, p ...);
+        static bool add(const void* const address, const void* const destination) {
+            std::lock_guard<std::mutex> lock(mutex());
+            install();
+            for (std::size_t i = 0; i < kCapacity; ++i) {
+                Entry& entry = entries()[i];
+                if (entry.address.load() != nullptr) continue;
+                entry.destination.store(destination);
+                entry.address.store(address);
+                return true;
+            }
+            return false;
         }
-    };
 
-    template < typename R, typename ... P >
-    struct JoMockBase<R(P ...)> {
-        JoMockBase(const string& _functionName) : functionName(_functionName) {}
-        virtual ~JoMockBase() {}
+        static bool remove(const void* const address) {
+            std::lock_guard<std::mutex> lock(mutex());
+            for (std::size_t i = 0; i < kCapacity; ++i) {
+                Entry& entry = entries()[i];
+                if (entry.address.load() == address) {
+                    remember(address);
+                    entry.address.store(nullptr);
+                    return true;
+                }
+            }
+            return false;
+        }
 
-        R stubFunc(P... p) {
-            gmocker.SetOwnerAndName(this, functionName.c_str());
-            return gmocker.Invoke(p ...);
+        static bool contains(const void* const address) {
+            for (std::size_t i = 0; i < kCapacity; ++i) {
+                if (entries()[i].address.load() == address) return true;
+            }
+            return false;
         }
 
-        ::testing::MockSpec<R(P...)> gmock_stubFunc(const ::testing::Matcher<P>&... p) {
-            gmocker.RegisterOwner(this);
-            return gmocker.With(p ...);
+        // Write slots are used by one writer at a time, under the lock of JoMockPatchTransaction::apply().
+        static void beginWrite(const std::size_t slot, const void* const address) {
+            static const bool installed = (std::lock_guard<std::mutex>(mutex()), install(), true);
+            (void)installed;
+            remember(address);
+            writes()[slot].store(address);
         }
 
-        virtual void restore() = 0;
+        static void endWrite(const std::size_t slot) {
+            writes()[slot].store(nullptr);
+        }
 
-        mutable ::testing::FunctionMocker<R(P...)> gmocker;
-        vector<char> binaryBackup; // Backup the mockee's binary code changed in RuntimePatcher.
-        const string functionName;
-    };
+    private:
+        struct Entry {
+            std::atomic<const void*> address;
+            std::atomic<const void*> destination;
+        };
 
-    template < typename I, typename R, typename ... P>
-    struct JoMock<I(R(P ...))> : JoMockBase<R(P ...)> {
-        typedef I IntegrateType(R(P ...));
-        typedef R FunctionType(P ...);
-        JoMock(FunctionType function, const string& functionName) :
-            JoMockBase<FunctionType>(functionName),
-            originFunction(function) {
-            SingletonBase<decltype(this)>::getInstance() = this;
-            JoMockPatch::graftFunction(originFunction,
-                MockerEntryPoint<IntegrateType>::EntryPoint,
-                JoMockBase<FunctionType>::binaryBackup);
+        static std::mutex& mutex() {
+            static std::mutex value;
+            return value;
         }
 
-        virtual ~JoMock() {
-            restore();
+        static Entry* entries() {
+            static Entry value[kCapacity];
+            return value;
         }
 
-        void restore() {
-            JoMockPatch::_restore(originFunction, JoMockBase<FunctionType>::binaryBackup);
-            SingletonBase<decltype(this)>::getInstance() = nullptr;
+        static std::atomic<const void*>* writes() {
+            static std::atomic<const void*> value[kWrites];
+            return value;
         }
 
-        FunctionType* originFunction;
-    };
+        // Addresses written or trapped lately : a thread may reach their trap after it is gone.
+        static std::atomic<const void*>* history() {
+            static std::atomic<const void*> value[kCapacity];
+            return value;
+        }
 
-    template < typename I, typename C, typename R, typename ... P>
-    struct JoMock<I(R(C::*)(const void*, P ...) const)> : JoMockBase<R(const void*, P ...)> {
-        typedef I IntegrateType(R(C::*)(const void*, P ...) const);
-        typedef I EntryPointType(R(C::*)(P ...) const);
-        typedef R(C::* FunctionType)(P ...) const;
-        typedef R StubFunctionType(const void*, P ...);
-        JoMock(FunctionType function, const string& functionName) :
-            JoMockBase<StubFunctionType>(functionName),
-            originFunction(function) {
-            SingletonBase<decltype(this)>::getInstance() = this;
-            JoMockPatch::graftFunction(originFunction,
-                &MockerEntryPoint<EntryPointType>::EntryPoint,
-                JoMockBase<StubFunctionType>::binaryBackup);
+        static void remember(const void* const address) {
+            static std::atomic<std::size_t> next(0);
+            history()[next.fetch_add(1) % kCapacity].store(address);
         }
-        virtual ~JoMock() {
-            restore();
+
+        static bool remembered(const void* const address) {
+            for (std::size_t i = 0; i < kCapacity; ++i) {
+                if (history()[i].load() == address) return true;
+            }
+            return false;
         }
-        virtual void restore() {
-            JoMockPatch::_restore(originFunction, JoMockBase<StubFunctionType>::binaryBackup);
-            SingletonBase<decltype(this)>::getInstance() = nullptr;
+
+        // A breakpoint instruction, not raise(), kill() or a single step.
+        static bool isBreakpoint(const siginfo_t* const info) {
+#if defined(__aarch64__)
+            return info->si_code == TRAP_BRKPT;
+#else
+            return info->si_code == SI_KERNEL;
+#endif
         }
-        FunctionType originFunction;
-    };
 
-    template < typename I, typename C, typename R, typename ... P>
-    struct JoMock<I(R(C::*)(const void*, P ...))> : JoMockBase<R(const void*, P ...)> {
-        typedef I IntegrateType(R(C::*)(const void*, P ...));
-        typedef I EntryPointType(R(C::*)(P ...));
-        typedef R(C::* FunctionType)(P ...);
-        typedef R StubFunctionType(const void*, P ...);
-        JoMock(FunctionType function, const string& functionName) :
-            JoMockBase<StubFunctionType>(functionName),
-            originFunction(function) {
-            SingletonBase<decltype(this)>::getInstance() = this;
-            JoMockPatch::graftFunction(originFunction,
-                &MockerEntryPoint<EntryPointType>::EntryPoint,
-                JoMockBase<StubFunctionType>::binaryBackup);
+        static struct sigaction& previous() {
+            static struct sigaction value;
+            return value;
         }
-        virtual ~JoMock() {
-            restore();
+
+        static void install() {
+            static bool installed = false;
+            if (installed) return;
+            struct sigaction action;
+            std::memset(&action, 0, sizeof(action));
+            action.sa_sigaction = &handler;
+            action.sa_flags = SA_SIGINFO | SA_RESTART;
+            sigemptyset(&action.sa_mask);
+            installed = sigaction(SIGTRAP, &action, &previous()) == 0;
         }
-        virtual void restore() {
-            JoMockPatch::_restore(originFunction, JoMockBase<StubFunctionType>::binaryBackup);
-            SingletonBase<decltype(this)>::getInstance() = nullptr;
+
+        static void jump(ucontext_t* const state, const void* const destination) {
+#if defined(__aarch64__)
+            state->uc_mcontext.pc = reinterpret_cast<std::uintptr_t>(destination);
+#elif defined(__x86_64__)
+            state->uc_mcontext.gregs[REG_RIP] = reinterpret_cast<greg_t>(destination);
+#else
+            state->uc_mcontext.gregs[REG_EIP] = reinterpret_cast<greg_t>(destination);
+#endif
+        }
+
+        static void handler(const int number, siginfo_t* const info, void* const context) {
+            ucontext_t* const state = static_cast<ucontext_t*>(context);
+#if defined(__aarch64__)
+            const void* const address = reinterpret_cast<const void*>(state->uc_mcontext.pc);
+#elif defined(__x86_64__)
+            const void* const address = reinterpret_cast<const void*>(state->uc_mcontext.gregs[REG_RIP] - 1);
+#else
+            const void* const address = reinterpret_cast<const void*>(state->uc_mcontext.gregs[REG_EIP] - 1);
+#endif
+            if (isBreakpoint(info)) {
+                for (std::size_t i = 0; i < kWrites; ++i) {
+                    if (writes()[i].load() != address) continue;
+                    while (writes()[i].load() == address) {
+                        sched_yield();
+                    }
+                    jump(state, address);
+                    return;
+                }
+                for (std::size_t i = 0; i < kCapacity; ++i) {
+                    Entry& entry = entries()[i];
+                    if (entry.address.load() != address) continue;
+                    jump(state, entry.destination.load());
+                    return;
+                }
+                char trap[4];
+                if (remembered(address) && std::memcmp(address, trap, encode(trap)) != 0) { // removed, run the new code.
+                    jump(state, address);
+                    return;
+                }
+            }
+            const struct sigaction& chained = previous();
+            if ((chained.sa_flags & SA_SIGINFO) != 0 && chained.sa_sigaction != nullptr) {
+                chained.sa_sigaction(number, info, context);
+            }
+            else if (chained.sa_handler != SIG_DFL && chained.sa_handler != SIG_IGN) {
+                chained.sa_handler(number);
+            }
+            else {
+                signal(number, SIG_DFL);
+                raise(number);
+            }
         }
-        FunctionType originFunction;
     };
+#endif
 
-    template < typename T >
-    struct JoMockCache {
-    private:
-        friend struct MockerCreator;
-        typedef unordered_map<const void*, const shared_ptr<T>> HashMap;
+#ifdef JOMOCK_QUIESCE_SUPPORT
+    // Parks every other thread of the process in a signal handler while code is written, so that none runs
+    // half-written instructions. Threads are found in /proc/self/task with raw system calls : a parked thread
+    // may hold the malloc lock.
+    struct JoMockQuiesce {
+        static const std::size_t kMaxThreads = 1024;
 
-        static HashMap& getInstance() {
-            return SingletonBase<HashMap>::getInstance();
+        static bool& enabled() {
+            static bool value = false;
+            return value;
         }
 
-        static void restoreCachedMockFunction() {
-            for (auto& mocker : getInstance()) {
-                mocker.second->restore();
+        // Returns false when a thread did not stop in time (it blocks the signal, or is exiting).
+        static bool stop() {
+            State& current = state();
+            install();
+            current.released.store(false);
+            current.arrived.store(0);
+            current.left.store(0);
+            std::size_t sent = 0;
+            const pid_t self = static_cast<pid_t>(syscall(SYS_gettid));
+            bool complete = true;
+            for (bool found = true; found;) {
+                found = false;
+                pid_t tids[256];
+                const int file = open("/proc/self/task", O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+                if (file < 0) return false;
+                char buffer[4096];
+                long read;
+                while ((read = syscall(SYS_getdents64, file, buffer, sizeof(buffer))) > 0) {
+                    std::size_t count = 0;
+                    for (long offset = 0; offset < read;) {
+                        const Dirent* const entry = reinterpret_cast<const Dirent*>(buffer + offset);
+                        offset += entry->length;
+                        const pid_t tid = static_cast<pid_t>(std::strtol(entry->name, nullptr, 10));
+                        if (tid > 0 && tid != self && count < 256) tids[count++] = tid;
+                    }
+                    for (std::size_t i = 0; i < count; ++i) {
+                        if (sent >= kMaxThreads || std::find(current.signaled, current.signaled + sent, tids[i]) != current.signaled + sent) continue;
+                        if (syscall(SYS_tgkill, getpid(), tids[i], signalNumber()) != 0) continue;
+                        current.signaled[sent++] = tids[i];
+                        found = true;
+                    }
+                }
+                close(file);
+                if (!wait(current.arrived, sent)) {
+                    complete = false;
+                    break;
+                }
             }
-            getInstance().clear();
+            const std::size_t arrived = current.arrived.load();
+            current.parked = arrived < kMaxThreads ? arrived : kMaxThreads;
+            return complete;
         }
-    };
 
-    struct MockerCreator {
-    private:
-        typedef list<function<void()>> mockFunctions;
+        static void release() {
+            State& current = state();
+            current.released.store(true);
+            wait(current.left, current.arrived.load());
+        }
 
-        template < typename I, typename R, typename ... P >
-        static const shared_ptr<JoMockBase<R(P ...)>> createJoMock(R function(P ...), const string& functionName) {
-            return shared_ptr<JoMockBase<R(P ...)>>(new JoMock<I(R(P ...))>(function, functionName));
+        // Where the parked threads stopped.
+        static std::size_t parked() {
+            return state().parked;
         }
 
-        template < typename I, typename C, typename R, typename ... P >
-        static const shared_ptr<JoMockBase<R(const void*, P ...)>> createJoMock(R(C::* function)(P ...) const, const string& functionName) {
-            typedef I IntegrateType(R(C::*)(const void*, P ...) const);
-            return shared_ptr<JoMockBase<R(const void*, P ...)>>(new JoMock<IntegrateType>(function, functionName));
+        static const void* pc(const std::size_t index) {
+            return state().pcs[index].load();
+        }
+
+    private:
+        struct Dirent {
+            std::uint64_t inode;
+            std::int64_t offset;
+            unsigned short length;
+            unsigned char type;
+            char name[1];
         };
 
-        template < typename I, typename C, typename R, typename ... P >
-        static const shared_ptr<JoMockBase<R(const void*, P ...)>> createJoMock(R(C::* function)(P ...), const string& functionName) {
-            typedef I IntegrateType(R(C::*)(const void*, P ...));
-            return shared_ptr<JoMockBase<R(const void*, P ...)>>(new JoMock<IntegrateType>(function, functionName)); \
+        struct State {
+            std::atomic<bool> released;
+            std::atomic<std::size_t> arrived;
+            std::atomic<std::size_t> left;
+            std::atomic<const void*> pcs[kMaxThreads];
+            pid_t signaled[kMaxThreads];
+            std::size_t parked;
         };
 
-        template < typename I, typename M, typename F >
-        static const shared_ptr<M> getJoMocker(F function, const string& functionName) {
-            typedef JoMockCache<M> JoMockCacheType;
-            const void* address = reinterpret_cast<const void*>((size_t&)function);
-            auto got = JoMockCacheType::getInstance().find(address);
-            if (got != JoMockCacheType::getInstance().end()) {
-                return got->second;
-            }
-            else {
-                SingletonBase<mockFunctions>::getInstance().push_back(bind(JoMockCacheType::restoreCachedMockFunction));
-                JoMockCacheType::getInstance().insert({ {address, createJoMock<I>(function, functionName)} });
-                return getJoMocker<I, M>(function, functionName);
-            }
+        static State& state() {
+            static State value;
+            return value;
         }
 
-    public:
-        template < typename I, typename R, typename ... P >
-        static const shared_ptr<JoMockBase<R(P ...)>> getJoMock(R function(P ...), const string& functionName) {
-            return getJoMocker<I, JoMockBase<R(P ...)>>(function, functionName);
+        static int signalNumber() {
+            return SIGRTMIN + 6;
         }
 
-        template < typename I, typename C, typename R, typename ... P >
-        static shared_ptr<JoMockBase<R(const void*, P ...)>> getJoMock(R(C::* function)(P ...) const, const string& functionName) {
-            return getJoMocker<I, JoMockBase<R(const void*, P ...)>>(function, functionName);
-        };
+        static void install() {
+            static bool installed = false;
+            if (installed) return;
+            struct sigaction action;
+            std::memset(&action, 0, sizeof(action));
+            action.sa_sigaction = &handler;
+            action.sa_flags = SA_SIGINFO | SA_RESTART;
+            sigemptyset(&action.sa_mask);
+            installed = sigaction(signalNumber(), &action, nullptr) == 0;
+        }
 
-        template < typename I, typename C, typename R, typename ... P >
-        static shared_ptr<JoMockBase<R(const void*, P ...)>> getJoMock(R(C::* function)(P ...), const string& functionName) {
-            return getJoMocker<I, JoMockBase<R(const void*, P ...)>>(function, functionName);
-        };
+        // Up to 200ms for 'counter' to reach 'target'.
+        static bool wait(const std::atomic<std::size_t>& counter, const std::size_t target) {
+            for (int i = 0; counter.load() < target; ++i) {
+                if (i >= 2000) return false;
+                if (i < 100) sched_yield();
+                else pause(100000);
+            }
+            return true;
+        }
 
-        static void restoreAll() {
-            for (auto& restorer : SingletonBase<mockFunctions>::getInstance()) {
-                restorer();
+        // Not usleep(), which virtual time may have mocked (see jomock_clock.h).
+        static void pause(const long nanoseconds) {
+            const timespec duration = { 0, nanoseconds };
+            syscall(SYS_clock_nanosleep, CLOCK_MONOTONIC, 0, &duration, nullptr);
+        }
+
+        static void handler(int, siginfo_t*, void* const context) {
+            const ucontext_t* const state = static_cast<const ucontext_t*>(context);
+#if defined(__aarch64__)
+            const void* const pc = reinterpret_cast<const void*>(state->uc_mcontext.pc);
+#elif defined(__x86_64__)
+            const void* const pc = reinterpret_cast<const void*>(state->uc_mcontext.gregs[REG_RIP]);
+#else
+            const void* const pc = reinterpret_cast<const void*>(state->uc_mcontext.gregs[REG_EIP]);
+#endif
+            State& current = JoMockQuiesce::state();
+            const std::size_t index = current.arrived.load();
+            if (index < kMaxThreads) current.pcs[index].store(pc);
+            current.arrived.fetch_add(1);
+            while (!current.released.load()) {
+                sched_yield();
             }
-            SingletonBase<mockFunctions>::getInstance().clear();
+#if defined(__aarch64__)
+            __asm__ volatile("isb" ::: "memory");
+#endif
+            current.left.fetch_add(1);
         }
     };
+#endif
+
+    // Writes code that other threads may be running. A span within an aligned 8 byte word is one atomic
+    // store. Longer ones get a trap on their first instruction, then the rest of their bytes, then the first
+    // instruction, each step made visible to every core before the next; a thread entering meanwhile waits
+    // in the trap. Threads stopped inside the written bytes are left to JoMockQuiesce.
+    struct JoMockLiveWrite {
+        // 'entry' is false for a span that may start inside an instruction, where no trap can be put.
+        struct Span { char* address; const char* code; std::size_t size; bool entry; };
+
+        // Writes 'spans' in order; overlapping spans go to different batches.
+        static void write(const std::vector<Span>& spans) {
+            for (std::size_t begin = 0; begin < spans.size();) {
+                std::size_t end = begin + 1;
+                const char* low = spans[begin].address;
+                const char* high = low + spans[begin].size;
+                for (; end < spans.size() && end - begin < kBatch; ++end) {
+                    const Span& next = spans[end];
+                    if (next.address < high && low < next.address + next.size && overlaps(spans, begin, end)) break;
+                    low = std::min<const char*>(low, next.address);
+                    high = std::max<const char*>(high, next.address + next.size);
+                }
+                writeBatch(spans, begin, end);
+                begin = end;
+            }
+        }
+
+    private:
+#ifdef JOMOCK_TRAP_SUPPORT
+        static const std::size_t kBatch = JoMockTrap::kWrites;
+#else
+        static const std::size_t kBatch = 64;
+#endif
+
+        static bool overlaps(const std::vector<Span>& spans, const std::size_t begin, const std::size_t end) {
+            const Span& last = spans[end];
+            for (std::size_t i = begin; i < end; ++i) {
+                if (spans[i].address < last.address + last.size && last.address < spans[i].address + spans[i].size) return true;
+            }
+            return false;
+        }
+
+        static bool withinWord(const Span& span) {
+            const std::uintptr_t begin = reinterpret_cast<std::uintptr_t>(span.address);
+            return begin + span.size <= (begin & ~static_cast<std::uintptr_t>(7)) + 8;
+        }
+
+        static void writeBatch(const std::vector<Span>& spans, const std::size_t begin, const std::size_t end) {
+            bool trapped[kBatch] = {};
+            bool any = false;
+#ifdef JOMOCK_TRAP_SUPPORT
+            char trap[4];
+            const std::size_t head = JoMockTrap::encode(trap);
+#endif
+            for (std::size_t i = begin; i < end; ++i) {
+                const Span& span = spans[i];
+                if (withinWord(span)) {
+                    storeWord(span);
+                    continue;
+                }
+#ifdef JOMOCK_TRAP_SUPPORT
+                if (span.entry && span.size > head) {
+                    JoMockTrap::beginWrite(i - begin, span.address);
+                    writeUnit(span.address, trap, head);
+                    trapped[i - begin] = any = true;
+                    continue;
+                }
+#endif
+                std::memcpy(span.address, span.code, span.size);
+            }
+#ifdef JOMOCK_TRAP_SUPPORT
+            if (!any) return;
+            serialize(spans, begin, end);
+            for (std::size_t i = begin; i < end; ++i) {
+                if (trapped[i - begin]) std::memcpy(spans[i].address + head, spans[i].code + head, spans[i].size - head);
+            }
+            serialize(spans, begin, end);
+            for (std::size_t i = begin; i < end; ++i) {
+                if (trapped[i - begin]) writeUnit(spans[i].address, spans[i].code, head);
+            }
+            serialize(spans, begin, end);
+            for (std::size_t i = begin; i < end; ++i) {
+                if (trapped[i - begin]) JoMockTrap::endWrite(i - begin);
+            }
+#else
+            (void)trapped;
+            (void)any;
+#endif
+        }
+
+        static void storeWord(const Span& span) {
+            const std::uintptr_t begin = reinterpret_cast<std::uintptr_t>(span.address);
+            std::uint64_t* const word = reinterpret_cast<std::uint64_t*>(begin & ~static_cast<std::uintptr_t>(7));
+            std::uint64_t value;
+            std::memcpy(&value, word, sizeof(value));
+            std::memcpy(reinterpret_cast<char*>(&value) + (begin & 7), span.code, span.size);
+#ifndef NON_WIN32_SUPPORT
+            InterlockedExchange64(reinterpret_cast<volatile LONG64*>(word), static_cast<LONG64>(value));
+#else
+            __atomic_store_n(word, value, __ATOMIC_SEQ_CST);
+#endif
+        }
+
+#ifdef JOMOCK_TRAP_SUPPORT
+        static void writeUnit(char* const address, const char* const code, const std::size_t size) {
+            if (size == 4) {
+                std::uint32_t value;
+                std::memcpy(&value, code, sizeof(value));
+                __atomic_store_n(reinterpret_cast<std::uint32_t*>(address), value, __ATOMIC_SEQ_CST);
+            }
+            else {
+                __atomic_store_n(address, code[0], __ATOMIC_SEQ_CST);
+            }
+        }
+
+        // Makes the bytes written so far visible to the instruction fetch of every core.
+        static void serialize(const std::vector<Span>& spans, const std::size_t begin, const std::size_t end) {
+            for (std::size_t i = begin; i < end; ++i) {
+                JoMockPage::flushInstructionCache(spans[i].address, spans[i].size);
+            }
+#ifdef SYS_membarrier
+            static const bool membarrier = syscall(SYS_membarrier, 1 << 6, 0) == 0; // register private expedited sync core
+            if (membarrier) {
+                syscall(SYS_membarrier, 1 << 5, 0); // private expedited sync core
+                return;
+            }
+#endif
+            std::atomic_thread_fence(std::memory_order_seq_cst);
+        }
+#endif
+    };
+
+    // Content of a text page before its first patch, see JoMockSnapshot. Pages are never freed.
+    struct JoMockSnapshotPage {
+        char* address;
+        std::unique_ptr<char[]> bytes;
+        std::size_t patches; // live patches in the page.
+        std::atomic<std::size_t> restores; // copies of 'bytes' queued and not applied yet.
+        std::vector<JoMockPatchWrite> written; // patches written since the snapshot, to verify the page.
+    };
+
+    // Collects code writes and applies them with one protection flip per run of adjacent pages.
+    // While a transaction is open in a thread, every JOMOCK() graft and restore of that thread
+    // is queued into it and takes effect on commit().
+    struct JoMockPatchTransaction {
+        static const std::size_t kMaxPatchSize = sizeof(JoMockPatchWrite::code);
+
+        JoMockPatchTransaction() : previous(current()), committed(false) {
+            current() = this;
+            pending.swap(spare<JoMockPatchWrite>()); // reuse the capacity of the thread's last transaction.
+            restores.swap(spare<JoMockSnapshotPage*>());
+        }
+
+        ~JoMockPatchTransaction() {
+            if (!commit()) {
+                std::abort();
+            }
+            if (pending.capacity() > spare<JoMockPatchWrite>().capacity()) {
+                pending.swap(spare<JoMockPatchWrite>());
+            }
+            if (restores.capacity() > spare<JoMockSnapshotPage*>().capacity()) {
+                restores.swap(spare<JoMockSnapshotPage*>());
+            }
+        }
+
+        static JoMockPatchTransaction*& current() {
+            static thread_local JoMockPatchTransaction* transaction = nullptr;
+            return transaction;
+        }
+
+        void write(void* const address, const char* const code, const std::size_t size) {
+            for (std::size_t offset = 0; offset < size; offset += kMaxPatchSize) {
+                JoMockPatchWrite patch;
+                patch.address = reinterpret_cast<char*>(address) + offset;
+                patch.size = size - offset < kMaxPatchSize ? size - offset : kMaxPatchSize;
+                std::copy(code + offset, code + offset + patch.size, patch.code);
+                pending.push_back(patch);
+            }
+        }
+
+        // Copies the snapshot of 'page' back, before the writes of the transaction are applied.
+        void restorePage(JoMockSnapshotPage* const page) {
+            restores.push_back(page);
+        }
+
+        bool commit() {
+            if (committed) return true;
+            committed = true;
+            if (current() == this) {
+                current() = previous;
+            }
+            bool result = apply(pending, restores);
+#ifdef JOMOCK_TRAP_SUPPORT
+            for (const void* const address : traps) {
+                JoMockTrap::remove(address);
+            }
+#endif
+            pending.clear();
+            restores.clear();
+            traps.clear();
+            return result;
+        }
+
+        std::size_t size() const {
+            return pending.size();
+        }
+
+        static bool apply(const std::vector<JoMockPatchWrite>& writes,
+            const std::vector<JoMockSnapshotPage*>& snapshots = std::vector<JoMockSnapshotPage*>()) {
+            if (writes.empty() && snapshots.empty()) return true;
+            const std::size_t pageSize = JoMockPage::pageSize();
+            static thread_local std::vector<std::size_t> pages;
+            pages.clear();
+            for (const JoMockSnapshotPage* snapshot : snapshots) {
+                pages.push_back(reinterpret_cast<std::size_t>(snapshot->address));
+            }
+            for (const JoMockPatchWrite& patch : writes) {
+                const std::size_t begin = reinterpret_cast<std::size_t>(patch.address);
+                const std::size_t last = JoMockPage::alignAddress(begin + patch.size - 1, pageSize);
+                for (std::size_t page = JoMockPage::alignAddress(begin, pageSize); page <= last; page += pageSize) {
+                    pages.push_back(page);
+                }
+            }
+            std::sort(pages.begin(), pages.end());
+            pages.erase(std::unique(pages.begin(), pages.end()), pages.end());
+
+            std::lock_guard<std::mutex> lock(SingletonBase<std::mutex>::getInstance());
+#ifdef NON_WIN32_SUPPORT
+            JoMockPage::loadProtections();
+#endif
+            // Adjacent pages share a run when they share a protection, which the run gets back.
+            static thread_local std::vector<Run> runs;
+            runs.clear();
+            for (std::size_t page : pages) {
+#ifdef NON_WIN32_SUPPORT
+                const int protect = JoMockPage::protection(page);
+#else
+                const int protect = 0;
+#endif
+                if (!runs.empty() && runs.back().end == page && runs.back().protect == protect) {
+                    runs.back().end += pageSize;
+                }
+                else {
+                    Run run = { page, page + pageSize, 0, protect };
+                    runs.push_back(run);
+                }
+            }
+
+            bool result = true;
+            std::size_t unprotected = 0;
+            for (; unprotected < runs.size(); ++unprotected) {
+                Run& run = runs[unprotected];
+                if (!JoMockPage::unprotect(reinterpret_cast<void*>(run.begin), run.end - run.begin, run.oldProtect)) {
+                    result = false;
+                    break;
+                }
+            }
+            if (result) {
+                write(spans(writes, snapshots, pageSize), snapshots, pageSize);
+            }
+            for (JoMockSnapshotPage* snapshot : snapshots) {
+                --snapshot->restores;
+            }
+            for (std::size_t i = 0; i < unprotected; ++i) {
+                const Run& run = runs[i];
+                JoMockPage::flushInstructionCache(reinterpret_cast<void*>(run.begin), run.end - run.begin);
+                JoMockPage::restoreProtection(reinterpret_cast<void*>(run.begin), run.end - run.begin, run.oldProtect);
+            }
+            return result;
+        }
+
+        // Removes the trap at 'address' once the transaction is applied, see JoMockPatch::releaseJump.
+        void releaseTrap(const void* const address) {
+            traps.push_back(address);
+        }
+
+    private:
+        struct Run { std::size_t begin; std::size_t end; unsigned long oldProtect; int protect; };
+        typedef JoMockLiveWrite::Span Span;
+
+        // The patches of the restored pages first, with their saved bytes, then the writes.
+        static const std::vector<Span>& spans(const std::vector<JoMockPatchWrite>& writes,
+            const std::vector<JoMockSnapshotPage*>& snapshots, const std::size_t pageSize) {
+            static thread_local std::vector<Span> value;
+            value.clear();
+            for (const JoMockSnapshotPage* snapshot : snapshots) {
+                char* const begin = snapshot->address;
+                char* const end = begin + pageSize;
+                const std::size_t first = value.size();
+                for (const JoMockPatchWrite& patch : snapshot->written) {
+                    char* const from = std::max(patch.address, begin);
+                    char* const to = std::min(patch.address + patch.size, end);
+                    if (from >= to || std::memcmp(from, snapshot->bytes.get() + (from - begin), to - from) == 0) continue;
+                    bool repeated = false; // the same entry patched again since the snapshot.
+                    for (std::size_t i = first; i < value.size() && !repeated; ++i) {
+                        repeated = value[i].address == from && value[i].size == static_cast<std::size_t>(to - from);
+                    }
+                    if (repeated) continue;
+                    Span span = { from, snapshot->bytes.get() + (from - begin), static_cast<std::size_t>(to - from), from == patch.address };
+                    value.push_back(span);
+                }
+            }
+            for (const JoMockPatchWrite& patch : writes) {
+                Span span = { patch.address, patch.code, patch.size, true };
+                value.push_back(span);
+            }
+            return value;
+        }
+
+        static void write(const std::vector<Span>& spans, const std::vector<JoMockSnapshotPage*>& snapshots, const std::size_t pageSize) {
+#ifdef JOMOCK_QUIESCE_SUPPORT
+            const bool stopped = JoMockQuiesce::enabled() && quiesce(spans);
+#else
+            const bool stopped = false;
+#endif
+            if (stopped) {
+                for (const Span& span : spans) {
+                    std::memcpy(span.address, span.code, span.size);
+                }
+            }
+            else {
+                JoMockLiveWrite::write(spans);
+            }
+            for (const JoMockSnapshotPage* snapshot : snapshots) { // bytes changed without a recorded patch.
+                if (std::memcmp(snapshot->address, snapshot->bytes.get(), pageSize) != 0) {
+                    std::memcpy(snapshot->address, snapshot->bytes.get(), pageSize);
+                }
+            }
+#ifdef JOMOCK_QUIESCE_SUPPORT
+            if (JoMockQuiesce::enabled()) {
+                JoMockQuiesce::release();
+            }
+#endif
+        }
+
+#ifdef JOMOCK_QUIESCE_SUPPORT
+        // Stops the other threads outside the bytes to write. Returns false when some could not be stopped
+        // there; they are still stopped, and the writes fall back to JoMockLiveWrite.
+        static bool quiesce(const std::vector<Span>& spans) {
+            for (int attempt = 0; attempt < 1000; ++attempt) {
+                const bool complete = JoMockQuiesce::stop();
+                bool inside = false;
+                for (std::size_t i = 0; i < JoMockQuiesce::parked() && !inside; ++i) {
+                    const char* const pc = static_cast<const char*>(JoMockQuiesce::pc(i));
+                    for (const Span& span : spans) {
+                        if (pc > span.address && pc < span.address + span.size) {
+                            inside = true;
+                            break;
+                        }
+                    }
+                }
+                if (!inside) return complete;
+                JoMockQuiesce::release();
+                sched_yield();
+            }
+            JoMockQuiesce::stop();
+            return false;
+        }
+#endif
+
+        template < typename T >
+        static std::vector<T>& spare() {
+            static thread_local std::vector<T> value;
+            return value;
+        }
+
+        JoMockPatchTransaction(const JoMockPatchTransaction&);
+        JoMockPatchTransaction& operator=(const JoMockPatchTransaction&);
+
+        JoMockPatchTransaction* const previous;
+        bool committed;
+        std::vector<JoMockPatchWrite> pending;
+        std::vector<JoMockSnapshotPage*> restores;
+        std::vector<const void*> traps;
+    };
+
+    // Page snapshots behind CLEAR_JOMOCK(). The first patch written in a text page saves the page, and
+    // when the last patch of the page is reverted the saved page is copied back whole, in the same
+    // transaction. In verification mode the page is compared first with the snapshot and the patches
+    // jomock wrote; a page changed by someone else (a debugger breakpoint, another patcher) is reported
+    // and only jomock's own bytes are put back.
+    struct JoMockSnapshot {
+        static bool& enabled() {
+            static bool value = true;
+            return value;
+        }
+
+        static bool& verifying() {
+            static bool value = false;
+            return value;
+        }
+
+        // Pages found modified outside jomock by verification.
+        static std::size_t conflicts() {
+            std::lock_guard<std::mutex> lock(mutex());
+            return conflictCount();
+        }
+
+        // Called before 'code' is queued for 'address'.
+        static void capture(void* const address, const char* const code, const std::size_t size) {
+            if (!enabled() || size == 0) return;
+            std::lock_guard<std::mutex> lock(mutex());
+            JoMockPatchWrite patch;
+            patch.address = static_cast<char*>(address);
+            patch.size = size < sizeof(patch.code) ? size : sizeof(patch.code);
+            std::memcpy(patch.code, code, patch.size);
+            forEachPage(address, size, [&patch](JoMockSnapshotPage& page, const std::size_t pageSize) {
+                if (page.patches == 0) {
+                    if (page.restores == 0) { // otherwise the saved bytes are still the original ones.
+                        std::memcpy(page.bytes.get(), page.address, pageSize);
+                        page.written.clear();
+                    }
+                }
+                ++page.patches;
+                page.written.push_back(patch);
+            });
+        }
+
+        // Called when the original bytes of 'address' are queued into 'transaction'.
+        static void release(JoMockPatchTransaction& transaction, void* const address, const std::size_t size) {
+            if (size == 0) return;
+            std::lock_guard<std::mutex> lock(mutex());
+            forEachPage(address, size, [&transaction](JoMockSnapshotPage& page, const std::size_t pageSize) {
+                if (page.patches == 0 || --page.patches != 0) return;
+                if (verifying() && !verify(page, pageSize)) {
+                    ++conflictCount();
+                    return;
+                }
+                ++page.restores;
+                transaction.restorePage(&page);
+            }, false);
+        }
+
+    private:
+        static std::mutex& mutex() {
+            static std::mutex value;
+            return value;
+        }
+
+        static std::size_t& conflictCount() {
+            static std::size_t value = 0;
+            return value;
+        }
+
+        // Snapshot pages sorted by address.
+        static std::vector<JoMockSnapshotPage*>& pages() {
+            static std::vector<JoMockSnapshotPage*> value;
+            return value;
+        }
+
+        template < typename F >
+        static void forEachPage(void* const address, const std::size_t size, F visit, const bool create = true) {
+            const std::size_t pageSize = JoMockPage::pageSize();
+            const std::size_t begin = reinterpret_cast<std::size_t>(address);
+            const std::size_t last = JoMockPage::alignAddress(begin + size - 1, pageSize);
+            for (std::size_t start = JoMockPage::alignAddress(begin, pageSize); start <= last; start += pageSize) {
+                char* const base = reinterpret_cast<char*>(start);
+                std::vector<JoMockSnapshotPage*>& table = pages();
+                auto got = std::lower_bound(table.begin(), table.end(), base,
+                    [](const JoMockSnapshotPage* page, const char* value) { return page->address < value; });
+                if (got == table.end() || (*got)->address != base) {
+                    if (!create) continue;
+                    JoMockSnapshotPage* const page = new JoMockSnapshotPage();
+                    page->address = base;
+                    page->bytes.reset(new char[pageSize]);
+                    page->patches = 0;
+                    page->restores = 0;
+                    got = table.insert(got, page);
+                }
+                visit(**got, pageSize);
+            }
+        }
+
+        // True when every byte of the page is either the saved one or one jomock wrote.
+        static bool verify(const JoMockSnapshotPage& page, const std::size_t pageSize) {
+            const std::size_t kBlock = 64;
+            for (std::size_t offset = 0; offset < pageSize; ++offset) {
+                if (offset % kBlock == 0 && std::memcmp(page.address + offset, page.bytes.get() + offset, kBlock) == 0) {
+                    offset += kBlock - 1;
+                    continue;
+                }
+                const char current = page.address[offset];
+                if (current == page.bytes[offset]) continue;
+                bool ours = false;
+                for (const JoMockPatchWrite& patch : page.written) {
+                    const char* const at = page.address + offset;
+                    if (at >= patch.address && at < patch.address + patch.size && patch.code[at - patch.address] == current) {
+                        ours = true;
+                        break;
+                    }
+                }
+                if (!ours) {
+                    fprintf(stderr, "jomock: code at %p was changed outside jomock, only the mocked entries of its page are restored\n",
+                        static_cast<void*>(page.address + offset));
+                    return false;
+                }
+            }
+            return true;
+        }
+    };
+
+    // Executable memory for generated code. Blocks are never returned to the system, released ones are handed
+    // out again by allocate().
+    struct JoMockExecutableMemory {
+        static const std::size_t kChunkSize = 64 * 1024;
+#ifdef ARM64_SUPPORT
+        static const std::size_t kReach = 0x08000000; // b imm26
+#else
+        static const std::size_t kReach = 0x80000000u; // jmp rel32
+#endif
+
+        // Returns a block of 'size' bytes, within the reach of a direct jump from 'near' when it is given.
+        static void* allocate(const std::size_t size, const void* const near = nullptr) {
+            std::lock_guard<std::mutex> lock(mutex());
+            const std::size_t aligned = (size + 15) & ~static_cast<std::size_t>(15);
+            if (aligned > kChunkSize) return nullptr;
+            std::vector<Block>& spares = SingletonBase<std::vector<Block>>::getInstance();
+            for (std::size_t i = spares.size(); i-- > 0;) { // the last released first.
+                if (spares[i].size == aligned && (near == nullptr || isReachable(spares[i].address, near))) {
+                    void* const block = spares[i].address;
+                    spares.erase(spares.begin() + i);
+                    return block;
+                }
+            }
+            std::vector<Chunk>& chunks = SingletonBase<std::vector<Chunk>>::getInstance();
+            Chunk* chunk = nullptr;
+            for (Chunk& candidate : chunks) {
+                if (candidate.used + aligned <= kChunkSize && (near == nullptr || isReachable(candidate.base, near))) {
+                    chunk = &candidate;
+                    break;
+                }
+            }
+            if (chunk == nullptr) {
+                char* const base = static_cast<char*>(near == nullptr ? map(nullptr) : mapNear(near));
+                if (base == nullptr) return nullptr;
+                Chunk fresh = { base, 0 };
+                chunks.push_back(fresh);
+                chunk = &chunks.back();
+            }
+            char* const block = chunk->base + chunk->used;
+            chunk->used += aligned;
+            return block;
+        }
+
+        // Gives back a block of 'size' bytes returned by allocate(), once nothing jumps to it anymore.
+        static void release(void* const block, const std::size_t size) {
+            std::lock_guard<std::mutex> lock(mutex());
+            const Block spare = { static_cast<char*>(block), (size + 15) & ~static_cast<std::size_t>(15) };
+            SingletonBase<std::vector<Block>>::getInstance().push_back(spare);
+        }
+
+        // Copies 'code' into the executable block returned by allocate().
+        static bool write(void* const block, const char* const code, const std::size_t size) {
+            JoMockPatchTransaction transaction;
+            transaction.write(block, code, size);
+            return transaction.commit();
+        }
+
+        static bool isReachable(const void* const from, const void* const to) {
+            const std::size_t a = reinterpret_cast<std::size_t>(from);
+            const std::size_t b = reinterpret_cast<std::size_t>(to);
+            const std::size_t distance = a > b ? a - b : b - a;
+            return distance < kReach - 0x10000u - kChunkSize;
+        }
+
+    private:
+        struct Chunk {
+            char* base;
+            std::size_t used;
+        };
+
+        struct Block {
+            char* address;
+            std::size_t size;
+        };
+
+        static std::mutex& mutex() {
+            static std::mutex value;
+            return value;
+        }
+
+        static void* map(void* const hint) {
+#ifndef NON_WIN32_SUPPORT
+            return VirtualAlloc(hint, kChunkSize, MEM_COMMIT | MEM_RESERVE, PAGE_EXECUTE_READ);
+#else
+            void* const memory = mmap(hint, kChunkSize, PROT_READ | PROT_EXEC, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+            return memory == MAP_FAILED ? nullptr : memory;
+#endif
+        }
+
+        static void unmap(void* const memory) {
+#ifndef NON_WIN32_SUPPORT
+            VirtualFree(memory, 0, MEM_RELEASE);
+#else
+            munmap(memory, kChunkSize);
+#endif
+        }
+
+        // Probes free address ranges around 'near', closest first.
+        static void* mapNear(const void* const near) {
+            if (sizeof(void*) == 4) return map(nullptr);
+            const std::size_t kStep = kReach / 128;
+            const std::size_t origin = reinterpret_cast<std::size_t>(near) & ~(kChunkSize - 1);
+            for (std::size_t distance = kStep; distance < kReach - kReach / 8; distance += kStep) {
+                const std::size_t candidates[] = { origin - distance, origin + distance };
+                for (std::size_t candidate : candidates) {
+                    if (candidate < kStep) continue;
+                    void* const memory = map(reinterpret_cast<void*>(candidate));
+                    if (memory == nullptr) continue;
+                    if (isReachable(memory, near)) return memory;
+                    unmap(memory);
+                }
+            }
+            return nullptr;
+        }
+    };
+
+    // Absolute jumps placed within direct jump reach of patched functions, so that a graft to a far destination
+    // (a PIE entry point from libc, for instance) still uses the 5-byte jmp rel32, or the 4-byte b on ARM64. Veneers are shared by
+    // grafts to the same destination, and released ones are retargeted by later installs instead of
+    // allocating.
+    struct JoMockVeneerPool {
+        static const std::size_t kVeneerSize = 16;
+#ifdef ARM64_SUPPORT
+        static const std::size_t kLiteralOffset = 8;
+#else
+        static const std::size_t kLiteralOffset = 6;
+#endif
+
+        static void* get(const void* const function, const void* const destination) {
+            std::lock_guard<std::mutex> lock(mutex());
+            std::vector<Veneer>& pool = veneers();
+            Veneer* spare = nullptr;
+            for (Veneer& veneer : pool) {
+                if (!JoMockExecutableMemory::isReachable(veneer.address, function)) continue;
+                if (veneer.destination == destination) {
+                    ++veneer.references;
+                    return veneer.address;
+                }
+                if (veneer.references == 0 && spare == nullptr) {
+                    spare = &veneer;
+                }
+            }
+            if (spare != nullptr) {
+                if (!JoMockExecutableMemory::write(spare->address + kLiteralOffset,
+                    reinterpret_cast<const char*>(&destination), sizeof(destination))) return nullptr;
+                spare->destination = destination;
+                spare->references = 1;
+                return spare->address;
+            }
+            char* const address = static_cast<char*>(JoMockExecutableMemory::allocate(kVeneerSize, function));
+            if (address == nullptr) return nullptr;
+#ifdef ARM64_SUPPORT
+            const std::uint32_t jump[2] = { 0x58000050, 0xD61F0200 }; // ldr x16, #8; br x16
+#else
+            const unsigned char jump[kLiteralOffset] = { 0xFF, 0x25, 0x00, 0x00, 0x00, 0x00 }; // jmp [rip + 0]
+#endif
+            char code[kVeneerSize];
+            std::memcpy(code, jump, kLiteralOffset);
+            std::memcpy(code + kLiteralOffset, &destination, sizeof(destination));
+            std::fill(code + kLiteralOffset + sizeof(destination), code + kVeneerSize, (char)0xCC);
+            if (!JoMockExecutableMemory::write(address, code, kVeneerSize)) return nullptr;
+            Veneer veneer = { address, destination, 1 };
+            pool.push_back(veneer);
+            return address;
+        }
+
+        // Drops a reference taken by get(). Addresses that are not veneers are ignored.
+        static void release(const void* const address) {
+            std::lock_guard<std::mutex> lock(mutex());
+            for (Veneer& veneer : veneers()) {
+                if (veneer.address == address) {
+                    if (veneer.references > 0) --veneer.references;
+                    return;
+                }
+            }
+        }
+
+        static std::size_t size() {
+            std::lock_guard<std::mutex> lock(mutex());
+            return veneers().size();
+        }
+
+    private:
+        struct Veneer {
+            char* address;
+            const void* destination;
+            std::size_t references;
+        };
+
+        static std::mutex& mutex() {
+            static std::mutex value;
+            return value;
+        }
+
+        static std::vector<Veneer>& veneers() {
+            static std::vector<Veneer> value;
+            return value;
+        }
+    };
+
+#ifdef JOMOCK_THUNK_SUPPORT
+    // GDB's JIT interface : GDB reads the in-memory object files linked from the descriptor when
+    // __jit_debug_register_code() is called. Both belong to the JIT of the process, or to the program; the
+    // thunks are not registered when nothing defines them.
+    struct JoMockJitEntry {
+        JoMockJitEntry* next;
+        JoMockJitEntry* previous;
+        const char* symbolFile;
+        std::uint64_t symbolFileSize;
+    };
+
+    struct JoMockJitDescriptor {
+        std::uint32_t version;
+        std::uint32_t action; // 1 : 'relevant' was registered, 2 : it was unregistered.
+        JoMockJitEntry* relevant;
+        JoMockJitEntry* first;
+    };
+
+    extern "C" {
+        extern void __jit_debug_register_code() __attribute__((weak));
+        extern JoMockJitDescriptor __jit_debug_descriptor __attribute__((weak));
+    }
+#endif
+
+    // Where an argument of type T travels in the x86-64 System V and AArch64 calling conventions : an integer
+    // register, a floating point one, or neither (memory, register pairs).
+    template < typename T >
+    struct JoMockRegisterClass {
+        static const int integers = ((std::is_integral<T>::value || std::is_enum<T>::value) && sizeof(T) <= 8)
+            || std::is_pointer<T>::value || std::is_reference<T>::value || std::is_same<T, std::nullptr_t>::value ? 1 : 0;
+        static const int floats = std::is_same<T, float>::value || std::is_same<T, double>::value ? 1 : 0;
+    };
+
+    template < >
+    struct JoMockRegisterClass<void> {
+        static const int integers = 0;
+        static const int floats = 0;
+    };
+
+    template < typename ... A >
+    struct JoMockRegisterArguments {
+        static const int integers = 0;
+        static const int floats = 0;
+        static const bool fit = true;
+    };
+
+    template < typename T, typename ... A >
+    struct JoMockRegisterArguments<T, A ...> {
+        static const int integers = JoMockRegisterClass<T>::integers + JoMockRegisterArguments<A ...>::integers;
+        static const int floats = JoMockRegisterClass<T>::floats + JoMockRegisterArguments<A ...>::floats;
+        static const bool fit = JoMockRegisterClass<T>::integers + JoMockRegisterClass<T>::floats == 1
+            && JoMockRegisterArguments<A ...>::fit;
+    };
+
+    template < typename T >
+    struct JoMockThunkable {
+        static const bool value = false;
+    };
+
+    // Whether a call of R(A ...) still passes everything in registers with one more pointer in front.
+    template < typename R, typename ... A >
+    struct JoMockThunkable<R(A ...)> {
+#ifdef ARM64_SUPPORT
+        static const int kIntegerRegisters = 8; // x0-x7
+#else
+        static const int kIntegerRegisters = 6; // rdi, rsi, rdx, rcx, r8, r9
+#endif
+        static const int kFloatRegisters = 8;
+        static const bool value = (std::is_void<R>::value || JoMockRegisterClass<R>::integers + JoMockRegisterClass<R>::floats == 1)
+            && JoMockRegisterArguments<A ...>::fit
+            && JoMockRegisterArguments<A ...>::integers < kIntegerRegisters
+            && JoMockRegisterArguments<A ...>::floats <= kFloatRegisters;
+    };
+
+    // Code generated per mock (Linux, x86-64 and ARM64) : it shifts the integer argument registers by one, loads
+    // the mock's address, baked in as an immediate, into the first and jumps to the static entry of the mock
+    // (MockerEntryPoint::Call), so that a mocked call does not load the mock from its singleton. Signatures that
+    // do not fit in registers (JoMockThunkable) and thread-local dispatch keep the template entry points.
+    // A thunk is released with its mock, its code is reused by the next ones. Thunks are named
+    // "jomock:<functionName>" for GDB, through its JIT interface, and for perf with JOMOCK_PERF_MAP(true).
+    struct JoMockThunk {
+#ifdef ARM64_SUPPORT
+        static const std::size_t kSize = 56;
+#else
+        static const std::size_t kSize = 39;
+#endif
+
+        // On by default.
+        static bool& enabled() {
+            static bool value = true;
+            return value;
+        }
+
+        // Appends the thunks to /tmp/perf-<pid>.map, the ones made so far included.
+        static void setPerfMap(const bool enable) {
+#ifdef JOMOCK_THUNK_SUPPORT
+            std::lock_guard<std::mutex> lock(mutex());
+            if (enable && !perfMap()) {
+                for (const std::pair<const Key, Thunk>& thunk : thunks()) {
+                    writePerfMap(thunk.second);
+                }
+            }
+            perfMap() = enable;
+#else
+            (void)enable;
+#endif
+        }
+
+        // The destination of the jump grafted at 'function' : a thunk calling 'call(mock, arguments ...)' when
+        // the signature lets one, 'fallback' otherwise.
+        template < typename M, typename R, typename ... A, typename F, typename E >
+        static void* entry(F function, M* const mock, R(*call)(M*, A ...), E fallback, const char* const name) {
+#ifdef JOMOCK_THUNK_SUPPORT
+            if (JoMockThunkable<R(A ...)>::value && enabled()) {
+                void* const thunk = get(reinterpret_cast<void*>((std::size_t&)function), mock,
+                    reinterpret_cast<void*>((std::size_t&)call), name);
+                if (thunk != nullptr) return thunk;
+            }
+#else
+            (void)function;
+            (void)mock;
+            (void)call;
+            (void)name;
+#endif
+            return reinterpret_cast<void*>((std::size_t&)fallback);
+        }
+
+        // Frees the thunks made for 'mock', once its jumps are reverted. A line already written to the perf map
+        // stays : perf takes the last one given for an address.
+        static void release(const void* const mock) {
+#ifdef JOMOCK_THUNK_SUPPORT
+            std::lock_guard<std::mutex> lock(mutex());
+            std::map<Key, Thunk>& made = thunks();
+            for (std::map<Key, Thunk>::iterator thunk = made.lower_bound(Key(mock, nullptr));
+                thunk != made.end() && thunk->first.first == mock; thunk = made.erase(thunk)) {
+                unregisterCode(thunk->second);
+                JoMockExecutableMemory::release(thunk->second.code, kSize);
+            }
+#else
+            (void)mock;
+#endif
+        }
+
+        // The thunk made for 'mock', nullptr when it has none.
+        static const void* find(const void* const mock) {
+#ifdef JOMOCK_THUNK_SUPPORT
+            std::lock_guard<std::mutex> lock(mutex());
+            for (const std::pair<const Key, Thunk>& thunk : thunks()) {
+                if (thunk.first.first == mock) return thunk.second.code;
+            }
+#else
+            (void)mock;
+#endif
+            return nullptr;
+        }
+
+#ifdef JOMOCK_THUNK_SUPPORT
+    private:
+        typedef std::pair<const void*, const void*> Key; // the mock, the entry.
+
+        struct Thunk {
+            void* code;
+            std::string symbol;
+            std::vector<char> symbolFile;
+            JoMockJitEntry entry;
+        };
+
+        static std::mutex& mutex() {
+            static std::mutex value;
+            return value;
+        }
+
+        static bool& perfMap() {
+            static bool value = false;
+            return value;
+        }
+
+        static std::map<Key, Thunk>& thunks() {
+            static std::map<Key, Thunk> value;
+            return value;
+        }
+
+        static void* get(const void* const function, const void* const mock, const void* const destination, const char* const name) {
+            std::lock_guard<std::mutex> lock(mutex());
+            const Key key(mock, destination);
+            const std::map<Key, Thunk>::iterator found = thunks().find(key);
+            if (found != thunks().end()) return found->second.code;
+            void* code = JoMockExecutableMemory::allocate(kSize, function);
+            if (code == nullptr) code = JoMockExecutableMemory::allocate(kSize); // reached through a veneer.
+            char bytes[kSize];
+            encode(bytes, mock, destination);
+            if (code == nullptr || !JoMockExecutableMemory::write(code, bytes, kSize)) return nullptr;
+            Thunk& thunk = thunks()[key];
+            thunk.code = code;
+            thunk.symbol = std::string("jomock:") + name;
+            if (perfMap()) writePerfMap(thunk);
+            registerCode(thunk);
+            return code;
+        }
+
+        static void encode(char* const code, const void* const mock, const void* const destination) {
+#ifdef ARM64_SUPPORT
+            std::uint32_t instructions[10];
+            for (std::uint32_t i = 0; i < 7; ++i) {
+                instructions[i] = 0xAA0003E0 | ((6 - i) << 16) | (7 - i); // mov x7, x6 ... mov x1, x0
+            }
+            instructions[7] = 0x58000060; // ldr x0, #12 (the mock)
+            instructions[8] = 0x58000090; // ldr x16, #16 (the entry)
+            instructions[9] = 0xD61F0200; // br x16
+            std::memcpy(code, instructions, sizeof(instructions));
+            std::memcpy(code + 40, &mock, sizeof(mock));
+            std::memcpy(code + 48, &destination, sizeof(destination));
+#else
+            static const unsigned char shift[] = {
+                0x4D, 0x89, 0xC1, // mov r9, r8
+                0x49, 0x89, 0xC8, // mov r8, rcx
+                0x48, 0x89, 0xD1, // mov rcx, rdx
+                0x48, 0x89, 0xF2, // mov rdx, rsi
+                0x48, 0x89, 0xFE, // mov rsi, rdi
+                0x48, 0xBF };     // movabs rdi, the mock
+            static const unsigned char jump[] = { 0xFF, 0x25, 0x00, 0x00, 0x00, 0x00 }; // jmp [rip + 0]
+            std::memcpy(code, shift, sizeof(shift));
+            std::memcpy(code + 17, &mock, sizeof(mock));
+            std::memcpy(code + 25, jump, sizeof(jump));
+            std::memcpy(code + 31, &destination, sizeof(destination));
+#endif
+        }
+
+        // By the system calls : the libc file functions may be mocked.
+        static void writePerfMap(const Thunk& thunk) {
+            char path[64];
+            snprintf(path, sizeof(path), "/tmp/perf-%d.map", static_cast<int>(getpid()));
+            const long file = syscall(SYS_openat, AT_FDCWD, path, O_WRONLY | O_CREAT | O_APPEND | O_CLOEXEC, 0644);
+            if (file < 0) return;
+            char line[512];
+            const int length = snprintf(line, sizeof(line), "%zx %zx %s\n", reinterpret_cast<std::size_t>(thunk.code),
+                kSize, thunk.symbol.c_str());
+            if (length > 0) {
+                syscall(SYS_write, file, line, std::min(static_cast<std::size_t>(length), sizeof(line) - 1));
+            }
+            syscall(SYS_close, file);
+        }
+
+        // The descriptor and the function of GDB's JIT interface : the program's, or those of a library.
+        static bool jitInterface(JoMockJitDescriptor*& descriptor, void(*&notify)()) {
+            descriptor = &__jit_debug_descriptor;
+            notify = &__jit_debug_register_code;
+            if (descriptor == nullptr || notify == nullptr) {
+                descriptor = static_cast<JoMockJitDescriptor*>(dlsym(RTLD_DEFAULT, "__jit_debug_descriptor"));
+                notify = reinterpret_cast<void(*)()>(dlsym(RTLD_DEFAULT, "__jit_debug_register_code"));
+            }
+            return descriptor != nullptr && notify != nullptr;
+        }
+
+        static void registerCode(Thunk& thunk) {
+            JoMockJitDescriptor* descriptor;
+            void(*notify)();
+            if (!jitInterface(descriptor, notify)) return;
+            thunk.symbolFile = symbolFile(thunk.code, thunk.symbol);
+            thunk.entry.symbolFile = thunk.symbolFile.data();
+            thunk.entry.symbolFileSize = thunk.symbolFile.size();
+            thunk.entry.previous = nullptr;
+            thunk.entry.next = descriptor->first;
+            if (thunk.entry.next != nullptr) {
+                thunk.entry.next->previous = &thunk.entry;
+            }
+            descriptor->first = &thunk.entry;
+            descriptor->relevant = &thunk.entry;
+            descriptor->action = 1;
+            notify();
+            descriptor->action = 0;
+        }
+
+        static void unregisterCode(Thunk& thunk) {
+            JoMockJitDescriptor* descriptor;
+            void(*notify)();
+            if (thunk.symbolFile.empty() || !jitInterface(descriptor, notify)) return;
+            if (thunk.entry.previous != nullptr) {
+                thunk.entry.previous->next = thunk.entry.next;
+            } else {
+                descriptor->first = thunk.entry.next;
+            }
+            if (thunk.entry.next != nullptr) {
+                thunk.entry.next->previous = thunk.entry.previous;
+            }
+            descriptor->relevant = &thunk.entry;
+            descriptor->action = 2;
+            notify();
+            descriptor->action = 0;
+        }
+
+        // A relocatable ELF file with a .text section at 'code' and one function symbol over it.
+        static std::vector<char> symbolFile(const void* const code, const std::string& symbol) {
+            static const char sectionNames[] = "\0.text\0.symtab\0.strtab\0.shstrtab";
+            const std::size_t namesOffset = sizeof(Elf64_Ehdr);
+            const std::size_t stringsOffset = namesOffset + sizeof(sectionNames);
+            const std::size_t stringsSize = symbol.size() + 2;
+            const std::size_t symbolsOffset = (stringsOffset + stringsSize + 7) & ~static_cast<std::size_t>(7);
+            const std::size_t sectionsOffset = symbolsOffset + 2 * sizeof(Elf64_Sym);
+            std::vector<char> file(sectionsOffset + 5 * sizeof(Elf64_Shdr), 0);
+
+            Elf64_Ehdr header;
+            std::memset(&header, 0, sizeof(header));
+            std::memcpy(header.e_ident, ELFMAG, SELFMAG);
+            header.e_ident[EI_CLASS] = ELFCLASS64;
+            header.e_ident[EI_DATA] = ELFDATA2LSB;
+            header.e_ident[EI_VERSION] = EV_CURRENT;
+            header.e_ident[EI_OSABI] = ELFOSABI_SYSV;
+            header.e_type = ET_REL;
+#ifdef ARM64_SUPPORT
+            header.e_machine = EM_AARCH64;
+#else
+            header.e_machine = EM_X86_64;
+#endif
+            header.e_version = EV_CURRENT;
+            header.e_shoff = sectionsOffset;
+            header.e_ehsize = sizeof(Elf64_Ehdr);
+            header.e_shentsize = sizeof(Elf64_Shdr);
+            header.e_shnum = 5;
+            header.e_shstrndx = 4;
+            std::memcpy(file.data(), &header, sizeof(header));
+            std::memcpy(file.data() + namesOffset, sectionNames, sizeof(sectionNames));
+            std::memcpy(file.data() + stringsOffset + 1, symbol.data(), symbol.size());
+
+            Elf64_Sym symbols[2];
+            std::memset(symbols, 0, sizeof(symbols));
+            symbols[1].st_name = 1;
+            symbols[1].st_info = ELF64_ST_INFO(STB_GLOBAL, STT_FUNC);
+            symbols[1].st_shndx = 1;
+            symbols[1].st_size = kSize;
+            std::memcpy(file.data() + symbolsOffset, symbols, sizeof(symbols));
+
+            Elf64_Shdr sections[5];
+            std::memset(sections, 0, sizeof(sections));
+            sections[1].sh_name = 1; // .text, its code is in memory.
+            sections[1].sh_type = SHT_NOBITS;
+            sections[1].sh_flags = SHF_ALLOC | SHF_EXECINSTR;
+            sections[1].sh_addr = reinterpret_cast<std::size_t>(code);
+            sections[1].sh_size = kSize;
+            sections[1].sh_addralign = 16;
+            sections[2].sh_name = 7; // .symtab
+            sections[2].sh_type = SHT_SYMTAB;
+            sections[2].sh_offset = symbolsOffset;
+            sections[2].sh_size = sizeof(symbols);
+            sections[2].sh_link = 3;
+            sections[2].sh_info = 1;
+            sections[2].sh_addralign = 8;
+            sections[2].sh_entsize = sizeof(Elf64_Sym);
+            sections[3].sh_name = 15; // .strtab
+            sections[3].sh_type = SHT_STRTAB;
+            sections[3].sh_offset = stringsOffset;
+            sections[3].sh_size = stringsSize;
+            sections[3].sh_addralign = 1;
+            sections[4].sh_name = 23; // .shstrtab
+            sections[4].sh_type = SHT_STRTAB;
+            sections[4].sh_offset = namesOffset;
+            sections[4].sh_size = sizeof(sectionNames);
+            sections[4].sh_addralign = 1;
+            std::memcpy(file.data() + sectionsOffset, sections, sizeof(sections));
+            return file;
+        }
+#endif
+    };
+
+    // Original bytes of a patched entry, kept inline.
+    struct JoMockBackup {
+        JoMockBackup() : length(0) {}
+
+        void assign(const char* const code, const std::size_t size) {
+            length = size < sizeof(bytes) ? size : sizeof(bytes);
+            std::memcpy(bytes, code, length);
+        }
+
+        void clear() { length = 0; }
+        bool empty() const { return length == 0; }
+        std::size_t size() const { return length; }
+        const char* data() const { return bytes; }
+        const char* begin() const { return bytes; }
+        const char* end() const { return bytes + length; }
+
+    private:
+        char bytes[JoMockPatchTransaction::kMaxPatchSize];
+        std::size_t length;
+    };
+
+    // Entry patched on behalf of a whole class (JoMockClass).
+    struct JoMockClaim {
+        JoMockClaim() : taken(false) {}
+
+        JoMockBackup backup; // original bytes, empty while the entry is not patched for the class.
+        bool taken; // a mock of its own took the entry over.
+    };
+
+    // Claimed entries. A graft at a claimed entry takes it over : the class's jump is reverted first, and
+    // the class leaves the entry alone from then on.
+    struct JoMockClaims {
+        static void claim(const void* const address, JoMockClaim* const claim) {
+            std::lock_guard<std::mutex> lock(mutex());
+            claims()[address] = claim;
+            count().store(claims().size());
+        }
+
+        static void release(const void* const address) {
+            std::lock_guard<std::mutex> lock(mutex());
+            claims().erase(address);
+            count().store(claims().size());
+        }
+
+        // Moves the original bytes of the claimed entry at 'address' to 'backup'. False when it is not claimed.
+        static bool take(const void* const address, JoMockBackup& backup) {
+            if (count().load(std::memory_order_relaxed) == 0) return false;
+            std::lock_guard<std::mutex> lock(mutex());
+            const std::unordered_map<const void*, JoMockClaim*>::iterator found = claims().find(address);
+            if (found == claims().end()) return false;
+            backup = found->second->backup;
+            found->second->backup.clear();
+            found->second->taken = true;
+            claims().erase(found);
+            count().store(claims().size());
+            return true;
+        }
+
+    private:
+        static std::mutex& mutex() {
+            static std::mutex value;
+            return value;
+        }
+
+        static std::unordered_map<const void*, JoMockClaim*>& claims() {
+            static std::unordered_map<const void*, JoMockClaim*> value;
+            return value;
+        }
+
+        static std::atomic<std::size_t>& count() {
+            static std::atomic<std::size_t> value(0);
+            return value;
+        }
+    };
+
+#ifdef JOMOCK_IMPORT_SUPPORT
+    // GOT entry through which a module reaches an imported function.
+    struct JoMockImportSlot {
+        void** address;
+        bool relro; // read-only once the module is relocated.
+    };
+
+    // Slots of one symbol in the selected modules. Records are never freed : they key import mocks in the registry.
+    struct JoMockImportSymbol {
+        std::string name;
+        void* original; // definition found by the dynamic linker.
+        unsigned long long generation; // module set the slots were collected from.
+        std::vector<JoMockImportSlot> slots;
+        std::vector<void*> saved; // slot values replaced by the installed mock, empty otherwise.
+    };
+
+    // Index of the JUMP_SLOT and GLOB_DAT relocations of the loaded modules. A module is parsed the first
+    // time a symbol is looked up in it, and the slots of a symbol are kept until a module is loaded or unloaded.
+    struct JoMockImportIndex {
+        // Slots of 'name' in the modules whose path contains 'module' ("" is the program), or in all modules.
+        static JoMockImportSymbol* find(const char* const name, const char* const module) {
+            std::lock_guard<std::mutex> lock(mutex());
+            const unsigned long long current = generation();
+            if (current != loaded()) {
+                refresh();
+                loaded() = current;
+            }
+            std::string key(module == nullptr ? "*" : "=");
+            key.append(module == nullptr ? "" : module).push_back('\0');
+            key.append(name);
+            std::unique_ptr<JoMockImportSymbol>& record = symbols()[key];
+            if (!record) {
+                record.reset(new JoMockImportSymbol());
+                record->name = name;
+                record->original = nullptr;
+                record->generation = 0;
+            }
+            if (record->generation != current && record->saved.empty()) { // a live mock keeps its slots.
+                record->slots.clear();
+                for (std::unique_ptr<Module>& loadedModule : modules()) {
+                    if (module != nullptr && (module[0] == '\0' ? !loadedModule->path.empty() : loadedModule->path.find(module) == std::string::npos)) {
+                        continue;
+                    }
+                    if (!loadedModule->indexed) {
+                        index(*loadedModule);
+                    }
+                    auto got = loadedModule->slots.find(record->name);
+                    if (got != loadedModule->slots.end()) {
+                        record->slots.insert(record->slots.end(), got->second.begin(), got->second.end());
+                    }
+                }
+                record->original = dlsym(RTLD_DEFAULT, name);
+                record->generation = current;
+            }
+            return record.get();
+        }
+
+        // Loads and unloads seen by the dynamic linker.
+        static unsigned long long generation() {
+            unsigned long long value = 0;
+            dl_iterate_phdr([](struct dl_phdr_info* info, std::size_t, void* data) {
+                *static_cast<unsigned long long*>(data) = info->dlpi_adds + info->dlpi_subs;
+                return 1;
+            }, &value);
+            return value;
+        }
+
+        // One pointer store : no instruction is changed, so no cache is flushed.
+        static void write(const JoMockImportSlot& slot, void* const value) {
+            std::lock_guard<std::mutex> lock(SingletonBase<std::mutex>::getInstance());
+            void* const page = reinterpret_cast<void*>(JoMockPage::alignAddress(reinterpret_cast<std::size_t>(slot.address), JoMockPage::pageSize()));
+            if (slot.relro && mprotect(page, JoMockPage::pageSize(), PROT_READ | PROT_WRITE) != 0) {
+                fprintf(stderr, "jomock: cannot unprotect the GOT entry at %p\n", static_cast<void*>(slot.address));
+                std::abort();
+            }
+            __atomic_store_n(slot.address, value, __ATOMIC_RELEASE);
+            if (slot.relro) {
+                mprotect(page, JoMockPage::pageSize(), PROT_READ);
+            }
+        }
+
+    private:
+        struct Module {
+            std::string path;
+            ElfW(Addr) base;
+            const ElfW(Dyn)* dynamic;
+            ElfW(Addr) relroBegin;
+            ElfW(Addr) relroEnd;
+            bool indexed;
+            std::unordered_map<std::string, std::vector<JoMockImportSlot>> slots;
+        };
+
+        static std::mutex& mutex() {
+            static std::mutex value;
+            return value;
+        }
+
+        static unsigned long long& loaded() {
+            static unsigned long long value = ~0ULL;
+            return value;
+        }
+
+        static std::vector<std::unique_ptr<Module>>& modules() {
+            static std::vector<std::unique_ptr<Module>> value;
+            return value;
+        }
+
+        static std::unordered_map<std::string, std::unique_ptr<JoMockImportSymbol>>& symbols() {
+            static std::unordered_map<std::string, std::unique_ptr<JoMockImportSymbol>> value;
+            return value;
+        }
+
+        // Lists the loaded modules again, keeping the index of the ones still loaded at the same place.
+        static void refresh() {
+            std::vector<std::unique_ptr<Module>> previous;
+            previous.swap(modules());
+            dl_iterate_phdr([](struct dl_phdr_info* info, std::size_t, void* data) {
+                std::vector<std::unique_ptr<Module>>& previous = *static_cast<std::vector<std::unique_ptr<Module>>*>(data);
+                const std::string path(info->dlpi_name == nullptr ? "" : info->dlpi_name);
+                for (std::unique_ptr<Module>& known : previous) {
+                    if (known && known->base == info->dlpi_addr && known->path == path) {
+                        modules().push_back(std::move(known));
+                        return 0;
+                    }
+                }
+                std::unique_ptr<Module> module(new Module());
+                module->path = path;
+                module->base = info->dlpi_addr;
+                module->dynamic = nullptr;
+                module->relroBegin = module->relroEnd = 0;
+                module->indexed = false;
+                for (ElfW(Half) i = 0; i < info->dlpi_phnum; ++i) {
+                    const ElfW(Phdr)& header = info->dlpi_phdr[i];
+                    if (header.p_type == PT_DYNAMIC) {
+                        module->dynamic = reinterpret_cast<const ElfW(Dyn)*>(info->dlpi_addr + header.p_vaddr);
+                    }
+                    else if (header.p_type == PT_GNU_RELRO) {
+                        module->relroBegin = info->dlpi_addr + header.p_vaddr;
+                        // the dynamic linker protects whole pages only.
+                        module->relroEnd = JoMockPage::alignAddress(module->relroBegin + header.p_memsz, JoMockPage::pageSize());
+                    }
+                }
+                modules().push_back(std::move(module));
+                return 0;
+            }, &previous);
+        }
+
+        // Most dynamic linkers relocate the dynamic section in place, the vDSO's is left as file offsets.
+        static ElfW(Addr) pointer(const Module& module, const ElfW(Addr) value) {
+            return value < module.base ? module.base + value : value;
+        }
+
+        static void index(Module& module) {
+            module.indexed = true;
+            if (module.dynamic == nullptr) return;
+            const ElfW(Sym)* symbols = nullptr;
+            const char* strings = nullptr;
+            const ElfW(Rela)* relocations[2] = { nullptr, nullptr };
+            std::size_t sizes[2] = { 0, 0 };
+            bool rela = true;
+            for (const ElfW(Dyn)* entry = module.dynamic; entry->d_tag != DT_NULL; ++entry) {
+                switch (entry->d_tag) {
+                case DT_SYMTAB: symbols = reinterpret_cast<const ElfW(Sym)*>(pointer(module, entry->d_un.d_ptr)); break;
+                case DT_STRTAB: strings = reinterpret_cast<const char*>(pointer(module, entry->d_un.d_ptr)); break;
+                case DT_RELA: relocations[0] = reinterpret_cast<const ElfW(Rela)*>(pointer(module, entry->d_un.d_ptr)); break;
+                case DT_RELASZ: sizes[0] = entry->d_un.d_val; break;
+                case DT_JMPREL: relocations[1] = reinterpret_cast<const ElfW(Rela)*>(pointer(module, entry->d_un.d_ptr)); break;
+                case DT_PLTRELSZ: sizes[1] = entry->d_un.d_val; break;
+                case DT_PLTREL: rela = entry->d_un.d_val == DT_RELA; break;
+                default: break;
+                }
+            }
+            if (symbols == nullptr || strings == nullptr) return;
+            if (!rela) sizes[1] = 0;
+#ifdef ARM64_SUPPORT
+            const unsigned long kJumpSlot = R_AARCH64_JUMP_SLOT, kGlobalData = R_AARCH64_GLOB_DAT;
+#else
+            const unsigned long kJumpSlot = R_X86_64_JUMP_SLOT, kGlobalData = R_X86_64_GLOB_DAT;
+#endif
+            for (int table = 0; table < 2; ++table) {
+                if (relocations[table] == nullptr) continue;
+                for (std::size_t i = 0; i < sizes[table] / sizeof(ElfW(Rela)); ++i) {
+                    const ElfW(Rela)& relocation = relocations[table][i];
+                    const unsigned long type = ELF64_R_TYPE(relocation.r_info);
+                    const unsigned long symbol = ELF64_R_SYM(relocation.r_info);
+                    if ((type != kJumpSlot && type != kGlobalData) || symbol == 0) continue;
+                    JoMockImportSlot slot;
+                    slot.address = reinterpret_cast<void**>(module.base + relocation.r_offset);
+                    const ElfW(Addr) address = reinterpret_cast<ElfW(Addr)>(slot.address);
+                    slot.relro = address >= module.relroBegin && address < module.relroEnd;
+                    module.slots[strings + symbols[symbol].st_name].push_back(slot);
+                }
+            }
+        }
+    };
+#endif
+
+#ifdef JOMOCK_SYMBOL_SUPPORT
+    // Inlined calls recorded in DWARF .debug_info (versions 2 to 5, 32-bit format), grouped by the linkage
+    // name (or the name) of the inlined function. Addresses are the ones of the file.
+    struct JoMockDwarf {
+        struct Section {
+            const unsigned char* data;
+            std::size_t size;
+        };
+
+        struct Sections {
+            Section info, abbrev, str, lineStr, addr, strOffsets;
+        };
+
+        struct Site {
+            std::uint64_t address; // entry of the inlined code, 0 if not recorded.
+            unsigned line; // line of the call.
+        };
+
+        static void inlinedCalls(const Sections& sections, std::unordered_map<std::string, std::vector<Site>>& calls) {
+            if (sections.info.data == nullptr || sections.abbrev.data == nullptr) return;
+            Reader reader(sections);
+            std::vector<std::pair<std::uint64_t, Site>> pending; // abstract origin of each inlined call.
+            const unsigned char* p = sections.info.data;
+            const unsigned char* const end = p + sections.info.size;
+            while (p + 11 <= end) {
+                Unit unit;
+                if (!reader.header(p, end, unit)) break;
+                p = unit.dies;
+                const std::vector<Abbrev>& table = reader.abbrevs(unit.abbrevOffset);
+                while (p < unit.end) {
+                    const std::uint64_t code = uleb(p, unit.end);
+                    if (code == 0) continue;
+                    if (code >= table.size() || table[code].tag == 0) break;
+                    const Abbrev& abbrev = table[code];
+                    if (abbrev.skip != 0) { // nothing read from it, all fixed size.
+                        p += abbrev.skip;
+                        continue;
+                    }
+                    Site site = { 0, 0 };
+                    std::uint64_t origin = 0;
+                    bool hasEntry = false;
+                    for (const Attribute& attribute : abbrev.attributes) {
+                        Value value;
+                        if (!reader.read(attribute, p, unit, value)) {
+                            p = unit.end;
+                            break;
+                        }
+                        switch (attribute.name) {
+                        case 0x11: if (value.kind == Value::kAddress && !hasEntry) site.address = value.number; break; // low_pc
+                        case 0x52: if (value.kind == Value::kAddress) { site.address = value.number; hasEntry = true; } break; // entry_pc
+                        case 0x31: if (value.kind == Value::kReference) origin = value.number; break; // abstract_origin
+                        case 0x59: site.line = static_cast<unsigned>(value.number); break; // call_line
+                        case 0x73: unit.addrBase = value.number; break; // addr_base
+                        case 0x72: unit.strOffsetsBase = value.number; break; // str_offsets_base
+                        default: break;
+                        }
+                    }
+                    if (abbrev.tag == 0x1D && origin != 0) { // inlined_subroutine
+                        pending.push_back(std::make_pair(origin, site));
+                    }
+                }
+                reader.remember(unit);
+                p = unit.end;
+            }
+            std::unordered_map<std::uint64_t, std::string> names;
+            for (const std::pair<std::uint64_t, Site>& call : pending) {
+                auto known = names.find(call.first);
+                if (known == names.end()) {
+                    known = names.insert(std::make_pair(call.first, reader.name(call.first, 0))).first;
+                }
+                if (!known->second.empty()) {
+                    calls[known->second].push_back(call.second);
+                }
+            }
+        }
+
+    private:
+        struct Attribute {
+            std::uint64_t name;
+            std::uint64_t form;
+            std::int64_t implicit;
+        };
+
+        struct Abbrev {
+            std::uint64_t tag;
+            std::vector<Attribute> attributes;
+            std::size_t skip; // size of the attributes when they all have a fixed size and none is read, 0 otherwise.
+        };
+
+        struct Unit {
+            std::uint64_t offset;
+            const unsigned char* dies;
+            const unsigned char* end;
+            unsigned version;
+            unsigned addressSize;
+            std::uint64_t abbrevOffset;
+            std::uint64_t addrBase;
+            std::uint64_t strOffsetsBase;
+        };
+
+        struct Value {
+            enum Kind { kNumber, kAddress, kReference, kString, kOther };
+            Kind kind;
+            std::uint64_t number;
+            const char* string;
+        };
+
+        static std::uint64_t uleb(const unsigned char*& p, const unsigned char* const end) {
+            std::uint64_t value = 0;
+            for (unsigned shift = 0; p < end; shift += 7) {
+                const unsigned char byte = *p++;
+                if (shift < 64) value |= static_cast<std::uint64_t>(byte & 0x7F) << shift;
+                if ((byte & 0x80) == 0) break;
+            }
+            return value;
+        }
+
+        static std::int64_t sleb(const unsigned char*& p, const unsigned char* const end) {
+            std::int64_t value = 0;
+            unsigned shift = 0;
+            unsigned char byte = 0;
+            while (p < end) {
+                byte = *p++;
+                if (shift < 64) value |= static_cast<std::int64_t>(byte & 0x7F) << shift;
+                shift += 7;
+                if ((byte & 0x80) == 0) break;
+            }
+            if (shift < 64 && (byte & 0x40) != 0) value |= -(static_cast<std::int64_t>(1) << shift);
+            return value;
+        }
+
+        static std::uint64_t fixed(const unsigned char*& p, const std::size_t size) {
+            std::uint64_t value = 0;
+            for (std::size_t i = 0; i < size; ++i) {
+                value |= static_cast<std::uint64_t>(p[i]) << (8 * i);
+            }
+            p += size;
+            return value;
+        }
+
+        class Reader {
+        public:
+            explicit Reader(const Sections& _sections) : sections(_sections) {}
+
+            bool header(const unsigned char* p, const unsigned char* const end, Unit& unit) {
+                unit.offset = p - sections.info.data;
+                const std::uint64_t length = fixed(p, 4);
+                if (length >= 0xFFFFFFF0 || length > static_cast<std::uint64_t>(end - p)) return false; // 64-bit DWARF is not read.
+                unit.end = p + length;
+                unit.version = static_cast<unsigned>(fixed(p, 2));
+                unit.addrBase = 8; // after the .debug_addr header, when the unit does not say.
+                unit.strOffsetsBase = 8;
+                unit.dies = unit.end; // units not read are skipped.
+                if (unit.version < 2 || unit.version > 5) return true;
+                if (unit.version >= 5) {
+                    const unsigned type = *p++;
+                    unit.addressSize = *p++;
+                    unit.abbrevOffset = fixed(p, 4);
+                    if (type != 1 && type != 3) return true; // compile and partial units only.
+                }
+                else {
+                    unit.abbrevOffset = fixed(p, 4);
+                    unit.addressSize = *p++;
+                }
+                if (unit.abbrevOffset < sections.abbrev.size) {
+                    unit.dies = p;
+                }
+                return true;
+            }
+
+            const std::vector<Abbrev>& abbrevs(const std::uint64_t offset) {
+                std::vector<Abbrev>& table = tables[offset];
+                if (!table.empty()) return table;
+                table.resize(1);
+                const unsigned char* p = sections.abbrev.data + offset;
+                const unsigned char* const end = sections.abbrev.data + sections.abbrev.size;
+                while (p < end) {
+                    const std::uint64_t code = uleb(p, end);
+                    if (code == 0 || code > (1u << 20)) break;
+                    Abbrev abbrev;
+                    abbrev.tag = uleb(p, end);
+                    abbrev.skip = 0;
+                    ++p; // children
+                    bool fixedSize = abbrev.tag != 0x1D; // inlined_subroutine
+                    for (;;) {
+                        Attribute attribute;
+                        attribute.name = uleb(p, end);
+                        attribute.form = uleb(p, end);
+                        attribute.implicit = attribute.form == 0x21 ? sleb(p, end) : 0;
+                        if (attribute.name == 0 && attribute.form == 0) break;
+                        abbrev.attributes.push_back(attribute);
+                        const std::size_t size = formSize(attribute.form);
+                        fixedSize = fixedSize && size != SIZE_MAX && attribute.name != 0x73 && attribute.name != 0x72;
+                        abbrev.skip += size;
+                    }
+                    if (!fixedSize || abbrev.attributes.empty()) abbrev.skip = 0;
+                    if (table.size() <= code) table.resize(code + 1);
+                    table[code] = abbrev;
+                }
+                return table;
+            }
+
+            bool read(const Attribute& attribute, const unsigned char*& p, const Unit& unit, Value& result) const {
+                const unsigned char* const end = unit.end;
+                result.kind = Value::kNumber;
+                result.number = 0;
+                result.string = nullptr;
+                std::uint64_t form = attribute.form;
+                if (form == 0x16) form = uleb(p, end); // indirect
+                switch (form) {
+                case 0x01: result.kind = Value::kAddress; result.number = fixed(p, unit.addressSize); return true;
+                case 0x1B: case 0x29: case 0x2A: case 0x2B: case 0x2C: { // addrx
+                    const std::uint64_t index = form == 0x1B ? uleb(p, end) : fixed(p, form - 0x28);
+                    const std::uint64_t at = unit.addrBase + index * unit.addressSize;
+                    if (sections.addr.data == nullptr || at + unit.addressSize > sections.addr.size) return true;
+                    const unsigned char* address = sections.addr.data + at;
+                    result.kind = Value::kAddress;
+                    result.number = fixed(address, unit.addressSize);
+                    return true;
+                }
+                case 0x0B: result.number = fixed(p, 1); return true;
+                case 0x05: result.number = fixed(p, 2); return true;
+                case 0x06: result.number = fixed(p, 4); return true;
+                case 0x07: result.number = fixed(p, 8); return true;
+                case 0x0D: result.number = static_cast<std::uint64_t>(sleb(p, end)); return true;
+                case 0x0F: result.number = uleb(p, end); return true;
+                case 0x21: result.number = static_cast<std::uint64_t>(attribute.implicit); return true;
+                case 0x17: result.number = fixed(p, 4); return true; // sec_offset
+                case 0x11: result.kind = Value::kReference; result.number = unit.offset + fixed(p, 1); return true;
+                case 0x12: result.kind = Value::kReference; result.number = unit.offset + fixed(p, 2); return true;
+                case 0x13: result.kind = Value::kReference; result.number = unit.offset + fixed(p, 4); return true;
+                case 0x14: result.kind = Value::kReference; result.number = unit.offset + fixed(p, 8); return true;
+                case 0x15: result.kind = Value::kReference; result.number = unit.offset + uleb(p, end); return true;
+                case 0x10: result.kind = Value::kReference; result.number = fixed(p, unit.version == 2 ? unit.addressSize : 4); return true;
+                case 0x08: // string
+                    result.kind = Value::kString;
+                    result.string = reinterpret_cast<const char*>(p);
+                    while (p < end && *p != 0) ++p;
+                    ++p;
+                    return true;
+                case 0x0E: result.kind = Value::kString; result.string = string(sections.str, fixed(p, 4)); return true;
+                case 0x1F: result.kind = Value::kString; result.string = string(sections.lineStr, fixed(p, 4)); return true;
+                case 0x1A: case 0x25: case 0x26: case 0x27: case 0x28: { // strx
+                    const std::uint64_t index = form == 0x1A ? uleb(p, end) : fixed(p, form - 0x24);
+                    const std::uint64_t at = unit.strOffsetsBase + index * 4;
+                    result.kind = Value::kString;
+                    if (sections.strOffsets.data != nullptr && at + 4 <= sections.strOffsets.size) {
+                        const unsigned char* offset = sections.strOffsets.data + at;
+                        result.string = string(sections.str, fixed(offset, 4));
+                    }
+                    return true;
+                }
+                case 0x0C: p += 1; result.kind = Value::kOther; return true; // flag
+                case 0x19: result.kind = Value::kOther; return true; // flag_present
+                case 0x0A: { const std::uint64_t size = fixed(p, 1); p += size; result.kind = Value::kOther; return true; }
+                case 0x03: { const std::uint64_t size = fixed(p, 2); p += size; result.kind = Value::kOther; return true; }
+                case 0x04: { const std::uint64_t size = fixed(p, 4); p += size; result.kind = Value::kOther; return true; }
+                case 0x09: case 0x18: { const std::uint64_t size = uleb(p, end); p += size; result.kind = Value::kOther; return true; }
+                case 0x1E: p += 16; result.kind = Value::kOther; return true; // data16
+                case 0x20: case 0x24: p += 8; result.kind = Value::kOther; return true; // ref_sig8, ref_sup8
+                case 0x1C: case 0x1D: case 0x1F20: case 0x1F21: p += 4; result.kind = Value::kOther; return true; // sup and alt
+                case 0x22: case 0x23: case 0x1F01: case 0x1F02: uleb(p, end); result.kind = Value::kOther; return true;
+                default: return false;
+                }
+            }
+
+            void remember(const Unit& unit) {
+                if (unit.dies != unit.end) units.push_back(unit);
+            }
+
+            // Linkage name of the function described at 'offset', following abstract_origin and specification.
+            std::string name(const std::uint64_t offset, const int depth) {
+                auto unit = std::upper_bound(units.begin(), units.end(), offset,
+                    [](const std::uint64_t value, const Unit& candidate) { return value < candidate.offset; });
+                if (unit == units.begin() || depth > 8) return std::string();
+                --unit;
+                const unsigned char* p = sections.info.data + offset;
+                if (p < unit->dies || p >= unit->end) return std::string();
+                const std::vector<Abbrev>& table = abbrevs(unit->abbrevOffset);
+                const std::uint64_t code = uleb(p, unit->end);
+                if (code == 0 || code >= table.size()) return std::string();
+                const char* linkageName = nullptr;
+                const char* plainName = nullptr;
+                std::uint64_t next = 0;
+                for (const Attribute& attribute : table[code].attributes) {
+                    Value value;
+                    if (!read(attribute, p, *unit, value)) break;
+                    if ((attribute.name == 0x6E || attribute.name == 0x2007) && value.kind == Value::kString) linkageName = value.string;
+                    else if (attribute.name == 0x03 && value.kind == Value::kString) plainName = value.string;
+                    else if ((attribute.name == 0x31 || attribute.name == 0x47) && value.kind == Value::kReference) next = value.number;
+                }
+                if (linkageName != nullptr) return linkageName;
+                if (next != 0) {
+                    const std::string found = name(next, depth + 1);
+                    if (!found.empty()) return found;
+                }
+                return plainName != nullptr ? plainName : std::string();
+            }
+
+        private:
+            // Size of a form in a loaded module (32-bit DWARF, native addresses), SIZE_MAX when it varies.
+            static std::size_t formSize(const std::uint64_t form) {
+                switch (form) {
+                case 0x01: return sizeof(void*);
+                case 0x0B: case 0x11: case 0x0C: case 0x25: case 0x29: return 1;
+                case 0x05: case 0x12: case 0x26: case 0x2A: return 2;
+                case 0x27: case 0x2B: return 3;
+                case 0x06: case 0x13: case 0x17: case 0x0E: case 0x1F: case 0x28: case 0x2C: case 0x1C: case 0x1D: return 4;
+                case 0x07: case 0x14: case 0x20: case 0x24: return 8;
+                case 0x1E: return 16;
+                case 0x19: case 0x21: return 0;
+                default: return SIZE_MAX;
+                }
+            }
+
+            static const char* string(const Section& section, const std::uint64_t offset) {
+                return section.data != nullptr && offset < section.size ? reinterpret_cast<const char*>(section.data + offset) : nullptr;
+            }
+
+            const Sections& sections;
+            std::unordered_map<std::uint64_t, std::vector<Abbrev>> tables;
+            std::vector<Unit> units;
+        };
+    };
+
+    // Function symbols of the loaded modules, read from their .symtab and .dynsym. A module's file is mapped
+    // and its symbols sorted by name on the first lookup; demangled names are sorted separately, on the
+    // first lookup by a demangled name. Both stay until the module is unloaded.
+    struct JoMockSymbolIndex {
+        // Address of the function called 'name' : a symbol name, or a demangled name with or without its
+        // parameter list ("ns::helper", "(anonymous namespace)::helper(int)"). nullptr if not found or ambiguous.
+        static void* find(const char* const name) {
+            std::lock_guard<std::mutex> lock(mutex());
+            const unsigned long long current = JoMockImportIndex::generation();
+            if (current != loaded()) {
+                refresh();
+                loaded() = current;
+            }
+            std::vector<ElfW(Addr)> found;
+            for (std::unique_ptr<Module>& module : modules()) {
+                if (!module->parsed) {
+                    parse(*module);
+                }
+                auto range = std::equal_range(module->symbols.begin(), module->symbols.end(), Symbol{ name, 0, 0 }, lessName);
+                for (auto it = range.first; it != range.second; ++it) {
+                    found.push_back(it->address);
+                }
+                if (!found.empty()) break; // the first module defining it, as the dynamic linker does.
+            }
+            if (found.empty()) {
+                const std::string full = normalize(name);
+                const std::string base = full.substr(0, baseLength(full));
+                const bool withParameters = base.size() != full.size();
+                for (std::unique_ptr<Module>& module : modules()) {
+                    if (!module->demangled) {
+                        demangle(*module);
+                    }
+                    Demangled key = { base, std::string(), 0 };
+                    auto range = std::equal_range(module->names.begin(), module->names.end(), key,
+                        [](const Demangled& left, const Demangled& right) { return left.base < right.base; });
+                    for (auto it = range.first; it != range.second; ++it) {
+                        if (!withParameters || it->full == full) {
+                            found.push_back(it->address);
+                        }
+                    }
+                    if (!found.empty()) break;
+                }
+            }
+            std::sort(found.begin(), found.end());
+            found.erase(std::unique(found.begin(), found.end()), found.end());
+            if (found.size() > 1) {
+                fprintf(stderr, "jomock: symbol %s is ambiguous, %zu functions have this name\n", name, found.size());
+                return nullptr;
+            }
+            return found.empty() ? nullptr : reinterpret_cast<void*>(found[0]);
+        }
+
+        // Function symbols starting with one of 'prefixes', with their addresses, from the first module defining any.
+        static std::vector<std::pair<std::string, void*>> findPrefixed(const std::vector<std::string>& prefixes) {
+            std::lock_guard<std::mutex> lock(mutex());
+            const unsigned long long current = JoMockImportIndex::generation();
+            if (current != loaded()) {
+                refresh();
+                loaded() = current;
+            }
+            std::vector<std::pair<std::string, void*>> found;
+            for (std::unique_ptr<Module>& module : modules()) {
+                if (!module->parsed) {
+                    parse(*module);
+                }
+                for (const std::string& prefix : prefixes) {
+                    auto it = std::lower_bound(module->symbols.begin(), module->symbols.end(), Symbol{ prefix.c_str(), 0, 0 }, lessName);
+                    for (; it != module->symbols.end() && std::strncmp(it->name, prefix.c_str(), prefix.size()) == 0; ++it) {
+                        found.push_back(std::make_pair(std::string(it->name), reinterpret_cast<void*>(it->address)));
+                    }
+                }
+                if (!found.empty()) break;
+            }
+            return found;
+        }
+
+        // Size of the function symbol at 'function' (0 if none) and distance to the next function symbol
+        // (SIZE_MAX if none). False when 'function' is in no module with symbols.
+        static bool bounds(const void* const function, std::size_t& size, std::size_t& next) {
+            std::lock_guard<std::mutex> lock(mutex());
+            const ElfW(Addr) address = reinterpret_cast<ElfW(Addr)>(function);
+            Module* const module = moduleOf(address);
+            if (module == nullptr || module->byAddress.empty()) return false;
+            size = 0;
+            next = SIZE_MAX;
+            auto after = std::upper_bound(module->byAddress.begin(), module->byAddress.end(), address,
+                [](const ElfW(Addr) value, const Symbol& symbol) { return value < symbol.address; });
+            if (after != module->byAddress.end()) next = after->address - address;
+            for (auto at = after; at != module->byAddress.begin() && (at - 1)->address == address; --at) {
+                size = std::max<std::size_t>(size, (at - 1)->size);
+            }
+            return true;
+        }
+
+        // Vtable group (_ZTV symbol) containing 'address'. False when there is no such symbol.
+        static bool vtable(const void* const address, const void*& begin, std::size_t& size) {
+            std::lock_guard<std::mutex> lock(mutex());
+            const ElfW(Addr) value = reinterpret_cast<ElfW(Addr)>(address);
+            Module* const module = moduleOf(value);
+            if (module == nullptr) return false;
+            auto after = std::upper_bound(module->vtables.begin(), module->vtables.end(), value,
+                [](const ElfW(Addr) at, const Symbol& symbol) { return at < symbol.address; });
+            if (after == module->vtables.begin() || value >= (after - 1)->address + (after - 1)->size) return false;
+            begin = reinterpret_cast<const void*>((after - 1)->address);
+            size = (after - 1)->size;
+            return true;
+        }
+
+        // Demangled name of the function containing 'address', empty if unknown.
+        static std::string nameAt(const void* const address) {
+            std::lock_guard<std::mutex> lock(mutex());
+            return nameAt(reinterpret_cast<ElfW(Addr)>(address));
+        }
+
+        struct InlinedCall {
+            const void* address; // nullptr if not recorded.
+            unsigned line;
+            std::string caller;
+        };
+
+        // Calls to the function at 'function' that the compiler inlined in the module defining it, from its DWARF.
+        static std::vector<InlinedCall> inlinedCalls(const void* const function) {
+            std::lock_guard<std::mutex> lock(mutex());
+            std::vector<InlinedCall> result;
+            const ElfW(Addr) address = reinterpret_cast<ElfW(Addr)>(function);
+            Module* const module = moduleOf(address);
+            if (module == nullptr) return result;
+            if (!module->dwarfRead) {
+                module->dwarfRead = true;
+                JoMockDwarf::inlinedCalls(module->dwarf, module->inlined);
+            }
+            auto at = std::lower_bound(module->byAddress.begin(), module->byAddress.end(), address,
+                [](const Symbol& symbol, const ElfW(Addr) value) { return symbol.address < value; });
+            for (; at != module->byAddress.end() && at->address == address; ++at) {
+                auto sites = module->inlined.find(at->name);
+                if (sites == module->inlined.end()) continue;
+                for (const JoMockDwarf::Site& site : sites->second) {
+                    const ElfW(Addr) runtime = site.address == 0 ? 0 : module->base + site.address;
+                    InlinedCall call = { reinterpret_cast<const void*>(runtime), site.line, runtime == 0 ? std::string() : nameAt(runtime) };
+                    result.push_back(call);
+                }
+            }
+            return result;
+        }
+
+    private:
+        struct Symbol {
+            const char* name; // in the mapped file.
+            ElfW(Addr) address;
+            ElfW(Xword) size;
+        };
+
+        struct Demangled {
+            std::string base; // without parameter list, qualifiers and ABI tags.
+            std::string full; // normalized, see normalize().
+            ElfW(Addr) address;
+        };
+
+        struct Module {
+            std::string path;
+            ElfW(Addr) base;
+            ElfW(Addr) begin; // loaded segments.
+            ElfW(Addr) end;
+            bool parsed;
+            bool demangled;
+            bool dwarfRead;
+            std::vector<Symbol> symbols;
+            std::vector<Symbol> byAddress;
+            std::vector<Symbol> vtables; // by address.
+            std::vector<Demangled> names;
+            JoMockDwarf::Sections dwarf;
+            std::unordered_map<std::string, std::vector<JoMockDwarf::Site>> inlined;
+        };
+
+        static std::mutex& mutex() {
+            static std::mutex value;
+            return value;
+        }
+
+        static unsigned long long& loaded() {
+            static unsigned long long value = ~0ULL;
+            return value;
+        }
+
+        static std::vector<std::unique_ptr<Module>>& modules() {
+            static std::vector<std::unique_ptr<Module>> value;
+            return value;
+        }
+
+        static Module* moduleOf(const ElfW(Addr) address) {
+            const unsigned long long current = JoMockImportIndex::generation();
+            if (current != loaded()) {
+                refresh();
+                loaded() = current;
+            }
+            for (std::unique_ptr<Module>& module : modules()) {
+                if (address < module->begin || address >= module->end) continue;
+                if (!module->parsed) {
+                    parse(*module);
+                }
+                return module.get();
+            }
+            return nullptr;
+        }
+
+        static std::string nameAt(const ElfW(Addr) address) {
+            Module* const module = moduleOf(address);
+            if (module == nullptr) return std::string();
+            auto after = std::upper_bound(module->byAddress.begin(), module->byAddress.end(), address,
+                [](const ElfW(Addr) value, const Symbol& symbol) { return value < symbol.address; });
+            if (after == module->byAddress.begin()) return std::string();
+            const Symbol& symbol = *(after - 1);
+            if (symbol.size != 0 && address >= symbol.address + symbol.size) return std::string();
+            int status = 0;
+            char* const text = abi::__cxa_demangle(symbol.name, nullptr, nullptr, &status);
+            const std::string result(text != nullptr ? text : symbol.name);
+            free(text);
+            return result;
+        }
+
+        static bool lessName(const Symbol& left, const Symbol& right) {
+            return std::strcmp(left.name, right.name) < 0;
+        }
+
+        static void refresh() {
+            std::vector<std::unique_ptr<Module>> previous;
+            previous.swap(modules());
+            dl_iterate_phdr([](struct dl_phdr_info* info, std::size_t, void* data) {
+                std::vector<std::unique_ptr<Module>>& previous = *static_cast<std::vector<std::unique_ptr<Module>>*>(data);
+                const std::string path(info->dlpi_name == nullptr ? "" : info->dlpi_name);
+                for (std::unique_ptr<Module>& known : previous) {
+                    if (known && known->base == info->dlpi_addr && known->path == path) {
+                        modules().push_back(std::move(known));
+                        return 0;
+                    }
+                }
+                std::unique_ptr<Module> module(new Module());
+                module->path = path;
+                module->base = info->dlpi_addr;
+                module->parsed = module->demangled = module->dwarfRead = false;
+                std::memset(&module->dwarf, 0, sizeof(module->dwarf));
+                module->begin = ~static_cast<ElfW(Addr)>(0);
+                module->end = 0;
+                for (ElfW(Half) i = 0; i < info->dlpi_phnum; ++i) {
+                    const ElfW(Phdr)& header = info->dlpi_phdr[i];
+                    if (header.p_type != PT_LOAD) continue;
+                    module->begin = std::min<ElfW(Addr)>(module->begin, info->dlpi_addr + header.p_vaddr);
+                    module->end = std::max<ElfW(Addr)>(module->end, info->dlpi_addr + header.p_vaddr + header.p_memsz);
+                }
+                modules().push_back(std::move(module));
+                return 0;
+            }, &previous);
+        }
+
+        // Maps the module's file for good : the symbol names point into it.
+        static void parse(Module& module) {
+            module.parsed = true;
+            const int file = open(module.path.empty() ? "/proc/self/exe" : module.path.c_str(), O_RDONLY | O_CLOEXEC);
+            if (file < 0) return; // the vDSO has no file.
+            struct stat status;
+            void* mapped = MAP_FAILED;
+            if (fstat(file, &status) == 0 && static_cast<std::size_t>(status.st_size) >= sizeof(ElfW(Ehdr))) {
+                mapped = mmap(nullptr, status.st_size, PROT_READ, MAP_PRIVATE, file, 0);
+            }
+            close(file);
+            if (mapped == MAP_FAILED) return;
+            const char* const image = static_cast<const char*>(mapped);
+            const std::size_t size = status.st_size;
+            const ElfW(Ehdr)* const header = reinterpret_cast<const ElfW(Ehdr)*>(image);
+            if (std::memcmp(header->e_ident, ELFMAG, SELFMAG) != 0 || header->e_ident[EI_CLASS] != ELFCLASS64 ||
+                header->e_shoff == 0 || header->e_shoff + header->e_shnum * sizeof(ElfW(Shdr)) > size) {
+                munmap(mapped, size);
+                return;
+            }
+            const ElfW(Shdr)* const sections = reinterpret_cast<const ElfW(Shdr)*>(image + header->e_shoff);
+            for (ElfW(Half) i = 0; i < header->e_shnum; ++i) {
+                const ElfW(Shdr)& table = sections[i];
+                if ((table.sh_type != SHT_SYMTAB && table.sh_type != SHT_DYNSYM) || table.sh_entsize != sizeof(ElfW(Sym)) ||
+                    table.sh_link >= header->e_shnum || table.sh_offset + table.sh_size > size) {
+                    continue;
+                }
+                const ElfW(Shdr)& strings = sections[table.sh_link];
+                if (strings.sh_offset + strings.sh_size > size) continue;
+                const ElfW(Sym)* const symbols = reinterpret_cast<const ElfW(Sym)*>(image + table.sh_offset);
+                for (std::size_t j = 0; j < table.sh_size / sizeof(ElfW(Sym)); ++j) {
+                    const ElfW(Sym)& symbol = symbols[j];
+                    if (symbol.st_shndx == SHN_UNDEF || symbol.st_value == 0 || symbol.st_name >= strings.sh_size) continue;
+                    const Symbol entry = { image + strings.sh_offset + symbol.st_name, module.base + symbol.st_value, symbol.st_size };
+                    if (ELF64_ST_TYPE(symbol.st_info) == STT_OBJECT && std::strncmp(entry.name, "_ZTV", 4) == 0) {
+                        module.vtables.push_back(entry);
+                    }
+                    if (ELF64_ST_TYPE(symbol.st_info) != STT_FUNC) continue;
+                    module.symbols.push_back(entry);
+                }
+            }
+            std::sort(module.symbols.begin(), module.symbols.end(), [](const Symbol& left, const Symbol& right) {
+                const int order = std::strcmp(left.name, right.name);
+                return order != 0 ? order < 0 : left.address < right.address;
+            });
+            module.symbols.erase(std::unique(module.symbols.begin(), module.symbols.end(), [](const Symbol& left, const Symbol& right) {
+                return left.address == right.address && std::strcmp(left.name, right.name) == 0;
+            }), module.symbols.end()); // .dynsym repeats .symtab
+            module.byAddress = module.symbols;
+            std::sort(module.byAddress.begin(), module.byAddress.end(), [](const Symbol& left, const Symbol& right) {
+                return left.address < right.address;
+            });
+            std::sort(module.vtables.begin(), module.vtables.end(), [](const Symbol& left, const Symbol& right) {
+                return left.address < right.address;
+            });
+            if (header->e_shstrndx < header->e_shnum) {
+                const ElfW(Shdr)& names = sections[header->e_shstrndx];
+                struct Wanted {
+                    const char* name;
+                    JoMockDwarf::Section* section;
+                } wanted[] = {
+                    { ".debug_info", &module.dwarf.info }, { ".debug_abbrev", &module.dwarf.abbrev },
+                    { ".debug_str", &module.dwarf.str }, { ".debug_line_str", &module.dwarf.lineStr },
+                    { ".debug_addr", &module.dwarf.addr }, { ".debug_str_offsets", &module.dwarf.strOffsets }
+                };
+                for (ElfW(Half) i = 0; i < header->e_shnum && names.sh_offset + names.sh_size <= size; ++i) {
+                    const ElfW(Shdr)& section = sections[i];
+                    if (section.sh_name >= names.sh_size || (section.sh_flags & SHF_COMPRESSED) != 0 ||
+                        section.sh_type == SHT_NOBITS || section.sh_offset + section.sh_size > size) {
+                        continue;
+                    }
+                    const char* const name = image + names.sh_offset + section.sh_name;
+                    for (Wanted& entry : wanted) {
+                        if (std::strcmp(name, entry.name) == 0) {
+                            entry.section->data = reinterpret_cast<const unsigned char*>(image + section.sh_offset);
+                            entry.section->size = section.sh_size;
+                        }
+                    }
+                }
+            }
+        }
+
+        static void demangle(Module& module) {
+            module.demangled = true;
+            if (!module.parsed) {
+                parse(module);
+            }
+            for (const Symbol& symbol : module.symbols) {
+                if (std::strncmp(symbol.name, "_Z", 2) != 0) continue; // C names are found as they are.
+                int status = 0;
+                char* const text = abi::__cxa_demangle(symbol.name, nullptr, nullptr, &status);
+                if (text == nullptr) continue;
+                Demangled entry;
+                entry.full = normalize(text);
+                free(text);
+                entry.base = entry.full.substr(0, baseLength(entry.full));
+                entry.address = symbol.address;
+                module.names.push_back(entry);
+            }
+            std::sort(module.names.begin(), module.names.end(), [](const Demangled& left, const Demangled& right) {
+                return left.base < right.base;
+            });
+        }
+
+        // Drops the spaces the demangler puts after commas and before qualifiers, and the ABI tags.
+        static std::string normalize(const char* const name) {
+            std::string result;
+            for (const char* at = name; *at != '\0'; ++at) {
+                if (*at == ' ' && (result.empty() || !isIdentifier(result.back()) || !isIdentifier(at[1]))) continue;
+                if (std::strncmp(at, "[abi:", 5) == 0) {
+                    const char* const end = std::strchr(at, ']');
+                    if (end != nullptr) {
+                        at = end;
+                        continue;
+                    }
+                }
+                result.push_back(*at);
+            }
+            return result;
+        }
+
+        static bool isIdentifier(const char c) {
+            return (c >= 'a' && c <= 'z') || (c >= 'A' && c <= 'Z') || (c >= '0' && c <= '9') || c == '_';
+        }
+
+        // Length of the name before its parameter list, the last balanced "(...)" before the qualifiers.
+        static std::size_t baseLength(const std::string& name) {
+            std::size_t end = name.size();
+            static const char* const kQualifiers[] = { "const", "volatile", "&&", "&" };
+            for (bool stripped = true; stripped; ) {
+                stripped = false;
+                for (const char* qualifier : kQualifiers) {
+                    const std::size_t length = std::strlen(qualifier);
+                    if (end > length && name.compare(end - length, length, qualifier) == 0 && name[end - length - 1] != '(') {
+                        end -= length;
+                        stripped = true;
+                    }
+                }
+            }
+            if (end == 0 || name[end - 1] != ')') return name.size();
+            int depth = 0;
+            for (std::size_t i = end; i-- > 0; ) {
+                if (name[i] == ')') ++depth;
+                else if (name[i] == '(' && --depth == 0) return i;
+            }
+            return name.size();
+        }
+    };
+
+    template < typename T >
+    struct JoMockSymbolTarget { };
+
+    template < typename R, typename ... P >
+    struct JoMockSymbolTarget<R(P ...)> {
+        typedef R(*Pointer)(P ...);
+    };
+
+    template < typename R, typename ... P >
+    struct JoMockSymbolTarget<R(*)(P ...)> {
+        typedef R(*Pointer)(P ...);
+    };
+
+    template < typename C, typename R, typename ... P >
+    struct JoMockSymbolTarget<R(C::*)(P ...) const> {
+        typedef R(C::*Pointer)(P ...) const;
+    };
+
+    template < typename C, typename R, typename ... P >
+    struct JoMockSymbolTarget<R(C::*)(P ...)> {
+        typedef R(C::*Pointer)(P ...);
+    };
+#endif
+
+    struct JoMockInstruction {
+        enum Branch { kNone, kJump, kConditional, kCall, kLoop, kReturn, kIndirect };
+        std::size_t length; // 0 when the bytes could not be decoded.
+        std::size_t opcodeOffset;
+        std::size_t displacementOffset; // offset of a rip-relative disp32, 0 if none.
+        std::size_t relativeOffset; // offset of a relative branch operand, 0 if none.
+        std::size_t relativeSize;
+        Branch branch;
+        unsigned char condition; // condition code of jcc.
+    };
+
+    // Length decoder for the x86/x86-64 instruction set, enough to move whole instructions around.
+    struct JoMockDecoder {
+        static JoMockInstruction decode(const unsigned char* const code, const bool is64 = sizeof(void*) == 8) {
+            JoMockInstruction instruction = { 0, 0, 0, 0, 0, JoMockInstruction::kNone, 0 };
+            std::size_t i = 0;
+            bool operand16 = false;
+            bool address16 = false;
+            bool rexW = false;
+            for (;; ++i) {
+                const unsigned char prefix = code[i];
+                if (i == 14) return instruction;
+                if (prefix == 0x66) operand16 = true;
+                else if (prefix == 0x67) address16 = !is64;
+                else if (prefix != 0xF0 && prefix != 0xF2 && prefix != 0xF3 && prefix != 0x2E && prefix != 0x36
+                    && prefix != 0x3E && prefix != 0x26 && prefix != 0x64 && prefix != 0x65) break;
+            }
+            if (is64 && (code[i] & 0xF0) == 0x40) {
+                rexW = (code[i] & 0x08) != 0;
+                ++i;
+            }
+            const std::size_t z = operand16 ? 2 : 4;
+            std::size_t immediate = 0;
+            bool modrm = false;
+            const unsigned char op = code[i];
+
+            if ((op == 0xC4 || op == 0xC5 || op == 0x62) && (is64 || (code[i + 1] & 0xC0) == 0xC0)) {
+                // VEX / EVEX encoded instruction.
+                unsigned char map = 1;
+                if (op == 0xC5) i += 2;
+                else if (op == 0xC4) { map = code[i + 1] & 0x1F; i += 3; }
+                else { map = code[i + 1] & 0x07; i += 4; }
+                const unsigned char opcode = code[i];
+                instruction.opcodeOffset = i++;
+                modrm = !(map == 1 && opcode == 0x77);
+                if (map == 3) immediate = 1;
+                if (map == 1 && ((opcode >= 0x70 && opcode <= 0x73) || opcode == 0xC2 || (opcode >= 0xC4 && opcode <= 0xC6))) immediate = 1;
+            }
+            else if (op == 0x0F) {
+                instruction.opcodeOffset = i;
+                const unsigned char opcode = code[i + 1];
+                i += 2;
+                if (opcode == 0x38) { ++i; modrm = true; }
+                else if (opcode == 0x3A) { ++i; modrm = true; immediate = 1; }
+                else if (opcode >= 0x80 && opcode <= 0x8F) {
+                    instruction.branch = JoMockInstruction::kConditional;
+                    instruction.condition = opcode & 0x0F;
+                    instruction.relativeOffset = i;
+                    instruction.relativeSize = is64 ? 4 : z;
+                    immediate = instruction.relativeSize;
+                }
+                else if (opcode == 0x05 || opcode == 0x06 || opcode == 0x07 || opcode == 0x08 || opcode == 0x09
+                    || opcode == 0x0B || opcode == 0x0E || (opcode >= 0x30 && opcode <= 0x37) || opcode == 0x77
+                    || opcode == 0xA0 || opcode == 0xA1 || opcode == 0xA2 || opcode == 0xA8 || opcode == 0xA9
+                    || opcode == 0xAA || (opcode >= 0xC8 && opcode <= 0xCF)) {
+                    // no operand
+                }
+                else {
+                    modrm = true;
+                    if ((opcode >= 0x70 && opcode <= 0x73) || opcode == 0xA4 || opcode == 0xAC || opcode == 0xBA
+                        || opcode == 0xC2 || (opcode >= 0xC4 && opcode <= 0xC6) || opcode == 0x0F) immediate = 1;
+                }
+            }
+            else {
+                instruction.opcodeOffset = i++;
+                const unsigned char low = op & 0x07;
+                if (op < 0x40 && low < 4) modrm = true;
+                else if (op < 0x40 && low == 4) immediate = 1;
+                else if (op < 0x40 && low == 5) immediate = z;
+                else if (op < 0x40 || (op >= 0x40 && op <= 0x61)) {
+                    if (is64 && (op < 0x50 || op > 0x5F)) return instruction;
+                }
+                else if (op == 0x62 || op == 0x63 || (op >= 0x84 && op <= 0x8F) || (op >= 0xD0 && op <= 0xD3)
+                    || (op >= 0xD8 && op <= 0xDF) || op == 0xFE || op == 0xC4 || op == 0xC5) modrm = true;
+                else if (op == 0x68) immediate = z;
+                else if (op == 0x69) { modrm = true; immediate = z; }
+                else if (op == 0x6A || op == 0xA8 || (op >= 0xB0 && op <= 0xB7) || op == 0xCD
+                    || op == 0xD4 || op == 0xD5 || (op >= 0xE4 && op <= 0xE7)) immediate = 1;
+                else if (op == 0x6B || op == 0x80 || op == 0x82 || op == 0x83 || op == 0xC0 || op == 0xC1 || op == 0xC6) {
+                    modrm = true;
+                    immediate = 1;
+                }
+                else if (op == 0x81 || op == 0xC7) { modrm = true; immediate = z; }
+                else if (op >= 0x70 && op <= 0x7F) {
+                    instruction.branch = JoMockInstruction::kConditional;
+                    instruction.condition = op & 0x0F;
+                    instruction.relativeOffset = i;
+                    instruction.relativeSize = immediate = 1;
+                }
+                else if (op >= 0xE0 && op <= 0xE3) {
+                    instruction.branch = JoMockInstruction::kLoop;
+                    instruction.relativeOffset = i;
+                    instruction.relativeSize = immediate = 1;
+                }
+                else if (op == 0xE8 || op == 0xE9 || op == 0xEB) {
+                    instruction.branch = op == 0xE8 ? JoMockInstruction::kCall : JoMockInstruction::kJump;
+                    instruction.relativeOffset = i;
+                    instruction.relativeSize = immediate = op == 0xEB ? 1 : (is64 ? 4 : z);
+                }
+                else if (op == 0x9A || op == 0xEA) {
+                    if (is64) return instruction;
+                    immediate = z + 2;
+                }
+                else if (op >= 0xA0 && op <= 0xA3) immediate = is64 ? (address16 ? 4 : 8) : (address16 ? 2 : 4);
+                else if (op == 0xA9) immediate = z;
+                else if (op >= 0xB8 && op <= 0xBF) immediate = rexW ? 8 : z;
+                else if (op == 0xC2 || op == 0xCA) { instruction.branch = JoMockInstruction::kReturn; immediate = 2; }
+                else if (op == 0xC3 || op == 0xCB || op == 0xCF) instruction.branch = JoMockInstruction::kReturn;
+                else if (op == 0xC8) immediate = 3;
+                else if (op == 0xF6 || op == 0xF7) {
+                    modrm = true;
+                    if (((code[i] >> 3) & 0x07) < 2) immediate = op == 0xF6 ? 1 : z;
+                }
+                else if (op == 0xFF) {
+                    modrm = true;
+                    const unsigned char reg = (code[i] >> 3) & 0x07;
+                    if (reg >= 2 && reg <= 5) instruction.branch = JoMockInstruction::kIndirect;
+                }
+                // everything else is a single byte
+            }
+
+            if (modrm) {
+                const unsigned char value = code[i++];
+                const unsigned char mod = value >> 6;
+                const unsigned char rm = value & 0x07;
+                if (mod != 3) {
+                    if (address16) {
+                        if ((mod == 0 && rm == 6) || mod == 2) i += 2;
+                        else if (mod == 1) i += 1;
+                    }
+                    else {
+                        if (rm == 4) {
+                            const unsigned char sib = code[i++];
+                            if (mod == 0 && (sib & 0x07) == 5) i += 4;
+                        }
+                        if (mod == 0 && rm == 5) {
+                            if (is64) instruction.displacementOffset = i;
+                            i += 4;
+                        }
+                        else if (mod == 1) i += 1;
+                        else if (mod == 2) i += 4;
+                    }
+                }
+            }
+            i += immediate;
+            if (i > 15) return instruction;
+            instruction.length = i;
+            return instruction;
+        }
+    };
+
+    // Checks an entry patch before it is written : the function must be long enough for it, or followed by
+    // padding, and none of its branches may land inside it. The size comes from the symbol table when there
+    // is one; otherwise the function is followed up to its first return or jump past the patch.
+    struct JoMockPatchCheck {
+        enum Policy { kTrap, kFail, kUnchecked };
+        enum Verdict { kSafe, kTooShort, kBranchInside, kUndecodable };
+
+        // kTrap patches an unsafe entry with JoMockTrap where available and fails elsewhere.
+        static Policy& policy() {
+            static Policy value = kTrap;
+            return value;
+        }
+
+        // Prints the inlined calls of each mocked function, they keep running the original code.
+        static bool& reportInlining() {
+            static bool value = true;
+            return value;
+        }
+
+        static const char* describe(const Verdict verdict) {
+            switch (verdict) {
+            case kTooShort: return "the function is shorter than the jump";
+            case kBranchInside: return "a branch of the function lands inside the jump";
+            case kUndecodable: return "the entry could not be decoded";
+            default: return "safe";
+            }
+        }
+
+        // Verdicts are kept per function and patch size, so only the first graft pays for the analysis.
+        static Verdict check(const void* const function, const std::size_t patchSize) {
+            std::lock_guard<std::mutex> lock(mutex());
+            const std::pair<const void*, std::size_t> key(function, patchSize);
+            const auto known = verdicts().find(key);
+            if (known != verdicts().end()) return known->second;
+            const Verdict verdict = inspect(function, patchSize);
+            verdicts()[key] = verdict;
+#ifdef JOMOCK_SYMBOL_SUPPORT
+            if (reportInlining()) {
+                report(function);
+            }
+#endif
+            return verdict;
+        }
+
+        static Verdict inspect(const void* const function, const std::size_t patchSize) {
+            const unsigned char* const code = static_cast<const unsigned char*>(function);
+            std::size_t size = 0;
+            std::size_t next = SIZE_MAX;
+#ifdef JOMOCK_SYMBOL_SUPPORT
+            JoMockSymbolIndex::bounds(function, size, next);
+#endif
+            const std::size_t limit = std::min<std::size_t>(size != 0 ? size : 4096, next);
+#ifdef ARM64_SUPPORT
+            if (patchSize <= 4) return kSafe; // one instruction.
+            for (std::size_t offset = 0; offset + 4 <= limit; offset += 4) {
+                std::uint32_t instruction;
+                std::memcpy(&instruction, code + offset, sizeof(instruction));
+                std::int64_t distance = 0;
+                if ((instruction & 0x7C000000) == 0x14000000) distance = static_cast<std::int32_t>(instruction << 6) >> 4; // b, bl
+                else if ((instruction & 0xFF000010) == 0x54000000 || (instruction & 0x7E000000) == 0x34000000) {
+                    distance = static_cast<std::int32_t>((instruction >> 5) << 13) >> 11; // b.cond, cbz, cbnz
+                }
+                else if ((instruction & 0x7E000000) == 0x36000000) distance = static_cast<std::int32_t>((instruction >> 5) << 18) >> 16; // tbz, tbnz
+                const std::int64_t target = static_cast<std::int64_t>(offset) + distance;
+                if (distance != 0 && target > 0 && target < static_cast<std::int64_t>(patchSize)) return kBranchInside;
+                const bool ends = (instruction & 0xFC000000) == 0x14000000 || (instruction & 0xFFFFFC1F) == 0xD65F0000
+                    || (instruction & 0xFFFFFC1F) == 0xD61F0000; // b, ret, br
+                if (size == 0 && ends) {
+                    if (offset + 4 < patchSize && !padding(code, offset + 4, patchSize)) return kTooShort;
+                    if (offset + 4 >= patchSize) break;
+                }
+            }
+#else
+            std::size_t offset = 0;
+            while (offset < limit) {
+                const JoMockInstruction instruction = JoMockDecoder::decode(code + offset);
+                if (instruction.length == 0) {
+                    if (offset < patchSize) return kUndecodable;
+                    break;
+                }
+                if (instruction.relativeSize != 0) {
+                    std::int64_t distance = 0;
+                    if (instruction.relativeSize == 1) distance = static_cast<std::int8_t>(code[offset + instruction.relativeOffset]);
+                    else if (instruction.relativeSize == 2) { std::int16_t value; std::memcpy(&value, code + offset + instruction.relativeOffset, 2); distance = value; }
+                    else { std::int32_t value; std::memcpy(&value, code + offset + instruction.relativeOffset, 4); distance = value; }
+                    const std::int64_t target = static_cast<std::int64_t>(offset + instruction.length) + distance;
+                    if (target > 0 && target < static_cast<std::int64_t>(patchSize)) return kBranchInside;
+                }
+                offset += instruction.length;
+                const bool ends = instruction.branch == JoMockInstruction::kReturn || instruction.branch == JoMockInstruction::kJump
+                    || (instruction.branch == JoMockInstruction::kIndirect && ((code[offset - instruction.length + instruction.opcodeOffset + 1] >> 3) & 0x06) == 0x04);
+                if (size == 0 && ends) {
+                    if (offset < patchSize && !padding(code, offset, patchSize)) return kTooShort;
+                    if (offset >= patchSize) break;
+                }
+            }
+#endif
+            if (size != 0 && size < patchSize && (next < patchSize || !padding(code, size, patchSize))) return kTooShort;
+            return kSafe;
+        }
+
+    private:
+        static std::mutex& mutex() {
+            static std::mutex value;
+            return value;
+        }
+
+        static std::map<std::pair<const void*, std::size_t>, Verdict>& verdicts() {
+            static std::map<std::pair<const void*, std::size_t>, Verdict> value;
+            return value;
+        }
+
+        // True when [from, to) holds alignment padding only : int3 and nop, or nop and udf on ARM64.
+        static bool padding(const unsigned char* const code, std::size_t from, const std::size_t to) {
+#ifdef ARM64_SUPPORT
+            for (; from < to; from += 4) {
+                std::uint32_t instruction;
+                std::memcpy(&instruction, code + from, sizeof(instruction));
+                if (instruction != 0xD503201F && instruction != 0) return false;
+            }
+#else
+            while (from < to) {
+                const JoMockInstruction instruction = JoMockDecoder::decode(code + from);
+                const unsigned char op = code[from + instruction.opcodeOffset];
+                const bool nop = op == 0x90 || op == 0xCC || (op == 0x0F && code[from + instruction.opcodeOffset + 1] == 0x1F);
+                if (instruction.length == 0 || !nop) return false;
+                from += instruction.length;
+            }
+#endif
+            return true;
+        }
+
+#ifdef JOMOCK_SYMBOL_SUPPORT
+        static void report(const void* const function) {
+            const std::vector<JoMockSymbolIndex::InlinedCall> calls = JoMockSymbolIndex::inlinedCalls(function);
+            if (calls.empty()) return;
+            const std::string name = JoMockSymbolIndex::nameAt(function);
+            for (const JoMockSymbolIndex::InlinedCall& call : calls) {
+                fprintf(stderr, "jomock: %s is inlined into %s at %p (line %u), the mock does not see that call\n",
+                    name.c_str(), call.caller.empty() ? "?" : call.caller.c_str(), call.address, call.line);
+            }
+        }
+#endif
+    };
+
+    struct JoMockPatch {
+        template < typename F1, typename F2 >
+        static void graftFunction(F1 address, F2 destination, JoMockBackup& binary_backup) {
+            void* function = reinterpret_cast<void*>((std::size_t&)address);
+            setJump(function, reinterpret_cast<void*>((std::size_t&)destination), binary_backup);
+        }
+
+        template < typename F >
+        static void _restore(F address, const JoMockBackup& binary_backup) {
+            revertJump(reinterpret_cast<void*>((std::size_t&)address), binary_backup);
+        }
+
+        // Turns a code address into a function or member function pointer of type F.
+        template < typename F >
+        static F toFunction(void* const address) {
+            F function = F();
+            std::memcpy(&function, &address, sizeof(address));
+            return function;
+        }
+
+        static void backupBinary(const char* const function, JoMockBackup& binary_backup, const std::size_t size) {
+            binary_backup.assign(function, size);
+        }
+
+        static bool isDistanceOverflow(const std::size_t distance) {
+            const std::ptrdiff_t signedDistance = static_cast<std::ptrdiff_t>(distance);
+            if(signedDistance > INT32_MAX) return true;
+            if(signedDistance < INT32_MIN) return true;
+            return false;
+        }
+
+        static std::size_t calculateDistance(const void* const address, const void* const destination) {
+            std::size_t distance = reinterpret_cast<std::size_t>(destination)
+                - reinterpret_cast<std::size_t>(address) - 5; // For jmp instruction;
+            return distance;
+        }
+
+        static void patchFunctionShortDistance(char* const function, const std::size_t distance) {
+            const char* const distance_bytes = reinterpret_cast<const char*>(&distance);
+            function[0] = (char)0xE9; // jmp
+            std::copy(distance_bytes, distance_bytes + 4, function + 1);
+        }
+
+        static void patchFunctionLongAddress(char* const function, const void* const destination) {
+            const char* const distance_bytes = reinterpret_cast<const char*>(&destination);
+            function[0] = 0x68; // push
+            std::copy(distance_bytes, distance_bytes + 4, function + 1);
+            function[5] = (char)0xC7;
+            function[6] = (char)0x44;
+            function[7] = (char)0x24;
+            function[8] = (char)0x04;
+            std::copy(distance_bytes + 4, distance_bytes + 8, function + 9);
+            function[13] = (char)0xC3; // ret
+        }
+
+        // ARM64 'b' reaches +-128MB. Returns 4, or 0 when 'destination' is out of range.
+        static std::size_t encodeBranchArm64(const void* const address, const void* const destination, char* const code) {
+            const std::int64_t distance = static_cast<std::int64_t>(reinterpret_cast<std::uintptr_t>(destination)
+                - reinterpret_cast<std::uintptr_t>(address));
+            if (distance % 4 != 0 || distance < -0x08000000 || distance >= 0x08000000) return 0;
+            const std::uint32_t instruction = 0x14000000 | (static_cast<std::uint32_t>(distance >> 2) & 0x03FFFFFF);
+            std::memcpy(code, &instruction, sizeof(instruction));
+            return 4;
+        }
+
+        // ARM64 jump to any address : ldr x16, #8; br x16; .quad destination
+        static std::size_t encodeAbsoluteJumpArm64(const void* const destination, char* const code) {
+            const std::uint32_t instructions[2] = { 0x58000050, 0xD61F0200 };
+            const std::uint64_t literal = reinterpret_cast<std::uintptr_t>(destination);
+            std::memcpy(code, instructions, sizeof(instructions));
+            std::memcpy(code + sizeof(instructions), &literal, sizeof(literal));
+            return 16;
+        }
+
+        // Encodes the jump from 'address' to 'destination' into 'code' and returns its length.
+        static std::size_t encodeJump(const void* const address, const void* const destination, char* const code) {
+            #ifdef ARM64_SUPPORT
+            if (encodeBranchArm64(address, destination, code) != 0) return 4;
+            const void* const veneer = JoMockVeneerPool::get(address, destination);
+            if (veneer != nullptr && encodeBranchArm64(address, veneer, code) != 0) return 4;
+            if (veneer != nullptr) JoMockVeneerPool::release(veneer);
+            return encodeAbsoluteJumpArm64(destination, code);
+            #else
+            std::size_t distance = calculateDistance(address, destination);
+            if (isDistanceOverflow(distance)) {
+                const void* const veneer = JoMockVeneerPool::get(address, destination);
+                if (veneer == nullptr) {
+                    patchFunctionLongAddress(code, destination);
+                    return 14; // long jmp.
+                }
+                distance = calculateDistance(address, veneer);
+            }
+            patchFunctionShortDistance(code, distance);
+            return 5; // short jmp.
+            #endif
+        }
+
+        // Queues 'code' into the thread's open transaction, or applies it right away. 'reverting' marks the
+        // original bytes of a patch, which may let the whole page be restored from its snapshot.
+        static void writeCode(void* const address, const char* const code, const std::size_t size, const bool reverting = false) {
+            JoMockPatchTransaction* transaction = JoMockPatchTransaction::current();
+            if (transaction != nullptr) {
+                queueCode(*transaction, address, code, size, reverting);
+                return;
+            }
+            JoMockPatchTransaction immediate;
+            queueCode(immediate, address, code, size, reverting);
+            if (!immediate.commit()) {
+                std::abort();
+            }
+        }
+
+        static void queueCode(JoMockPatchTransaction& transaction, void* const address, const char* const code, const std::size_t size,
+            const bool reverting) {
+            if (!reverting) {
+                JoMockSnapshot::capture(address, code, size);
+            }
+            if (reverting) {
+                releaseJump(address, nullptr, &transaction);
+            }
+            transaction.write(address, code, size);
+            if (reverting) {
+                JoMockSnapshot::release(transaction, address, size);
+            }
+        }
+
+        static void setJump(void* const address, const void* const destination, JoMockBackup& binary_backup) {
+            JoMockBackup claimed;
+            if (JoMockClaims::take(address, claimed)) { // the original bytes are back before the jump is planned.
+                JoMockPatchTransaction immediate;
+                queueCode(immediate, address, claimed.data(), claimed.size(), true);
+                if (!immediate.commit()) {
+                    std::abort();
+                }
+            }
+            char code[JoMockPatchTransaction::kMaxPatchSize];
+            std::size_t size = encodeJump(address, destination, code);
+            size = checkJump(address, destination, code, size);
+            backupBinary(reinterpret_cast<const char*>(address), binary_backup, size);
+            writeCode(address, code, size);
+        }
+
+        static void revertJump(void* address, const JoMockBackup& binary_backup) {
+            if (binary_backup.empty()) return;
+            writeCode(address, binary_backup.data(), binary_backup.size(), true);
+        }
+
+        // Checks the jump encoded for 'address' (see JoMockPatchCheck) and returns its size, which is the
+        // size of a trap when the jump is not safe. Fails when nothing safe can be written.
+        static std::size_t checkJump(void* const address, const void* const destination, char* const code, const std::size_t size) {
+            if (JoMockPatchCheck::policy() == JoMockPatchCheck::kUnchecked) return size;
+            const JoMockPatchCheck::Verdict verdict = JoMockPatchCheck::check(address, size);
+            if (verdict == JoMockPatchCheck::kSafe) return size;
+            #ifdef JOMOCK_TRAP_SUPPORT
+            if (JoMockPatchCheck::policy() == JoMockPatchCheck::kTrap && JoMockTrap::add(address, destination)) {
+                releaseJump(address, code);
+                return JoMockTrap::encode(code);
+            }
+            #endif
+            #ifdef JOMOCK_SYMBOL_SUPPORT
+            const std::string name = JoMockSymbolIndex::nameAt(address);
+            #else
+            const std::string name;
+            #endif
+            fprintf(stderr, "jomock: cannot patch %s at %p safely, %s\n", name.empty() ? "the function" : name.c_str(),
+                address, JoMockPatchCheck::describe(verdict));
+            std::abort();
+        }
+
+        // Returns the veneer used by the jump at 'address', if any, to the pool, and drops its trap, once
+        // 'transaction' is applied when it is given. 'written' is the jump when it is not written yet.
+        static void releaseJump(const void* const address, const void* const written = nullptr,
+            JoMockPatchTransaction* const transaction = nullptr) {
+            const unsigned char* const code = static_cast<const unsigned char*>(written != nullptr ? written : address);
+            #ifdef ARM64_SUPPORT
+            std::uint32_t instruction;
+            std::memcpy(&instruction, code, sizeof(instruction));
+            #ifdef JOMOCK_TRAP_SUPPORT
+            if (instruction == 0xD4200000 && releaseTrap(address, transaction)) return;
+            #endif
+            if ((instruction & 0xFC000000) != 0x14000000) return;
+            const std::int32_t distance = static_cast<std::int32_t>(instruction << 6) >> 4; // imm26 * 4
+            JoMockVeneerPool::release(static_cast<const char*>(address) + distance);
+            #else
+            #ifdef JOMOCK_TRAP_SUPPORT
+            if (code[0] == 0xCC && releaseTrap(address, transaction)) return;
+            #endif
+            if (code[0] != 0xE9) return;
+            int32_t distance;
+            std::memcpy(&distance, code + 1, sizeof(distance));
+            JoMockVeneerPool::release(static_cast<const char*>(address) + 5 + distance);
+            #endif
+        }
+
+        #ifdef JOMOCK_TRAP_SUPPORT
+        static bool releaseTrap(const void* const address, JoMockPatchTransaction* const transaction) {
+            if (transaction == nullptr) return JoMockTrap::remove(address);
+            if (!JoMockTrap::contains(address)) return false;
+            transaction->releaseTrap(address); // a thread may still hit the trap until the original bytes are back.
+            return true;
+        }
+        #endif
+    };
+
+    // Moves the first whole instructions of a function to another address, rewriting pc-relative operands.
+    struct JoMockRelocator {
+        // x86/x86-64: relocates the instructions of 'code' (located at 'from') covering 'patchSize' bytes into
+        // 'out' as if 'out' were located at 'to', then jumps back. Returns the size written, or 0 on failure.
+        static std::size_t relocateX86(const unsigned char* const code, const std::uintptr_t from, const std::size_t patchSize,
+            std::size_t& covered, const std::uintptr_t to, char* const out, const bool is64 = sizeof(void*) == 8) {
+            std::uintptr_t targets[16];
+            std::size_t branches = 0;
+            std::size_t size = 0;
+            covered = 0;
+            while (covered < patchSize) {
+                const JoMockInstruction instruction = JoMockDecoder::decode(code + covered, is64);
+                if (instruction.length == 0 || branches == 16) return 0;
+                const unsigned char* const source = code + covered;
+                const std::uintptr_t next = from + covered + instruction.length;
+                covered += instruction.length;
+                if ((instruction.branch == JoMockInstruction::kReturn || instruction.branch == JoMockInstruction::kIndirect)
+                    && covered < patchSize) return 0; // the function is shorter than the jump.
+
+                if (instruction.relativeOffset != 0) {
+                    if (instruction.branch == JoMockInstruction::kLoop) return 0;
+                    std::intptr_t relative = 0;
+                    if (instruction.relativeSize == 1) relative = static_cast<signed char>(source[instruction.relativeOffset]);
+                    else if (instruction.relativeSize == 2) relative = readInteger<std::int16_t>(source + instruction.relativeOffset);
+                    else relative = readInteger<std::int32_t>(source + instruction.relativeOffset);
+                    const std::uintptr_t target = next + relative;
+                    targets[branches++] = target;
+                    size += encodeBranchX86(out + size, instruction, target, to + size, is64);
+                    continue;
+                }
+
+                std::copy(source, source + instruction.length, out + size);
+                if (instruction.displacementOffset != 0) {
+                    const std::uintptr_t target = next + readInteger<std::int32_t>(source + instruction.displacementOffset);
+                    const std::uintptr_t moved = to + size + instruction.length;
+                    const std::int64_t displacement = static_cast<std::int64_t>(target - moved);
+                    if (displacement > INT32_MAX || displacement < INT32_MIN) return 0;
+                    const std::int32_t value = static_cast<std::int32_t>(displacement);
+                    std::memcpy(out + size + instruction.displacementOffset, &value, sizeof(value));
+                }
+                size += instruction.length;
+            }
+            for (std::size_t i = 0; i < branches; ++i) {
+                if (targets[i] >= from && targets[i] < from + covered) return 0; // branch into the moved bytes.
+            }
+            JoMockInstruction jump = { 5, 0, 0, 1, 4, JoMockInstruction::kJump, 0 };
+            return size + encodeBranchX86(out + size, jump, from + covered, to + size, is64);
+        }
+
+        // ARM64: same as relocateX86 for A64 instructions. Targets are materialized as absolute literals
+        // loaded into x16 (or the destination register), so the result does not depend on where it is placed.
+        static std::size_t relocateArm64(const std::uint32_t* const code, const std::uintptr_t from, const std::size_t patchSize,
+            std::size_t& covered, std::uint32_t* const out) {
+            const std::uint32_t kLdrX16 = 0x58000050; // ldr x16, #8
+            const std::uint32_t kBrX16 = 0xD61F0200; // br x16
+            std::uintptr_t targets[4];
+            std::size_t branches = 0;
+            std::size_t size = 0;
+            covered = 0;
+            for (std::size_t index = 0; covered < patchSize; ++index, covered += 4) {
+                if (index == 4) return 0;
+                const std::uint32_t word = code[index];
+                const std::uintptr_t pc = from + index * 4;
+                const std::uint32_t rd = word & 0x1F;
+                if ((word & 0x7C000000) == 0x14000000) { // b / bl
+                    const std::uintptr_t target = pc + signExtend(word & 0x03FFFFFF, 26) * 4;
+                    targets[branches++] = target;
+                    if (word & 0x80000000) { // bl
+                        out[size++] = 0x58000070; // ldr x16, #12
+                        out[size++] = 0xD63F0200; // blr x16
+                        out[size++] = 0x14000003; // b #12
+                    }
+                    else {
+                        out[size++] = kLdrX16;
+                        out[size++] = kBrX16;
+                    }
+                    size = emitLiteral(out, size, target);
+                }
+                else if ((word & 0xFF000010) == 0x54000000 || (word & 0x7E000000) == 0x34000000 || (word & 0x7E000000) == 0x36000000) {
+                    // b.cond / cbz / cbnz / tbz / tbnz : inverted condition skips an absolute jump.
+                    std::uint32_t inverted = 0;
+                    std::uintptr_t target = 0;
+                    if ((word & 0xFF000010) == 0x54000000) {
+                        target = pc + signExtend((word >> 5) & 0x7FFFF, 19) * 4;
+                        if ((word & 0x0F) >= 0x0E) return 0;
+                        inverted = 0x54000000 | (5 << 5) | ((word & 0x0F) ^ 1);
+                    }
+                    else if ((word & 0x7E000000) == 0x34000000) {
+                        target = pc + signExtend((word >> 5) & 0x7FFFF, 19) * 4;
+                        inverted = ((word & 0xFF00001F) ^ 0x01000000) | (5 << 5);
+                    }
+                    else {
+                        target = pc + signExtend((word >> 5) & 0x3FFF, 14) * 4;
+                        inverted = ((word & 0xFFF8001F) ^ 0x01000000) | (5 << 5);
+                    }
+                    targets[branches++] = target;
+                    out[size++] = inverted;
+                    out[size++] = kLdrX16;
+                    out[size++] = kBrX16;
+                    size = emitLiteral(out, size, target);
+                }
+                else if ((word & 0x1F000000) == 0x10000000) { // adr / adrp
+                    const std::intptr_t immediate = signExtend(((word >> 5) & 0x7FFFF) << 2 | ((word >> 29) & 0x03), 21);
+                    const std::uintptr_t target = (word & 0x80000000)
+                        ? (pc & ~static_cast<std::uintptr_t>(0xFFF)) + immediate * 4096
+                        : pc + immediate;
+                    out[size++] = 0x58000040 | rd; // ldr xd, #8
+                    out[size++] = 0x14000003; // b #12
+                    size = emitLiteral(out, size, target);
+                }
+                else if ((word & 0x3B000000) == 0x18000000) { // ldr (literal)
+                    if (word & 0x04000000) return 0; // simd register
+                    const std::uint32_t opc = word >> 30;
+                    const std::uintptr_t target = pc + signExtend((word >> 5) & 0x7FFFF, 19) * 4;
+                    if (opc == 3) continue; // prfm
+                    out[size++] = 0x58000040 | rd; // ldr xt, #8
+                    out[size++] = 0x14000003; // b #12
+                    size = emitLiteral(out, size, target);
+                    const std::uint32_t loads[] = { 0xB9400000, 0xF9400000, 0xB9800000 }; // ldr wt / ldr xt / ldrsw xt, [xt]
+                    out[size++] = loads[opc] | (rd << 5) | rd;
+                }
+                else {
+                    out[size++] = word;
+                }
+            }
+            for (std::size_t i = 0; i < branches; ++i) {
+                if (targets[i] >= from && targets[i] < from + covered) return 0;
+            }
+            out[size++] = kLdrX16;
+            out[size++] = kBrX16;
+            size = emitLiteral(out, size, from + covered);
+            return size * 4;
+        }
+
+    private:
+        template < typename T >
+        static T readInteger(const unsigned char* const address) {
+            T value;
+            std::memcpy(&value, address, sizeof(value));
+            return value;
+        }
+
+        static std::intptr_t signExtend(const std::uint32_t value, const unsigned bits) {
+            const std::uint32_t sign = 1u << (bits - 1);
+            return static_cast<std::intptr_t>(static_cast<std::int32_t>((value ^ sign) - sign));
+        }
+
+        static std::size_t emitLiteral(std::uint32_t* const out, std::size_t size, const std::uint64_t value) {
+            out[size++] = static_cast<std::uint32_t>(value);
+            out[size++] = static_cast<std::uint32_t>(value >> 32);
+            return size;
+        }
+
+        static std::size_t encodeBranchX86(char* const out, const JoMockInstruction& instruction, const std::uintptr_t target,
+            const std::uintptr_t at, const bool is64) {
+            std::size_t size = 0;
+            if (is64) {
+                if (instruction.branch == JoMockInstruction::kConditional) {
+                    out[size++] = static_cast<char>(0x70 | (instruction.condition ^ 1)); // skip the jump below
+                    out[size++] = 14;
+                }
+                else if (instruction.branch == JoMockInstruction::kCall) {
+                    const char call[] = { (char)0xFF, 0x15, 0x02, 0x00, 0x00, 0x00, (char)0xEB, 0x08 }; // call [rip + 2]; jmp +8
+                    std::copy(call, call + sizeof(call), out);
+                    std::memcpy(out + sizeof(call), &target, 8);
+                    return sizeof(call) + 8;
+                }
+                const char jump[] = { (char)0xFF, 0x25, 0x00, 0x00, 0x00, 0x00 }; // jmp [rip + 0]
+                std::copy(jump, jump + sizeof(jump), out + size);
+                std::memcpy(out + size + sizeof(jump), &target, 8);
+                return size + sizeof(jump) + 8;
+            }
+            if (instruction.branch == JoMockInstruction::kConditional) {
+                out[size++] = 0x0F;
+                out[size++] = static_cast<char>(0x80 | instruction.condition);
+            }
+            else {
+                out[size++] = static_cast<char>(instruction.branch == JoMockInstruction::kCall ? 0xE8 : 0xE9);
+            }
+            const std::uint32_t relative = static_cast<std::uint32_t>(target - (at + size + 4));
+            std::memcpy(out + size, &relative, 4);
+            return size + 4;
+        }
+    };
+
+    // Builds a copy of a function's first instructions followed by a jump to the rest of the function,
+    // so the original behaviour stays callable after its entry has been overwritten.
+    struct JoMockTrampoline {
+        // Returns the trampoline of 'function' covering at least 'patchSize' bytes, or nullptr when the
+        // instructions cannot be moved. 'backup' holds the original bytes if the entry is already patched.
+        static void* get(const void* const function, const std::size_t patchSize, const JoMockBackup& backup = JoMockBackup()) {
+            std::lock_guard<std::mutex> lock(mutex());
+            Entry& entry = entries()[function];
+            if (entry.trampoline == nullptr || entry.covered < patchSize) {
+                void* const trampoline = create(function, patchSize, backup, entry.covered);
+                if (trampoline == nullptr) return nullptr;
+                entry.trampoline = trampoline;
+            }
+            return entry.trampoline;
+        }
+
+        static void* create(const void* const function, const std::size_t patchSize, const JoMockBackup& backup, std::size_t& covered) {
+            unsigned char code[64];
+            std::memcpy(code, function, sizeof(code));
+            std::copy(backup.begin(), backup.end(), code);
+            const std::uintptr_t from = reinterpret_cast<std::uintptr_t>(function);
+#ifdef ARM64_SUPPORT
+            std::uint32_t words[64];
+            std::uint32_t instructions[16];
+            std::memcpy(instructions, code, sizeof(instructions));
+            const std::size_t size = JoMockRelocator::relocateArm64(instructions, from, patchSize, covered, words);
+            if (size == 0) return nullptr;
+            void* const block = JoMockExecutableMemory::allocate(size);
+            if (block == nullptr) return nullptr;
+            return JoMockExecutableMemory::write(block, reinterpret_cast<const char*>(words), size) ? block : nullptr;
+#else
+            char buffer[256];
+            const std::size_t estimate = JoMockRelocator::relocateX86(code, from, patchSize, covered, from, buffer);
+            if (estimate == 0) return nullptr;
+            void* const block = JoMockExecutableMemory::allocate(estimate, function);
+            if (block == nullptr) return nullptr;
+            const std::size_t size = JoMockRelocator::relocateX86(code, from, patchSize, covered,
+                reinterpret_cast<std::uintptr_t>(block), buffer);
+            if (size == 0) return nullptr;
+            return JoMockExecutableMemory::write(block, buffer, size) ? block : nullptr;
+#endif
+        }
+
+    private:
+        struct Entry {
+            void* trampoline;
+            std::size_t covered;
+        };
+
+        static std::mutex& mutex() {
+            static std::mutex value;
+            return value;
+        }
+
+        static unordered_map<const void*, Entry>& entries() {
+            static unordered_map<const void*, Entry> value;
+            return value;
+        }
+    };
+
+    struct JoMockNode {
+        JoMockNode() : trampoline(nullptr), destroy(nullptr), storage(nullptr) {}
+        virtual ~JoMockNode() {}
+        virtual void restore() = 0;
+
+        // Entry of the original implementation of 'function', built on first use.
+        void* originalEntry(const void* const function, const char* const functionName) {
+            if (trampoline == nullptr) {
+                trampoline = JoMockTrampoline::get(function, binaryBackup.size(), binaryBackup);
+                if (trampoline == nullptr) {
+                    fprintf(stderr, "jomock: cannot relocate the entry of %s\n", functionName);
+                    std::abort();
+                }
+            }
+            return trampoline;
+        }
+
+        JoMockBackup binaryBackup; // Backup the mockee's binary code changed in RuntimePatcher.
+        void* trampoline; // original entry, built on the first callOriginal().
+        void (*destroy)(JoMockNode*); // set by JoMockStorage.
+        bool* storage; // in-use flag of the static storage holding the node, nullptr on the heap.
+    };
+
+    // Live mocks of one scope : the process, or a thread in thread-local dispatch mode. Mocks are found
+    // by function through an open-addressed table and restored in creation order from a flat journal.
+    // Both keep their capacity, so a warm registry does not allocate.
+    struct JoMockRegistry {
+        JoMockRegistry() : stamp(nextStamp()), used(0) {}
+
+        ~JoMockRegistry() {
+            restoreAll();
+        }
+
+        JoMockNode* find(const void* const function, const void* const kind) const {
+            if (table.empty()) return nullptr;
+            const std::size_t mask = table.size() - 1;
+            for (std::size_t index = hash(function, kind) & mask; ; index = (index + 1) & mask) {
+                const Slot& slot = table[index];
+                if (slot.node == nullptr) return nullptr;
+                if (slot.function == function && slot.kind == kind) return slot.node;
+            }
+        }
+
+        // Registers 'node' for 'function', in place of a node discarded for the same function.
+        void add(const void* const function, const void* const kind, JoMockNode* const node) {
+            if ((used + 1) * 2 > table.size()) {
+                grow();
+            }
+            place(function, kind, node);
+            journal.push_back(node);
+        }
+
+        // Restores and destroys 'node' ahead of its replacement.
+        void discard(JoMockNode* const node) {
+            node->restore();
+            journal.erase(std::remove(journal.begin(), journal.end(), node), journal.end());
+            node->destroy(node);
+        }
+
+        void restoreAll() {
+            {
+                JoMockPatchTransaction transaction;
+                for (JoMockNode* node : journal) {
+                    node->restore();
+                }
+            }
+            for (JoMockNode* node : journal) {
+                node->destroy(node);
+            }
+            journal.clear();
+            std::fill(table.begin(), table.end(), Slot());
+            used = 0;
+            stamp = nextStamp();
+        }
+
+        std::size_t size() const {
+            return journal.size();
+        }
+
+        std::size_t stamp; // unique among registries, renewed by restoreAll().
+
+    private:
+        struct Slot {
+            const void* function;
+            const void* kind;
+            JoMockNode* node;
+        };
+
+        static std::size_t nextStamp() {
+            static std::atomic<std::size_t> value(0);
+            return ++value;
+        }
+
+        static std::size_t hash(const void* const function, const void* const kind) {
+            std::size_t value = (reinterpret_cast<std::size_t>(function) ^ reinterpret_cast<std::size_t>(kind)) >> 2;
+            value *= 0x9E3779B1u;
+            return value ^ (value >> 15);
+        }
+
+        void place(const void* const function, const void* const kind, JoMockNode* const node) {
+            const std::size_t mask = table.size() - 1;
+            for (std::size_t index = hash(function, kind) & mask; ; index = (index + 1) & mask) {
+                Slot& slot = table[index];
+                if (slot.node == nullptr) {
+                    const Slot fresh = { function, kind, node };
+                    slot = fresh;
+                    ++used;
+                    return;
+                }
+                if (slot.function == function && slot.kind == kind) {
+                    slot.node = node;
+                    return;
+                }
+            }
+        }
+
+        void grow() {
+            std::vector<Slot> previous(table.empty() ? 32 : table.size() * 2, Slot());
+            previous.swap(table);
+            used = 0;
+            for (const Slot& slot : previous) {
+                if (slot.node != nullptr) {
+                    place(slot.function, slot.kind, slot.node);
+                }
+            }
+        }
+
+        std::vector<Slot> table;
+        std::vector<JoMockNode*> journal;
+        std::size_t used;
+    };
+
+    // Identifies the kind of node kept in a registry, so that a mock and a stub of the same function
+    // do not collide.
+    template < typename T >
+    struct JoMockKind {
+        static const void* id() {
+            static const char tag = 0;
+            return &tag;
+        }
+    };
+
+    // Mocks created by the calling thread in thread-local dispatch mode.
+    struct JoMockThreadState {
+        ~JoMockThreadState() {
+            restoreAll();
+        }
+
+        static JoMockThreadState& current() {
+            static thread_local JoMockThreadState state;
+            return state;
+        }
+
+        void* slot(const std::size_t index) const {
+            return index < slots.size() ? slots[index] : nullptr;
+        }
+
+        void setSlot(const std::size_t index, void* const mock) {
+            if (index >= slots.size()) {
+                slots.resize(index + 1, nullptr);
+            }
+            slots[index] = mock;
+        }
+
+        void restoreAll() {
+            registry.restoreAll();
+        }
+
+        std::vector<void*> slots;
+        JoMockRegistry registry;
+    };
+
+    struct JoMockDispatchTarget {
+        std::size_t slot;
+        void* trampoline;
+    };
+
+    // Thread-local dispatch: a patched function jumps to an entry point that looks the mock up in the
+    // calling thread's slot table, and threads without a mock run the original code via a trampoline.
+    struct JoMockThreadLocalDispatch {
+        static const std::size_t kNoSlot = ~static_cast<std::size_t>(0);
+
+        static bool& enabled() {
+            static bool value = false;
+            return value;
+        }
+
+        template < typename F1, typename F2 >
+        static std::size_t acquire(F1 address, F2 entryPoint, JoMockDispatchTarget& target, void* const mock, const char* const functionName) {
+            return acquireFunction(reinterpret_cast<void*>((std::size_t&)address),
+                reinterpret_cast<void*>((std::size_t&)entryPoint), target, mock, functionName);
+        }
+
+        template < typename F >
+        static void release(F address, const std::size_t slot) {
+            releaseFunction(reinterpret_cast<void*>((std::size_t&)address), slot);
+        }
+
+    private:
+        struct Entry {
+            std::size_t slot;
+            std::size_t references;
+            JoMockBackup backup;
+        };
+
+        static std::mutex& mutex() {
+            static std::mutex value;
+            return value;
+        }
+
+        static unordered_map<void*, Entry>& entries() {
+            static unordered_map<void*, Entry> value;
+            return value;
+        }
+
+        static std::size_t acquireFunction(void* const function, const void* const entryPoint, JoMockDispatchTarget& target,
+            void* const mock, const char* const functionName) {
+            std::lock_guard<std::mutex> lock(mutex());
+            unordered_map<void*, Entry>& table = entries();
+            auto got = table.find(function);
+            if (got == table.end()) {
+                Entry entry = { table.size(), 0, JoMockBackup() };
+                got = table.insert({ function, entry }).first;
+            }
+            Entry& entry = got->second;
+            if (entry.references == 0) {
+                char code[JoMockPatchTransaction::kMaxPatchSize];
+                std::size_t size = JoMockPatch::encodeJump(function, entryPoint, code);
+                size = JoMockPatch::checkJump(function, entryPoint, code, size);
+                void* const trampoline = JoMockTrampoline::get(function, size);
+                if (trampoline == nullptr) {
+                    fprintf(stderr, "jomock: cannot relocate the entry of %s for thread-local dispatch\n", functionName);
+                    std::abort();
+                }
+                target.slot = entry.slot;
+                target.trampoline = trampoline;
+                JoMockPatch::backupBinary(reinterpret_cast<const char*>(function), entry.backup, size);
+                JoMockPatchTransaction immediate; // other threads fall through the trampoline from now on.
+                JoMockPatch::queueCode(immediate, function, code, size, false);
+                if (!immediate.commit()) {
+                    std::abort();
+                }
+            }
+            ++entry.references;
+            JoMockThreadState::current().setSlot(entry.slot, mock);
+            return entry.slot;
+        }
+
+        static void releaseFunction(void* const function, const std::size_t slot) {
+            JoMockThreadState::current().setSlot(slot, nullptr);
+            std::lock_guard<std::mutex> lock(mutex());
+            Entry& entry = entries()[function];
+            if (--entry.references == 0) {
+                JoMockPatchTransaction immediate;
+                JoMockPatch::queueCode(immediate, function, entry.backup.data(), entry.backup.size(), true);
+                if (!immediate.commit()) {
+                    std::abort();
+                }
+            }
+        }
+    };
+
+    template < typename I, typename R, typename ... P >
+    struct MockerEntryPoint<I(R(P ...))> {
+        typedef I IntegrateType(R(P ...));
+        friend struct JoMock<IntegrateType>;
+        JOMOCK_ENTRY static R EntryPoint(P... p) {
+            return SingletonBase<JoMock<IntegrateType>*>::getInstance()->stubFunc(p ...);
+        }
+        // Reached by a thunk (JoMockThunk) with the mock in front of the arguments.
+        JOMOCK_ENTRY static R Call(JoMock<IntegrateType>* const mock, P... p) {
+            return mock->stubFunc(p ...);
+        }
+    };
+
+    template < typename I, typename C, typename R, typename ... P >
+    struct MockerEntryPoint<I(R(C::*)(P ...) const)> {
+        typedef I IntegrateType(R(C::*)(const void*, P ...) const);
+        friend struct JoMock<IntegrateType>; \
+            JOMOCK_ENTRY R EntryPoint(P... p) {
+            JoMock<IntegrateType>* const mock = SingletonBase<JoMock<IntegrateType>*>::getInstance();
+            if (!mock->instances.admits(this)) {
+                return mock->callOriginal(this, p ...);
+            }
+            return mock->stubFunc(this, p ...);
+        }
+        JOMOCK_ENTRY static R Call(JoMock<IntegrateType>* const mock, const void* const object, P... p) {
+            if (!mock->instances.admits(object)) {
+                return mock->callOriginal(object, p ...);
+            }
+            return mock->stubFunc(object, p ...);
+        }
+    };
+
+    template < typename I, typename C, typename R, typename ... P >
+    struct MockerEntryPoint<I(R(C::*)(P ...))> {
+        typedef I IntegrateType(R(C::*)(const void*, P ...));
+        friend struct JoMock<IntegrateType>; \
+            JOMOCK_ENTRY R EntryPoint(P... p) {
+            JoMock<IntegrateType>* const mock = SingletonBase<JoMock<IntegrateType>*>::getInstance();
+            if (!mock->instances.admits(this)) {
+                return mock->callOriginal(this, p ...);
+            }
+            return mock->stubFunc(this, p ...);
+        }
+        JOMOCK_ENTRY static R Call(JoMock<IntegrateType>* const mock, const void* const object, P... p) {
+            if (!mock->instances.admits(object)) {
+                return mock->callOriginal(object, p ...);
+            }
+            return mock->stubFunc(object, p ...);
+        }
+    };
+
+    template < typename T >
+    struct ThreadLocalEntryPoint { };
+
+    template < typename I, typename R, typename ... P >
+    struct ThreadLocalEntryPoint<I(R(P ...))> {
+        static JoMockDispatchTarget& target() {
+            static JoMockDispatchTarget value = { JoMockThreadLocalDispatch::kNoSlot, nullptr };
+            return value;
+        }
+        JOMOCK_ENTRY static R EntryPoint(P... p) {
+            const JoMockDispatchTarget& dispatch = target();
+            JoMockBase<R(P ...)>* mock = static_cast<JoMockBase<R(P ...)>*>(JoMockThreadState::current().slot(dispatch.slot));
+            if (mock != nullptr) {
+                return mock->stubFunc(p ...);
+            }
+            return JoMockPatch::toFunction<R(*)(P ...)>(dispatch.trampoline)(p ...);
+        }
+    };
+
+    template < typename I, typename C, typename R, typename ... P >
+    struct ThreadLocalEntryPoint<I(R(C::*)(P ...) const)> {
+        static JoMockDispatchTarget& target() {
+            static JoMockDispatchTarget value = { JoMockThreadLocalDispatch::kNoSlot, nullptr };
+            return value;
+        }
+        JOMOCK_ENTRY R EntryPoint(P... p) {
+            const JoMockDispatchTarget& dispatch = target();
+            JoMockMethod<R(const void*, P ...)>* mock = static_cast<JoMockMethod<R(const void*, P ...)>*>(
+                static_cast<JoMockBase<R(const void*, P ...)>*>(JoMockThreadState::current().slot(dispatch.slot)));
+            if (mock != nullptr && mock->instances.admits(this)) {
+                return mock->stubFunc(this, p ...);
+            }
+            return (reinterpret_cast<const C*>(this)->*JoMockPatch::toFunction<R(C::*)(P ...) const>(dispatch.trampoline))(p ...);
+        }
+    };
+
+    template < typename I, typename C, typename R, typename ... P >
+    struct ThreadLocalEntryPoint<I(R(C::*)(P ...))> {
+        static JoMockDispatchTarget& target() {
+            static JoMockDispatchTarget value = { JoMockThreadLocalDispatch::kNoSlot, nullptr };
+            return value;
+        }
+        JOMOCK_ENTRY R EntryPoint(P... p) {
+            const JoMockDispatchTarget& dispatch = target();
+            JoMockMethod<R(const void*, P ...)>* mock = static_cast<JoMockMethod<R(const void*, P ...)>*>(
+                static_cast<JoMockBase<R(const void*, P ...)>*>(JoMockThreadState::current().slot(dispatch.slot)));
+            if (mock != nullptr && mock->instances.admits(this)) {
+                return mock->stubFunc(this, p ...);
+            }
+            return (reinterpret_cast<C*>(this)->*JoMockPatch::toFunction<R(C::*)(P ...)>(dispatch.trampoline))(p ...);
+        }
+    };
+
+    // Opt-in call tracing (JOMOCK_TRACE) : each mock action leaves a fixed-size record in a ring of its thread,
+    // written without a lock, and restoreAll() appends the records made since the last dump to '<path>.json',
+    // a Chrome trace (chrome://tracing, Perfetto), and '<path>.bin'. A ring keeps the last kRecords calls, a
+    // dump takes kRecords - 1 of them as the oldest may be overwritten meanwhile. stop() closes the JSON array.
+    // The binary file is "JMTRACE1" then a chunk per dump : u32 name count, the names (u32 length, bytes),
+    // f64 ticks per microsecond, u32 record count, the records (u32 mock = name index, u32 thread, u64 start
+    // and u64 duration in ticks since the start of the trace).
+    struct JoMockTrace {
+        static const std::size_t kRecords = 4096;
+
+        struct Record {
+            const char* name; // functionName of the mock.
+            std::uint64_t start;
+            std::uint64_t duration;
+            std::uint32_t thread;
+        };
+
+        // The branch taken by every mock action.
+        static bool active() {
+            return enabled().load(std::memory_order_relaxed);
+        }
+
+        static std::uint64_t ticks() {
+#if (defined(__GNUC__) || defined(__clang__)) && defined(__aarch64__)
+            std::uint64_t value;
+            __asm__ __volatile__("mrs %0, cntvct_el0" : "=r"(value));
+            return value;
+#elif defined(_MSC_VER) || defined(__x86_64__) || defined(__i386__)
+            return __rdtsc();
+#else
+            return static_cast<std::uint64_t>(std::chrono::duration_cast<std::chrono::nanoseconds>(
+                std::chrono::steady_clock::now().time_since_epoch()).count());
+#endif
+        }
+
+        static void record(const char* const name, const std::uint64_t start, const std::uint64_t end) {
+            Ring& ring = local();
+            const std::uint64_t index = ring.head.load(std::memory_order_relaxed);
+            Record& slot = ring.records[index % kRecords];
+            slot.name = name;
+            slot.start = start;
+            slot.duration = end - start;
+            slot.thread = ring.thread;
+            ring.head.store(index + 1, std::memory_order_release);
+        }
+
+        // Truncates the files and records from now on, a trace in progress is closed first.
+        static bool start(const std::string& path) {
+            stop();
+            State& trace = state();
+            std::lock_guard<std::mutex> lock(trace.mutex);
+            FILE* const json = std::fopen((path + ".json").c_str(), "wb");
+            FILE* const binary = std::fopen((path + ".bin").c_str(), "wb");
+            if (json != nullptr) std::fputs("[\n", json);
+            if (binary != nullptr) std::fwrite("JMTRACE1", 1, 8, binary);
+            const bool opened = json != nullptr && binary != nullptr;
+            if (json != nullptr) std::fclose(json);
+            if (binary != nullptr) std::fclose(binary);
+            if (!opened) {
+                fprintf(stderr, "jomock: cannot write the trace %s\n", path.c_str());
+                return false;
+            }
+            for (const std::unique_ptr<Ring>& ring : trace.rings) {
+                ring->dumped = ring->head.load(std::memory_order_acquire);
+            }
+            trace.path = path;
+            trace.written = 0;
+            trace.base = ticks();
+            trace.baseTime = std::chrono::steady_clock::now();
+            enabled().store(true, std::memory_order_relaxed);
+            return true;
+        }
+
+        // Dumps the rest and closes the JSON array.
+        static void stop() {
+            if (!active()) return;
+            flush();
+            State& trace = state();
+            std::lock_guard<std::mutex> lock(trace.mutex);
+            enabled().store(false, std::memory_order_relaxed);
+            FILE* const json = std::fopen((trace.path + ".json").c_str(), "ab");
+            if (json == nullptr) return;
+            std::fputs("\n]\n", json);
+            std::fclose(json);
+        }
+
+        // Appends the records made since the last dump to the files.
+        static void flush() {
+            if (!active()) return;
+            State& trace = state();
+            std::lock_guard<std::mutex> lock(trace.mutex);
+            std::vector<Record> records;
+            std::size_t lost = 0;
+            for (const std::unique_ptr<Ring>& ring : trace.rings) {
+                // The slot of record 'head' may be half written : the oldest whole one is head - kRecords + 1.
+                const std::uint64_t head = ring->head.load(std::memory_order_acquire);
+                std::uint64_t from = std::max(ring->dumped, head >= kRecords ? head - kRecords + 1 : 0);
+                const std::size_t first = records.size();
+                for (std::uint64_t i = from; i < head; ++i) {
+                    records.push_back(ring->records[i % kRecords]);
+                }
+                // Records the thread overwrote while they were copied are dropped.
+                const std::uint64_t after = ring->head.load(std::memory_order_acquire);
+                if (after >= kRecords && after - kRecords + 1 > from) {
+                    const std::uint64_t overwritten = std::min(after - kRecords + 1, head) - from;
+                    records.erase(records.begin() + first, records.begin() + first + static_cast<std::ptrdiff_t>(overwritten));
+                    from += overwritten;
+                }
+                lost += static_cast<std::size_t>(from - ring->dumped);
+                ring->dumped = head;
+            }
+            if (lost != 0) {
+                fprintf(stderr, "jomock: %zu trace records were overwritten before the dump\n", lost);
+            }
+            if (records.empty()) return;
+            const double elapsed = static_cast<double>(std::chrono::duration_cast<std::chrono::nanoseconds>(
+                std::chrono::steady_clock::now() - trace.baseTime).count()) / 1000.0;
+            const std::uint64_t now = ticks();
+            const double perMicrosecond = elapsed > 0 && now > trace.base ? static_cast<double>(now - trace.base) / elapsed : 1000.0;
+            std::vector<const char*> names;
+            for (const Record& record : records) {
+                if (std::find(names.begin(), names.end(), record.name) == names.end()) names.push_back(record.name);
+            }
+            writeJson(trace, records, perMicrosecond);
+            writeBinary(trace, records, names, perMicrosecond);
+        }
+
+    private:
+        struct Ring {
+            explicit Ring(const std::uint32_t _thread) : head(0), dumped(0), thread(_thread) {}
+            Record records[kRecords];
+            std::atomic<std::uint64_t> head; // records written.
+            std::uint64_t dumped; // records dumped or skipped, under the mutex.
+            const std::uint32_t thread;
+        };
+
+        struct State {
+            State() : written(0), base(0) {}
+            std::mutex mutex;
+            std::vector<std::unique_ptr<Ring>> rings; // kept after their thread ends, for the next dump.
+            std::string path;
+            std::size_t written; // records in the JSON file.
+            std::uint64_t base;
+            std::chrono::steady_clock::time_point baseTime;
+        };
+
+        static std::atomic<bool>& enabled() {
+            static std::atomic<bool> value(false);
+            return value;
+        }
+
+        static State& state() {
+            static State value;
+            return value;
+        }
+
+        static Ring& local() {
+            static thread_local Ring* ring = nullptr;
+            if (ring == nullptr) {
+                State& trace = state();
+                std::lock_guard<std::mutex> lock(trace.mutex);
+                trace.rings.emplace_back(new Ring(static_cast<std::uint32_t>(trace.rings.size() + 1)));
+                ring = trace.rings.back().get();
+            }
+            return *ring;
+        }
+
+        static void writeJson(State& trace, const std::vector<Record>& records, const double perMicrosecond) {
+            FILE* const file = std::fopen((trace.path + ".json").c_str(), "ab");
+            if (file == nullptr) return;
+            for (const Record& record : records) {
+                std::fputs(trace.written++ == 0 ? "{\"name\":\"" : ",\n{\"name\":\"", file);
+                for (const char* c = record.name; *c != '\0'; ++c) {
+                    if (*c == '"' || *c == '\\') std::fputc('\\', file);
+                    std::fputc(*c, file);
+                }
+                fprintf(file, "\",\"ph\":\"X\",\"pid\":1,\"tid\":%u,\"ts\":%.3f,\"dur\":%.3f}", record.thread,
+                    static_cast<double>(record.start - trace.base) / perMicrosecond, static_cast<double>(record.duration) / perMicrosecond);
+            }
+            std::fclose(file);
+        }
+
+        static void writeBinary(const State& trace, const std::vector<Record>& records, const std::vector<const char*>& names,
+            const double perMicrosecond) {
+            FILE* const file = std::fopen((trace.path + ".bin").c_str(), "ab");
+            if (file == nullptr) return;
+            const std::uint32_t nameCount = static_cast<std::uint32_t>(names.size());
+            std::fwrite(&nameCount, sizeof(nameCount), 1, file);
+            for (const char* const name : names) {
+                const std::uint32_t length = static_cast<std::uint32_t>(std::strlen(name));
+                std::fwrite(&length, sizeof(length), 1, file);
+                std::fwrite(name, 1, length, file);
+            }
+            std::fwrite(&perMicrosecond, sizeof(perMicrosecond), 1, file);
+            const std::uint32_t recordCount = static_cast<std::uint32_t>(records.size());
+            std::fwrite(&recordCount, sizeof(recordCount), 1, file);
+            for (const Record& record : records) {
+                const std::uint32_t head[2] = {
+                    static_cast<std::uint32_t>(std::find(names.begin(), names.end(), record.name) - names.begin()), record.thread };
+                const std::uint64_t times[2] = { record.start - trace.base, record.duration };
+                std::fwrite(head, sizeof(head), 1, file);
+                std::fwrite(times, sizeof(times), 1, file);
+            }
+            std::fclose(file);
+        }
+    };
+
+    // Times the mock action of its scope.
+    struct JoMockTraceScope {
+        explicit JoMockTraceScope(const char* const _name) : name(_name), start(JoMockTrace::ticks()) {}
+        ~JoMockTraceScope() {
+            JoMockTrace::record(name, start, JoMockTrace::ticks());
+        }
+        const char* const name;
+        const std::uint64_t start;
+    };
+
+    // Behavior of an installed mock in place of its gmock expectations, swapped with one pointer store.
+    template < typename R, typename ... P >
+    struct JoMockTarget<R(P ...)> {
+        virtual ~JoMockTarget() {}
+        virtual R invoke(P... p) = 0;
+    };
+
+    template < typename F, typename R, typename ... P >
+    struct JoMockCallable : JoMockTarget<R(P ...)> {
+        JoMockCallable(const F& _callable) : callable(_callable) {}
+        R invoke(P... p) {
+            return callable(p ...);
+        }
+        F callable;
+    };
+
+    // Call count of a JoMockFast, kept on per-thread shards and checked against times() when it goes away.
+    template < typename D >
+    struct JoMockFastCalls {
+        JoMockFastCalls(const char* const _functionName) : functionName(_functionName), minimum(0), maximum(SIZE_MAX) {
+            for (Shard& shard : shards) {
+                shard.calls.store(0, std::memory_order_relaxed);
+            }
+        }
+
+        ~JoMockFastCalls() {
+            const std::size_t count = calls();
+            if (count < minimum || count > maximum) {
+                ADD_FAILURE() << "jomock: " << functionName << " was called " << count << " times, expected "
+                    << (maximum == SIZE_MAX ? "at least " + std::to_string(minimum) : minimum == maximum ?
+                        std::to_string(minimum) : std::to_string(minimum) + " to " + std::to_string(maximum));
+            }
+        }
+
+        D& times(const std::size_t count) {
+            minimum = maximum = count;
+            return static_cast<D&>(*this);
+        }
+
+        D& atLeast(const std::size_t count) {
+            minimum = count;
+            return static_cast<D&>(*this);
+        }
+
+        D& atMost(const std::size_t count) {
+            maximum = count;
+            return static_cast<D&>(*this);
+        }
+
+        std::size_t calls() const {
+            std::size_t sum = 0;
+            for (const Shard& shard : shards) {
+                sum += shard.calls.load(std::memory_order_relaxed);
+            }
+            return sum;
+        }
+
+    protected:
+        void count() {
+            static std::atomic<std::size_t> next(0);
+            static thread_local const std::size_t index = next.fetch_add(1, std::memory_order_relaxed) % kShards;
+            shards[index].calls.fetch_add(1, std::memory_order_relaxed);
+        }
+
+    private:
+        static const std::size_t kShards = 64;
+
+        // Padded rather than aligned : plain new does not over-align before C++17, and counters 64 bytes
+        // apart never share a cache line wherever the array starts.
+        struct Shard {
+            std::atomic<std::size_t> calls;
+            char padding[64 - sizeof(std::atomic<std::size_t>)];
+        };
+        static_assert(sizeof(Shard) == 64, "one shard per cache line");
+
+        const char* const functionName;
+        std::size_t minimum;
+        std::size_t maximum;
+        Shard shards[kShards];
+    };
+
+    // Expectation backend without gmock's lock, for mocks called from many threads at once : return values
+    // (willOnce() values in order, then the willRepeatedly() value) and a call count. Only the willOnce()
+    // values take a shared ticket, until they run out. Arguments are not matched. Set it up before the calls.
+    template < typename R, typename ... P >
+    struct JoMockFast<R(P ...)> : JoMockTarget<R(P ...)>, JoMockFastCalls<JoMockFast<R(P ...)>> {
+        JoMockFast(const char* const functionName) :
+            JoMockFastCalls<JoMockFast>(functionName), repeated(false), ticket(0), exhausted(false) {}
+
+        JoMockFast& willOnce(const R& value) {
+            once.push_back(value);
+            exhausted.store(false, std::memory_order_relaxed);
+            return *this;
+        }
+
+        JoMockFast& willRepeatedly(const R& value) {
+            always.clear();
+            always.push_back(value);
+            repeated = true;
+            return *this;
+        }
+
+        R invoke(P...) {
+            this->count();
+            if (!exhausted.load(std::memory_order_relaxed)) {
+                const std::size_t index = ticket.fetch_add(1, std::memory_order_relaxed);
+                if (index < once.size()) return once[index];
+                exhausted.store(true, std::memory_order_relaxed);
+            }
+            if (repeated) return always.front();
+            return once.empty() ? Default<R>::get() : once.back();
+        }
+
+    private:
+        template < typename T, bool = std::is_default_constructible<T>::value >
+        struct Default {
+            static T get() { return T(); }
+        };
+
+        template < typename T >
+        struct Default<T, false> {
+            static T get() {
+                fprintf(stderr, "jomock: no return value set for a call\n");
+                std::abort();
+            }
+        };
+
+        std::vector<R> once;
+        std::vector<R> always; // the willRepeatedly() value, if any.
+        bool repeated;
+        std::atomic<std::size_t> ticket;
+        std::atomic<bool> exhausted;
+    };
+
+    template < typename ... P >
+    struct JoMockFast<void(P ...)> : JoMockTarget<void(P ...)>, JoMockFastCalls<JoMockFast<void(P ...)>> {
+        JoMockFast(const char* const functionName) : JoMockFastCalls<JoMockFast>(functionName) {}
+
+        void invoke(P...) {
+            this->count();
+        }
+    };
+
+    template < typename R, typename ... P >
+    struct JoMockBase<R(P ...)> : JoMockNode {
+        JoMockBase(const char* const _functionName) :
+            functionName(_functionName), dispatchSlot(JoMockThreadLocalDispatch::kNoSlot), dispatch(nullptr),
+            passThrough(this), parked(nullptr) {}
+        virtual ~JoMockBase() {
+            for (const std::function<void()>& hook : restoreHooks) {
+                hook();
+            }
+        }
+
+        R stubFunc(P... p) {
+            if (JoMockTrace::active()) {
+                const JoMockTraceScope scope(functionName);
+                return act(p ...);
+            }
+            return act(p ...);
+        }
+
+        // Switches the mock to the lock-free backend (see JoMockFast), in place of its gmock expectations.
+        JoMockFast<R(P ...)>& fast() {
+            static_assert(std::is_void<R>::value || (!std::is_reference<R>::value && std::is_copy_constructible<R>::value),
+                "jomock : the fast backend returns copies of its values");
+            if (!fastOwner) {
+                fastOwner.reset(new JoMockFast<R(P ...)>(functionName));
+            }
+            dispatch.store(fastOwner.get(), std::memory_order_release);
+            return static_cast<JoMockFast<R(P ...)>&>(*fastOwner);
+        }
+
+        // Switches the mock to the real function with latency and failures added (see JoMockInject).
+        JoMockInject<R(P ...)>& inject() {
+            if (!injectOwner) {
+                injectOwner.reset(new JoMockInject<R(P ...)>(this));
+            }
+            dispatch.store(injectOwner.get(), std::memory_order_release);
+            return static_cast<JoMockInject<R(P ...)>&>(*injectOwner);
+        }
+
+        // A target calling 'callable', kept until the mock goes away. A callable without state is stored once
+        // per type, the others once per call : prepare those here for hot swaps.
+        template < typename F >
+        JoMockTarget<R(P ...)>* target(const F& callable) {
+            std::lock_guard<std::mutex> lock(targetsMutex);
+            const void* const kind = std::is_empty<F>::value ? JoMockKind<F>::id() : nullptr;
+            if (kind != nullptr) {
+                for (const auto& stored : targets) {
+                    if (stored.first == kind) return stored.second.get();
+                }
+            }
+            targets.emplace_back(kind, std::unique_ptr<JoMockTarget<R(P ...)>>(new JoMockCallable<F, R, P ...>(callable)));
+            return targets.back().second.get();
+        }
+
+        // Sends the calls to 'next' (the gmock expectations when nullptr). The jump stays in place and calls
+        // on other threads see either target, so it can change while they run.
+        void retarget(JoMockTarget<R(P ...)>* const next) {
+            dispatch.store(next, std::memory_order_release);
+        }
+
+        void retarget(std::nullptr_t) {
+            retarget(static_cast<JoMockTarget<R(P ...)>*>(nullptr));
+        }
+
+        template < typename F >
+        void retarget(const F& callable) {
+            retarget(target(callable));
+        }
+
+        // Runs 'hook' when CLEAR_JOMOCK removes the mock, after the functions are restored.
+        void atRestore(const std::function<void()>& hook) {
+            restoreHooks.push_back(hook);
+        }
+
+        // A disabled mock passes the calls through to the original function until enable().
+        void disable() {
+            JoMockTarget<R(P ...)>* current = dispatch.load(std::memory_order_relaxed);
+            do {
+                if (current == &passThrough) return;
+                parked.store(current, std::memory_order_relaxed);
+            } while (!dispatch.compare_exchange_weak(current, &passThrough, std::memory_order_release, std::memory_order_relaxed));
+        }
+
+        void enable() {
+            JoMockTarget<R(P ...)>* expected = &passThrough;
+            dispatch.compare_exchange_strong(expected, parked.load(std::memory_order_relaxed), std::memory_order_release, std::memory_order_relaxed);
+        }
+
+        ::testing::MockSpec<R(P...)> gmock_stubFunc(const ::testing::Matcher<P>&... p) {
+            gmocker.RegisterOwner(this);
+            return gmocker.With(p ...);
+        }
+
+        virtual void restore() = 0;
+
+        // Runs the original implementation while the mock stays in place.
+        virtual R callOriginal(P... p) = 0;
+
+        // gmock action delegating to callOriginal().
+        ::testing::Action<R(P...)> originalAction() {
+            return ::testing::Invoke(this, &JoMockBase::callOriginal);
+        }
+
+        mutable ::testing::FunctionMocker<R(P...)> gmocker;
+        const char* const functionName;
+        std::size_t dispatchSlot; // slot in the thread's table when created in thread-local dispatch mode.
+        std::atomic<JoMockTarget<R(P ...)>*> dispatch; // nullptr : the gmock expectations.
+
+    private:
+        R act(P... p) {
+            JoMockTarget<R(P ...)>* const target = dispatch.load(std::memory_order_acquire);
+            if (target != nullptr) {
+                return target->invoke(p ...);
+            }
+            gmocker.SetOwnerAndName(this, functionName);
+            return gmocker.Invoke(p ...);
+        }
+
+        struct PassThrough : JoMockTarget<R(P ...)> {
+            PassThrough(JoMockBase* const _owner) : owner(_owner) {}
+            R invoke(P... p) {
+                return owner->callOriginal(p ...);
+            }
+            JoMockBase* const owner;
+        };
+
+        // Held as targets so that the backends are instantiated only for the mocks using them. The fast one
+        // verifies its call count in its destructor, when the mock goes away.
+        std::unique_ptr<JoMockTarget<R(P ...)>> fastOwner;
+        std::unique_ptr<JoMockTarget<R(P ...)>> injectOwner;
+        std::mutex targetsMutex;
+        std::vector<std::pair<const void*, std::unique_ptr<JoMockTarget<R(P ...)>>>> targets; // with the type of a callable without state.
+        PassThrough passThrough;
+        std::atomic<JoMockTarget<R(P ...)>*> parked; // target before disable().
+        std::vector<std::function<void()>> restoreHooks;
+    };
+
+    // Per-thread xoroshiro128+ for the injections. seed() makes the draws repeatable : every thread reseeds on
+    // its next draw from the seed and the order it first drew in.
+    struct JoMockRandom {
+        static std::uint64_t next() {
+            State& state = local();
+            const std::uint64_t generation = seeds().generation.load(std::memory_order_relaxed);
+            if (state.generation != generation) {
+                reseed(state, generation);
+            }
+            const std::uint64_t s0 = state.s[0];
+            std::uint64_t s1 = state.s[1];
+            const std::uint64_t result = s0 + s1;
+            s1 ^= s0;
+            state.s[0] = rotate(s0, 24) ^ s1 ^ (s1 << 16);
+            state.s[1] = rotate(s1, 37);
+            return result;
+        }
+
+        // In [0, 1).
+        static double uniform() {
+            return static_cast<double>(next() >> 11) * (1.0 / 9007199254740992.0);
+        }
+
+        // Standard normal, by Box-Muller.
+        static double normal() {
+            const double u = 1.0 - uniform();
+            return std::sqrt(-2.0 * std::log(u)) * std::cos(6.283185307179586 * uniform());
+        }
+
+        static void seed(const std::uint64_t value) {
+            Seeds& all = seeds();
+            std::lock_guard<std::mutex> lock(all.mutex);
+            all.value = value;
+            all.threads = 0;
+            all.generation.fetch_add(1, std::memory_order_relaxed);
+        }
+
+    private:
+        struct State {
+            std::uint64_t s[2];
+            std::uint64_t generation;
+        };
+
+        struct Seeds {
+            Seeds() : value(0x853C49E6748FEA9Bull), threads(0), generation(1) {}
+            std::mutex mutex;
+            std::uint64_t value;
+            std::uint64_t threads;
+            std::atomic<std::uint64_t> generation;
+        };
+
+        static Seeds& seeds() {
+            static Seeds value;
+            return value;
+        }
+
+        static State& local() {
+            static thread_local State state = { { 0, 0 }, 0 };
+            return state;
+        }
+
+        static void reseed(State& state, const std::uint64_t generation) {
+            Seeds& all = seeds();
+            std::lock_guard<std::mutex> lock(all.mutex);
+            std::uint64_t mix = all.value + ++all.threads * 0x9E3779B97F4A7C15ull;
+            state.s[0] = splitMix(mix);
+            state.s[1] = splitMix(mix);
+            state.generation = generation;
+        }
+
+        static std::uint64_t splitMix(std::uint64_t& x) {
+            std::uint64_t z = (x += 0x9E3779B97F4A7C15ull);
+            z = (z ^ (z >> 30)) * 0xBF58476D1CE4E5B9ull;
+            z = (z ^ (z >> 27)) * 0x94D049BB133111EBull;
+            return z ^ (z >> 31);
+        }
+
+        static std::uint64_t rotate(const std::uint64_t x, const int k) {
+            return (x << k) | (x >> (64 - k));
+        }
+    };
+
+    // Latency added to an injected call.
+    struct JoMockLatency {
+        typedef std::chrono::nanoseconds Duration;
+        enum Kind { None, Fixed, Uniform, LogNormal };
+
+        JoMockLatency() : kind(None), low(0), high(0), sigma(0) {}
+
+        static JoMockLatency fixed(const Duration latency) {
+            return JoMockLatency(Fixed, latency, latency, 0);
+        }
+
+        static JoMockLatency uniform(const Duration low, const Duration high) {
+            return JoMockLatency(Uniform, low, high, 0);
+        }
+
+        // exp(normal(ln median, sigma)), cut at 'limit' : a long tail for sigma around 0.5 to 1.
+        static JoMockLatency lognormal(const Duration median, const double sigma, const Duration limit = Duration::max()) {
+            return JoMockLatency(LogNormal, median, limit, sigma);
+        }
+
+        Duration sample() const {
+            switch (kind) {
+            case Fixed:
+                return low;
+            case Uniform:
+                return low + Duration(static_cast<Duration::rep>(JoMockRandom::uniform() * static_cast<double>((high - low).count())));
+            case LogNormal: {
+                const double value = static_cast<double>(low.count()) * std::exp(sigma * JoMockRandom::normal());
+                return value < static_cast<double>(high.count()) ? Duration(static_cast<Duration::rep>(value)) : high;
+            }
+            default:
+                return Duration(0);
+            }
+        }
+
+        Kind kind;
+        Duration low; // the median of LogNormal.
+        Duration high; // the limit of LogNormal.
+        double sigma;
+
+    private:
+        JoMockLatency(const Kind _kind, const Duration _low, const Duration _high, const double _sigma) :
+            kind(_kind), low(_low), high(_high), sigma(_sigma) {}
+    };
+
+    // Runs the real function with latency, failed returns and exceptions added at random (JOMOCK_INJECT). The
+    // settings change at any time, also while other threads call : each change publishes a new plan with one
+    // pointer store, the previous plans are kept until the mock goes away. The latency is a sleep, virtual with
+    // JOMOCK_VIRTUAL_TIME(); it comes before the failure. An exception needs a function that may throw : calls
+    // to a function the compiler proved not to throw get no unwind entry.
+    template < typename R, typename ... P >
+    struct JoMockInject<R(P ...)> : JoMockTarget<R(P ...)> {
+        explicit JoMockInject(JoMockBase<R(P ...)>* const _owner) : owner(_owner), failed(0), thrown(0) {
+            plans.emplace_back(new Plan());
+            plan.store(plans.back().get(), std::memory_order_release);
+        }
+
+        R invoke(P... p) {
+            const Plan& current = *plan.load(std::memory_order_acquire);
+            if (current.latency.kind != JoMockLatency::None) {
+                const JoMockLatency::Duration latency = current.latency.sample();
+                if (latency.count() > 0) std::this_thread::sleep_for(latency);
+            }
+            if (current.raising > 0 && JoMockRandom::uniform() < current.raising) {
+                thrown.fetch_add(1, std::memory_order_relaxed);
+                current.raise();
+            }
+            if (current.failing > 0 && JoMockRandom::uniform() < current.failing) {
+                failed.fetch_add(1, std::memory_order_relaxed);
+                if (current.error != 0) errno = current.error;
+                return current.result();
+            }
+            return owner->callOriginal(p ...);
+        }
+
+        JoMockInject& latency(const JoMockLatency& distribution) {
+            return change([&distribution](Plan& next) { next.latency = distribution; });
+        }
+
+        // With 'probability', returns 'value' in place of the call and sets errno to 'error' unless 0.
+        template < typename V, typename Q = R >
+        typename std::enable_if<!std::is_void<Q>::value, JoMockInject&>::type fail(const double probability, const V& value,
+            const int error = 0) {
+            return change([&](Plan& next) {
+                next.failing = probability;
+                next.result = [value]() -> R { return value; };
+                next.error = error;
+            });
+        }
+
+        template < typename Q = R >
+        typename std::enable_if<std::is_void<Q>::value, JoMockInject&>::type fail(const double probability, const int error = 0) {
+            return change([&](Plan& next) {
+                next.failing = probability;
+                next.result = []() {};
+                next.error = error;
+            });
+        }
+
+        // With 'probability', throws a copy of 'exception' in place of the call.
+        template < typename E >
+        JoMockInject& raise(const double probability, const E& exception) {
+            return change([&](Plan& next) {
+                next.raising = probability;
+                next.raise = [exception]() { throw exception; };
+            });
+        }
+
+        // Back to the real function alone.
+        JoMockInject& clear() {
+            return change([](Plan& next) { next = Plan(); });
+        }
+
+        std::size_t failures() const {
+            return failed.load(std::memory_order_relaxed);
+        }
+
+        std::size_t exceptions() const {
+            return thrown.load(std::memory_order_relaxed);
+        }
+
+    private:
+        struct Plan {
+            Plan() : failing(0), error(0), raising(0) {}
+            JoMockLatency latency;
+            double failing;
+            std::function<R()> result;
+            int error;
+            double raising;
+            std::function<void()> raise;
+        };
+
+        // Publishes a copy of the current plan changed by 'edit'.
+        template < typename F >
+        JoMockInject& change(F edit) {
+            std::lock_guard<std::mutex> lock(mutex);
+            plans.emplace_back(new Plan(*plan.load(std::memory_order_relaxed)));
+            edit(*plans.back());
+            plan.store(plans.back().get(), std::memory_order_release);
+            return *this;
+        }
+
+        JoMockBase<R(P ...)>* const owner;
+        std::atomic<Plan*> plan;
+        std::vector<std::unique_ptr<Plan>> plans;
+        std::mutex mutex;
+        std::atomic<std::size_t> failed;
+        std::atomic<std::size_t> thrown;
+    };
+
+    // Objects a member function mock is limited to (see JOMOCK_INSTANCE), open addressing on the object address.
+    // An empty set admits every object. Objects are added before other threads call the function.
+    struct JoMockInstanceSet {
+        JoMockInstanceSet() : count(0), shift(0) {}
+
+        bool admits(const void* const object) const {
+            if (count == 0) return true;
+            const std::size_t mask = slots.size() - 1;
+            for (std::size_t i = hash(object); ; i = (i + 1) & mask) {
+                const void* const slot = slots[i];
+                if (slot == object) return true;
+                if (slot == nullptr) return false;
+            }
+        }
+
+        void add(const void* const object) {
+            if (object == nullptr || (count != 0 && admits(object))) return;
+            if ((count + 1) * 2 > slots.size()) {
+                std::vector<const void*> previous(slots.size() < 8 ? 16 : slots.size() * 2, nullptr);
+                previous.swap(slots);
+                shift = 64;
+                for (std::size_t size = slots.size(); size > 1; size >>= 1) --shift;
+                for (const void* const moved : previous) {
+                    if (moved != nullptr) insert(moved);
+                }
+            }
+            insert(object);
+            ++count;
+        }
+
+        std::size_t size() const {
+            return count;
+        }
+
+    private:
+        std::size_t hash(const void* const object) const {
+            return static_cast<std::size_t>((reinterpret_cast<std::uintptr_t>(object) * 0x9E3779B97F4A7C15ull) >> shift);
+        }
+
+        void insert(const void* const object) {
+            const std::size_t mask = slots.size() - 1;
+            std::size_t i = hash(object);
+            while (slots[i] != nullptr) i = (i + 1) & mask;
+            slots[i] = object;
+        }
+
+        std::vector<const void*> slots;
+        std::size_t count;
+        unsigned shift;
+    };
+
+    // Common part of the mocks of member functions.
+    template < typename R, typename ... P >
+    struct JoMockMethod<R(const void*, P ...)> : JoMockBase<R(const void*, P ...)> {
+        JoMockMethod(const char* const functionName) : JoMockBase<R(const void*, P ...)>(functionName) {}
+
+        JoMockInstanceSet instances; // calls on other objects run the original function.
+    };
+
+    template < typename I, typename R, typename ... P>
+    struct JoMock<I(R(P ...))> : JoMockBase<R(P ...)> {
+        typedef I IntegrateType(R(P ...));
+        typedef R FunctionType(P ...);
+        JoMock(FunctionType function, const char* const functionName) :
+            JoMockBase<FunctionType>(functionName),
+            originFunction(function) {
+            if (JoMockThreadLocalDispatch::enabled()) {
+                JoMockBase<FunctionType>::dispatchSlot = JoMockThreadLocalDispatch::acquire(originFunction,
+                    ThreadLocalEntryPoint<IntegrateType>::EntryPoint,
+                    ThreadLocalEntryPoint<IntegrateType>::target(),
+                    static_cast<JoMockBase<FunctionType>*>(this), functionName);
+                JoMockBase<FunctionType>::trampoline = ThreadLocalEntryPoint<IntegrateType>::target().trampoline;
+                return;
+            }
+            SingletonBase<decltype(this)>::getInstance() = this;
+            JoMockPatch::graftFunction(originFunction,
+                JoMockThunk::entry(originFunction, this, &MockerEntryPoint<IntegrateType>::Call,
+                    MockerEntryPoint<IntegrateType>::EntryPoint, functionName),
+                JoMockBase<FunctionType>::binaryBackup);
+        }
+
+        virtual ~JoMock() {
+            restore();
+        }
+
+        void restore() {
+            if (JoMockBase<FunctionType>::dispatchSlot != JoMockThreadLocalDispatch::kNoSlot) {
+                JoMockThreadLocalDispatch::release(originFunction, JoMockBase<FunctionType>::dispatchSlot);
+                JoMockBase<FunctionType>::dispatchSlot = JoMockThreadLocalDispatch::kNoSlot;
+                return;
+            }
+            JoMockPatch::_restore(originFunction, JoMockBase<FunctionType>::binaryBackup);
+            JoMockBase<FunctionType>::binaryBackup.clear();
+            JoMockThunk::release(this);
+            SingletonBase<decltype(this)>::getInstance() = nullptr;
+        }
+
+        R callOriginal(P... p) {
+            return JoMockPatch::toFunction<FunctionType*>(JoMockBase<FunctionType>::originalEntry(reinterpret_cast<void*>(originFunction),
+                JoMockBase<FunctionType>::functionName))(p ...);
+        }
+
+        FunctionType* originFunction;
+    };
+
+    template < typename I, typename C, typename R, typename ... P>
+    struct JoMock<I(R(C::*)(const void*, P ...) const)> : JoMockMethod<R(const void*, P ...)> {
+        typedef I IntegrateType(R(C::*)(const void*, P ...) const);
+        typedef I EntryPointType(R(C::*)(P ...) const);
+        typedef R(C::* FunctionType)(P ...) const;
+        typedef R StubFunctionType(const void*, P ...);
+        JoMock(FunctionType function, const char* const functionName) :
+            JoMockMethod<StubFunctionType>(functionName),
+            originFunction(function) {
+            if (JoMockThreadLocalDispatch::enabled()) {
+                JoMockBase<StubFunctionType>::dispatchSlot = JoMockThreadLocalDispatch::acquire(originFunction,
+                    &ThreadLocalEntryPoint<EntryPointType>::EntryPoint,
+                    ThreadLocalEntryPoint<EntryPointType>::target(),
+                    static_cast<JoMockBase<StubFunctionType>*>(this), functionName);
+                JoMockBase<StubFunctionType>::trampoline = ThreadLocalEntryPoint<EntryPointType>::target().trampoline;
+                return;
+            }
+            SingletonBase<decltype(this)>::getInstance() = this;
+            JoMockPatch::graftFunction(originFunction,
+                JoMockThunk::entry(originFunction, this, &MockerEntryPoint<EntryPointType>::Call,
+                    &MockerEntryPoint<EntryPointType>::EntryPoint, functionName),
+                JoMockBase<StubFunctionType>::binaryBackup);
+        }
+        virtual ~JoMock() {
+            restore();
+        }
+        virtual void restore() {
+            if (JoMockBase<StubFunctionType>::dispatchSlot != JoMockThreadLocalDispatch::kNoSlot) {
+                JoMockThreadLocalDispatch::release(originFunction, JoMockBase<StubFunctionType>::dispatchSlot);
+                JoMockBase<StubFunctionType>::dispatchSlot = JoMockThreadLocalDispatch::kNoSlot;
+                return;
+            }
+            JoMockPatch::_restore(originFunction, JoMockBase<StubFunctionType>::binaryBackup);
+            JoMockBase<StubFunctionType>::binaryBackup.clear();
+            JoMockThunk::release(this);
+            SingletonBase<decltype(this)>::getInstance() = nullptr;
+        }
+        R callOriginal(const void* object, P... p) {
+            void* const address = reinterpret_cast<void*>((std::size_t&)originFunction);
+            return (static_cast<const C*>(object)->*JoMockPatch::toFunction<FunctionType>(
+                JoMockBase<StubFunctionType>::originalEntry(address, JoMockBase<StubFunctionType>::functionName)))(p ...);
+        }
+        FunctionType originFunction;
+    };
+
+    template < typename I, typename C, typename R, typename ... P>
+    struct JoMock<I(R(C::*)(const void*, P ...))> : JoMockMethod<R(const void*, P ...)> {
+        typedef I IntegrateType(R(C::*)(const void*, P ...));
+        typedef I EntryPointType(R(C::*)(P ...));
+        typedef R(C::* FunctionType)(P ...);
+        typedef R StubFunctionType(const void*, P ...);
+        JoMock(FunctionType function, const char* const functionName) :
+            JoMockMethod<StubFunctionType>(functionName),
+            originFunction(function) {
+            if (JoMockThreadLocalDispatch::enabled()) {
+                JoMockBase<StubFunctionType>::dispatchSlot = JoMockThreadLocalDispatch::acquire(originFunction,
+                    &ThreadLocalEntryPoint<EntryPointType>::EntryPoint,
+                    ThreadLocalEntryPoint<EntryPointType>::target(),
+                    static_cast<JoMockBase<StubFunctionType>*>(this), functionName);
+                JoMockBase<StubFunctionType>::trampoline = ThreadLocalEntryPoint<EntryPointType>::target().trampoline;
+                return;
+            }
+            SingletonBase<decltype(this)>::getInstance() = this;
+            JoMockPatch::graftFunction(originFunction,
+                JoMockThunk::entry(originFunction, this, &MockerEntryPoint<EntryPointType>::Call,
+                    &MockerEntryPoint<EntryPointType>::EntryPoint, functionName),
+                JoMockBase<StubFunctionType>::binaryBackup);
+        }
+        virtual ~JoMock() {
+            restore();
+        }
+        virtual void restore() {
+            if (JoMockBase<StubFunctionType>::dispatchSlot != JoMockThreadLocalDispatch::kNoSlot) {
+                JoMockThreadLocalDispatch::release(originFunction, JoMockBase<StubFunctionType>::dispatchSlot);
+                JoMockBase<StubFunctionType>::dispatchSlot = JoMockThreadLocalDispatch::kNoSlot;
+                return;
+            }
+            JoMockPatch::_restore(originFunction, JoMockBase<StubFunctionType>::binaryBackup);
+            JoMockBase<StubFunctionType>::binaryBackup.clear();
+            JoMockThunk::release(this);
+            SingletonBase<decltype(this)>::getInstance() = nullptr;
+        }
+        R callOriginal(const void* object, P... p) {
+            void* const address = reinterpret_cast<void*>((std::size_t&)originFunction);
+            return (static_cast<C*>(const_cast<void*>(object))->*JoMockPatch::toFunction<FunctionType>(
+                JoMockBase<StubFunctionType>::originalEntry(address, JoMockBase<StubFunctionType>::functionName)))(p ...);
+        }
+        FunctionType originFunction;
+    };
+
+#ifdef JOMOCK_VTABLE_SUPPORT
+    // Slot of a pointer to virtual member function, Itanium C++ ABI : { ptr, adj } with ptr = 1 + the slot offset,
+    // or on ARM ptr = the slot offset and the virtual flag in the low bit of adj.
+    struct JoMockVirtualSlot {
+        std::size_t index; // in words from the address point of the vtable.
+        std::ptrdiff_t adjustment; // from the object to the subobject holding the vptr.
+
+        template < typename F >
+        static bool decode(F function, JoMockVirtualSlot& slot) {
+            struct { std::uintptr_t ptr; std::ptrdiff_t adj; } value;
+            static_assert(sizeof(F) == sizeof(value), "unexpected member function pointer layout");
+            std::memcpy(&value, &function, sizeof(value));
+#ifdef ARM64_SUPPORT
+            if ((value.adj & 1) == 0) return false;
+            slot.index = value.ptr / sizeof(void*);
+            slot.adjustment = value.adj >> 1;
+#else
+            if ((value.ptr & 1) == 0) return false;
+            slot.index = (value.ptr - 1) / sizeof(void*);
+            slot.adjustment = value.adj;
+#endif
+            return true;
+        }
+    };
+
+    // Per-object copies of vtables. The first slot replaced for an object copies the vtable group its vptr
+    // points into (the _ZTV symbol) and points the vptr at the copy; when the last one is restored the vptr
+    // gets its original value. Both are one pointer store, the text and its protection are left alone.
+    // Each copy has a stamp, a mock restores a slot only in the copy it wrote to : a copy left by an object
+    // destroyed while attached is dropped when another object reuses the address or is detached.
+    struct JoMockShadow {
+        // Function in slot 'index' of the original vtable of 'object', nullptr when the vtable is not known.
+        static void* original(void* const object, const std::size_t index) {
+            std::lock_guard<std::mutex> lock(mutex());
+            auto found = current(object);
+            if (found != tables().end()) {
+                return index < found->second.slots ? found->second.original[index] : nullptr;
+            }
+            void** const vptr = *static_cast<void***>(object);
+            const void* begin = nullptr;
+            std::size_t size = 0;
+            if (!JoMockSymbolIndex::vtable(vptr, begin, size)) return nullptr;
+            const std::size_t offset = static_cast<std::size_t>(reinterpret_cast<const char*>(vptr) - static_cast<const char*>(begin));
+            return offset + (index + 1) * sizeof(void*) <= size ? vptr[index] : nullptr;
+        }
+
+        // Puts 'entry' in slot 'index' of the vtable of 'object', 'stamp' names the copy. False when the
+        // vtable is not known.
+        static bool replace(void* const object, const std::size_t index, void* const entry, std::size_t& stamp) {
+            std::lock_guard<std::mutex> lock(mutex());
+            auto found = current(object);
+            if (found == tables().end()) {
+                void** const vptr = *static_cast<void***>(object);
+                const void* begin = nullptr;
+                std::size_t size = 0;
+                if (!JoMockSymbolIndex::vtable(vptr, begin, size)) return false;
+                const std::size_t offset = (reinterpret_cast<const char*>(vptr) - static_cast<const char*>(begin)) / sizeof(void*);
+                static std::size_t stamps = 0;
+                Table& table = tables()[object];
+                table.original = vptr;
+                table.words.reset(new void*[size / sizeof(void*)]);
+                std::memcpy(table.words.get(), begin, size);
+                table.vptr = table.words.get() + offset;
+                table.slots = size / sizeof(void*) - offset;
+                table.replaced = 0;
+                table.stamp = ++stamps;
+                found = tables().find(object);
+            }
+            Table& table = found->second;
+            if (index >= table.slots) return false;
+            table.vptr[index] = entry;
+            if (table.replaced++ == 0) {
+                __atomic_store_n(static_cast<void***>(object), table.vptr, __ATOMIC_RELEASE);
+            }
+            stamp = table.stamp;
+            return true;
+        }
+
+        // Whether 'object' points at the copy 'stamp'.
+        static bool holds(void* const object, const std::size_t stamp) {
+            std::lock_guard<std::mutex> lock(mutex());
+            auto found = current(object);
+            return found != tables().end() && found->second.stamp == stamp;
+        }
+
+        static void restore(void* const object, const std::size_t index, const std::size_t stamp) {
+            std::lock_guard<std::mutex> lock(mutex());
+            auto found = tables().find(object);
+            if (found == tables().end() || found->second.stamp != stamp) return;
+            Table& table = found->second;
+            table.vptr[index] = table.original[index];
+            if (--table.replaced != 0) return;
+            void** expected = table.vptr; // a destroyed object has its vptr reset by its destructor.
+            __atomic_compare_exchange_n(static_cast<void***>(object), &expected, table.original, false, __ATOMIC_RELEASE, __ATOMIC_RELAXED);
+            tables().erase(found);
+        }
+
+        // Gives the subobjects in [object, object + size) their vtables back and forgets their copies, the
+        // mocks attached to them stop writing to them.
+        static void detach(const void* const object, const std::size_t size) {
+            std::lock_guard<std::mutex> lock(mutex());
+            char* const begin = static_cast<char*>(const_cast<void*>(object));
+            auto found = tables().lower_bound(begin);
+            while (found != tables().end() && static_cast<char*>(found->first) < begin + size) {
+                void** expected = found->second.vptr;
+                __atomic_compare_exchange_n(static_cast<void***>(found->first), &expected, found->second.original, false, __ATOMIC_RELEASE, __ATOMIC_RELAXED);
+                found = tables().erase(found);
+            }
+        }
+
+    private:
+        struct Table {
+            void** original; // vptr of the object.
+            std::unique_ptr<void*[]> words; // copy of the vtable group.
+            void** vptr; // in 'words'.
+            std::size_t slots; // from 'vptr' to the end of the group.
+            std::size_t replaced;
+            std::size_t stamp;
+        };
+
+        static std::mutex& mutex() {
+            static std::mutex value;
+            return value;
+        }
+
+        static std::map<void*, Table>& tables() {
+            static std::map<void*, Table> value;
+            return value;
+        }
+
+        // The copy 'object' points at. One it does not point at was left by an object destroyed at that
+        // address while attached, it is dropped.
+        static std::map<void*, Table>::iterator current(void* const object) {
+            auto found = tables().find(object);
+            if (found == tables().end() || *static_cast<void***>(object) == found->second.vptr) return found;
+            tables().erase(found);
+            return tables().end();
+        }
+    };
+
+    // Detaches an object from its virtual function mocks when it goes out of scope, for objects that die
+    // before CLEAR_JOMOCK. Declare it after the object.
+    struct JoMockDetach {
+        template < typename T >
+        explicit JoMockDetach(T* const _object) : object(_object), size(sizeof(T)) {}
+        ~JoMockDetach() {
+            JoMockShadow::detach(object, size);
+        }
+        JoMockDetach(const JoMockDetach&) = delete;
+        JoMockDetach& operator=(const JoMockDetach&) = delete;
+
+        const void* const object;
+        const std::size_t size;
+    };
+
+    // Mock of a virtual function for the objects attached to it (see JOMOCK_VIRTUAL), through their copy of
+    // the vtable. 'this' given to the expectations is the subobject the function runs on.
+    template < typename R, typename ... P >
+    struct JoMockVirtual<R(const void*, P ...)> : JoMockBase<R(const void*, P ...)> {
+        JoMockVirtual(const JoMockVirtualSlot& _slot, void* const _original, void* const _entry, const char* const functionName) :
+            JoMockBase<R(const void*, P ...)>(functionName), slot(_slot), original(_original), entry(_entry) {}
+
+        void attach(void* const object) {
+            for (auto attached = objects.begin(); attached != objects.end(); ++attached) {
+                if (attached->first != object) continue;
+                if (JoMockShadow::holds(object, attached->second)) return;
+                objects.erase(attached); // left by an object destroyed at this address.
+                break;
+            }
+            std::size_t stamp = 0;
+            if (!JoMockShadow::replace(object, slot.index, entry, stamp)) {
+                fprintf(stderr, "jomock: cannot find the vtable of the object given for %s\n", this->functionName);
+                std::abort();
+            }
+            objects.emplace_back(object, stamp);
+        }
+
+        void restore() {
+            for (const auto& attached : objects) {
+                JoMockShadow::restore(attached.first, slot.index, attached.second);
+            }
+            objects.clear();
+        }
+
+        const JoMockVirtualSlot slot;
+        void* const original;
+        void* const entry;
+        std::vector<std::pair<void*, std::size_t>> objects; // with the stamp of their copy.
+    };
+
+    template < typename I, typename C, typename R, typename ... P >
+    struct JoMockVirtual<I(R(C::*)(const void*, P ...) const)> : JoMockVirtual<R(const void*, P ...)> {
+        typedef JoMockVirtual<R(const void*, P ...)> Base;
+        JoMockVirtual(const JoMockVirtualSlot& slot, void* const original, const char* const functionName) :
+            Base(slot, original, entryPoint(), functionName) {
+            SingletonBase<JoMockVirtual*>::getInstance() = this;
+        }
+        virtual ~JoMockVirtual() {
+            Base::restore();
+            SingletonBase<JoMockVirtual*>::getInstance() = nullptr;
+        }
+        R callOriginal(const void* object, P... p) {
+            return (static_cast<const C*>(object)->*JoMockPatch::toFunction<R(C::*)(P ...) const>(Base::original))(p ...);
+        }
+        JOMOCK_ENTRY R EntryPoint(P... p) const {
+            return SingletonBase<JoMockVirtual*>::getInstance()->stubFunc(this, p ...);
+        }
+        static void* entryPoint() {
+            R(JoMockVirtual::* function)(P ...) const = &JoMockVirtual::EntryPoint;
+            return reinterpret_cast<void*>((std::size_t&)function);
+        }
+    };
+
+    template < typename I, typename C, typename R, typename ... P >
+    struct JoMockVirtual<I(R(C::*)(const void*, P ...))> : JoMockVirtual<R(const void*, P ...)> {
+        typedef JoMockVirtual<R(const void*, P ...)> Base;
+        JoMockVirtual(const JoMockVirtualSlot& slot, void* const original, const char* const functionName) :
+            Base(slot, original, entryPoint(), functionName) {
+            SingletonBase<JoMockVirtual*>::getInstance() = this;
+        }
+        virtual ~JoMockVirtual() {
+            Base::restore();
+            SingletonBase<JoMockVirtual*>::getInstance() = nullptr;
+        }
+        R callOriginal(const void* object, P... p) {
+            return (static_cast<C*>(const_cast<void*>(object))->*JoMockPatch::toFunction<R(C::*)(P ...)>(Base::original))(p ...);
+        }
+        JOMOCK_ENTRY R EntryPoint(P... p) {
+            return SingletonBase<JoMockVirtual*>::getInstance()->stubFunc(this, p ...);
+        }
+        static void* entryPoint() {
+            R(JoMockVirtual::* function)(P ...) = &JoMockVirtual::EntryPoint;
+            return reinterpret_cast<void*>((std::size_t&)function);
+        }
+    };
+#endif
+
+#ifdef JOMOCK_IMPORT_SUPPORT
+    // Mock of an imported function : the GOT entries of the callers point at the mock, the text is untouched.
+    template < typename I, typename R, typename ... P >
+    struct JoMockImport<I(R(P ...))> : JoMockBase<R(P ...)> {
+        typedef R FunctionType(P ...);
+        JoMockImport(JoMockImportSymbol* const _symbol, const char* const functionName) :
+            JoMockBase<FunctionType>(functionName),
+            symbol(_symbol) {
+            SingletonBase<JoMockImport*>::getInstance() = this;
+            for (const JoMockImportSlot& slot : symbol->slots) {
+                symbol->saved.push_back(*slot.address);
+                JoMockImportIndex::write(slot, reinterpret_cast<void*>(&EntryPoint));
+            }
+        }
+
+        virtual ~JoMockImport() {
+            restore();
+        }
+
+        void restore() {
+            for (std::size_t i = 0; i < symbol->saved.size(); ++i) {
+                JoMockImportIndex::write(symbol->slots[i], symbol->saved[i]);
+            }
+            symbol->saved.clear();
+            SingletonBase<JoMockImport*>::getInstance() = nullptr;
+        }
+
+        R callOriginal(P... p) {
+            return JoMockPatch::toFunction<FunctionType*>(symbol->original)(p ...);
+        }
+
+        JOMOCK_ENTRY static R EntryPoint(P... p) {
+            return SingletonBase<JoMockImport*>::getInstance()->stubFunc(p ...);
+        }
+
+        JoMockImportSymbol* const symbol;
+    };
+#endif
+
+    template < typename T >
+    struct JoMockSignature { };
+
+    template < typename R, typename ... P >
+    struct JoMockSignature<R(*)(P ...)> {
+        typedef R StubType(P ...);
+        static R invoke(void* const address, P... p) {
+            return JoMockPatch::toFunction<R(*)(P ...)>(address)(p ...);
+        }
+    };
+
+    template < typename C, typename R, typename ... P >
+    struct JoMockSignature<R(C::*)(P ...) const> {
+        typedef R StubType(const void*, P ...);
+        static R invoke(void* const address, const void* object, P... p) {
+            return (static_cast<const C*>(object)->*JoMockPatch::toFunction<R(C::*)(P ...) const>(address))(p ...);
+        }
+    };
+
+    template < typename C, typename R, typename ... P >
+    struct JoMockSignature<R(C::*)(P ...)> {
+        typedef R StubType(const void*, P ...);
+        static R invoke(void* const address, const void* object, P... p) {
+            return (static_cast<C*>(const_cast<void*>(object))->*JoMockPatch::toFunction<R(C::*)(P ...)>(address))(p ...);
+        }
+    };
+
+    template < typename T >
+    struct JoMockStubBase { };
+
+    // gmock-free mock: the patched function calls the stub's callable directly.
+    template < typename R, typename ... P >
+    struct JoMockStubBase<R(P ...)> : JoMockNode {
+        typedef R Invoker(void*, P ...);
+
+        JoMockStubBase(const void* const function, Invoker* const _invoker, const char* const _functionName) :
+            origin(function), invoker(_invoker), functionName(_functionName), counting(false), counter(0) {}
+
+        // Relaxed call counting, off by default.
+        void countCalls(const bool enable = true) {
+            counting.store(enable, std::memory_order_relaxed);
+        }
+
+        std::size_t calls() const {
+            return counter.load(std::memory_order_relaxed);
+        }
+
+        void resetCalls() {
+            counter.store(0, std::memory_order_relaxed);
+        }
+
+        void count() {
+            if (counting.load(std::memory_order_relaxed)) {
+                counter.fetch_add(1, std::memory_order_relaxed);
+            }
+        }
+
+        R callOriginal(P... p) {
+            return invoker(originalEntry(origin, functionName), p ...);
+        }
+
+        const void* const origin;
+        Invoker* const invoker;
+        const char* const functionName;
+        std::atomic<bool> counting;
+        std::atomic<std::size_t> counter;
+    };
+
+    template < typename S, typename T >
+    struct StubEntryPoint { };
+
+    template < typename S, typename R, typename ... P >
+    struct StubEntryPoint<S, R(*)(P ...)> {
+        JOMOCK_ENTRY static R EntryPoint(P... p) {
+            S* const stub = S::instance;
+            stub->count();
+            if (JoMockTrace::active()) {
+                const JoMockTraceScope scope(stub->functionName);
+                return stub->callable(p ...);
+            }
+            return stub->callable(p ...);
+        }
+    };
+
+    template < typename S, typename C, typename R, typename ... P >
+    struct StubEntryPoint<S, R(C::*)(P ...) const> {
+        JOMOCK_ENTRY R EntryPoint(P... p) {
+            S* const stub = S::instance;
+            stub->count();
+            if (JoMockTrace::active()) {
+                const JoMockTraceScope scope(stub->functionName);
+                return stub->callable(reinterpret_cast<const C*>(this), p ...);
+            }
+            return stub->callable(reinterpret_cast<const C*>(this), p ...);
+        }
+    };
+
+    template < typename S, typename C, typename R, typename ... P >
+    struct StubEntryPoint<S, R(C::*)(P ...)> {
+        JOMOCK_ENTRY R EntryPoint(P... p) {
+            S* const stub = S::instance;
+            stub->count();
+            if (JoMockTrace::active()) {
+                const JoMockTraceScope scope(stub->functionName);
+                return stub->callable(reinterpret_cast<C*>(this), p ...);
+            }
+            return stub->callable(reinterpret_cast<C*>(this), p ...);
+        }
+    };
+
+    // Stub of the function of type T calling F. Member functions get the object pointer as first argument.
+    template < typename I, typename F, typename T >
+    struct JoMockStub : JoMockStubBase<typename JoMockSignature<T>::StubType> {
+        typedef JoMockStubBase<typename JoMockSignature<T>::StubType> Base;
+
+        JoMockStub(T function, const F& _callable, const char* const functionName) :
+            Base(reinterpret_cast<const void*>((std::size_t&)function), &JoMockSignature<T>::invoke, functionName),
+            callable(_callable),
+            originFunction(function) {
+            instance = this;
+            JoMockPatch::graftFunction(originFunction, &StubEntryPoint<JoMockStub, T>::EntryPoint, Base::binaryBackup);
+        }
+
+        virtual ~JoMockStub() {
+            restore();
+        }
+
+        void restore() {
+            if (instance != this) return;
+            JoMockPatch::_restore(originFunction, Base::binaryBackup);
+            instance = nullptr;
+        }
+
+        F callable;
+        T originFunction;
+        static JoMockStub* instance; // plain static, no initialization guard on the call path.
+    };
+
+    template < typename I, typename F, typename T >
+    JoMockStub<I, F, T>* JoMockStub<I, F, T>::instance = nullptr;
+
+    // Storage for the live mock of one call site, so that creating a mock does not allocate. A second mock
+    // from the same call site (a JOMOCK() on a function pointer in a loop) goes to the heap.
+    template < typename T >
+    struct JoMockStorage {
+        template < typename ... A >
+        static T* create(A&&... a) {
+            Slot& slot = JoMockThreadLocalDispatch::enabled() ? threadSlot() : processSlot();
+            T* node;
+            if (slot.used) {
+                node = new T(std::forward<A>(a) ...);
+            }
+            else {
+                node = new (slot.buffer) T(std::forward<A>(a) ...);
+                slot.used = true;
+                node->storage = &slot.used;
+            }
+            node->destroy = &destroy;
+            return node;
+        }
+
+        static void destroy(JoMockNode* const node) {
+            bool* const used = node->storage;
+            if (used == nullptr) {
+                delete static_cast<T*>(node);
+                return;
+            }
+            static_cast<T*>(node)->~T();
+            *used = false;
+        }
+
+    private:
+        struct Slot {
+            alignas(T) unsigned char buffer[sizeof(T)];
+            bool used;
+        };
+
+        static Slot& processSlot() {
+            static Slot value;
+            return value;
+        }
+
+        static Slot& threadSlot() {
+            static thread_local Slot value;
+            return value;
+        }
+    };
+
+#ifdef JOMOCK_SYMBOL_SUPPORT
+    // Every named member function of a class (JOMOCK_CLASS), found in the symbol table by the mangled name of
+    // the class, static ones included; constructors, destructors, operators and member templates are left
+    // alone. By default (kCallOriginal) they run the original code and are not patched. JOMOCK(&Class::method)
+    // is the gmock handle of a method, made on first use : it takes the method over from the class.
+    // Process-wide only.
+    struct JoMockClass : JoMockNode {
+        // kReturnDefault patches the methods without a handle in one transaction to return zero : 0, false,
+        // nullptr, 0.0 or nothing. The result type is not in the symbol table, so a method returning an object
+        // by value (through a hidden result pointer) gets an object that was never constructed, and its caller
+        // destroys garbage. Opt in only when every method called without a handle returns a scalar or nothing.
+        enum Default { kReturnDefault, kCallOriginal };
+
+        JoMockClass(const char* const mangledType, const char* const className) : name(className), behaviour(kCallOriginal) {
+            enumerate(mangledType);
+            if (methods.empty()) {
+                fprintf(stderr, "jomock: class %s has no member function in the symbol table\n", name);
+            }
+            patch();
+        }
+
+        virtual ~JoMockClass() {
+            restore();
+        }
+
+        virtual void restore() {
+            unpatch();
+        }
+
+        // What the methods without a handle do, switched in one transaction.
+        JoMockClass& setDefault(const Default value) {
+            if (value != behaviour) {
+                behaviour = value;
+                if (value == kReturnDefault) {
+                    patch();
+                }
+                else {
+                    unpatch();
+                }
+            }
+            return *this;
+        }
+
+        std::size_t size() const {
+            return methods.size();
+        }
+
+        // Demangled names of the methods.
+        std::vector<std::string> names() const {
+            std::vector<std::string> result;
+            for (const std::unique_ptr<Method>& method : methods) {
+                result.push_back(method->name);
+            }
+            return result;
+        }
+
+    private:
+        struct Method {
+            void* address;
+            std::string name;
+            JoMockClaim claim;
+        };
+
+        // Symbols "_ZN" [V][K] [R|O] <class> <length> <name> [ABI tags] "E" <parameters>.
+        void enumerate(const char* const mangledType) {
+            std::string type(mangledType);
+            if (type.size() > 2 && type[0] == 'N' && type[type.size() - 1] == 'E') {
+                type = type.substr(1, type.size() - 2);
+            }
+            std::vector<std::string> prefixes;
+            const char* const qualifiers[] = { "", "V", "K", "VK" };
+            const char* const references[] = { "", "R", "O" };
+            for (const char* const qualifier : qualifiers) {
+                for (const char* const reference : references) {
+                    prefixes.push_back(std::string("_ZN") + qualifier + reference + type);
+                }
+            }
+            for (const std::pair<std::string, void*>& symbol : JoMockSymbolIndex::findPrefixed(prefixes)) {
+                std::size_t at = 0;
+                for (const std::string& prefix : prefixes) {
+                    if (symbol.first.compare(0, prefix.size(), prefix) == 0) at = prefix.size();
+                }
+                if (!skipName(symbol.first, at)) continue;
+                while (at < symbol.first.size() && symbol.first[at] == 'B') { // ABI tags, "B5cxx11"
+                    if (!skipName(symbol.first, ++at)) break;
+                }
+                if (at >= symbol.first.size() || symbol.first[at] != 'E') continue;
+                bool known = false;
+                for (const std::unique_ptr<Method>& method : methods) {
+                    known = known || method->address == symbol.second;
+                }
+                if (known) continue;
+                std::unique_ptr<Method> method(new Method());
+                method->address = symbol.second;
+                int status = 0;
+                char* const text = abi::__cxa_demangle(symbol.first.c_str(), nullptr, nullptr, &status);
+                method->name = text != nullptr ? text : symbol.first;
+                free(text);
+                methods.push_back(std::move(method));
+            }
+        }
+
+        // Moves 'at' past a <length> <identifier>.
+        static bool skipName(const std::string& symbol, std::size_t& at) {
+            std::size_t length = 0;
+            while (at < symbol.size() && symbol[at] >= '0' && symbol[at] <= '9') {
+                length = length * 10 + (symbol[at++] - '0');
+            }
+            if (length == 0 || at + length > symbol.size()) return false;
+            at += length;
+            return true;
+        }
+
+        void patch() {
+            if (behaviour != kReturnDefault || methods.empty()) return;
+            void* const zero = returnZero(methods.front()->address);
+            JoMockPatchTransaction transaction;
+            for (const std::unique_ptr<Method>& method : methods) {
+                if (method->claim.taken || !method->claim.backup.empty()) continue;
+                JoMockPatch::graftFunction(method->address, zero, method->claim.backup);
+                JoMockClaims::claim(method->address, &method->claim);
+            }
+            if (!transaction.commit()) {
+                std::abort();
+            }
+        }
+
+        void unpatch() {
+            JoMockPatchTransaction transaction;
+            for (const std::unique_ptr<Method>& method : methods) {
+                JoMockClaims::release(method->address);
+                JoMockPatch::_restore(method->address, method->claim.backup);
+                method->claim.backup.clear();
+            }
+            if (!transaction.commit()) {
+                std::abort();
+            }
+        }
+
+        // Clears the integer and floating point result registers and returns.
+        static void* returnZero(const void* const near) {
+            static std::mutex mutex;
+            static void* code = nullptr;
+            std::lock_guard<std::mutex> lock(mutex);
+            if (code != nullptr) return code;
+#ifdef ARM64_SUPPORT
+            // mov x0, #0; mov x1, #0; movi d0, #0; movi d1, #0; ret
+            const std::uint32_t instructions[] = { 0xD2800000, 0xD2800001, 0x2F00E400, 0x2F00E401, 0xD65F03C0 };
+#else
+            // xor eax, eax; xor edx, edx; xorps xmm0, xmm0; xorps xmm1, xmm1; ret
+            const unsigned char instructions[] = { 0x31, 0xC0, 0x31, 0xD2, 0x0F, 0x57, 0xC0, 0x0F, 0x57, 0xC9, 0xC3 };
+#endif
+            void* block = JoMockExecutableMemory::allocate(sizeof(instructions), near);
+            if (block == nullptr) block = JoMockExecutableMemory::allocate(sizeof(instructions)); // reached through a veneer.
+            if (block == nullptr || !JoMockExecutableMemory::write(block, reinterpret_cast<const char*>(instructions), sizeof(instructions))) {
+                fprintf(stderr, "jomock: no executable memory for JOMOCK_CLASS\n");
+                std::abort();
+            }
+            code = block;
+            return code;
+        }
+
+        const char* const name;
+        Default behaviour;
+        std::vector<std::unique_ptr<Method>> methods; // claims point into them.
+    };
+#endif
+
+    // Last mock returned for a call site, valid while the registry stamp is unchanged.
+    struct JoMockRecent {
+        JoMockNode* node;
+        const void* function;
+        std::size_t stamp;
+    };
+
+    struct MockerCreator {
+    private:
+        template < typename I, typename R, typename ... P >
+        static JoMockBase<R(P ...)>* createJoMock(R function(P ...), const char* const functionName) {
+            return JoMockStorage<JoMock<I(R(P ...))>>::create(function, functionName);
+        }
+
+        template < typename I, typename C, typename R, typename ... P >
+        static JoMockBase<R(const void*, P ...)>* createJoMock(R(C::* function)(P ...) const, const char* const functionName) {
+            typedef I IntegrateType(R(C::*)(const void*, P ...) const);
+            return JoMockStorage<JoMock<IntegrateType>>::create(function, functionName);
+        };
+
+        template < typename I, typename C, typename R, typename ... P >
+        static JoMockBase<R(const void*, P ...)>* createJoMock(R(C::* function)(P ...), const char* const functionName) {
+            typedef I IntegrateType(R(C::*)(const void*, P ...));
+            return JoMockStorage<JoMock<IntegrateType>>::create(function, functionName);
+        };
+
+        static JoMockRegistry& registry() {
+            if (JoMockThreadLocalDispatch::enabled()) {
+                return JoMockThreadState::current().registry;
+            }
+            return SingletonBase<JoMockRegistry>::getInstance();
+        }
+
+        template < typename I >
+        static JoMockRecent& recent() {
+            static JoMockRecent process;
+            static thread_local JoMockRecent thread;
+            return JoMockThreadLocalDispatch::enabled() ? thread : process;
+        }
+
+#ifdef JOMOCK_VTABLE_SUPPORT
+        // One mock per overrider, shared by the objects attached to it.
+        template < typename M, typename S, typename F >
+        static JoMockVirtual<S>* getJoMockVirtualOf(void* const object, F function, const char* const functionName) {
+            JoMockVirtualSlot slot;
+            if (!JoMockVirtualSlot::decode(function, slot)) {
+                fprintf(stderr, "jomock: %s is not a virtual function\n", functionName);
+                std::abort();
+            }
+            void* const subobject = static_cast<char*>(object) + slot.adjustment;
+            void* const original = JoMockShadow::original(subobject, slot.index);
+            if (original == nullptr) {
+                fprintf(stderr, "jomock: cannot find the vtable of the object given for %s\n", functionName);
+                std::abort();
+            }
+            JoMockRegistry& mocks = registry();
+            const void* const kind = JoMockKind<JoMockVirtual<S>>::id();
+            JoMockNode* node = mocks.find(original, kind);
+            if (node == nullptr) {
+                node = JoMockStorage<M>::create(slot, original, functionName);
+                mocks.add(original, kind, node);
+            }
+            JoMockVirtual<S>* const mock = static_cast<JoMockVirtual<S>*>(node);
+            mock->attach(subobject);
+            return mock;
+        }
+#endif
+
+        template < typename I, typename M, typename F >
+        static M* getJoMocker(F function, const char* const functionName) {
+            const void* address = reinterpret_cast<const void*>((size_t&)function);
+            JoMockRegistry& mocks = registry();
+            JoMockRecent& last = recent<I>();
+            if (last.stamp == mocks.stamp && last.function == address) {
+                return static_cast<M*>(last.node);
+            }
+            const void* const kind = JoMockKind<M>::id();
+            JoMockNode* node = mocks.find(address, kind);
+            if (node == nullptr) {
+                node = createJoMock<I>(function, functionName);
+                mocks.add(address, kind, node);
+            }
+            const JoMockRecent hit = { node, address, mocks.stamp };
+            last = hit;
+            return static_cast<M*>(node);
+        }
+
+    public:
+        template < typename I, typename R, typename ... P >
+        static JoMockBase<R(P ...)>* getJoMock(R function(P ...), const char* const functionName) {
+            return getJoMocker<I, JoMockBase<R(P ...)>>(function, functionName);
+        }
+
+        template < typename I, typename C, typename R, typename ... P >
+        static JoMockBase<R(const void*, P ...)>* getJoMock(R(C::* function)(P ...) const, const char* const functionName) {
+            return getJoMocker<I, JoMockBase<R(const void*, P ...)>>(function, functionName);
+        };
+
+        template < typename I, typename C, typename R, typename ... P >
+        static JoMockBase<R(const void*, P ...)>* getJoMock(R(C::* function)(P ...), const char* const functionName) {
+            return getJoMocker<I, JoMockBase<R(const void*, P ...)>>(function, functionName);
+        };
+
+        // The mock of 'function', limited to 'object' and the other objects selected for it.
+        template < typename I, typename O, typename C, typename R, typename ... P >
+        static JoMockBase<R(const void*, P ...)>* getJoMockInstance(const O* const object, R(C::* function)(P ...) const,
+            const char* const functionName) {
+            JoMockBase<R(const void*, P ...)>* const mock = getJoMock<I>(function, functionName);
+            static_cast<JoMockMethod<R(const void*, P ...)>*>(mock)->instances.add(static_cast<const C*>(object));
+            return mock;
+        }
+
+        template < typename I, typename O, typename C, typename R, typename ... P >
+        static JoMockBase<R(const void*, P ...)>* getJoMockInstance(O* const object, R(C::* function)(P ...),
+            const char* const functionName) {
+            JoMockBase<R(const void*, P ...)>* const mock = getJoMock<I>(function, functionName);
+            static_cast<JoMockMethod<R(const void*, P ...)>*>(mock)->instances.add(static_cast<const C*>(object));
+            return mock;
+        }
+
+#ifdef JOMOCK_VTABLE_SUPPORT
+        // Mocks the virtual function 'function' for 'object' only, see JoMockShadow.
+        template < typename I, typename O, typename C, typename R, typename ... P >
+        static JoMockBase<R(const void*, P ...)>* getJoMockVirtual(const O* const object, R(C::* function)(P ...) const,
+            const char* const functionName) {
+            typedef I IntegrateType(R(C::*)(const void*, P ...) const);
+            return getJoMockVirtualOf<JoMockVirtual<IntegrateType>, R(const void*, P ...)>(
+                const_cast<C*>(static_cast<const C*>(object)), function, functionName);
+        }
+
+        template < typename I, typename O, typename C, typename R, typename ... P >
+        static JoMockBase<R(const void*, P ...)>* getJoMockVirtual(O* const object, R(C::* function)(P ...),
+            const char* const functionName) {
+            typedef I IntegrateType(R(C::*)(const void*, P ...));
+            return getJoMockVirtualOf<JoMockVirtual<IntegrateType>, R(const void*, P ...)>(
+                static_cast<C*>(object), function, functionName);
+        }
+#endif
+
+        template < typename I, typename T, typename F >
+        static JoMockStub<I, F, T>* getJoMockStub(T function, F callable, const char* const functionName) {
+            const void* address = reinterpret_cast<const void*>((size_t&)function);
+            const void* const kind = JoMockKind<JoMockNode>::id();
+            JoMockRegistry& mocks = registry();
+            JoMockNode* const previous = mocks.find(address, kind);
+            if (previous != nullptr) {
+                mocks.discard(previous); // a new stub replaces the previous one.
+            }
+            JoMockStub<I, F, T>* const stub = JoMockStorage<JoMockStub<I, F, T>>::create(function, callable, functionName);
+            mocks.add(address, kind, stub);
+            return stub;
+        }
+
+#ifdef JOMOCK_SYMBOL_SUPPORT
+        // Patches the member functions of C (see JoMockClass) until CLEAR_JOMOCK().
+        template < typename C >
+        static JoMockClass* getJoMockClass(const char* const className) {
+            if (JoMockThreadLocalDispatch::enabled()) {
+                fprintf(stderr, "jomock: JOMOCK_CLASS(%s) patches for every thread, it does not work with thread-local dispatch\n", className);
+                std::abort();
+            }
+            const void* const address = &typeid(C);
+            const void* const kind = JoMockKind<JoMockClass>::id();
+            JoMockRegistry& mocks = registry();
+            JoMockNode* node = mocks.find(address, kind);
+            if (node == nullptr) {
+                node = JoMockStorage<JoMockClass>::create(typeid(C).name(), className);
+                mocks.add(address, kind, node);
+            }
+            return static_cast<JoMockClass*>(node);
+        }
+
+        // Mocks the function found by name in JoMockSymbolIndex, 'symbolName' must outlive the mock.
+        template < typename I, typename F >
+        static auto getJoMockSymbol(const char* const symbolName)
+            -> decltype(getJoMock<I>(typename JoMockSymbolTarget<F>::Pointer(), symbolName)) {
+            static void* address = nullptr;
+            static unsigned long long generation = 0;
+            if (address == nullptr || generation != JoMockImportIndex::generation()) {
+                address = JoMockSymbolIndex::find(symbolName);
+                generation = JoMockImportIndex::generation();
+                if (address == nullptr) {
+                    fprintf(stderr, "jomock: cannot find function %s\n", symbolName);
+                    std::abort();
+                }
+            }
+            return getJoMock<I>(JoMockPatch::toFunction<typename JoMockSymbolTarget<F>::Pointer>(address), symbolName);
+        }
+#endif
+
+#ifdef JOMOCK_IMPORT_SUPPORT
+        // Mocks the imports of 'function' in the GOT of the modules selected by 'module' (see JoMockImportIndex).
+        // 'function' only gives the signature, the symbol is looked up by name.
+        template < typename I, typename R, typename ... P >
+        static JoMockBase<R(P ...)>* getJoMockImport(R function(P ...), const char* const functionName, const char* const module) {
+            (void)function;
+            static JoMockImportSymbol* cached = nullptr;
+            if (cached == nullptr || cached->generation != JoMockImportIndex::generation()) {
+                const char* name = functionName;
+                if (std::strncmp(name, "::", 2) == 0) name += 2;
+                if (std::strncmp(name, "std::", 5) == 0) name += 5;
+                cached = JoMockImportIndex::find(name, module);
+                if (cached->slots.empty() || cached->original == nullptr) {
+                    fprintf(stderr, "jomock: no import of %s found\n", functionName);
+                    std::abort();
+                }
+            }
+            typedef JoMockBase<R(P ...)> M;
+            JoMockRegistry& mocks = registry();
+            const void* const kind = JoMockKind<M>::id();
+            JoMockNode* node = mocks.find(cached, kind);
+            if (node == nullptr) {
+                node = JoMockStorage<JoMockImport<I(R(P ...))>>::create(cached, functionName);
+                mocks.add(cached, kind, node);
+            }
+            return static_cast<M*>(node);
+        }
+#endif
+
+        // Thread-local dispatch makes every mock created afterwards visible to its creating thread only,
+        // other threads keep running the original function. Switch it before creating any mock.
+        static void setThreadLocalDispatch(const bool enable) {
+            JoMockThreadLocalDispatch::enabled() = enable;
+        }
+
+        // Page snapshots are on by default : the text pages are copied back whole when their last mock goes away.
+        static void setPageSnapshots(const bool enable) {
+            JoMockSnapshot::enabled() = enable;
+        }
+
+        // Compares each page with its snapshot before copying it back, and leaves the pages changed by
+        // someone else alone (only the mocked entries are restored there).
+        static void setRestoreVerification(const bool enable) {
+            JoMockSnapshot::verifying() = enable;
+        }
+
+        // What to do with an entry that cannot take a jump (see JoMockPatchCheck) : trap, fail, or patch anyway.
+        static void setPatchPolicy(const JoMockPatchCheck::Policy policy) {
+            JoMockPatchCheck::policy() = policy;
+        }
+
+        static void setInliningReport(const bool enable) {
+            JoMockPatchCheck::reportInlining() = enable;
+        }
+
+        // Stops the other threads while patches are written (Linux), see JoMockQuiesce.
+        static void setQuiescence(const bool enable) {
+#ifdef JOMOCK_QUIESCE_SUPPORT
+            JoMockQuiesce::enabled() = enable;
+#else
+            (void)enable;
+#endif
+        }
+
+        // Traces the mock actions into '<path>.json' and '<path>.bin', nullptr stops (see JoMockTrace).
+        static void setTrace(const char* const path) {
+            if (path != nullptr) {
+                JoMockTrace::start(path);
+            }
+            else {
+                JoMockTrace::stop();
+            }
+        }
+
+        // Mocks created afterwards enter through the template entry points instead of thunks (see JoMockThunk).
+        static void setThunks(const bool enable) {
+            JoMockThunk::enabled() = enable;
+        }
+
+        // Lists the mock thunks in /tmp/perf-<pid>.map for perf.
+        static void setPerfMap(const bool enable) {
+            JoMockThunk::setPerfMap(enable);
+        }
+
+        static void restoreAll() {
+            registry().restoreAll();
+            JoMockTrace::flush();
+        }
+    };
+
+#ifdef JOMOCK_SYMBOL_SUPPORT
+    // JOMOCK_SYMBOL<Signature>("name") : the call site's counter, then the signature and the name.
+    template < int uniq >
+    struct JoMockSymbolSite {
+        template < typename F >
+        static auto get(const char* const symbolName)
+            -> decltype(*MockerCreator::getJoMockSymbol<TypeForUniqMocker<uniq>, F>(symbolName)) {
+            return *MockerCreator::getJoMockSymbol<TypeForUniqMocker<uniq>, F>(symbolName);
+        }
+    };
+#endif
 }
 
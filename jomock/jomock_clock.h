@@ -0,0 +1,256 @@
+/*
+* @file      jomock_clock.h
+* @brief     Virtual time : mocks the libc sleep, clock and timed wait functions with a clock that only moves
+*            when a test sleeps or advances it, so that timeouts and backoffs take no real time.
+*            This is an open source with MIT license deployed in https://github.com/jonah512/jomock
+*
+*/
+#pragma once
+
+#include <gtest/gtest.h>
+#include <gmock/gmock.h>
+
+#include "jomock.h"
+
+#include <atomic>
+#include <chrono>
+#include <mutex>
+#include <set>
+#include <cstdint>
+#include <cerrno>
+
+#ifdef NON_WIN32_SUPPORT
+#include <time.h>
+#include <sys/time.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <sys/syscall.h>
+#endif
+
+// Installs the mocks and returns the clock, ::jomock::JoMockClock. CLEAR_JOMOCK() puts real time back.
+#define JOMOCK_VIRTUAL_TIME() ::jomock::JoMockClock::install()
+
+namespace jomock {
+
+#ifdef NON_WIN32_SUPPORT
+    // Time seen through the mocked functions : the real time of the install plus the virtual time elapsed
+    // since. A sleep moves the clock to its end and returns at once; threads sleeping together overlap, as
+    // they would in real time. A timed wait returns when it is notified or the clock reaches its deadline.
+    // CPU time clocks stay real. With thread-local dispatch the clock is seen by the installing thread only.
+    struct JoMockClock {
+        typedef std::chrono::nanoseconds Duration;
+
+        static JoMockClock& instance() {
+            static JoMockClock value;
+            return value;
+        }
+
+        static JoMockClock& install();
+
+        Duration elapsed() const {
+            return Duration(offset.load());
+        }
+
+        void advance(const Duration duration) {
+            if (duration.count() > 0) offset.fetch_add(duration.count());
+        }
+
+        // Off by default : timed waits only end by a notification, advance() or another thread's sleep. On, a
+        // wait nobody notifies within a millisecond of real time and whose deadline is the nearest one moves the
+        // clock there, which is only right when the notifier is blocked in virtual time itself : a notifier doing
+        // more than a millisecond of real work makes the wait time out.
+        void setAutoAdvance(const bool enable) {
+            autoAdvance.store(enable);
+        }
+
+        // Threads in a timed wait.
+        std::size_t waiters() const {
+            std::lock_guard<std::mutex> lock(mutex);
+            return deadlines.size();
+        }
+
+        // Time of 'clock', false for a clock that is not virtual.
+        bool read(const clockid_t clock, timespec* const time) const {
+            if (!isVirtual(clock)) return false;
+            fromNanoseconds(bases[clock] + offset.load(), time);
+            return true;
+        }
+
+        int sleepFor(const timespec* const duration) {
+            if (!valid(duration)) return EINVAL;
+            advanceTo(offset.load() + toNanoseconds(*duration));
+            return 0;
+        }
+
+        int sleepUntil(const clockid_t clock, const timespec* const deadline) {
+            if (!valid(deadline)) return EINVAL;
+            advanceTo(toNanoseconds(*deadline) - bases[clock]);
+            return 0;
+        }
+
+        // 'wait' waits on the condition variable for real until an absolute CLOCK_MONOTONIC time.
+        template < typename W >
+        int waitUntil(const clockid_t clock, const timespec* const deadline, W wait) {
+            if (!valid(deadline)) return EINVAL;
+            const std::int64_t end = toNanoseconds(*deadline) - bases[clock];
+            if (offset.load() >= end) return ETIMEDOUT;
+            std::multiset<std::int64_t>::iterator mine;
+            {
+                std::lock_guard<std::mutex> lock(mutex);
+                mine = deadlines.insert(end);
+            }
+            int result;
+            for (;;) {
+                timespec slice;
+                fromNanoseconds(realNanoseconds(CLOCK_MONOTONIC) + 1000000, &slice);
+                result = wait(&slice);
+                if (result != ETIMEDOUT) break;
+                if (offset.load() >= end) break;
+                std::lock_guard<std::mutex> lock(mutex);
+                if (autoAdvance.load() && *deadlines.begin() == end) {
+                    advanceTo(end);
+                    break;
+                }
+            }
+            std::lock_guard<std::mutex> lock(mutex);
+            deadlines.erase(mine);
+            return result;
+        }
+
+        bool isVirtual(const clockid_t clock) const {
+            return clock >= 0 && clock < kClocks && virtualClock[clock];
+        }
+
+        // Real time of 'clock', by the system call : the libc functions may be mocked.
+        static std::int64_t realNanoseconds(const clockid_t clock) {
+            timespec time = { 0, 0 };
+            syscall(SYS_clock_gettime, clock, &time);
+            return toNanoseconds(time);
+        }
+
+    private:
+        static const int kClocks = 12;
+
+        // gettimeofday(), whose time zone parameter changed type across glibc versions.
+        struct TimeOfDay {
+            template < typename Z >
+            int operator()(timeval* const result, Z) const {
+                timespec now;
+                instance().read(CLOCK_REALTIME, &now);
+                if (result != nullptr) {
+                    result->tv_sec = now.tv_sec;
+                    result->tv_usec = static_cast<suseconds_t>(now.tv_nsec / 1000);
+                }
+                return 0;
+            }
+        };
+
+        JoMockClock() : offset(0), autoAdvance(false) {
+            std::fill(bases, bases + kClocks, 0);
+            std::fill(virtualClock, virtualClock + kClocks, false);
+        }
+
+        // Starts virtual time at the real time of now.
+        void reset() {
+            const clockid_t clocks[] = { CLOCK_REALTIME, CLOCK_MONOTONIC, CLOCK_MONOTONIC_RAW, CLOCK_REALTIME_COARSE,
+                CLOCK_MONOTONIC_COARSE, CLOCK_BOOTTIME };
+            for (const clockid_t clock : clocks) {
+                timespec time;
+                virtualClock[clock] = syscall(SYS_clock_gettime, clock, &time) == 0;
+                bases[clock] = toNanoseconds(time);
+            }
+            offset.store(0);
+            autoAdvance.store(false);
+        }
+
+        void advanceTo(const std::int64_t target) {
+            std::int64_t current = offset.load();
+            while (current < target && !offset.compare_exchange_weak(current, target)) {}
+        }
+
+        static bool valid(const timespec* const time) {
+            return time != nullptr && time->tv_nsec >= 0 && time->tv_nsec < 1000000000;
+        }
+
+        static std::int64_t toNanoseconds(const timespec& time) {
+            return static_cast<std::int64_t>(time.tv_sec) * 1000000000 + time.tv_nsec;
+        }
+
+        static void fromNanoseconds(const std::int64_t value, timespec* const time) {
+            time->tv_sec = static_cast<time_t>(value / 1000000000);
+            time->tv_nsec = static_cast<long>(value % 1000000000);
+        }
+
+        std::atomic<std::int64_t> offset; // virtual nanoseconds since the install.
+        std::atomic<bool> autoAdvance;
+        std::int64_t bases[kClocks]; // real time of each clock at the install.
+        bool virtualClock[kClocks];
+        mutable std::mutex mutex;
+        std::multiset<std::int64_t> deadlines; // of the timed waits, in virtual nanoseconds since the install.
+    };
+
+    inline JoMockClock& JoMockClock::install() {
+        JoMockClock& clock = instance();
+        auto gettime = &JOMOCK(clock_gettime);
+        if (gettime->dispatch.load() == nullptr) { // not installed since the last CLEAR_JOMOCK().
+            clock.reset();
+        }
+        gettime->retarget([gettime](clockid_t id, timespec* time) {
+            return instance().read(id, time) ? 0 : gettime->callOriginal(id, time);
+        });
+        (JOMOCK(nanosleep)).retarget([](const timespec* duration, timespec*) {
+            const int error = instance().sleepFor(duration);
+            errno = error;
+            return error == 0 ? 0 : -1;
+        });
+        auto clockSleep = &JOMOCK(clock_nanosleep);
+        clockSleep->retarget([clockSleep](clockid_t id, int flags, const timespec* time, timespec* remaining) {
+            if (!instance().isVirtual(id)) return clockSleep->callOriginal(id, flags, time, remaining);
+            return (flags & TIMER_ABSTIME) != 0 ? instance().sleepUntil(id, time) : instance().sleepFor(time);
+        });
+        (JOMOCK(usleep)).retarget([](useconds_t microseconds) {
+            const timespec duration = { static_cast<time_t>(microseconds / 1000000), static_cast<long>(microseconds % 1000000) * 1000 };
+            return instance().sleepFor(&duration) == 0 ? 0 : -1;
+        });
+        (JOMOCK(sleep)).retarget([](unsigned seconds) {
+            const timespec duration = { static_cast<time_t>(seconds), 0 };
+            instance().sleepFor(&duration);
+            return 0u;
+        });
+        auto timedWait = &JOMOCK(pthread_cond_timedwait);
+        timedWait->retarget([timedWait](pthread_cond_t* condition, pthread_mutex_t* mutex, const timespec* deadline) {
+            return instance().waitUntil(CLOCK_REALTIME, deadline, [timedWait, condition, mutex](const timespec* slice) {
+                timespec real; // the deadline of pthread_cond_timedwait() is on CLOCK_REALTIME.
+                fromNanoseconds(realNanoseconds(CLOCK_REALTIME) + toNanoseconds(*slice) - realNanoseconds(CLOCK_MONOTONIC), &real);
+                return timedWait->callOriginal(condition, mutex, &real);
+            });
+        });
+#if defined(__GLIBC__) && (__GLIBC__ > 2 || (__GLIBC__ == 2 && __GLIBC_MINOR__ >= 30))
+        auto clockWait = &JOMOCK(pthread_cond_clockwait);
+        clockWait->retarget([clockWait](pthread_cond_t* condition, pthread_mutex_t* mutex, clockid_t id, const timespec* deadline) {
+            if (!instance().isVirtual(id)) return clockWait->callOriginal(condition, mutex, id, deadline);
+            return instance().waitUntil(id, deadline, [clockWait, condition, mutex](const timespec* slice) {
+                return clockWait->callOriginal(condition, mutex, CLOCK_MONOTONIC, slice);
+            });
+        });
+#endif
+#ifdef JOMOCK_IMPORT_SUPPORT
+        // time() and gettimeofday() resolve into the vDSO, their callers are redirected instead.
+        const JoMockImportSymbol* const timeImport = JoMockImportIndex::find("time", nullptr);
+        if (!timeImport->slots.empty() && timeImport->original != nullptr) {
+            (JOMOCK_IMPORT(time)).retarget([](time_t* result) {
+                timespec now;
+                instance().read(CLOCK_REALTIME, &now);
+                if (result != nullptr) *result = now.tv_sec;
+                return now.tv_sec;
+            });
+        }
+        const JoMockImportSymbol* const dayImport = JoMockImportIndex::find("gettimeofday", nullptr);
+        if (!dayImport->slots.empty() && dayImport->original != nullptr) {
+            (JOMOCK_IMPORT(gettimeofday)).retarget(TimeOfDay());
+        }
+#endif
+        return clock;
+    }
+#endif
+}
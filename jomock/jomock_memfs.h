@@ -0,0 +1,660 @@
+/*
+* @file      jomock_memfs.h
+* @brief     In-memory file system : mocks the libc file functions so that the files under the mounted paths live
+*            in memory, with errors and latency injected per path. Other paths reach the real file system.
+*            This is an open source with MIT license deployed in https://github.com/jonah512/jomock
+*
+*/
+#pragma once
+
+#include <gtest/gtest.h>
+#include <gmock/gmock.h>
+
+#include "jomock.h"
+
+#include <atomic>
+#include <chrono>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <vector>
+#include <algorithm>
+#include <cstdint>
+#include <cstring>
+#include <cerrno>
+
+#ifdef NON_WIN32_SUPPORT
+#include <fcntl.h>
+#include <limits.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/syscall.h>
+#endif
+
+// Installs the mocks, mounts 'path' and returns the file system, ::jomock::JoMockMemoryFs.
+// CLEAR_JOMOCK() puts the real file system back and closes the descriptors left open, the next install starts empty.
+#define JOMOCK_MEMORY_FS(path) ::jomock::JoMockMemoryFs::install(path)
+
+namespace jomock {
+
+#ifdef NON_WIN32_SUPPORT
+    // Files under the mounted paths, kept in pages of kPage bytes that go back to a pool when a file is truncated
+    // or dropped, and are reused by the next tests. The namespace is flat : a file can be created under a mounted
+    // path without its directories. Descriptors are real descriptors of /dev/null, so their numbers never collide
+    // with the real files. A mapping is a copy of the file; a shared writable one is written back by munmap().
+    // The stdio and iostream files are opened by the internal functions of libc and stay on the real file system.
+    // With thread-local dispatch the files are seen by the installing thread only.
+    struct JoMockMemoryFs {
+        typedef std::chrono::nanoseconds Duration;
+
+        // Operations selected by fail() and delay().
+        enum Operation {
+            Open = 1, Read = 2, Write = 4, Seek = 8, Stat = 16, Close = 32, Unlink = 64, Map = 128, All = 0xFF
+        };
+
+        static const std::size_t kPage = 4096;
+
+        static JoMockMemoryFs& instance() {
+            static JoMockMemoryFs value;
+            return value;
+        }
+
+        static JoMockMemoryFs& install(const std::string& path);
+
+        // Keeps the files under 'path' in memory.
+        void mount(const std::string& path) {
+            Lock lock(*this);
+            mounts.push_back(normalize(path));
+            mounted.store(true);
+        }
+
+        // 'operations' on 'path' and the files under it fail with 'error', 'times' times or always for -1.
+        void fail(const std::string& path, const unsigned operations, const int error, const int times = -1) {
+            const Rule rule = { normalize(path), operations, error, times, Duration(0) };
+            Lock lock(*this);
+            rules.push_back(rule);
+        }
+
+        // 'operations' on 'path' and the files under it take 'latency' more. The wait is a nanosleep(), which
+        // JOMOCK_VIRTUAL_TIME() turns into virtual time.
+        void delay(const std::string& path, const unsigned operations, const Duration latency) {
+            const Rule rule = { normalize(path), operations, 0, 0, latency };
+            Lock lock(*this);
+            rules.push_back(rule);
+        }
+
+        void clearFaults() {
+            Lock lock(*this);
+            rules.clear();
+        }
+
+        bool exists(const std::string& path) const {
+            Lock lock(*this);
+            return files.count(normalize(path)) != 0;
+        }
+
+        // Contents of the file at 'path', empty when there is none.
+        std::string contents(const std::string& path) const {
+            Lock lock(*this);
+            const std::map<std::string, std::shared_ptr<Inode>>::const_iterator found = files.find(normalize(path));
+            if (found == files.end()) return std::string();
+            std::string data(static_cast<std::size_t>(found->second->size), '\0');
+            readAt(*found->second, &data[0], data.size(), 0);
+            return data;
+        }
+
+        std::size_t fileCount() const {
+            Lock lock(*this);
+            return files.size();
+        }
+
+        // Pages ever allocated, in use or in the pool.
+        std::size_t allocatedPages() const {
+            Lock lock(*this);
+            return allocated;
+        }
+
+    private:
+        static const int kDescriptors = 4096;
+
+        struct Inode {
+            std::vector<unsigned char*> pages; // nullptr for a hole.
+            off_t size;
+            mode_t mode;
+            ino_t number;
+            timespec modified;
+        };
+
+        struct Descriptor {
+            std::shared_ptr<Inode> inode;
+            std::string path;
+            off_t position;
+            int flags;
+        };
+
+        struct Mapping {
+            unsigned char* address;
+            std::size_t length;
+            std::shared_ptr<Inode> inode;
+            off_t offset;
+        };
+
+        // The mutex, counted as held by this thread : the allocator, called under it, may call munmap().
+        struct Lock {
+            explicit Lock(const JoMockMemoryFs& fs) : guard(fs.mutex) { ++held(); }
+            ~Lock() { --held(); }
+
+            static int& held() {
+                static thread_local int value = 0;
+                return value;
+            }
+
+            std::lock_guard<std::mutex> guard;
+        };
+
+        struct Rule {
+            std::string path;
+            unsigned operations;
+            int error;
+            int remaining;
+            Duration latency;
+        };
+
+        JoMockMemoryFs() : mounted(false), sharedMappings(0), allocated(0), inodes(0) {
+            for (int i = 0; i < kDescriptors; ++i) memory[i].store(false);
+        }
+
+        ~JoMockMemoryFs() {
+            for (unsigned char* const page : pool) delete[] page;
+        }
+
+        bool isMemory(const int file) const {
+            return file >= 0 && file < kDescriptors && memory[file].load(std::memory_order_relaxed);
+        }
+
+        // True with the normalized path in 'path' when 'name' is under a mounted path.
+        bool resolve(const char* const name, std::string& path) const {
+            if (name == nullptr || !mounted.load()) return false;
+            path = normalize(name);
+            Lock lock(*this);
+            for (const std::string& mount : mounts) {
+                if (within(path, mount)) return true;
+            }
+            return false;
+        }
+
+        static bool within(const std::string& path, const std::string& root) {
+            if (root == "/") return true;
+            return path.compare(0, root.size(), root) == 0 && (path.size() == root.size() || path[root.size()] == '/');
+        }
+
+        // Absolute path without ".", ".." and repeated separators; relative paths start at the working directory.
+        static std::string normalize(const std::string& path) {
+            std::string full = path;
+            if (full.empty() || full[0] != '/') {
+                char directory[PATH_MAX];
+                if (getcwd(directory, sizeof(directory)) != nullptr) full = std::string(directory) + "/" + full;
+            }
+            std::vector<std::string> parts;
+            std::size_t begin = 0;
+            while (begin <= full.size()) {
+                std::size_t end = full.find('/', begin);
+                if (end == std::string::npos) end = full.size();
+                const std::string part = full.substr(begin, end - begin);
+                if (part == "..") {
+                    if (!parts.empty()) parts.pop_back();
+                }
+                else if (!part.empty() && part != ".") {
+                    parts.push_back(part);
+                }
+                begin = end + 1;
+            }
+            std::string result;
+            for (const std::string& part : parts) result += "/" + part;
+            return result.empty() ? std::string("/") : result;
+        }
+
+        // Applies the rules of 'operation' on 'path' : sleeps for their latency, false with errno set for an error.
+        bool admit(const std::string& path, const Operation operation) {
+            Duration latency(0);
+            int error = 0;
+            {
+                Lock lock(*this);
+                for (Rule& rule : rules) {
+                    if ((rule.operations & operation) == 0 || !within(path, rule.path)) continue;
+                    latency += rule.latency;
+                    if (rule.error != 0 && error == 0 && rule.remaining != 0) {
+                        error = rule.error;
+                        if (rule.remaining > 0) --rule.remaining;
+                    }
+                }
+            }
+            if (latency.count() > 0) {
+                timespec duration = { static_cast<time_t>(latency.count() / 1000000000), static_cast<long>(latency.count() % 1000000000) };
+                while (nanosleep(&duration, &duration) != 0 && errno == EINTR) {}
+            }
+            if (error != 0) {
+                errno = error;
+                return false;
+            }
+            return true;
+        }
+
+        unsigned char* takePage() {
+            unsigned char* page;
+            if (pool.empty()) {
+                page = new unsigned char[kPage];
+                ++allocated;
+            }
+            else {
+                page = pool.back();
+                pool.pop_back();
+            }
+            std::memset(page, 0, kPage);
+            return page;
+        }
+
+        void truncate(Inode& inode) {
+            for (unsigned char* const page : inode.pages) {
+                if (page != nullptr) pool.push_back(page);
+            }
+            inode.pages.clear();
+            inode.size = 0;
+        }
+
+        // Drops a reference to 'inode', its pages go to the pool with the last one.
+        void drop(std::shared_ptr<Inode>& inode) {
+            if (inode.use_count() == 1) truncate(*inode);
+            inode.reset();
+        }
+
+        static std::size_t readAt(const Inode& inode, void* const buffer, const std::size_t count, const off_t offset) {
+            if (offset >= inode.size) return 0;
+            const std::size_t size = std::min(count, static_cast<std::size_t>(inode.size - offset));
+            unsigned char* const output = static_cast<unsigned char*>(buffer);
+            for (std::size_t done = 0; done < size;) {
+                const std::size_t position = static_cast<std::size_t>(offset) + done;
+                const std::size_t index = position / kPage;
+                const std::size_t inside = position % kPage;
+                const std::size_t chunk = std::min(size - done, kPage - inside);
+                if (index < inode.pages.size() && inode.pages[index] != nullptr) {
+                    std::memcpy(output + done, inode.pages[index] + inside, chunk);
+                }
+                else {
+                    std::memset(output + done, 0, chunk);
+                }
+                done += chunk;
+            }
+            return size;
+        }
+
+        void writeAt(Inode& inode, const void* const buffer, const std::size_t count, const off_t offset) {
+            const unsigned char* const input = static_cast<const unsigned char*>(buffer);
+            for (std::size_t done = 0; done < count;) {
+                const std::size_t position = static_cast<std::size_t>(offset) + done;
+                const std::size_t index = position / kPage;
+                const std::size_t inside = position % kPage;
+                const std::size_t chunk = std::min(count - done, kPage - inside);
+                if (index >= inode.pages.size()) inode.pages.resize(index + 1, nullptr);
+                if (inode.pages[index] == nullptr) inode.pages[index] = takePage();
+                std::memcpy(inode.pages[index] + inside, input + done, chunk);
+                done += chunk;
+            }
+            if (count > 0) {
+                inode.size = std::max(inode.size, static_cast<off_t>(offset + count));
+                clock_gettime(CLOCK_REALTIME, &inode.modified);
+            }
+        }
+
+        int openFile(const std::string& path, const int flags, const mode_t mode) {
+            if (!admit(path, Open)) return -1;
+            Lock lock(*this);
+            const std::map<std::string, std::shared_ptr<Inode>>::iterator found = files.find(path);
+            if ((flags & O_DIRECTORY) != 0) { // the files are never directories, and none is created.
+                errno = found == files.end() ? ENOENT : ENOTDIR;
+                return -1;
+            }
+            if (found == files.end() && (flags & O_CREAT) == 0) {
+                errno = ENOENT;
+                return -1;
+            }
+            std::shared_ptr<Inode>& inode = found == files.end() ? files[path] : found->second;
+            if (inode == nullptr) {
+                inode = std::make_shared<Inode>();
+                inode->size = 0;
+                inode->mode = mode & 07777;
+                inode->number = ++inodes;
+                clock_gettime(CLOCK_REALTIME, &inode->modified);
+            }
+            else if ((flags & O_CREAT) != 0 && (flags & O_EXCL) != 0) {
+                errno = EEXIST;
+                return -1;
+            }
+            if ((flags & O_TRUNC) != 0 && (flags & O_ACCMODE) != O_RDONLY) truncate(*inode);
+            const int file = static_cast<int>(syscall(SYS_openat, AT_FDCWD, "/dev/null", O_RDONLY | O_CLOEXEC));
+            if (file < 0) return -1;
+            if (file >= kDescriptors) {
+                syscall(SYS_close, file);
+                errno = EMFILE;
+                return -1;
+            }
+            const Descriptor descriptor = { inode, path, 0, flags };
+            descriptors[file] = descriptor;
+            memory[file].store(true);
+            return file;
+        }
+
+        // Runs 'action' on the descriptor 'file' under the lock after the rules of 'operation'.
+        template < typename R, typename A >
+        R onDescriptor(const int file, const Operation operation, A action) {
+            std::string path;
+            {
+                Lock lock(*this);
+                const std::map<int, Descriptor>::iterator found = descriptors.find(file);
+                if (found == descriptors.end()) {
+                    errno = EBADF;
+                    return R(-1);
+                }
+                path = found->second.path;
+            }
+            if (!admit(path, operation)) return R(-1);
+            Lock lock(*this);
+            const std::map<int, Descriptor>::iterator found = descriptors.find(file);
+            if (found == descriptors.end()) {
+                errno = EBADF;
+                return R(-1);
+            }
+            return action(found->second);
+        }
+
+        ssize_t readFile(const int file, void* const buffer, const std::size_t count, const off_t* const offset) {
+            return onDescriptor<ssize_t>(file, Read, [&](Descriptor& descriptor) -> ssize_t {
+                if ((descriptor.flags & O_ACCMODE) == O_WRONLY) {
+                    errno = EBADF;
+                    return -1;
+                }
+                if (offset != nullptr && *offset < 0) {
+                    errno = EINVAL;
+                    return -1;
+                }
+                const std::size_t size = readAt(*descriptor.inode, buffer, count, offset != nullptr ? *offset : descriptor.position);
+                if (offset == nullptr) descriptor.position += static_cast<off_t>(size);
+                return static_cast<ssize_t>(size);
+            });
+        }
+
+        ssize_t writeFile(const int file, const void* const buffer, const std::size_t count, const off_t* const offset) {
+            return onDescriptor<ssize_t>(file, Write, [&](Descriptor& descriptor) -> ssize_t {
+                if ((descriptor.flags & O_ACCMODE) == O_RDONLY) {
+                    errno = EBADF;
+                    return -1;
+                }
+                if (offset != nullptr && *offset < 0) {
+                    errno = EINVAL;
+                    return -1;
+                }
+                if (offset == nullptr && (descriptor.flags & O_APPEND) != 0) descriptor.position = descriptor.inode->size;
+                writeAt(*descriptor.inode, buffer, count, offset != nullptr ? *offset : descriptor.position);
+                if (offset == nullptr) descriptor.position += static_cast<off_t>(count);
+                return static_cast<ssize_t>(count);
+            });
+        }
+
+        off_t seekFile(const int file, const off_t offset, const int whence) {
+            return onDescriptor<off_t>(file, Seek, [&](Descriptor& descriptor) -> off_t {
+                off_t base;
+                switch (whence) {
+                case SEEK_SET: base = 0; break;
+                case SEEK_CUR: base = descriptor.position; break;
+                case SEEK_END: base = descriptor.inode->size; break;
+                default: errno = EINVAL; return -1;
+                }
+                if (base + offset < 0) {
+                    errno = EINVAL;
+                    return -1;
+                }
+                descriptor.position = base + offset;
+                return descriptor.position;
+            });
+        }
+
+        int statFile(const int file, struct stat* const status) {
+            return onDescriptor<int>(file, Stat, [&](Descriptor& descriptor) -> int {
+                const Inode& inode = *descriptor.inode;
+                std::memset(status, 0, sizeof(*status));
+                status->st_dev = 0x4A4D; // "JM"
+                status->st_ino = inode.number;
+                status->st_mode = S_IFREG | inode.mode;
+                const std::map<std::string, std::shared_ptr<Inode>>::const_iterator linked = files.find(descriptor.path);
+                status->st_nlink = linked != files.end() && linked->second == descriptor.inode ? 1 : 0;
+                status->st_uid = getuid();
+                status->st_gid = getgid();
+                status->st_size = inode.size;
+                status->st_blksize = kPage;
+                status->st_blocks = static_cast<blkcnt_t>(std::count_if(inode.pages.begin(), inode.pages.end(),
+                    [](const unsigned char* page) { return page != nullptr; }) * (kPage / 512));
+                status->st_mtim = inode.modified;
+                status->st_ctim = inode.modified;
+                status->st_atim = inode.modified;
+                return 0;
+            });
+        }
+
+        int closeFile(const int file) {
+            if (onDescriptor<int>(file, Close, [](Descriptor&) { return 0; }) != 0) return -1;
+            Lock lock(*this);
+            const std::map<int, Descriptor>::iterator found = descriptors.find(file);
+            if (found == descriptors.end()) {
+                errno = EBADF;
+                return -1;
+            }
+            drop(found->second.inode);
+            descriptors.erase(found);
+            memory[file].store(false);
+            syscall(SYS_close, file);
+            return 0;
+        }
+
+        int unlinkFile(const std::string& path) {
+            if (!admit(path, Unlink)) return -1;
+            Lock lock(*this);
+            const std::map<std::string, std::shared_ptr<Inode>>::iterator found = files.find(path);
+            if (found == files.end()) {
+                errno = ENOENT;
+                return -1;
+            }
+            drop(found->second);
+            files.erase(found);
+            return 0;
+        }
+
+        // 'anonymous' maps private anonymous memory through the real mmap().
+        template < typename M >
+        void* mapFile(void* const address, const std::size_t length, const int protection, const int flags, const int file,
+            const off_t offset, M anonymous) {
+            return onDescriptor<void*>(file, Map, [&](Descriptor& descriptor) -> void* {
+                const int access = descriptor.flags & O_ACCMODE;
+                const bool shared = (flags & MAP_TYPE) != MAP_PRIVATE;
+                if (length == 0 || offset < 0 || offset % static_cast<off_t>(kPage) != 0) {
+                    errno = EINVAL;
+                    return MAP_FAILED;
+                }
+                if (access == O_WRONLY || (shared && (protection & PROT_WRITE) != 0 && access != O_RDWR)) {
+                    errno = EACCES;
+                    return MAP_FAILED;
+                }
+                void* const mapped = anonymous(address, length, PROT_READ | PROT_WRITE,
+                    (flags & ~MAP_TYPE) | MAP_PRIVATE | MAP_ANONYMOUS);
+                if (mapped == MAP_FAILED) return MAP_FAILED;
+                readAt(*descriptor.inode, mapped, length, offset);
+                if (protection != (PROT_READ | PROT_WRITE)) mprotect(mapped, length, protection);
+                if (shared && (protection & PROT_WRITE) != 0) {
+                    const Mapping mapping = { static_cast<unsigned char*>(mapped), length, descriptor.inode, offset };
+                    mappings.push_back(mapping);
+                    sharedMappings.fetch_add(1);
+                }
+                return mapped;
+            });
+        }
+
+        // Writes back the shared mappings in [address, address + length) before they are unmapped. An munmap()
+        // made while this thread holds the lock comes from the allocator, and is not one of them.
+        void unmapFile(void* const address, const std::size_t length) {
+            if (sharedMappings.load() == 0 || Lock::held() > 0) return;
+            unsigned char* const begin = static_cast<unsigned char*>(address);
+            unsigned char* const end = begin + length;
+            Lock lock(*this);
+            std::vector<Mapping> kept;
+            for (Mapping& mapping : mappings) {
+                unsigned char* const mappingEnd = mapping.address + mapping.length;
+                unsigned char* const from = std::max(begin, mapping.address);
+                unsigned char* const to = std::min(end, mappingEnd);
+                if (from >= to) {
+                    kept.push_back(mapping);
+                    continue;
+                }
+                const off_t position = mapping.offset + (from - mapping.address);
+                if (position < mapping.inode->size) {
+                    writeAt(*mapping.inode, from, std::min(static_cast<std::size_t>(to - from),
+                        static_cast<std::size_t>(mapping.inode->size - position)), position);
+                }
+                if (mapping.address < from) {
+                    const Mapping head = { mapping.address, static_cast<std::size_t>(from - mapping.address), mapping.inode, mapping.offset };
+                    kept.push_back(head);
+                }
+                if (to < mappingEnd) {
+                    const Mapping tail = { to, static_cast<std::size_t>(mappingEnd - to), mapping.inode, mapping.offset + (to - mapping.address) };
+                    kept.push_back(tail);
+                }
+                drop(mapping.inode);
+            }
+            mappings.swap(kept);
+            sharedMappings.store(mappings.size());
+        }
+
+        void reset() {
+            Lock lock(*this);
+            for (std::map<int, Descriptor>::iterator i = descriptors.begin(); i != descriptors.end(); ++i) {
+                drop(i->second.inode);
+                memory[i->first].store(false);
+                syscall(SYS_close, i->first);
+            }
+            descriptors.clear();
+            for (Mapping& mapping : mappings) drop(mapping.inode);
+            mappings.clear();
+            sharedMappings.store(0);
+            for (std::map<std::string, std::shared_ptr<Inode>>::iterator i = files.begin(); i != files.end(); ++i) {
+                drop(i->second);
+            }
+            files.clear();
+            rules.clear();
+            mounts.clear();
+            mounted.store(false);
+        }
+
+        std::atomic<bool> memory[kDescriptors]; // descriptors of the memory files, read without the lock.
+        std::atomic<bool> mounted;
+        std::atomic<std::size_t> sharedMappings;
+        mutable std::mutex mutex;
+        std::vector<std::string> mounts;
+        std::map<std::string, std::shared_ptr<Inode>> files;
+        std::map<int, Descriptor> descriptors;
+        std::vector<Mapping> mappings; // shared writable ones.
+        std::vector<Rule> rules;
+        std::vector<unsigned char*> pool;
+        std::size_t allocated;
+        ino_t inodes;
+    };
+
+    inline JoMockMemoryFs& JoMockMemoryFs::install(const std::string& path) {
+        JoMockMemoryFs& fs = instance();
+        // open() and openat() are variadic, the mode is read as a named parameter.
+        typedef int OpenEntry(const char*, int, mode_t);
+        typedef int OpenAtEntry(int, const char*, int, mode_t);
+        OpenEntry* const open = reinterpret_cast<OpenEntry*>(&::open);
+        OpenAtEntry* const openat = reinterpret_cast<OpenAtEntry*>(&::openat);
+        auto opener = &JOMOCK(open);
+        if (opener->dispatch.load() == nullptr) { // not installed since the last CLEAR_JOMOCK().
+            opener->atRestore([]() { instance().reset(); }); // closes the descriptors left open.
+        }
+        fs.mount(path);
+        opener->retarget([opener](const char* name, int flags, mode_t mode) {
+            std::string full;
+            return instance().resolve(name, full) ? instance().openFile(full, flags, mode) : opener->callOriginal(name, flags, mode);
+        });
+        auto atOpener = &JOMOCK(openat);
+        atOpener->retarget([atOpener](int directory, const char* name, int flags, mode_t mode) {
+            if (name == nullptr || (name[0] != '/' && directory != AT_FDCWD)) {
+                if (instance().isMemory(directory)) {
+                    errno = ENOTDIR;
+                    return -1;
+                }
+                return atOpener->callOriginal(directory, name, flags, mode);
+            }
+            std::string full;
+            return instance().resolve(name, full) ? instance().openFile(full, flags, mode) : atOpener->callOriginal(directory, name, flags, mode);
+        });
+        auto reader = &JOMOCK(::read);
+        reader->retarget([reader](int file, void* buffer, size_t count) {
+            return instance().isMemory(file) ? instance().readFile(file, buffer, count, nullptr) : reader->callOriginal(file, buffer, count);
+        });
+        auto writer = &JOMOCK(::write);
+        writer->retarget([writer](int file, const void* buffer, size_t count) {
+            return instance().isMemory(file) ? instance().writeFile(file, buffer, count, nullptr) : writer->callOriginal(file, buffer, count);
+        });
+        auto positionalReader = &JOMOCK(::pread);
+        positionalReader->retarget([positionalReader](int file, void* buffer, size_t count, off_t offset) {
+            return instance().isMemory(file) ? instance().readFile(file, buffer, count, &offset)
+                : positionalReader->callOriginal(file, buffer, count, offset);
+        });
+        auto positionalWriter = &JOMOCK(::pwrite);
+        positionalWriter->retarget([positionalWriter](int file, const void* buffer, size_t count, off_t offset) {
+            return instance().isMemory(file) ? instance().writeFile(file, buffer, count, &offset)
+                : positionalWriter->callOriginal(file, buffer, count, offset);
+        });
+        auto seeker = &JOMOCK(::lseek);
+        seeker->retarget([seeker](int file, off_t offset, int whence) {
+            return instance().isMemory(file) ? instance().seekFile(file, offset, whence) : seeker->callOriginal(file, offset, whence);
+        });
+#if defined(__GLIBC__) && (__GLIBC__ > 2 || (__GLIBC__ == 2 && __GLIBC_MINOR__ >= 33))
+        auto status = &JOMOCK(::fstat);
+        status->retarget([status](int file, struct stat* result) {
+            return instance().isMemory(file) ? instance().statFile(file, result) : status->callOriginal(file, result);
+        });
+#elif defined(__GLIBC__)
+        auto status = &JOMOCK(::__fxstat); // fstat() is inlined into this by the older headers.
+        status->retarget([status](int version, int file, struct stat* result) {
+            return instance().isMemory(file) ? instance().statFile(file, result) : status->callOriginal(version, file, result);
+        });
+#endif
+        auto closer = &JOMOCK(::close);
+        closer->retarget([closer](int file) {
+            return instance().isMemory(file) ? instance().closeFile(file) : closer->callOriginal(file);
+        });
+        auto unlinker = &JOMOCK(::unlink);
+        unlinker->retarget([unlinker](const char* name) {
+            std::string full;
+            return instance().resolve(name, full) ? instance().unlinkFile(full) : unlinker->callOriginal(name);
+        });
+        auto mapper = &JOMOCK(::mmap);
+        mapper->retarget([mapper](void* address, size_t length, int protection, int flags, int file, off_t offset) {
+            if (!instance().isMemory(file) || (flags & MAP_ANONYMOUS) != 0) {
+                return mapper->callOriginal(address, length, protection, flags, file, offset);
+            }
+            return instance().mapFile(address, length, protection, flags, file, offset,
+                [mapper](void* hint, size_t size, int access, int anonymous) {
+                    return mapper->callOriginal(hint, size, access, anonymous, -1, 0);
+                });
+        });
+        auto unmapper = &JOMOCK(::munmap);
+        unmapper->retarget([unmapper](void* address, size_t length) {
+            instance().unmapFile(address, length);
+            return unmapper->callOriginal(address, length);
+        });
+        return fs;
+    }
+#endif
+}
@@ -0,0 +1,223 @@
+/*
+* @file      jomock_memoize.h
+* @brief     Memoizes an expensive pure function : the mocked function answers repeated arguments from a bounded
+*            cache and forwards the misses to the original. The cache can persist in a mapped file across runs.
+*            This is an open source with MIT license deployed in https://github.com/jonah512/jomock
+*
+*/
+#pragma once
+
+#include <gtest/gtest.h>
+#include <gmock/gmock.h>
+
+#include "jomock.h"
+#include "jomock_replay.h"
+
+#include <list>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <unordered_map>
+#include <vector>
+#include <type_traits>
+#include <cstdint>
+#include <cstdio>
+
+// Returns the cache, ::jomock::JoMockMemo, of the mocked 'function'; its statistics are printed when
+// CLEAR_JOMOCK() takes the mock away.
+#define JOMOCK_MEMOIZE(function) ::jomock::JoMockMemoize::install(&JOMOCK(function))
+
+namespace jomock {
+
+    // Bytes fed to a sink, the size of a cached value.
+    struct JoMockCountSink {
+        JoMockCountSink() : size(0) {}
+
+        void put(const void* const, const std::size_t bytes) {
+            size += bytes;
+        }
+
+        std::size_t size;
+    };
+
+    template < typename T >
+    struct JoMockMemo { };
+
+    // Least recently used cache of the results, keyed by the hash of the arguments (JoMockRecording::key()).
+    // The arguments are hashed and the results sized and persisted by JoMockSerializer : specialize it to
+    // customize a type. The object of a member function is not part of the key, and other pointers need a
+    // specialization, so only functions whose result depends on their arguments alone fit.
+    // Two threads missing the same arguments both call the original.
+    template < typename R, typename ... P >
+    struct JoMockMemo<R(P ...)> {
+        static_assert(!std::is_void<R>::value && !std::is_reference<R>::value,
+            "jomock : a memoized function returns a value");
+        typedef typename std::decay<R>::type Value;
+
+        explicit JoMockMemo(JoMockBase<R(P ...)>* const _mocker) :
+            mocker(_mocker), name(_mocker->functionName), maxEntries(0), maxBytes(0), bytes(0), hits(0), misses(0), loads(0), evictions(0) {}
+
+        ~JoMockMemo() {
+            if (hits + misses != 0) {
+                fprintf(stderr, "jomock: memoized %s : %zu hits (%zu from %s), %zu misses, %zu evictions, %zu entries of %zu bytes\n",
+                    name, hits, loads, recording ? recording->path.c_str() : "no file", misses, evictions,
+                    entries.size(), bytes);
+            }
+        }
+
+        // Keeps at most 'entries' results of 'size' bytes in total (counted by JoMockSerializer), 0 for no bound.
+        JoMockMemo& limit(const std::size_t entries, const std::size_t size = 0) {
+            std::lock_guard<std::mutex> lock(mutex);
+            maxEntries = entries;
+            maxBytes = size;
+            evict();
+            return *this;
+        }
+
+        // Looks the misses up in the mapped file at 'path' before calling the original, and appends the new results.
+        // A file given before stays mapped with the cache, its results may be views into it.
+        JoMockMemo& persist(const std::string& path) {
+            std::lock_guard<std::mutex> lock(mutex);
+            if (recording) retired.push_back(std::move(recording));
+            recording.reset(new JoMockRecording(path));
+            return *this;
+        }
+
+        // Drops the cached results, the file keeps its records.
+        void clear() {
+            std::lock_guard<std::mutex> lock(mutex);
+            entries.clear();
+            positions.clear();
+            bytes = 0;
+        }
+
+        R call(P... p) {
+            const std::uint64_t key = JoMockRecording::key(name, p ...);
+            {
+                std::lock_guard<std::mutex> lock(mutex);
+                const typename std::unordered_map<std::uint64_t, typename std::list<Entry>::iterator>::iterator found = positions.find(key);
+                if (found != positions.end()) {
+                    ++hits;
+                    entries.splice(entries.begin(), entries, found->second);
+                    return found->second->value;
+                }
+                if (recording) {
+                    JoMockSource source;
+                    if (recording->next(key, source)) {
+                        Value value = JoMockSerializer<Value>::read(source);
+                        if (source.ok) {
+                            ++hits;
+                            ++loads;
+                            return insert(key, value);
+                        }
+                    }
+                }
+                ++misses;
+            }
+            Value value = mocker->callOriginal(p ...);
+            std::lock_guard<std::mutex> lock(mutex);
+            if (recording) {
+                recording->append(key, [&value](JoMockBufferSink& sink) { JoMockSerializer<Value>::write(sink, value); });
+            }
+            return insert(key, value);
+        }
+
+        std::size_t size() const {
+            std::lock_guard<std::mutex> lock(mutex);
+            return entries.size();
+        }
+
+        std::size_t hitCount() const {
+            std::lock_guard<std::mutex> lock(mutex);
+            return hits;
+        }
+
+        std::size_t missCount() const {
+            std::lock_guard<std::mutex> lock(mutex);
+            return misses;
+        }
+
+        std::size_t evictionCount() const {
+            std::lock_guard<std::mutex> lock(mutex);
+            return evictions;
+        }
+
+        // Bytes of the cached results.
+        std::size_t byteCount() const {
+            std::lock_guard<std::mutex> lock(mutex);
+            return bytes;
+        }
+
+    private:
+        struct Entry {
+            std::uint64_t key;
+            Value value;
+            std::size_t size;
+        };
+
+        Value insert(const std::uint64_t key, const Value& value) {
+            JoMockCountSink counter;
+            JoMockSerializer<Value>::write(counter, value);
+            const typename std::unordered_map<std::uint64_t, typename std::list<Entry>::iterator>::iterator found = positions.find(key);
+            if (found != positions.end()) { // computed by another thread meanwhile.
+                bytes -= found->second->size;
+                entries.erase(found->second);
+                positions.erase(found);
+            }
+            const Entry entry = { key, value, sizeof(Entry) + counter.size };
+            entries.push_front(entry);
+            positions[key] = entries.begin();
+            bytes += entry.size;
+            evict();
+            return value;
+        }
+
+        void evict() {
+            while (!entries.empty() && ((maxEntries != 0 && entries.size() > maxEntries) || (maxBytes != 0 && bytes > maxBytes))) {
+                bytes -= entries.back().size;
+                positions.erase(entries.back().key);
+                entries.pop_back();
+                ++evictions;
+            }
+        }
+
+        JoMockBase<R(P ...)>* const mocker;
+        const char* const name; // the mock may be going away with the cache.
+        std::list<Entry> entries; // most recently used first.
+        std::unordered_map<std::uint64_t, typename std::list<Entry>::iterator> positions;
+        std::unique_ptr<JoMockRecording> recording;
+        std::vector<std::unique_ptr<JoMockRecording>> retired;
+        mutable std::mutex mutex;
+        std::size_t maxEntries;
+        std::size_t maxBytes;
+        std::size_t bytes;
+        std::size_t hits;
+        std::size_t misses;
+        std::size_t loads;
+        std::size_t evictions;
+    };
+
+    struct JoMockMemoize {
+        // The cache of 'mocker', made on the first call; it goes away with the mock.
+        template < typename R, typename ... P >
+        static JoMockMemo<R(P ...)>& install(JoMockBase<R(P ...)>* const mocker) {
+            struct Installed {
+                std::weak_ptr<JoMockMemo<R(P ...)>> memo;
+                JoMockTarget<R(P ...)>* target;
+            };
+            static std::mutex mutex;
+            static std::map<const void*, Installed> installed; // a mock in static storage comes back.
+            std::lock_guard<std::mutex> lock(mutex);
+            Installed& entry = installed[mocker];
+            std::shared_ptr<JoMockMemo<R(P ...)>> memo = entry.memo.lock();
+            if (!memo) {
+                memo.reset(new JoMockMemo<R(P ...)>(mocker));
+                entry.memo = memo;
+                entry.target = mocker->target([memo](P... p) { return memo->call(p ...); });
+            }
+            mocker->retarget(entry.target);
+            return *memo;
+        }
+    };
+}
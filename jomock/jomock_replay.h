@@ -0,0 +1,694 @@
+/*
+* @file      jomock_replay.h
+* @brief     Records the calls of a mocked function into a trace file and replays them later as its behavior.
+*            Recording passes through to the real function; replay finds the recorded return value by the
+*            hash of the arguments and reads it straight from the mapped file.
+*            This is an open source with MIT license deployed in https://github.com/jonah512/jomock
+*
+*/
+#pragma once
+
+#include <gtest/gtest.h>
+#include <gmock/gmock.h>
+
+#include "jomock.h"
+
+#include <string>
+#include <vector>
+#include <algorithm>
+#include <mutex>
+#include <tuple>
+#include <type_traits>
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+
+#ifdef NON_WIN32_SUPPORT
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#endif
+
+// gmock actions : .WillRepeatedly(JOMOCK_RECORD(mocker, recording)), where mocker is &JOMOCK(function). The
+// buffers among the arguments follow : JOMOCK_RECORD(mocker, recording, ::jomock::JoMockArray<1, 2>()).
+#define JOMOCK_RECORD(...) ::jomock::JoMockReplay::record(__VA_ARGS__)
+#define JOMOCK_REPLAY(...) ::jomock::JoMockReplay::replay(__VA_ARGS__)
+
+namespace jomock {
+
+    // Hash of the serialized arguments, fed a chunk at a time.
+    struct JoMockHashSink {
+        JoMockHashSink() : value(0x9E3779B97F4A7C15ull) {}
+
+        void put(const void* const data, const std::size_t size) {
+            const unsigned char* p = static_cast<const unsigned char*>(data);
+            std::uint64_t h = value ^ (size * 0xFF51AFD7ED558CCDull);
+            std::size_t left = size;
+            for (; left >= 8; left -= 8, p += 8) {
+                std::uint64_t word;
+                std::memcpy(&word, p, sizeof(word));
+                h = rotate(h ^ (word * 0xC4CEB9FE1A85EC53ull), 29) * 0x9E3779B97F4A7C15ull;
+            }
+            std::uint64_t tail = 0;
+            std::memcpy(&tail, p, left);
+            value = mix(h ^ tail);
+        }
+
+        static std::uint64_t mix(std::uint64_t h) {
+            h ^= h >> 33;
+            h *= 0xFF51AFD7ED558CCDull;
+            h ^= h >> 33;
+            h *= 0xC4CEB9FE1A85EC53ull;
+            return h ^ (h >> 33);
+        }
+
+        std::uint64_t value;
+
+    private:
+        static std::uint64_t rotate(const std::uint64_t h, const unsigned bits) {
+            return (h << bits) | (h >> (64 - bits));
+        }
+    };
+
+    // Bytes of a record being written.
+    struct JoMockBufferSink {
+        explicit JoMockBufferSink(std::vector<char>& _buffer) : buffer(_buffer) {}
+
+        void put(const void* const data, const std::size_t size) {
+            const char* const p = static_cast<const char*>(data);
+            buffer.insert(buffer.end(), p, p + size);
+        }
+
+        std::vector<char>& buffer;
+    };
+
+    // Bytes of a recorded value, in the mapped file. 'ok' turns false when a value runs past its record.
+    struct JoMockSource {
+        const char* view(const std::size_t size) {
+            if (!ok || static_cast<std::size_t>(end - p) < size) {
+                ok = false;
+                return nullptr;
+            }
+            const char* const at = p;
+            p += size;
+            return at;
+        }
+
+        void copy(void* const out, const std::size_t size) {
+            const char* const at = view(size);
+            if (at != nullptr) std::memcpy(out, at, size);
+        }
+
+        const char* p;
+        const char* end;
+        bool ok;
+    };
+
+    // Serialization of a type for the recordings. write() feeds its bytes to a sink (the hash of the arguments,
+    // or a record) and read() builds the value back from a record. Specialize it for our own types :
+    //   template <> struct JoMockSerializer<Point> {
+    //       template < typename Sink > static void write(Sink& sink, const Point& value) { ... sink.put(&value.x, 4); }
+    //       static Point read(JoMockSource& source) { ... }
+    //   };
+    // Trivially copyable types are copied as they are, except pointers : void pointers (the object of a member
+    // function among them) are left out of the hash, C strings are hashed up to their terminator, and the others
+    // need a specialization, or a JoMockArray for a buffer and its size.
+    template < typename T, typename Enable = void >
+    struct JoMockSerializer {
+        static_assert(sizeof(T) == 0, "jomock : specialize JoMockSerializer for this type to record it");
+    };
+
+    template < typename T >
+    struct JoMockSerializer<T, typename std::enable_if<std::is_trivially_copyable<T>::value && !std::is_pointer<T>::value>::type> {
+        template < typename Sink >
+        static void write(Sink& sink, const T& value) {
+            sink.put(&value, sizeof(T));
+        }
+
+        static T read(JoMockSource& source) {
+            T value;
+            std::memset(static_cast<void*>(&value), 0, sizeof(T));
+            source.copy(&value, sizeof(T));
+            return value;
+        }
+    };
+
+    template < typename T >
+    struct JoMockSerializer<T*, typename std::enable_if<std::is_void<T>::value>::type> {
+        template < typename Sink >
+        static void write(Sink&, T* const) {}
+    };
+
+    // C strings are recorded with their terminator, a replayed one points into the mapped file.
+    template <>
+    struct JoMockSerializer<const char*> {
+        template < typename Sink >
+        static void write(Sink& sink, const char* const value) {
+            const std::uint32_t size = value == nullptr ? 0xFFFFFFFFu : static_cast<std::uint32_t>(std::strlen(value));
+            sink.put(&size, sizeof(size));
+            if (value != nullptr) sink.put(value, size + 1);
+        }
+
+        static const char* read(JoMockSource& source) {
+            std::uint32_t size = 0xFFFFFFFFu;
+            source.copy(&size, sizeof(size));
+            return size == 0xFFFFFFFFu ? nullptr : source.view(size + 1);
+        }
+    };
+
+    template <>
+    struct JoMockSerializer<std::string> {
+        template < typename Sink >
+        static void write(Sink& sink, const std::string& value) {
+            const std::uint64_t size = value.size();
+            sink.put(&size, sizeof(size));
+            sink.put(value.data(), value.size());
+        }
+
+        static std::string read(JoMockSource& source) {
+            std::uint64_t size = 0;
+            source.copy(&size, sizeof(size));
+            const char* const data = source.view(static_cast<std::size_t>(size));
+            return data != nullptr ? std::string(data, static_cast<std::size_t>(size)) : std::string();
+        }
+    };
+
+    template < typename T >
+    struct JoMockSerializer<std::vector<T>> {
+        template < typename Sink >
+        static void write(Sink& sink, const std::vector<T>& value) {
+            const std::uint64_t size = value.size();
+            sink.put(&size, sizeof(size));
+            writeElements(sink, value, std::is_trivially_copyable<T>());
+        }
+
+        static std::vector<T> read(JoMockSource& source) {
+            std::uint64_t size = 0;
+            source.copy(&size, sizeof(size));
+            std::vector<T> value;
+            readElements(source, value, static_cast<std::size_t>(size), std::is_trivially_copyable<T>());
+            return value;
+        }
+
+    private:
+        template < typename Sink >
+        static void writeElements(Sink& sink, const std::vector<T>& value, std::true_type) {
+            if (!value.empty()) sink.put(value.data(), value.size() * sizeof(T));
+        }
+
+        template < typename Sink >
+        static void writeElements(Sink& sink, const std::vector<T>& value, std::false_type) {
+            for (const T& element : value) JoMockSerializer<T>::write(sink, element);
+        }
+
+        static void readElements(JoMockSource& source, std::vector<T>& value, const std::size_t size, std::true_type) {
+            const char* const data = source.view(size * sizeof(T));
+            if (data == nullptr) return;
+            value.resize(size);
+            std::memcpy(static_cast<void*>(value.data()), data, size * sizeof(T));
+        }
+
+        static void readElements(JoMockSource& source, std::vector<T>& value, const std::size_t size, std::false_type) {
+            value.reserve(size);
+            for (std::size_t i = 0; i < size && source.ok; ++i) value.push_back(JoMockSerializer<T>::read(source));
+        }
+    };
+
+    // Argument 'Buffer' of a recorded function points to as many elements as argument 'Size' holds, e.g.
+    // JoMockArray<1, 2>() for read(int, void*, size_t). A buffer of const elements is part of the key of the call;
+    // the others are outputs, left out of the key, recorded after the call and written back by the replay.
+    template < std::size_t Buffer, std::size_t Size >
+    struct JoMockArray { };
+
+    // Argument 'Buffer' points to one element.
+    template < std::size_t Buffer >
+    using JoMockPointee = JoMockArray<Buffer, SIZE_MAX>;
+
+    template < std::size_t Size >
+    struct JoMockArrayFound : std::true_type {
+        static const std::size_t size = Size;
+    };
+
+    // The JoMockArray among 'A' whose buffer is argument 'I', if any.
+    template < std::size_t I, typename... A >
+    struct JoMockArrayAt : std::false_type {
+        static const std::size_t size = 0;
+    };
+
+    template < std::size_t I, std::size_t Buffer, std::size_t Size, typename... A >
+    struct JoMockArrayAt<I, JoMockArray<Buffer, Size>, A...> :
+        std::conditional<I == Buffer, JoMockArrayFound<Size>, JoMockArrayAt<I, A...>>::type { };
+
+    // Key and output buffers of a call whose arguments are described by the JoMockArrays 'A'.
+    template < typename... A >
+    struct JoMockCall {
+        template < typename Tuple >
+        static std::uint64_t key(const char* const function, const Tuple& arguments) {
+            JoMockHashSink sink;
+            sink.put(function, std::strlen(function));
+            writeArguments<0>(sink, arguments);
+            return JoMockHashSink::mix(sink.value);
+        }
+
+        template < typename Tuple >
+        static void writeOutputs(JoMockBufferSink& sink, const Tuple& arguments) {
+            const int expand[] = { 0, (output(sink, arguments, A()), 0)... };
+            (void)expand;
+        }
+
+        // Turns 'source.ok' false when a recorded buffer does not have the size of the given one.
+        template < typename Tuple >
+        static void readOutputs(JoMockSource& source, const Tuple& arguments) {
+            const int expand[] = { 0, (input(source, arguments, A()), 0)... };
+            (void)expand;
+        }
+
+    private:
+        template < typename T >
+        struct Elements {
+            typedef typename std::remove_pointer<T>::type Element;
+            static_assert(std::is_pointer<T>::value, "jomock : the buffer of a JoMockArray is a pointer");
+            static const bool constant = std::is_const<Element>::value;
+            static const std::size_t width = sizeof(typename std::conditional<std::is_void<Element>::value, char, Element>::type);
+        };
+
+        template < std::size_t I, typename Tuple >
+        struct Argument {
+            typedef typename std::decay<typename std::tuple_element<I, Tuple>::type>::type Type;
+        };
+
+        template < std::size_t B, std::size_t S, typename Tuple >
+        static std::uint64_t bytes(const Tuple& arguments) {
+            if (std::get<B>(arguments) == nullptr) return 0;
+            return count<S>(arguments) * Elements<typename Argument<B, Tuple>::Type>::width;
+        }
+
+        template < std::size_t S, typename Tuple >
+        static typename std::enable_if<S == SIZE_MAX, std::uint64_t>::type count(const Tuple&) {
+            return 1;
+        }
+
+        template < std::size_t S, typename Tuple >
+        static typename std::enable_if<S != SIZE_MAX, std::uint64_t>::type count(const Tuple& arguments) {
+            return static_cast<std::uint64_t>(std::get<S>(arguments));
+        }
+
+        template < std::size_t I, typename Tuple, typename Sink >
+        static typename std::enable_if<I == std::tuple_size<Tuple>::value>::type writeArguments(Sink&, const Tuple&) {}
+
+        template < std::size_t I, typename Tuple, typename Sink >
+        static typename std::enable_if<I < std::tuple_size<Tuple>::value>::type writeArguments(Sink& sink, const Tuple& arguments) {
+            writeArgument<I>(sink, arguments, JoMockArrayAt<I, A...>());
+            writeArguments<I + 1>(sink, arguments);
+        }
+
+        template < std::size_t I, typename Tuple, typename Sink >
+        static void writeArgument(Sink& sink, const Tuple& arguments, std::false_type) {
+            JoMockSerializer<typename Argument<I, Tuple>::Type>::write(sink, std::get<I>(arguments));
+        }
+
+        template < std::size_t I, typename Tuple, typename Sink >
+        static void writeArgument(Sink& sink, const Tuple& arguments, std::true_type) {
+            if (!Elements<typename Argument<I, Tuple>::Type>::constant) return; // an output, not known before the call.
+            const std::uint64_t size = bytes<I, JoMockArrayAt<I, A...>::size>(arguments);
+            sink.put(&size, sizeof(size));
+            if (size != 0) sink.put(std::get<I>(arguments), static_cast<std::size_t>(size));
+        }
+
+        template < std::size_t B, std::size_t S, typename Tuple >
+        static void output(JoMockBufferSink& sink, const Tuple& arguments, JoMockArray<B, S>) {
+            if (Elements<typename Argument<B, Tuple>::Type>::constant) return;
+            const std::uint64_t size = bytes<B, S>(arguments);
+            sink.put(&size, sizeof(size));
+            if (size != 0) sink.put(std::get<B>(arguments), static_cast<std::size_t>(size));
+        }
+
+        template < std::size_t B, std::size_t S, typename Tuple >
+        static void input(JoMockSource& source, const Tuple& arguments, JoMockArray<B, S>) {
+            typedef typename Argument<B, Tuple>::Type Type;
+            copyOut(source, std::get<B>(arguments), bytes<B, S>(arguments), std::integral_constant<bool, Elements<Type>::constant>());
+        }
+
+        template < typename T >
+        static void copyOut(JoMockSource&, T* const, const std::uint64_t, std::true_type) {}
+
+        template < typename T >
+        static void copyOut(JoMockSource& source, T* const buffer, const std::uint64_t size, std::false_type) {
+            std::uint64_t recorded = 0;
+            source.copy(&recorded, sizeof(recorded));
+            if (recorded != size) {
+                source.ok = false;
+                return;
+            }
+            const char* const data = source.view(static_cast<std::size_t>(size));
+            if (data != nullptr && size != 0) std::memcpy(static_cast<void*>(buffer), data, static_cast<std::size_t>(size));
+        }
+    };
+
+    // Append-only file of recorded calls. Each record holds the key of a call (the function name and the
+    // arguments, hashed) and the serialized return value; it stays mapped, and an index of the keys is kept
+    // in memory. A call recorded more than once replays its records in order, then repeats the last one.
+    // Growing maps the file again elsewhere and keeps the old mappings until the recording goes away, so the
+    // replayed views (const char*, pointers) stay valid as long as it, or until clear() writes over them.
+    class JoMockRecording {
+    public:
+        explicit JoMockRecording(const std::string& _path) : path(_path), base(nullptr), capacity(0), file(-1) {
+            open();
+        }
+
+        ~JoMockRecording() {
+            close();
+        }
+
+        JoMockRecording(const JoMockRecording&) = delete;
+        JoMockRecording& operator=(const JoMockRecording&) = delete;
+
+        // Drops every record.
+        void clear() {
+            std::lock_guard<std::mutex> lock(mutex);
+            header()->used = 0;
+            records.clear();
+            std::fill(index.begin(), index.end(), Slot());
+        }
+
+        std::size_t size() const {
+            return records.size();
+        }
+
+        template < typename... A >
+        static std::uint64_t key(const char* const function, const A&... arguments) {
+            return JoMockCall<>::key(function, std::forward_as_tuple(arguments...));
+        }
+
+        // Appends a record of 'payload' bytes filled by 'fill(sink)'.
+        template < typename F >
+        void append(const std::uint64_t key, F fill) {
+            std::lock_guard<std::mutex> lock(mutex);
+            scratch.clear();
+            JoMockBufferSink sink(scratch);
+            fill(sink);
+            const std::size_t size = sizeof(Record) + align(scratch.size());
+            const std::size_t offset = sizeof(Header) + static_cast<std::size_t>(header()->used);
+            if (!reserve(offset + size)) return;
+            Record record = { key, static_cast<std::uint32_t>(scratch.size()), 0 };
+            std::memcpy(base + offset, &record, sizeof(record));
+            if (!scratch.empty()) std::memcpy(base + offset + sizeof(record), scratch.data(), scratch.size());
+            header()->used += size; // the record is complete before it counts.
+            remember(key, offset);
+        }
+
+        // Bytes of the next record of 'key', nullptr when the call was not recorded.
+        bool next(const std::uint64_t key, JoMockSource& source) {
+            std::lock_guard<std::mutex> lock(mutex);
+            Slot* const slot = find(key);
+            if (slot == nullptr) return false;
+            Entry& entry = records[slot->cursor];
+            if (entry.next != kNone) slot->cursor = entry.next;
+            Record record;
+            std::memcpy(&record, base + entry.offset, sizeof(record));
+            source.p = base + entry.offset + sizeof(Record);
+            source.end = source.p + record.size;
+            source.ok = true;
+            return true;
+        }
+
+        const std::string path;
+
+    private:
+        struct Header {
+            char magic[8];
+            std::uint64_t used; // bytes of complete records after the header.
+        };
+
+        struct Record {
+            std::uint64_t key;
+            std::uint32_t size;
+            std::uint32_t reserved;
+        };
+
+        struct Entry {
+            std::size_t offset;
+            std::uint32_t next; // next record of the same key.
+        };
+
+        struct Slot {
+            Slot() : key(0), first(kNone), last(kNone), cursor(kNone) {}
+            std::uint64_t key;
+            std::uint32_t first;
+            std::uint32_t last;
+            std::uint32_t cursor;
+        };
+
+        static const std::uint32_t kNone = 0xFFFFFFFFu;
+
+        static std::size_t align(const std::size_t size) {
+            return (size + 7) & ~static_cast<std::size_t>(7);
+        }
+
+        Header* header() const {
+            return reinterpret_cast<Header*>(base);
+        }
+
+        Slot* find(const std::uint64_t key) {
+            if (index.empty()) return nullptr;
+            const std::size_t mask = index.size() - 1;
+            for (std::size_t i = key & mask;; i = (i + 1) & mask) {
+                Slot& slot = index[i];
+                if (slot.first == kNone) return nullptr;
+                if (slot.key == key) return &slot;
+            }
+        }
+
+        void remember(const std::uint64_t key, const std::size_t offset) {
+            const Entry entry = { offset, kNone };
+            records.push_back(entry);
+            const std::uint32_t at = static_cast<std::uint32_t>(records.size() - 1);
+            if ((records.size() + 1) * 2 > index.size()) {
+                rehash(index.empty() ? 64 : index.size() * 2);
+            }
+            Slot* slot = find(key);
+            if (slot != nullptr) {
+                records[slot->last].next = at;
+                slot->last = at;
+                if (slot->cursor == kNone) slot->cursor = at;
+                return;
+            }
+            const std::size_t mask = index.size() - 1;
+            std::size_t i = key & mask;
+            while (index[i].first != kNone) i = (i + 1) & mask;
+            index[i].key = key;
+            index[i].first = index[i].last = index[i].cursor = at;
+        }
+
+        void rehash(const std::size_t size) {
+            std::vector<Slot> old(size);
+            old.swap(index);
+            const std::size_t mask = index.size() - 1;
+            for (const Slot& slot : old) {
+                if (slot.first == kNone) continue;
+                std::size_t i = slot.key & mask;
+                while (index[i].first != kNone) i = (i + 1) & mask;
+                index[i] = slot;
+            }
+        }
+
+        void load() {
+            const std::size_t end = sizeof(Header) + static_cast<std::size_t>(header()->used);
+            for (std::size_t offset = sizeof(Header); offset + sizeof(Record) <= end;) {
+                Record record;
+                std::memcpy(&record, base + offset, sizeof(record));
+                const std::size_t size = sizeof(Record) + align(record.size);
+                if (offset + size > end) break;
+                remember(record.key, offset);
+                offset += size;
+            }
+        }
+
+#ifdef NON_WIN32_SUPPORT
+        void open() {
+            file = ::open(path.c_str(), O_RDWR | O_CREAT | O_CLOEXEC, 0644);
+            struct stat status;
+            if (file < 0 || fstat(file, &status) != 0) {
+                fprintf(stderr, "jomock: cannot open the recording %s\n", path.c_str());
+                return;
+            }
+            const std::size_t size = static_cast<std::size_t>(status.st_size);
+            if (!map(size < sizeof(Header) ? 4096 : size)) return;
+            if (size < sizeof(Header) || std::memcmp(header()->magic, "JOMOCKR1", 8) != 0) {
+                std::memcpy(header()->magic, "JOMOCKR1", 8);
+                header()->used = 0;
+            }
+            if (sizeof(Header) + header()->used > capacity) header()->used = 0; // cut short by a crash.
+            load();
+        }
+
+        void close() {
+            if (base != nullptr) {
+                const std::size_t size = sizeof(Header) + static_cast<std::size_t>(header()->used);
+                munmap(base, capacity);
+                if (ftruncate(file, static_cast<off_t>(size)) != 0) {
+                    fprintf(stderr, "jomock: cannot trim the recording %s\n", path.c_str());
+                }
+            }
+            for (const std::pair<char*, std::size_t>& mapping : retired) {
+                munmap(mapping.first, mapping.second);
+            }
+            if (file >= 0) ::close(file);
+        }
+
+        // The mappings of the same file share its pages, the old ones keep showing the records.
+        bool map(const std::size_t size) {
+            if (ftruncate(file, static_cast<off_t>(size)) != 0) return false;
+            void* const mapped = mmap(nullptr, size, PROT_READ | PROT_WRITE, MAP_SHARED, file, 0);
+            if (mapped == MAP_FAILED) {
+                fprintf(stderr, "jomock: cannot map the recording %s\n", path.c_str());
+                return false;
+            }
+            if (base != nullptr) retired.emplace_back(base, capacity);
+            base = static_cast<char*>(mapped);
+            capacity = size;
+            return true;
+        }
+
+        std::vector<std::pair<char*, std::size_t>> retired; // earlier mappings, for the views into them.
+#else
+        void open() {
+            FILE* const input = fopen(path.c_str(), "rb");
+            std::vector<char> bytes;
+            if (input != nullptr) {
+                char chunk[65536];
+                std::size_t read = 0;
+                while ((read = fread(chunk, 1, sizeof(chunk), input)) > 0) bytes.insert(bytes.end(), chunk, chunk + read);
+                fclose(input);
+            }
+            map(std::max<std::size_t>(bytes.size(), 4096));
+            std::memcpy(base, bytes.data(), bytes.size());
+            if (bytes.size() < sizeof(Header) || std::memcmp(header()->magic, "JOMOCKR1", 8) != 0) {
+                std::memcpy(header()->magic, "JOMOCKR1", 8);
+                header()->used = 0;
+            }
+            if (sizeof(Header) + header()->used > bytes.size()) header()->used = 0;
+            load();
+        }
+
+        // Without a shared mapping the records are written out when the recording is closed.
+        void close() {
+            FILE* const output = fopen(path.c_str(), "wb");
+            if (output != nullptr) {
+                fwrite(base, 1, sizeof(Header) + static_cast<std::size_t>(header()->used), output);
+                fclose(output);
+            }
+        }
+
+        // A copy, the old buffer is kept for the views into it.
+        bool map(const std::size_t size) {
+            std::vector<char> grown(size);
+            if (!memory.empty()) {
+                std::memcpy(grown.data(), memory.data(), memory.size());
+                retired.push_back(std::move(memory));
+            }
+            memory = std::move(grown);
+            base = memory.data();
+            capacity = size;
+            return true;
+        }
+
+        std::vector<char> memory;
+        std::vector<std::vector<char>> retired;
+#endif
+
+        bool reserve(const std::size_t size) {
+            if (base == nullptr) return false;
+            if (size <= capacity) return true;
+            std::size_t grown = capacity;
+            while (grown < size) grown *= 2;
+            return map(grown);
+        }
+
+        char* base;
+        std::size_t capacity;
+        int file;
+        std::mutex mutex;
+        std::vector<char> scratch;
+        std::vector<Entry> records;
+        std::vector<Slot> index;
+    };
+
+    struct JoMockReplay {
+        template < typename R, typename... P, typename... A >
+        static ::testing::Action<R(P...)> record(JoMockBase<R(P...)>* const mocker, JoMockRecording& recording, A...) {
+            return ::testing::Invoke(Recorder<JoMockCall<A...>, R, P...>{ mocker, &recording });
+        }
+
+        // A call that was not recorded fails the test and runs the original function.
+        template < typename R, typename... P, typename... A >
+        static ::testing::Action<R(P...)> replay(JoMockBase<R(P...)>* const mocker, JoMockRecording& recording, A...) {
+            static_assert(!std::is_reference<R>::value, "jomock : a returned reference cannot be replayed");
+            return ::testing::Invoke(Replayer<JoMockCall<A...>, R, P...>{ mocker, &recording });
+        }
+
+    private:
+        // The key is taken before the call, which writes the output buffers.
+        template < typename C, typename R, typename... P >
+        struct Recorder {
+            R operator()(P... p) const {
+                const std::uint64_t key = C::key(mocker->functionName, std::forward_as_tuple(p...));
+                R result = mocker->callOriginal(p...);
+                recording->append(key, [&](JoMockBufferSink& sink) {
+                    JoMockSerializer<typename std::decay<R>::type>::write(sink, result);
+                    C::writeOutputs(sink, std::forward_as_tuple(p...));
+                });
+                return result;
+            }
+            JoMockBase<R(P...)>* mocker;
+            JoMockRecording* recording;
+        };
+
+        template < typename C, typename... P >
+        struct Recorder<C, void, P...> {
+            void operator()(P... p) const {
+                const std::uint64_t key = C::key(mocker->functionName, std::forward_as_tuple(p...));
+                mocker->callOriginal(p...);
+                recording->append(key, [&](JoMockBufferSink& sink) { C::writeOutputs(sink, std::forward_as_tuple(p...)); });
+            }
+            JoMockBase<void(P...)>* mocker;
+            JoMockRecording* recording;
+        };
+
+        template < typename C, typename R, typename... P >
+        struct Replayer {
+            R operator()(P... p) const {
+                JoMockSource source;
+                if (recording->next(C::key(mocker->functionName, std::forward_as_tuple(p...)), source)) {
+                    R result = JoMockSerializer<typename std::decay<R>::type>::read(source);
+                    C::readOutputs(source, std::forward_as_tuple(p...));
+                    if (source.ok) return result;
+                }
+                missing(mocker->functionName, *recording);
+                return mocker->callOriginal(p...);
+            }
+            JoMockBase<R(P...)>* mocker;
+            JoMockRecording* recording;
+        };
+
+        template < typename C, typename... P >
+        struct Replayer<C, void, P...> {
+            void operator()(P... p) const {
+                JoMockSource source;
+                if (recording->next(C::key(mocker->functionName, std::forward_as_tuple(p...)), source)) {
+                    C::readOutputs(source, std::forward_as_tuple(p...));
+                    if (source.ok) return;
+                }
+                missing(mocker->functionName, *recording);
+                mocker->callOriginal(p...);
+            }
+            JoMockBase<void(P...)>* mocker;
+            JoMockRecording* recording;
+        };
+
+        static void missing(const char* const function, const JoMockRecording& recording) {
+            ADD_FAILURE() << "jomock: no call of " << function << " with these arguments in " << recording.path;
+        }
+    };
+}
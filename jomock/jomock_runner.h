@@ -0,0 +1,440 @@
+/*
+* @file      jomock_runner.h
+* @brief     Runs the gtest tests of a program in forked children, spread over all cores.
+*            Patches made by a test live in the copy-on-write text of its child and vanish with it,
+*            so a crashed or aborted test cannot leave mocks behind for the next one.
+*            This is an open source with MIT license deployed in https://github.com/jonah512/jomock
+*
+*/
+#pragma once
+
+#include <gtest/gtest.h>
+
+#include "jomock.h"
+
+#include <string>
+#include <vector>
+#include <map>
+#include <deque>
+#include <algorithm>
+#include <fstream>
+#include <sstream>
+#include <thread>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+
+#ifdef NON_WIN32_SUPPORT
+#include <cerrno>
+#include <csignal>
+#include <unistd.h>
+#include <poll.h>
+#include <sys/wait.h>
+#endif
+
+// Use in place of RUN_ALL_TESTS(), after testing::InitGoogleTest(&argc, argv).
+#define JOMOCK_RUN_ALL_TESTS(argc, argv) ::jomock::JoMockRunner::run(argc, argv)
+
+namespace jomock {
+
+    // Forks a child per test (or per batch of tests) and keeps 'jobs' children running. The queue is ordered
+    // by the durations measured in earlier runs, longest first, and a free core takes the next entry. Results
+    // and output come back through pipes; output is printed for failed tests only. Flags :
+    //   --jomock_jobs=N      children running at once, the number of cores by default
+    //   --jomock_batch=N     tests per child, 1 by default
+    //   --jomock_timings=F   file keeping the durations, <program>.timings by default
+    //   --jomock_serial      run in this process, as RUN_ALL_TESTS() does
+    struct JoMockRunner {
+        enum Status { kPending, kRunning, kPassed, kFailed, kSkipped, kCrashed };
+
+        struct Test {
+            std::string name;
+            double expected; // ms measured by an earlier run, negative if unknown.
+            double elapsed;
+            Status status;
+            std::string output;
+        };
+
+        struct Options {
+            std::size_t jobs;
+            std::size_t batch;
+            std::string timings;
+            bool serial;
+        };
+
+        static int run(int argc, char* argv[]) {
+            const Options options = parse(argc, argv);
+#ifndef NON_WIN32_SUPPORT
+            return RUN_ALL_TESTS();
+#else
+            if (options.serial) {
+                return RUN_ALL_TESTS();
+            }
+            std::vector<Test> tests = enumerate();
+            loadTimings(options.timings, tests);
+            std::stable_sort(tests.begin(), tests.end(), [](const Test& a, const Test& b) {
+                if ((a.expected < 0) != (b.expected < 0)) return a.expected < 0; // unknown first,
+                return a.expected > b.expected; // then longest.
+            });
+            const std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+            schedule(tests, options);
+            const double total = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+            saveTimings(options.timings, tests);
+            return report(tests, options, total);
+#endif
+        }
+
+        // gtest filter : positive patterns, then '-' and negative patterns, separated by ':'.
+        static bool matchesFilter(const std::string& name, const std::string& filter) {
+            const std::size_t dash = filter.find('-');
+            const std::string positive = dash == std::string::npos ? filter : filter.substr(0, dash);
+            const std::string negative = dash == std::string::npos ? std::string() : filter.substr(dash + 1);
+            return matchesAny(name, positive.empty() ? std::string("*") : positive) && !matchesAny(name, negative);
+        }
+
+    private:
+        static Options parse(int argc, char* argv[]) {
+            Options options = { std::thread::hardware_concurrency(), 1, std::string(argv[0]) + ".timings", false };
+            for (int i = 1; i < argc; ++i) {
+                const std::string argument = argv[i];
+                if (argument.compare(0, 14, "--jomock_jobs=") == 0) {
+                    options.jobs = std::strtoul(argument.c_str() + 14, nullptr, 10);
+                }
+                else if (argument.compare(0, 15, "--jomock_batch=") == 0) {
+                    options.batch = std::strtoul(argument.c_str() + 15, nullptr, 10);
+                }
+                else if (argument.compare(0, 17, "--jomock_timings=") == 0) {
+                    options.timings = argument.substr(17);
+                }
+                else if (argument == "--jomock_serial") {
+                    options.serial = true;
+                }
+            }
+            options.jobs = options.jobs == 0 ? 1 : options.jobs;
+            options.batch = options.batch == 0 ? 1 : options.batch;
+            return options;
+        }
+
+        static bool matchesPattern(const char* name, const char* pattern, const char* const end) {
+            if (pattern == end) return *name == '\0';
+            if (*pattern == '*') {
+                return matchesPattern(name, pattern + 1, end) || (*name != '\0' && matchesPattern(name + 1, pattern, end));
+            }
+            return *name != '\0' && (*pattern == '?' || *pattern == *name) && matchesPattern(name + 1, pattern + 1, end);
+        }
+
+        static bool matchesAny(const std::string& name, const std::string& patterns) {
+            std::size_t begin = 0;
+            while (begin <= patterns.size()) {
+                std::size_t end = patterns.find(':', begin);
+                end = end == std::string::npos ? patterns.size() : end;
+                if (end > begin && matchesPattern(name.c_str(), patterns.c_str() + begin, patterns.c_str() + end)) return true;
+                begin = end + 1;
+            }
+            return false;
+        }
+
+        static std::vector<Test> enumerate() {
+            std::vector<Test> tests;
+            const std::string filter = ::testing::GTEST_FLAG(filter);
+            const bool disabled = ::testing::GTEST_FLAG(also_run_disabled_tests);
+            ::testing::UnitTest& unit = *::testing::UnitTest::GetInstance();
+            for (int i = 0; i < unit.total_test_suite_count(); ++i) {
+                const ::testing::TestSuite& suite = *unit.GetTestSuite(i);
+                for (int j = 0; j < suite.total_test_count(); ++j) {
+                    const ::testing::TestInfo& info = *suite.GetTestInfo(j);
+                    const std::string name = std::string(suite.name()) + "." + info.name();
+                    const bool isDisabled = name.compare(0, 9, "DISABLED_") == 0 || std::strncmp(info.name(), "DISABLED_", 9) == 0;
+                    if (!matchesFilter(name, filter) || (isDisabled && !disabled)) continue;
+                    Test test = { name, -1.0, 0.0, kPending, std::string() };
+                    tests.push_back(test);
+                }
+            }
+            return tests;
+        }
+
+        static std::map<std::string, double> readTimings(const std::string& path) {
+            std::map<std::string, double> timings;
+            std::ifstream file(path.c_str());
+            std::string name;
+            double millis;
+            while (file >> name >> millis) {
+                timings[name] = millis;
+            }
+            return timings;
+        }
+
+        static void loadTimings(const std::string& path, std::vector<Test>& tests) {
+            const std::map<std::string, double> timings = readTimings(path);
+            for (Test& test : tests) {
+                auto got = timings.find(test.name);
+                if (got != timings.end()) test.expected = got->second;
+            }
+        }
+
+        // Tests that did not run this time keep their previous duration.
+        static void saveTimings(const std::string& path, const std::vector<Test>& tests) {
+            std::map<std::string, double> timings = readTimings(path);
+            for (const Test& test : tests) {
+                if (test.status != kPending) timings[test.name] = test.elapsed;
+            }
+            std::ofstream file(path.c_str(), std::ios::trunc);
+            for (auto& timing : timings) {
+                file << timing.first << ' ' << timing.second << '\n';
+            }
+        }
+
+#ifdef NON_WIN32_SUPPORT
+        // Writes a line into the result pipe when a test starts and when it ends : status, elapsed ms and
+        // name. Mocks left by the test are restored before its end is reported, so that gmock still verifies
+        // their expectations and the next test of a batch starts from the original code.
+        struct Recorder : public ::testing::EmptyTestEventListener {
+            explicit Recorder(const int _fd) : fd(_fd) {}
+
+            void OnTestStart(const ::testing::TestInfo& info) override {
+                send('R', 0, info);
+            }
+
+            void OnTestEnd(const ::testing::TestInfo& info) override {
+                MockerCreator::restoreAll(); // failures still count for this test.
+                const ::testing::TestResult& result = *info.result();
+                send(result.Skipped() ? 'S' : (result.Passed() ? 'P' : 'F'), result.elapsed_time(), info);
+            }
+
+            void send(const char status, const long long millis, const ::testing::TestInfo& info) {
+                char line[1024];
+                const int length = std::snprintf(line, sizeof(line), "%c %lld %s.%s\n", status, millis,
+                    info.test_suite_name(), info.name());
+                if (length > 0) {
+                    writeAll(fd, line, static_cast<std::size_t>(length) < sizeof(line) ? length : sizeof(line) - 1);
+                }
+            }
+
+            const int fd;
+        };
+
+        struct Child {
+            pid_t pid;
+            int results;
+            int output;
+            std::vector<std::size_t> tests;
+            std::size_t current; // test receiving the output.
+            std::string pending; // partial result line.
+            std::chrono::steady_clock::time_point start;
+        };
+
+        static void writeAll(const int fd, const char* data, std::size_t size) {
+            while (size > 0) {
+                const ssize_t written = ::write(fd, data, size);
+                if (written < 0 && errno == EINTR) continue;
+                if (written <= 0) return;
+                data += written;
+                size -= static_cast<std::size_t>(written);
+            }
+        }
+
+        static void schedule(std::vector<Test>& tests, const Options& options) {
+            std::map<std::string, std::size_t> index;
+            for (std::size_t i = 0; i < tests.size(); ++i) {
+                index[tests[i].name] = i;
+            }
+            std::deque<std::size_t> queue;
+            for (std::size_t i = 0; i < tests.size(); ++i) {
+                queue.push_back(i);
+            }
+            std::vector<Child> running;
+            fflush(stdout);
+            fflush(stderr);
+            while (!queue.empty() || !running.empty()) {
+                while (!queue.empty() && running.size() < options.jobs) {
+                    Child child;
+                    for (std::size_t i = 0; i < options.batch && !queue.empty(); ++i) {
+                        child.tests.push_back(queue.front());
+                        queue.pop_front();
+                    }
+                    child.current = child.tests.front();
+                    if (!spawn(tests, running, child)) {
+                        for (std::size_t test : child.tests) {
+                            tests[test].status = kCrashed;
+                            tests[test].output = "jomock: cannot fork\n";
+                        }
+                        continue;
+                    }
+                    running.push_back(child);
+                }
+                wait(tests, index, running, queue);
+            }
+        }
+
+        static bool spawn(const std::vector<Test>& tests, const std::vector<Child>& running, Child& child) {
+            int results[2];
+            int output[2];
+            if (::pipe(results) != 0) return false;
+            if (::pipe(output) != 0) {
+                ::close(results[0]);
+                ::close(results[1]);
+                return false;
+            }
+            const pid_t pid = ::fork();
+            if (pid < 0) {
+                ::close(results[0]); ::close(results[1]);
+                ::close(output[0]); ::close(output[1]);
+                return false;
+            }
+            if (pid == 0) {
+                for (const Child& other : running) {
+                    ::close(other.results);
+                    ::close(other.output);
+                }
+                ::close(results[0]);
+                ::close(output[0]);
+                ::dup2(output[1], STDOUT_FILENO);
+                ::dup2(output[1], STDERR_FILENO);
+                ::close(output[1]);
+                std::string filter;
+                for (std::size_t test : child.tests) {
+                    filter += (filter.empty() ? "" : ":") + tests[test].name;
+                }
+                ::testing::GTEST_FLAG(filter) = filter;
+                ::testing::UnitTest::GetInstance()->listeners().Append(new Recorder(results[1]));
+                const int result = RUN_ALL_TESTS();
+                fflush(stdout);
+                fflush(stderr);
+                ::_exit(result); // the patched text goes away with the child, no need to restore.
+            }
+            ::close(results[1]);
+            ::close(output[1]);
+            child.pid = pid;
+            child.results = results[0];
+            child.output = output[0];
+            child.start = std::chrono::steady_clock::now();
+            return true;
+        }
+
+        // Drains the pipes of the running children until one of them exits.
+        static void wait(std::vector<Test>& tests, const std::map<std::string, std::size_t>& index, std::vector<Child>& running,
+            std::deque<std::size_t>& queue) {
+            std::vector<pollfd> fds;
+            for (const Child& child : running) {
+                pollfd results = { child.results, POLLIN, 0 };
+                pollfd output = { child.output, POLLIN, 0 };
+                fds.push_back(results);
+                fds.push_back(output);
+            }
+            if (::poll(fds.data(), fds.size(), -1) < 0 && errno != EINTR) return;
+            char buffer[4096];
+            for (std::size_t i = 0; i < running.size(); ++i) {
+                Child& child = running[i];
+                if (fds[i * 2 + 1].revents != 0) {
+                    const ssize_t size = ::read(child.output, buffer, sizeof(buffer));
+                    if (size > 0) {
+                        tests[child.current].output.append(buffer, static_cast<std::size_t>(size));
+                    }
+                }
+                if (fds[i * 2].revents == 0) continue;
+                const ssize_t size = ::read(child.results, buffer, sizeof(buffer));
+                if (size > 0) {
+                    child.pending.append(buffer, static_cast<std::size_t>(size));
+                    record(tests, index, child);
+                    continue;
+                }
+                finish(tests, child, queue);
+                running.erase(running.begin() + i);
+                return;
+            }
+        }
+
+        static void record(std::vector<Test>& tests, const std::map<std::string, std::size_t>& index, Child& child) {
+            std::string& lines = child.pending;
+            std::size_t end;
+            while ((end = lines.find('\n')) != std::string::npos) {
+                std::istringstream line(lines.substr(0, end));
+                lines.erase(0, end + 1);
+                char status;
+                double millis;
+                std::string name;
+                if (!(line >> status >> millis >> name)) continue;
+                auto got = index.find(name);
+                if (got == index.end()) continue;
+                Test& test = tests[got->second];
+                if (status == 'R') {
+                    test.status = kRunning;
+                    child.current = got->second;
+                    continue;
+                }
+                test.status = status == 'S' ? kSkipped : (status == 'P' ? kPassed : kFailed);
+                test.elapsed = millis;
+            }
+        }
+
+        // Reaps an exited child. The test it died in is reported as crashed, the ones it did not reach
+        // go back to the queue.
+        static void finish(std::vector<Test>& tests, Child& child, std::deque<std::size_t>& queue) {
+            char buffer[4096];
+            ssize_t size;
+            while ((size = ::read(child.output, buffer, sizeof(buffer))) > 0) {
+                tests[child.current].output.append(buffer, static_cast<std::size_t>(size));
+            }
+            ::close(child.results);
+            ::close(child.output);
+            int status = 0;
+            while (::waitpid(child.pid, &status, 0) < 0 && errno == EINTR) {}
+            const double elapsed = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - child.start).count();
+            for (auto test = child.tests.rbegin(); test != child.tests.rend(); ++test) {
+                if (tests[*test].status == kPending && *test != child.current) {
+                    tests[*test].output.clear();
+                    queue.push_front(*test);
+                }
+            }
+            for (std::size_t test : child.tests) {
+                const bool died = tests[test].status == kRunning || (tests[test].status == kPending && test == child.current);
+                if (!died) continue;
+                tests[test].status = kCrashed;
+                tests[test].elapsed = elapsed;
+                char reason[64];
+                if (WIFSIGNALED(status)) {
+                    std::snprintf(reason, sizeof(reason), "killed by signal %d", WTERMSIG(status));
+                }
+                else {
+                    std::snprintf(reason, sizeof(reason), "exited with %d", WEXITSTATUS(status));
+                }
+                tests[test].output += std::string("jomock: ") + tests[test].name + " " + reason + "\n";
+            }
+        }
+#endif
+
+        static int report(const std::vector<Test>& tests, const Options& options, const double total) {
+            std::size_t passed = 0;
+            std::size_t skipped = 0;
+            std::vector<const Test*> failed;
+            for (const Test& test : tests) {
+                const char* label = "[       OK ]";
+                if (test.status == kPassed) {
+                    ++passed;
+                }
+                else if (test.status == kSkipped) {
+                    ++skipped;
+                    label = "[  SKIPPED ]";
+                }
+                else {
+                    failed.push_back(&test);
+                    label = test.status == kCrashed ? "[  CRASHED ]" : "[  FAILED  ]";
+                    std::fputs(test.output.c_str(), stdout);
+                }
+                std::printf("%s %s (%.0f ms)\n", label, test.name.c_str(), test.elapsed);
+            }
+            std::printf("[==========] %zu tests ran in %zu children at a time. (%.0f ms total)\n",
+                tests.size(), options.jobs, total);
+            std::printf("[  PASSED  ] %zu tests.\n", passed);
+            if (skipped != 0) {
+                std::printf("[  SKIPPED ] %zu tests.\n", skipped);
+            }
+            for (const Test* test : failed) {
+                std::printf("[  FAILED  ] %s\n", test->name.c_str());
+            }
+            std::fflush(stdout);
+            return failed.empty() ? 0 : 1;
+        }
+    };
+}